@@ -0,0 +1,316 @@
+#!/bin/sh
+#
+# Compare git2 and git on every builtin of src/builtin.c.
+#
+# usage: bench.sh [<git2 binary>]
+#
+# Settings (environment):
+#   BENCH_FILES      files in the generated repository (default 1000)
+#   BENCH_COMMITS    commits in the generated repository (default 100)
+#   BENCH_FILE_SIZE  size of each file, in bytes (default 4096)
+#   BENCH_PACKED     1 to pack the objects, 0 for loose objects (default 1)
+#   BENCH_SHAPE      more options of gen-repo.sh for the repository, as
+#                    "--depth=3 --sizes=skewed --layout=packs=4"
+#   BENCH_RUNS       runs of each command (default 100)
+#   BENCH_DIR        where repositories are generated (default /tmp/git2-bench)
+#   BENCH_OUTPUT     JSON report file (default bench_output.json)
+#   BENCH_COMMANDS   space separated subset of the commands to run
+#   GIT              the git to compare with (default git)
+#   BENCH_STARTUP_BUDGET_MS  highest median time git2 may add to a
+#                    command it hands to git at once (default 1)
+#   BENCH_TOLERANCE  when set, the highest share (in percent) by which the
+#                    median of git2 may exceed that of git on a call it
+#                    runs natively : the bench fails beyond it
+#   BENCH_TOLERANCE_MS  what git2 may lose in any case, in milliseconds,
+#                    as calls of a few milliseconds are mostly noise
+#                    (default 0.5)
+#
+# Each command has one or more representative calls. For each of them
+# and each binary the report gives the median and 99th percentile wall
+# clock time, the peak RSS (with /usr/bin/time) and the number of system
+# calls of one run (with strace). Missing tools give null values. A
+# summary is printed on stderr.
+#
+# A traced run (GIT2_TRACE_PERF) tells whether git2 ran the call itself
+# or handed it to git : "native" in the report. With BENCH_TOLERANCE,
+# a native call slower than git beyond the tolerance is a regression,
+# the only way to know that a please_git_do_it_for_me() guard may go.
+# The calls handed to git are only held to the startup budget.
+#
+# The startup check times a command git2 does not know ("version"),
+# which it execs git for right away : what git2 adds to git is its time
+# to exec. The bench fails when it is over BENCH_STARTUP_BUDGET_MS.
+
+BENCH_DIRECTORY="$(cd "$(dirname "$0")" && pwd)"
+ROOT_DIRECTORY="$(dirname "$BENCH_DIRECTORY")"
+
+GIT2="${1:-$ROOT_DIRECTORY/bin/git2}"
+GIT="${GIT:-git}"
+BENCH_FILES="${BENCH_FILES:-1000}"
+BENCH_COMMITS="${BENCH_COMMITS:-100}"
+BENCH_FILE_SIZE="${BENCH_FILE_SIZE:-4096}"
+BENCH_PACKED="${BENCH_PACKED:-1}"
+BENCH_SHAPE="${BENCH_SHAPE:-}"
+BENCH_RUNS="${BENCH_RUNS:-100}"
+BENCH_DIR="${BENCH_DIR:-/tmp/git2-bench}"
+BENCH_OUTPUT="${BENCH_OUTPUT:-bench_output.json}"
+BENCH_STARTUP_BUDGET_MS="${BENCH_STARTUP_BUDGET_MS:-1}"
+BENCH_TOLERANCE="${BENCH_TOLERANCE:-}"
+BENCH_TOLERANCE_MS="${BENCH_TOLERANCE_MS:-0.5}"
+
+case "$GIT2" in
+/*) ;;
+*) GIT2="$(pwd)/$GIT2" ;;
+esac
+case "$BENCH_OUTPUT" in
+/*) ;;
+*) BENCH_OUTPUT="$(pwd)/$BENCH_OUTPUT" ;;
+esac
+
+if ! test -x "$GIT2"
+then
+	echo "bench: cannot execute '$GIT2', build it first" >&2
+	exit 1
+fi
+
+# git2 must be measured alone, not through a fallback helper or a daemon
+unset GIT2_FALLBACK_SOCKET GIT2_DAEMON_SOCKET
+
+REPOSITORY="$BENCH_DIR/repo-$BENCH_FILES-$BENCH_COMMITS-$BENCH_FILE_SIZE-$BENCH_PACKED"
+test -z "$BENCH_SHAPE" ||
+REPOSITORY="$REPOSITORY-$(printf '%s' "$BENCH_SHAPE" | cksum | cut -d' ' -f1)"
+SCRATCH="$BENCH_DIR/scratch"
+
+if ! test -d "$REPOSITORY/.git"
+then
+	echo "bench: generating $REPOSITORY" >&2
+	"$BENCH_DIRECTORY/gen-repo.sh" $BENCH_SHAPE "$REPOSITORY" \
+		"$BENCH_FILES" "$BENCH_COMMITS" "$BENCH_FILE_SIZE" "$BENCH_PACKED" >&2 ||
+	exit 1
+fi
+
+rm -rf "$SCRATCH" && mkdir -p "$SCRATCH" || exit 1
+cd "$REPOSITORY" || exit 1
+
+TREE="$(git rev-parse HEAD^{tree})"
+git rev-list --objects --all | cut -d' ' -f1 >"$SCRATCH/objects"
+printf 'bench\n' >"$SCRATCH/message"
+cat >"$SCRATCH/tag" <<EOF
+object $(git rev-parse HEAD)
+type commit
+tag bench
+tagger Bench <bench@example.com> 1300000000 +0000
+
+bench
+EOF
+
+# The builtins, as listed in src/builtin.c
+COMMANDS="${BENCH_COMMANDS:-$(sed -n 's/^[ 	]*{"\([a-z-]*\)", cmd_[a-z_]*, [&a-z_A-Z]*},*$/\1/p' "$ROOT_DIRECTORY/src/builtin.c")}"
+
+# Arguments and standard input of the <n>-th representative call of a
+# command, false past the last one (or for an unknown command). Every
+# call leaves the repository as it found it.
+command_setup() {
+	STDIN=/dev/null
+	case "$1 $2" in
+	"init 1")           ARGS="init -q $SCRATCH/init" ;;
+	"rev-list 1")       ARGS="rev-list HEAD" ;;
+	"rev-list 2")       ARGS="rev-list --objects --all" ;;
+	"ls-files 1")       ARGS="ls-files" ;;
+	"ls-files 2")       ARGS="ls-files -s" ;;
+	"checkout 1")       ARGS="checkout -q master" ;;
+	"ls-tree 1")        ARGS="ls-tree -r HEAD" ;;
+	"ls-tree 2")        ARGS="ls-tree HEAD" ;;
+	"update-index 1")   ARGS="update-index --refresh" ;;
+	"mktag 1")          ARGS="mktag"; STDIN="$SCRATCH/tag" ;;
+	"commit-tree 1")    ARGS="commit-tree $TREE -p HEAD"; STDIN="$SCRATCH/message" ;;
+	"write-tree 1")     ARGS="write-tree" ;;
+	"read-tree 1")      ARGS="read-tree HEAD" ;;
+	"read-tree 2")      ARGS="read-tree -m HEAD" ;;
+	"checkout-index 1") ARGS="checkout-index -f -a" ;;
+	"cat-file 1")       ARGS="cat-file --batch-check"; STDIN="$SCRATCH/objects" ;;
+	"cat-file 2")       ARGS="cat-file --batch"; STDIN="$SCRATCH/objects" ;;
+	"cat-file 3")       ARGS="cat-file --batch-all-objects --batch-check" ;;
+	*)                  return 1 ;;
+	esac
+}
+
+now_ns() {
+	date +%s%N
+}
+
+# Wall clock time of each run, in nanoseconds, one per line
+measure_times() {
+	binary="$1"
+	i=0
+	while test $i -lt "$BENCH_RUNS"
+	do
+		start=$(now_ns)
+		$binary $ARGS <"$STDIN" >/dev/null 2>&1
+		end=$(now_ns)
+		echo $((end - start))
+		i=$((i + 1))
+	done
+}
+
+# "<median> <p99>" in milliseconds of the times on stdin
+percentiles() {
+	sort -n | awk '
+		{ t[NR] = $1 }
+		END {
+			if (!NR) { print "null null"; exit }
+			m = int((NR + 1) / 2)
+			p = int(NR * 0.99 + 0.999999)
+			if (p > NR) p = NR
+			printf "%.3f %.3f\n", t[m] / 1e6, t[p] / 1e6
+		}'
+}
+
+measure_rss() {
+	if test -x /usr/bin/time
+	then
+		/usr/bin/time -f %M -o "$SCRATCH/rss" $1 $ARGS <"$STDIN" >/dev/null 2>&1
+		tail -n 1 "$SCRATCH/rss"
+	else
+		echo null
+	fi
+}
+
+measure_syscalls() {
+	if command -v strace >/dev/null 2>&1 &&
+	   strace -f -c -o "$SCRATCH/strace" $1 $ARGS <"$STDIN" >/dev/null 2>&1 &&
+	   awk '$NF == "total" { print $4; found = 1 } END { exit !found }' "$SCRATCH/strace"
+	then
+		:
+	else
+		echo null
+	fi
+}
+
+# "true" when git2 runs the call itself, "false" when it hands it to git
+measure_native() {
+	rm -f "$SCRATCH/trace"
+	GIT2_TRACE_PERF="$SCRATCH/trace" "$GIT2" $ARGS <"$STDIN" >/dev/null 2>&1
+	if grep -q '"name":"fallback"' "$SCRATCH/trace" 2>/dev/null
+	then
+		echo false
+	else
+		echo true
+	fi
+}
+
+# 1 when git2 (median $2) is slower than git (median $1) beyond the tolerance
+is_regression() {
+	echo "$1 $2" | awk -v percent="$BENCH_TOLERANCE" -v slack="$BENCH_TOLERANCE_MS" '{
+		print ($2 > $1 * (1 + percent / 100) + slack) ? 1 : 0
+	}'
+}
+
+# JSON object with the measures of one binary
+measure() {
+	set -- "$1" $(measure_times "$1" | percentiles)
+	median="$2"
+	p99="$3"
+	rss="$(measure_rss "$1")"
+	syscalls="$(measure_syscalls "$1")"
+	printf '{"median_ms": %s, "p99_ms": %s, "max_rss_kb": %s, "syscalls": %s}' \
+		"$median" "$p99" "$rss" "$syscalls"
+	printf '%-16s %-5s median %8s ms  p99 %8s ms  rss %8s kB  syscalls %6s\n' \
+		"$name" "$label" "$median" "$p99" "$rss" "$syscalls" >&2
+	echo "$median" >"$SCRATCH/median-$label"
+}
+
+# "<git median> <git2 median> <overhead> <over budget : 0 or 1>" in milliseconds
+measure_startup() {
+	ARGS=version
+	STDIN=/dev/null
+	git_median=$(measure_times "$GIT" | percentiles | cut -d' ' -f1)
+	git2_median=$(measure_times "$GIT2" | percentiles | cut -d' ' -f1)
+	echo "$git_median $git2_median" | awk -v budget="$BENCH_STARTUP_BUDGET_MS" '{
+		overhead = $2 - $1
+		printf "%s %s %.3f %d\n", $1, $2, overhead, (overhead > budget)
+	}'
+}
+
+json_string() {
+	printf '"%s"' "$(printf '%s' "$1" | sed 's/\\/\\\\/g; s/"/\\"/g')"
+}
+
+{
+	printf '{\n'
+	printf '  "machine": %s,\n' "$(json_string "$(uname -a)")"
+	printf '  "git_version": %s,\n' "$(json_string "$("$GIT" --version)")"
+	printf '  "git2_version": %s,\n' "$(json_string "$(git -C "$ROOT_DIRECTORY" rev-parse HEAD 2>/dev/null)")"
+	printf '  "repository": {"files": %d, "commits": %d, "file_size": %d, "packed": %s, "shape": %s},\n' \
+		"$BENCH_FILES" "$BENCH_COMMITS" "$BENCH_FILE_SIZE" \
+		"$(test "$BENCH_PACKED" = 1 && echo true || echo false)" "$(json_string "$BENCH_SHAPE")"
+	printf '  "runs": %d,\n' "$BENCH_RUNS"
+	printf '  "tolerance": {"percent": %s, "ms": %s},\n' \
+		"${BENCH_TOLERANCE:-null}" "$BENCH_TOLERANCE_MS"
+	printf '  "results": ['
+
+	separator=
+	: >"$SCRATCH/regressions"
+	for name in $COMMANDS
+	do
+		if ! command_setup "$name" 1
+		then
+			echo "bench: no benchmark for '$name', skipped" >&2
+			continue
+		fi
+
+		call=1
+		while command_setup "$name" $call
+		do
+			native="$(measure_native)"
+			printf '%s\n    {"command": %s, "args": %s, "native": %s,\n' "$separator" \
+				"$(json_string "$name")" "$(json_string "$ARGS")" "$native"
+			label=git
+			printf '     "git": %s,\n' "$(measure "$GIT")"
+			label=git2
+			printf '     "git2": %s' "$(measure "$GIT2")"
+
+			regression=false
+			if test -n "$BENCH_TOLERANCE" && test "$native" = true &&
+			   test "$(is_regression "$(cat "$SCRATCH/median-git")" "$(cat "$SCRATCH/median-git2")")" = 1
+			then
+				regression=true
+				echo "$ARGS: git2 $(cat "$SCRATCH/median-git2") ms, git $(cat "$SCRATCH/median-git") ms" \
+					>>"$SCRATCH/regressions"
+			fi
+			test "$native" = true || printf '%-16s       handed to git\n' "$name" >&2
+			printf ',\n     "regression": %s}' "$regression"
+			separator=,
+			call=$((call + 1))
+		done
+	done
+
+	printf '\n  ],\n'
+
+	set -- $(measure_startup)
+	printf '  "startup": {"args": "version", "git_median_ms": %s, "git2_median_ms": %s, "overhead_ms": %s, "budget_ms": %s}\n' \
+		"$1" "$2" "$3" "$BENCH_STARTUP_BUDGET_MS"
+	printf '%-16s       overhead %8s ms  budget %s ms\n' startup "$3" "$BENCH_STARTUP_BUDGET_MS" >&2
+	echo "$4" >"$SCRATCH/over-budget"
+
+	printf '}\n'
+} >"$BENCH_OUTPUT" || exit 1
+
+over_budget="$(cat "$SCRATCH/over-budget")"
+regressions="$(cat "$SCRATCH/regressions")"
+rm -rf "$SCRATCH"
+echo "bench: report written to $BENCH_OUTPUT" >&2
+
+status=0
+if test "$over_budget" = 1
+then
+	echo "bench: git2 adds more than $BENCH_STARTUP_BUDGET_MS ms before running git" >&2
+	status=1
+fi
+if test -n "$regressions"
+then
+	echo "bench: git2 is slower than git by more than $BENCH_TOLERANCE% (+$BENCH_TOLERANCE_MS ms) on:" >&2
+	echo "$regressions" | sed 's/^/  /' >&2
+	status=1
+fi
+exit $status
@@ -0,0 +1,212 @@
+#!/bin/sh
+#
+# Generate a benchmark (or test) repository with git fast-import.
+#
+# usage: gen-repo.sh [<options>] <directory> <files> <commits> <file-size> [packed]
+#
+# The first commit adds <files> files of about <file-size> bytes; every
+# following commit modifies 1% of them (see --changes). The contents only depend on the
+# arguments, so two repositories built with the same arguments have the
+# same object ids : the oid of HEAD is printed once the repository is
+# ready, to tell. With packed=1 the objects are repacked in a single
+# pack, otherwise they are exploded as loose objects.
+#
+# Options:
+#   --files-per-dir=<n>  files in each directory (default 100)
+#   --depth=<n>          levels of directories above the files (default
+#                        1); each level splits the directories below it
+#                        evenly
+#   --changes=<percent>  of the files modified by each commit (default 1)
+#   --sizes=<shape>      of the blobs : "fixed" (all <file-size> bytes, the
+#                        default), "uniform" (from 1 to twice <file-size>)
+#                        or "skewed" (half of them from half of <file-size>
+#                        to <file-size>, a quarter up to twice it, and so
+#                        on up to 64 times it)
+#   --seed=<n>           of the pseudo-random choices : the blob sizes (1
+#                        by default), and the files each commit modifies
+#                        (which otherwise follow a fixed stride)
+#   --layout=<layout>    of the objects, instead of [packed] : "loose",
+#                        "packed" (one pack), "packs=<n>" (one pack per
+#                        n-th of the history, as many fetches leave them)
+#                        or "mixed" (one pack of the history, the objects
+#                        of the last commit loose)
+#
+# The pseudo-random numbers are those of Park and Miller's generator,
+# computed by awk exactly, so any awk gives the same repository.
+
+usage() {
+	echo "usage: $0 [--files-per-dir=<n>] [--depth=<n>] [--changes=<percent>]" >&2
+	echo "       [--sizes=fixed|uniform|skewed] [--seed=<n>]" >&2
+	echo "       [--layout=loose|packed|packs=<n>|mixed]" >&2
+	echo "       <directory> <files> <commits> <file-size> [packed]" >&2
+	exit 1
+}
+
+FILES_PER_DIR=100
+DEPTH=1
+CHANGES=1
+SIZES=fixed
+SEED=
+LAYOUT=
+
+while test $# -gt 0
+do
+	case "$1" in
+	--files-per-dir=*) FILES_PER_DIR="${1#*=}" ;;
+	--depth=*) DEPTH="${1#*=}" ;;
+	--changes=*) CHANGES="${1#*=}" ;;
+	--sizes=*) SIZES="${1#*=}" ;;
+	--seed=*) SEED="${1#*=}" ;;
+	--layout=*) LAYOUT="${1#*=}" ;;
+	--) shift; break ;;
+	-*) usage ;;
+	*) break ;;
+	esac
+	shift
+done
+
+test $# -ge 4 || usage
+
+DIRECTORY="$1"
+FILES="$2"
+COMMITS="$3"
+FILE_SIZE="$4"
+test -n "$LAYOUT" || LAYOUT="$(test "${5:-1}" = 1 && echo packed || echo loose)"
+
+case "$SIZES" in
+fixed|uniform|skewed) ;;
+*) usage ;;
+esac
+
+PACKS=1
+case "$LAYOUT" in
+loose|packed) ;;
+mixed) PACKS=2 ;;
+packs=*) PACKS="${LAYOUT#packs=}" ;;
+*) usage ;;
+esac
+
+rm -rf "$DIRECTORY" &&
+mkdir -p "$DIRECTORY" &&
+cd "$DIRECTORY" &&
+git init -q &&
+LC_ALL=C awk -v files="$FILES" -v commits="$COMMITS" -v size="$FILE_SIZE" \
+	-v per_dir="$FILES_PER_DIR" -v depth="$DEPTH" -v changes_percent="$CHANGES" \
+	-v sizes="$SIZES" -v seed="$SEED" -v packs="$PACKS" -v layout="$LAYOUT" '
+# Park and Miller : products stay below 2^53, exact in any awk
+function random() {
+	state = (state * 16807) % 2147483647
+	return state
+}
+function uniform() {
+	return random() / 2147483647
+}
+function blob_size(    k, low) {
+	if (sizes == "uniform")
+		return 1 + int(uniform() * 2 * size)
+	if (sizes == "skewed") {
+		# from size/2 to size for half of them, to twice size for a quarter...
+		for (k = 0; k < 6 && random() % 2; k++)
+			;
+		low = size * 2 ^ k / 2
+		return 1 + int(low + uniform() * low)
+	}
+	return size
+}
+function contents(file, revision, length_,    line, data) {
+	line = sprintf("file %d revision %d\n", file, revision)
+	data = line
+	while (length(data) < length_)
+		data = data data
+	return substr(data, 1, length_)
+}
+# depth 1 keeps the layout of the first version of this script
+function path(file,    n, p, level) {
+	n = int(file / per_dir)
+	if (depth <= 1)
+		return sprintf("dir%04d/file%06d", n, file)
+	p = ""
+	for (level = 1; level < depth; level++) {
+		p = sprintf("d%02d/", n % fanout) p
+		n = int(n / fanout)
+	}
+	return sprintf("dir%04d/%sfile%06d", n, p, file)
+}
+function blob(file, revision,    data) {
+	data = contents(file, revision, blob_size())
+	printf "M 100644 inline %s\n", path(file)
+	printf "data %d\n%s\n", length(data), data
+}
+BEGIN {
+	state = (seed == "" ? 1 : seed) % 2147483647
+	if (state <= 0)
+		state += 2147483646
+	changes = int(files * changes_percent / 100)
+	if (changes < 1)
+		changes = 1
+	if (changes > files)
+		changes = files
+
+	# as many directories in each level
+	directories = int((files + per_dir - 1) / per_dir)
+	fanout = 1
+	if (depth > 1)
+		while (fanout ^ depth < directories)
+			fanout++
+
+	for (c = 1; c <= commits; c++) {
+		# a pack per slice of the history, the last one of "mixed" being a commit
+		if (c > 1 && packs > 1 && (layout == "mixed" ? c == commits : (c - 1) % int((commits + packs - 1) / packs) == 0))
+			printf "checkpoint\n\n"
+
+		message = sprintf("commit %d\n", c)
+		printf "commit refs/heads/master\n"
+		printf "mark :%d\n", c
+		printf "committer Bench <bench@example.com> %d +0000\n", 1300000000 + c
+		printf "data %d\n%s", length(message), message
+		if (c > 1)
+			printf "from :%d\n", c - 1
+
+		if (c == 1)
+			for (f = 0; f < files; f++)
+				blob(f, 0)
+		else if (seed == "")
+			for (i = 0; i < changes; i++)
+				blob((c * 7919 + i * 104729) % files, c)
+		else {
+			# each of them once
+			split("", changed)
+			for (i = 0; i < changes; ) {
+				f = random() % files
+				if (f in changed)
+					continue
+				changed[f] = 1
+				blob(f, c)
+				i++
+			}
+		}
+		printf "\n"
+	}
+}' | git -c fastimport.unpackLimit=0 fast-import --quiet &&
+case "$LAYOUT" in
+packed)
+	git repack -a -d -q ;;
+loose|mixed)
+	HEAD_COMMIT="$(git rev-parse master)" &&
+	# unpack-objects skips the objects already in the repository, so
+	# move the pack away first
+	for pack in .git/objects/pack/*.pack
+	do
+		test -f "$pack" || continue
+		# only the pack of the last commit for "mixed"
+		test "$LAYOUT" = loose ||
+		git show-index <"${pack%.pack}.idx" | grep -q " $HEAD_COMMIT" ||
+		continue
+		mv "$pack" .git/import.pack &&
+		rm -f "${pack%.pack}.idx" &&
+		git unpack-objects -q <.git/import.pack &&
+		rm -f .git/import.pack || exit 1
+	done ;;
+esac &&
+git reset -q --hard master &&
+echo "$DIRECTORY: HEAD $(git rev-parse HEAD)"
@@ -0,0 +1,264 @@
+/*
+ * Micro-benchmark of the oid sets and maps of src/common/utils/oid-set.h
+ * against what a command would do without them : a chained hash table
+ * with one allocation per oid, and a sorted array searched with bsearch.
+ *
+ * usage: oid-set-bench [<oids>] [<rounds>]
+ *
+ * Each container gets the same pseudo-random oids (half of the lookups
+ * miss) and the best of the rounds is printed, in nanoseconds per
+ * operation. Only oid-set.c and arena.c are linked, with the allocators
+ * below.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "oid-set.h"
+#include "utils.h"
+
+void *xmalloc(size_t size)
+{
+	void *ret = malloc(size);
+
+	if (!ret) {
+		perror("malloc");
+		exit(1);
+	}
+	return ret;
+}
+
+void *xcalloc(size_t nmemb, size_t size)
+{
+	void *ret = calloc(nmemb, size);
+
+	if (!ret) {
+		perror("calloc");
+		exit(1);
+	}
+	return ret;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* xorshift64 : the same oids at each run */
+static void random_oids(git_oid *oids, size_t nr)
+{
+	uint64_t x = 0x9e3779b97f4a7c15ULL;
+
+	for (size_t i = 0; i < nr; i++) {
+		for (size_t j = 0; j < GIT_OID_RAWSZ; j++) {
+			x ^= x << 13;
+			x ^= x >> 7;
+			x ^= x << 17;
+			oids[i].id[j] = x >> 56;
+		}
+	}
+}
+
+struct chain {
+	struct chain *next;
+	git_oid oid;
+};
+
+struct chained_set {
+	struct chain **buckets;
+	size_t size;
+};
+
+static int chained_add(struct chained_set *set, const git_oid *oid)
+{
+	unsigned int hash;
+	struct chain **bucket, *c;
+
+	memcpy(&hash, oid->id, sizeof(hash));
+	bucket = &set->buckets[hash % set->size];
+	for (c = *bucket; c; c = c->next) {
+		if (!memcmp(c->oid.id, oid->id, GIT_OID_RAWSZ))
+			return 0;
+	}
+	c = xmalloc(sizeof(*c));
+	c->oid = *oid;
+	c->next = *bucket;
+	*bucket = c;
+	return 1;
+}
+
+static int chained_contains(const struct chained_set *set, const git_oid *oid)
+{
+	unsigned int hash;
+
+	memcpy(&hash, oid->id, sizeof(hash));
+	for (struct chain *c = set->buckets[hash % set->size]; c; c = c->next) {
+		if (!memcmp(c->oid.id, oid->id, GIT_OID_RAWSZ))
+			return 1;
+	}
+	return 0;
+}
+
+static void chained_clear(struct chained_set *set)
+{
+	for (size_t i = 0; i < set->size; i++) {
+		while (set->buckets[i]) {
+			struct chain *next = set->buckets[i]->next;
+			free(set->buckets[i]);
+			set->buckets[i] = next;
+		}
+	}
+	free(set->buckets);
+}
+
+static int oid_cmp(const void *a, const void *b)
+{
+	return memcmp(a, b, GIT_OID_RAWSZ);
+}
+
+/* ns per insertion, then per lookup */
+struct timing {
+	double add, lookup;
+};
+
+/* hits counts what the lookups found, so that they are not optimized out */
+static size_t hits;
+
+static struct timing bench_set(const git_oid *oids, size_t nr, int reserve)
+{
+	struct oid_set set = OID_SET_INIT;
+	struct timing t;
+	uint64_t start = now_ns();
+
+	if (reserve)
+		oid_set_reserve(&set, nr);
+	for (size_t i = 0; i < nr; i++)
+		oid_set_add(&set, &oids[i]);
+	t.add = (double)(now_ns() - start) / nr;
+
+	start = now_ns();
+	for (size_t i = 0; i < 2 * nr; i++)
+		hits += oid_set_contains(&set, &oids[i]);
+	t.lookup = (double)(now_ns() - start) / (2 * nr);
+
+	oid_set_clear(&set);
+	return t;
+}
+
+static struct timing bench_map(const git_oid *oids, size_t nr, int reserve)
+{
+	struct oid_map map = OID_MAP_INIT(sizeof(uint32_t));
+	struct timing t;
+	uint64_t start = now_ns();
+
+	if (reserve)
+		oid_map_reserve(&map, nr);
+	for (size_t i = 0; i < nr; i++)
+		*(uint32_t *)oid_map_put(&map, &oids[i], NULL) = i;
+	t.add = (double)(now_ns() - start) / nr;
+
+	start = now_ns();
+	for (size_t i = 0; i < 2 * nr; i++)
+		hits += oid_map_get(&map, &oids[i]) != NULL;
+	t.lookup = (double)(now_ns() - start) / (2 * nr);
+
+	oid_map_clear(&map);
+	return t;
+}
+
+static struct timing bench_chained(const git_oid *oids, size_t nr, int reserve)
+{
+	struct chained_set set;
+	struct timing t;
+	uint64_t start = now_ns();
+
+	(void)reserve;
+	set.size = nr;
+	set.buckets = xcalloc(set.size, sizeof(*set.buckets));
+	for (size_t i = 0; i < nr; i++)
+		chained_add(&set, &oids[i]);
+	t.add = (double)(now_ns() - start) / nr;
+
+	start = now_ns();
+	for (size_t i = 0; i < 2 * nr; i++)
+		hits += chained_contains(&set, &oids[i]);
+	t.lookup = (double)(now_ns() - start) / (2 * nr);
+
+	chained_clear(&set);
+	return t;
+}
+
+/* all the oids at once then sorted : one cannot ask it while adding */
+static struct timing bench_sorted(const git_oid *oids, size_t nr, int reserve)
+{
+	git_oid *sorted = xmalloc(nr * sizeof(*sorted));
+	struct timing t;
+	uint64_t start = now_ns();
+
+	(void)reserve;
+	memcpy(sorted, oids, nr * sizeof(*sorted));
+	qsort(sorted, nr, sizeof(*sorted), oid_cmp);
+	t.add = (double)(now_ns() - start) / nr;
+
+	start = now_ns();
+	for (size_t i = 0; i < 2 * nr; i++)
+		hits += bsearch(&oids[i], sorted, nr, sizeof(*sorted), oid_cmp) != NULL;
+	t.lookup = (double)(now_ns() - start) / (2 * nr);
+
+	free(sorted);
+	return t;
+}
+
+static const struct {
+	const char *name;
+	struct timing (*run)(const git_oid *oids, size_t nr, int reserve);
+	int reserve;
+} benches[] = {
+	{"oid_set", bench_set, 0},
+	{"oid_set (reserved)", bench_set, 1},
+	{"oid_map", bench_map, 0},
+	{"oid_map (reserved)", bench_map, 1},
+	{"chained hash", bench_chained, 0},
+	{"sorted array", bench_sorted, 0},
+};
+
+int main(int argc, char **argv)
+{
+	size_t nr = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+	int rounds = argc > 2 ? atoi(argv[2]) : 5;
+	git_oid *oids;
+
+	if (!nr || rounds < 1) {
+		fprintf(stderr, "usage: %s [<oids>] [<rounds>]\n", argv[0]);
+		return 1;
+	}
+
+	/* the second half is only looked up */
+	oids = xmalloc(2 * nr * sizeof(*oids));
+	random_oids(oids, 2 * nr);
+
+	printf("%zu oids, best of %d rounds, ns per operation\n", nr, rounds);
+	printf("%-20s %8s %8s\n", "", "add", "lookup");
+	for (size_t b = 0; b < sizeof(benches) / sizeof(*benches); b++) {
+		struct timing best = {0, 0};
+
+		for (int r = 0; r < rounds; r++) {
+			struct timing t = benches[b].run(oids, nr, benches[b].reserve);
+
+			if (!r || t.add < best.add)
+				best.add = t.add;
+			if (!r || t.lookup < best.lookup)
+				best.lookup = t.lookup;
+		}
+		printf("%-20s %8.1f %8.1f\n", benches[b].name, best.add, best.lookup);
+	}
+
+	if (hits != (size_t)rounds * 6 * nr)
+		fprintf(stderr, "warning: lookups found %zu oids\n", hits);
+	free(oids);
+	return 0;
+}
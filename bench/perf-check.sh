@@ -0,0 +1,69 @@
+#!/bin/sh
+#
+# Fail when git2 runs a command natively slower than git would run it.
+#
+# usage: perf-check.sh [<git2 binary>]
+#
+# bench.sh times the representative calls of every builtin of
+# src/builtin.c, under git2 and git, on each of the PERF_SHAPES
+# repositories, with BENCH_TOLERANCE set : any call git2 runs itself and
+# runs slower than git beyond the tolerance fails the check, so does
+# git2 taking more than its startup budget to hand a call to git.
+#
+# Settings (environment):
+#   PERF_TOLERANCE     share (in percent) by which git2 may be slower than
+#                      git (default 10)
+#   PERF_TOLERANCE_MS  what git2 may lose in any case, in milliseconds
+#                      (default 0.5)
+#   PERF_RUNS          runs of each call (default 20)
+#   PERF_SHAPES        ';' separated options of gen-repo.sh, one
+#                      repository each (default packed, loose, and a deep
+#                      tree of skewed blobs in several packs)
+#   PERF_OUTPUT        directory of the JSON reports of bench.sh, one per
+#                      shape (default perf_check)
+# The BENCH_* settings of bench.sh (but BENCH_SHAPE, BENCH_RUNS,
+# BENCH_TOLERANCE and BENCH_OUTPUT) apply, with 10000 files in 10
+# commits for the repositories.
+
+BENCH_DIRECTORY="$(cd "$(dirname "$0")" && pwd)"
+ROOT_DIRECTORY="$(dirname "$BENCH_DIRECTORY")"
+
+GIT2="${1:-$ROOT_DIRECTORY/bin/git2}"
+PERF_TOLERANCE="${PERF_TOLERANCE:-10}"
+PERF_TOLERANCE_MS="${PERF_TOLERANCE_MS:-0.5}"
+PERF_RUNS="${PERF_RUNS:-20}"
+PERF_SHAPES="${PERF_SHAPES:---layout=packed;--layout=loose;--depth=3 --sizes=skewed --seed=1 --layout=packs=4}"
+PERF_OUTPUT="${PERF_OUTPUT:-perf_check}"
+
+case "$PERF_OUTPUT" in
+/*) ;;
+*) PERF_OUTPUT="$(pwd)/$PERF_OUTPUT" ;;
+esac
+mkdir -p "$PERF_OUTPUT" || exit 1
+
+export BENCH_FILES="${BENCH_FILES:-10000}"
+export BENCH_COMMITS="${BENCH_COMMITS:-10}"
+export BENCH_RUNS="$PERF_RUNS"
+export BENCH_TOLERANCE="$PERF_TOLERANCE"
+export BENCH_TOLERANCE_MS="$PERF_TOLERANCE_MS"
+
+failed=
+shape_nr=0
+IFS=';'
+for shape in $PERF_SHAPES
+do
+	unset IFS
+	shape_nr=$((shape_nr + 1))
+	echo "perf-check: repository $shape_nr : $shape" >&2
+	BENCH_SHAPE="$shape" BENCH_OUTPUT="$PERF_OUTPUT/shape-$shape_nr.json" \
+		"$BENCH_DIRECTORY/bench.sh" "$GIT2" ||
+	failed="$failed $shape_nr"
+done
+unset IFS
+
+if test -n "$failed"
+then
+	echo "perf-check: failed on the repositories$failed, see $PERF_OUTPUT" >&2
+	exit 1
+fi
+echo "perf-check: git2 is within $PERF_TOLERANCE% of git on every native call" >&2
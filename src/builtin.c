@@ -1,27 +1,127 @@
 #include "builtin.h"
 #include "strbuf.h"
+#include "git-support.h"
+#include "trace.h"
+#include "ctype.h"
+#include "pack-on-write.h"
+#include "fsync.h"
 
+/*
+ * The options each builtin handles natively : when a command line has
+ * another one, git gets it right away. The names of each table are
+ * sorted, for bsearch(), then come the patterns : one ending with '*'
+ * stands for any option it starts, one ending with '#' for those it
+ * starts followed by a number. A NULL table leaves all the options to
+ * the builtin. All of it is constant : checking a command line allocates
+ * nothing.
+ */
+#define NATIVE_OPTIONS(names) { names, ARRAY_SIZE(names), NULL, 0 }
+#define NATIVE_OPTIONS_PATTERNS(names, patterns) { names, ARRAY_SIZE(names), patterns, ARRAY_SIZE(patterns) }
+
+static const struct native_options no_options = { NULL, 0, NULL, 0 };
+static const char *const cat_file_names[] = {"--batch", "--batch-all-objects", "--batch-check", "--unordered",
+	"-e", "-p", "-s", "-t"};
+static const struct native_options cat_file_options = NATIVE_OPTIONS(cat_file_names);
+static const char *const checkout_index_names[] = {"-a", "-f"};
+static const char *const checkout_index_patterns[] = {"-j*", "--jobs=*"};
+static const struct native_options checkout_index_options =
+	NATIVE_OPTIONS_PATTERNS(checkout_index_names, checkout_index_patterns);
+static const char *const commit_tree_names[] = {"--import", "-p"};
+static const struct native_options commit_tree_options = NATIVE_OPTIONS(commit_tree_names);
+static const char *const mktag_names[] = {"--batch"};
+static const struct native_options mktag_options = NATIVE_OPTIONS(mktag_names);
+static const char *const ls_files_names[] = {"--cached", "--exclude-standard", "--modified",
+	"--others", "--stage", "-c", "-m", "-o", "-s", "-z"};
+static const struct native_options ls_files_options = NATIVE_OPTIONS(ls_files_names);
+static const char *const ls_tree_names[] = {"--name-only", "--name-status", "-r", "-t", "-z"};
+static const struct native_options ls_tree_options = NATIVE_OPTIONS(ls_tree_names);
+static const char *const read_tree_names[] = {"-m"};
+static const struct native_options read_tree_options = NATIVE_OPTIONS(read_tree_names);
+static const char *const rev_list_names[] = {"--all", "--objects", "--pretty=oneline", "-n"};
+static const char *const rev_list_patterns[] = {"-n#", "--max-count=#", "-#"};
+static const struct native_options rev_list_options =
+	NATIVE_OPTIONS_PATTERNS(rev_list_names, rev_list_patterns);
+static const char *const update_index_names[] = {"--add", "--ignore-missing", "--really-refresh",
+	"--refresh", "--stdin", "-q", "-z"};
+static const struct native_options update_index_options = NATIVE_OPTIONS(update_index_names);
+static const char *const write_tree_names[] = {"--missing-ok"};
+static const struct native_options write_tree_options = NATIVE_OPTIONS(write_tree_names);
+
+/* sorted by name, for lookup_builtin() */
 cmd_struct commands[] = {
-	{"init", cmd_init},
-	{"rev-list", cmd_rev_list},
-	{"ls-files", cmd_ls_files},
-	{"checkout", cmd_checkout},
-	{"ls-tree", cmd_ls_tree},
-	{"update-index", cmd_update_index},
-	{"mktag", cmd_mktag},
-	{"commit-tree", cmd_commit_tree},
-	{"write-tree", cmd_write_tree},
-	{"read-tree", cmd_read_tree},
-	{"checkout-index", cmd_checkout_index},
-	{"cat-file", cmd_cat_file}
+	{"cat-file", cmd_cat_file, &cat_file_options},
+	{"checkout", cmd_checkout, &no_options},
+	{"checkout-index", cmd_checkout_index, &checkout_index_options},
+	{"commit-tree", cmd_commit_tree, &commit_tree_options},
+	{"init", cmd_init, NULL},
+	{"ls-files", cmd_ls_files, &ls_files_options},
+	{"ls-tree", cmd_ls_tree, &ls_tree_options},
+	{"mktag", cmd_mktag, &mktag_options},
+	{"read-tree", cmd_read_tree, &read_tree_options},
+	{"rev-list", cmd_rev_list, &rev_list_options},
+	{"update-index", cmd_update_index, &update_index_options},
+	{"write-tree", cmd_write_tree, &write_tree_options}
 };
 
+static int compare_command(const void *name, const void *command) {
+	return strcmp(name, ((const cmd_struct *)command)->cmd);
+}
+
+const cmd_struct *lookup_builtin(const char *cmd) {
+	return bsearch(cmd, commands, ARRAY_SIZE(commands), sizeof(cmd_struct), compare_command);
+}
+
 cmd_handler lookup_handler(const char *cmd) {
-	unsigned int i;
-	unsigned int max = sizeof(commands) / sizeof(cmd_struct);
+	const cmd_struct *command = lookup_builtin(cmd);
+
+	return command ? command->handler : NULL;
+}
+
+static int is_number(const char *str) {
+	if (!isdigit(*str))
+		return 0;
+	while (isdigit(*str))
+		str++;
+	return !*str;
+}
+
+static int compare_option(const void *arg, const void *option) {
+	return strcmp(arg, *(const char *const *)option);
+}
+
+static int is_native_option(const struct native_options *options, const char *arg) {
+	if (options->nr_names &&
+	    bsearch(arg, options->names, options->nr_names, sizeof(*options->names), compare_option))
+		return 1;
+
+	for (unsigned int i = 0; i < options->nr_patterns; i++) {
+		const char *pattern = options->patterns[i];
+		size_t len = strlen(pattern) - 1;
+
+		if (strncmp(arg, pattern, len))
+			continue;
+		if (pattern[len] == '*' || (pattern[len] == '#' && is_number(arg + len)))
+			return 1;
+	}
+	return 0;
+}
+
+int run_builtin(int argc, const char **argv) {
+	const cmd_struct *command = lookup_builtin(argv[0]);
+	if (command == NULL)
+		please_git_do_it_for_me(FALLBACK_COMMAND);
+
+	/* the builtin would only find out after some parsing */
+	for (int i = 1; command->options && i < argc && strcmp(argv[i], "--"); i++)
+		if (argv[i][0] == '-' && argv[i][1] && !is_native_option(command->options, argv[i]))
+			please_git_do_it_for_option(argv[i]);
+
+	uint64_t start = trace_perf_start();
+	int code = command->handler(argc, argv);
+	/* what the command wrote is there for the next one, and for git */
+	finish_pack_on_write();
+	fsync_batch();
+	trace_perf_stop(argv[0], start);
 
-	for (i = 0; i < max; i++)
-		if (!strcmp(commands[i].cmd, cmd))
-			return commands[i].handler;
-	return NULL;
+	return code;
 }
@@ -21,6 +21,15 @@ int cmd_init(int argc, const char **argv);
 
 extern cmd_struct commands[];
 
+const cmd_struct *lookup_builtin(const char *cmd);
+//the builtin named cmd, NULL if there is none
+
 cmd_handler lookup_handler(const char *cmd);
 
+int run_builtin(int argc, const char **argv);
+//run the builtin argv[0] in this process, falling back to git if there is
+//none. The commands of a run share the repository, its odb and its
+//index (see get_git_repository() and get_git_index_map()), so one
+//builtin can hand a part of its job to another one at no cost
+
 #endif /* BUILTIN_H */
@@ -1,108 +1,385 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <poll.h>
+#include <dirent.h>
+#include <sys/stat.h>
 #include <git2.h>
 #include "errors.h"
 #include "git-cat-file.h"
 #include "git-support.h"
 #include "repository.h"
 #include "strbuf.h"
-#include "git-ls-tree.h"
+#include "utils.h"
+#include "odb-stream.h"
+#include "revision.h"
+#include "builtin.h"
+#include "output.h"
+#include "pack-reader.h"
 
-int cmd_cat_file(int argc, const char **argv)
+/* stdin is read by blocks of this size in batch mode */
+#define BATCH_CHUNK_SIZE (64 * 1024)
+
+static int stdin_would_block()
 {
-	/* Uncomment when it passes the tests */
-	please_git_do_it_for_me();
+	struct pollfd pfd;
 
-	char opt;
-	if (argc != 2 && argc !=3) 
-		please_git_do_it_for_me();
+	pfd.fd = 0;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
 
-	if (argc == 3){
-		if ((strcmp(argv[1], "blob") == 0) || (strcmp(argv[1], "tree") == 0) || (strcmp(argv[1], "commit") == 0) || (strcmp(argv[1], "tag") == 0 ))
-			opt = '0';
-		else
-			opt = argv[1][1];
+	return poll(&pfd, 1, 0) == 0;
+}
+
+/* Write the object to stdout without any copy or stdio processing */
+static void write_object_contents(git_odb *odb, const git_oid *oid)
+{
+	int e;
+
+	/* what is already buffered goes first */
+	output_flush(get_stdout_output());
+
+	e = odb_write_object_to_fd(odb, oid, 1);
+
+	if (e == GIT_EOSERR)
+		die_errno("unable to write to stdout");
+	else if (e != GIT_SUCCESS)
+		libgit_error();
+}
+
+
+/* "<oid> <type> <size>", then the contents for --batch */
+static void batch_object(git_odb *odb, struct output *out, const git_oid *oid, git_otype type, size_t size, int print_contents)
+{
+	git_odb_object *odb_object;
+
+	output_add_oid(out, oid);
+	output_addf(out, " %s %zu\n", git_object_type2string(type), size);
+
+	if (print_contents) {
+		if (size >= OUTPUT_BLOCK_SIZE) {
+			/* Do not copy big objects : stream them right away */
+			write_object_contents(odb, oid);
+		} else {
+			if (odb_read_object(&odb_object, odb, oid) != GIT_SUCCESS)
+				libgit_error();
+			output_add(out, git_odb_object_data(odb_object), size);
+			git_odb_object_close(odb_object);
+		}
+		output_addch(out, '\n');
+	}
+
+	output_end_record(out);
+}
+
+/* Answer the input line name. Returns -1 for a name git has to resolve */
+static int batch_one(git_repository *repo, struct output *out, const char *name, size_t len, int print_contents)
+{
+	git_odb *odb = git_repository_database(repo);
+	git_oid oid;
+	git_otype type;
+	size_t size;
+	int e;
+
+	e = resolve_revision(&oid, repo, name);
+	if (e == GIT_ENOTIMPLEMENTED)
+		return -1;
+	if (e == GIT_EAMBIGUOUSOIDPREFIX)
+		e = GIT_ENOTFOUND;
+	if (e == GIT_SUCCESS)
+		e = odb_read_object_header(&size, &type, odb, &oid);
+
+	if (e == GIT_ENOTFOUND || e == GIT_ENOTOID) {
+		output_add(out, name, len);
+		output_addstr(out, " missing\n");
+		output_end_record(out);
+		return 0;
+	} else if (e != GIT_SUCCESS) {
+		libgit_error();
 	}
-	else if (argc == 2 && (strcmp(argv[1], "--batch") == 0))
-		opt = 'a';
-	
 
-	
+	batch_object(odb, out, &oid, type, size, print_contents);
+	return 0;
+}
+
+/*
+ * cat-file --batch and --batch-check : read object names from stdin and
+ * write their description (and contents) on stdout.
+ * Output is only flushed when it is big enough or when we would have to
+ * wait for more input, so that interactive callers get their answers.
+ * From the first name git2 does not resolve on, git answers the batch :
+ * it gets that line, the rest of what was read and what is still to come.
+ */
+static int cat_file_batch(int print_contents)
+{
+	struct strbuf input = STRBUF_INIT;
 	git_repository *repo = get_git_repository();
+	struct output *out = get_stdout_output();
+	size_t pos = 0;
+	char *eol;
+
+	for (;;) {
+		ssize_t loaded;
+
+		while ((eol = memchr(input.buf + pos, '\n', input.len - pos)) != NULL) {
+			*eol = '\0';
+			if (batch_one(repo, out, input.buf + pos, eol - (input.buf + pos), print_contents) < 0) {
+				*eol = '\n';
+				please_git_do_it_with_pending_input(FALLBACK_REVISION, input.buf + pos, input.len - pos);
+			}
+			pos = eol - input.buf + 1;
+		}
+
+		/* Keep the unfinished line only */
+		strbuf_remove(&input, 0, pos);
+		pos = 0;
+
+		if (stdin_would_block())
+			output_flush(out);
+
+		strbuf_grow(&input, BATCH_CHUNK_SIZE);
+		loaded = xread(0, input.buf + input.len, strbuf_avail(&input));
+		if (loaded < 0)
+			die_errno("could not read from stdin");
+		if (loaded == 0)
+			break;
+
+		strbuf_setlen(&input, input.len + loaded);
+	}
+
+	/* Last line without a trailing newline */
+	if (input.len && batch_one(repo, out, input.buf, input.len, print_contents) < 0)
+		please_git_do_it_with_pending_input(FALLBACK_REVISION, input.buf, input.len);
 
+	output_flush(out);
+	strbuf_release(&input);
+
+	return EXIT_SUCCESS;
+}
+
+/* An object of --batch-all-objects, and where it is read from */
+struct all_object {
 	git_oid oid;
-	if (git_oid_fromstr(&oid, (const char *)argv[argc-1]))
-		please_git_do_it_for_me();
+	struct pack_position pos;
+	git_otype type;
+	size_t size;
+};
+
+struct all_objects {
+	struct all_object *objects;
+	unsigned int nr, alloc;
+};
+
+static void add_object(struct all_objects *all, const git_oid *oid, const struct pack_position *pos)
+{
+	ALLOC_GROW(all->objects, all->nr + 1, all->alloc);
+	git_oid_cpy(&all->objects[all->nr].oid, oid);
+	all->objects[all->nr].pos = *pos;
+	all->nr++;
+}
+
+static void add_packed_object(const git_oid *oid, const struct pack_position *pos, void *data)
+{
+	add_object(data, oid, pos);
+}
+
+/* The loose objects, objects/xx/<38 hex digits> */
+static void add_loose_objects(struct all_objects *all, git_repository *repo)
+{
+	const struct pack_position loose = {PACK_POSITION_NONE, 0};
+	struct strbuf path = STRBUF_INIT;
+	size_t len;
 
+	strbuf_addstr(&path, git_repository_path(repo, GIT_REPO_PATH_ODB));
+	if (path.len && path.buf[path.len - 1] != '/')
+		strbuf_addch(&path, '/');
+	len = path.len;
+
+	for (int i = 0; i < 256; i++) {
+		struct dirent *de;
+		DIR *dir;
+		char hex[GIT_OID_HEXSZ + 1];
+		git_oid oid;
+
+		strbuf_setlen(&path, len);
+		strbuf_addf(&path, "%02x", i);
+		dir = opendir(path.buf);
+		if (!dir)
+			continue;
+		while ((de = readdir(dir)) != NULL) {
+			if (strlen(de->d_name) != GIT_OID_HEXSZ - 2)
+				continue;
+			memcpy(hex, path.buf + len, 2);
+			memcpy(hex + 2, de->d_name, GIT_OID_HEXSZ - 2);
+			hex[GIT_OID_HEXSZ] = '\0';
+			if (git_oid_fromstr(&oid, hex) == GIT_SUCCESS)
+				add_object(all, &oid, &loose);
+		}
+		closedir(dir);
+	}
+
+	strbuf_release(&path);
+}
+
+static int object_oid_cmp(const void *a, const void *b)
+{
+	const struct all_object *oa = a, *ob = b;
+	int cmp = git_oid_cmp(&oa->oid, &ob->oid);
+
+	/* the first copy of an object is the one kept */
+	return cmp ? cmp : pack_position_cmp(&oa->pos, &ob->pos);
+}
+
+static int object_position_cmp(const void *a, const void *b)
+{
+	const struct all_object *oa = a, *ob = b;
+	int cmp = pack_position_cmp(&oa->pos, &ob->pos);
+
+	return cmp ? cmp : git_oid_cmp(&oa->oid, &ob->oid);
+}
+
+/*
+ * --batch-all-objects : every object of the repository once, sorted by
+ * oid, or in the order of the packs with --unordered. The headers of
+ * --batch-check are read in the order of the packs in both cases, and
+ * only printed in the order of the oids afterwards : the packs are read
+ * forward instead of at random.
+ */
+static int cat_file_all_objects(int print_contents, int unordered)
+{
+	git_repository *repo = get_git_repository();
 	git_odb *odb = git_repository_database(repo);
-	git_odb_object *odb_object;
-	if(git_odb_read(&odb_object, odb, &oid) == GIT_ENOTFOUND)
-		libgit_error();
+	struct output *out = get_stdout_output();
+	struct all_objects all = {NULL, 0, 0};
+	struct strbuf alternates = STRBUF_INIT;
+	struct stat st;
+	unsigned int nr = 0;
 
-	size_t size = git_odb_object_size(odb_object);
-	git_otype type = git_odb_object_type(odb_object);
+	/* objects borrowed from other repositories are listed too */
+	strbuf_addf(&alternates, "%s/info/alternates", git_repository_path(repo, GIT_REPO_PATH_ODB));
+	if (!stat(alternates.buf, &st))
+		please_git_do_it_for_me(FALLBACK_OBJECTS);
+	strbuf_release(&alternates);
+
+	for_each_packed_object(repo, add_packed_object, &all);
+	add_loose_objects(&all, repo);
+
+	qsort(all.objects, all.nr, sizeof(*all.objects), object_oid_cmp);
+	for (unsigned int i = 0; i < all.nr; i++) {
+		if (nr && !git_oid_cmp(&all.objects[nr - 1].oid, &all.objects[i].oid))
+			continue;
+		all.objects[nr++] = all.objects[i];
+	}
+
+	if (unordered || !print_contents)
+		qsort(all.objects, nr, sizeof(*all.objects), object_position_cmp);
+
+	for (unsigned int i = 0; i < nr; i++) {
+		struct all_object *object = &all.objects[i];
+
+		if (odb_read_object_header(&object->size, &object->type, odb, &object->oid) != GIT_SUCCESS)
+			libgit_error();
+		if (unordered || print_contents)
+			batch_object(odb, out, &object->oid, object->type, object->size, print_contents);
+	}
+
+	if (!unordered && !print_contents) {
+		qsort(all.objects, nr, sizeof(*all.objects), object_oid_cmp);
+		for (unsigned int i = 0; i < nr; i++)
+			batch_object(odb, out, &all.objects[i].oid, all.objects[i].type, all.objects[i].size, 0);
+	}
+
+	output_flush(out);
+	free(all.objects);
+	return EXIT_SUCCESS;
+}
+
+int cmd_cat_file(int argc, const char **argv)
+{
+	int batch = -1, all_objects = 0, unordered = 0, other = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--batch"))
+			batch = 1;
+		else if (!strcmp(argv[i], "--batch-check"))
+			batch = 0;
+		else if (!strcmp(argv[i], "--batch-all-objects"))
+			all_objects = 1;
+		else if (!strcmp(argv[i], "--unordered"))
+			unordered = 1;
+		else
+			other = 1;
+	}
+
+	if (batch >= 0 && all_objects && !other)
+		return cat_file_all_objects(batch, unordered);
+	else if (batch >= 0 && argc == 2)
+		return cat_file_batch(batch);
+
+	/* "-e", "-p", "-s" or "-t", or a type, then a single name */
+	char opt;
+	if (argc != 3 || argv[2][0] == '-')
+		please_git_do_it_for_me(FALLBACK_USAGE);
+
+	if ((strcmp(argv[1], "blob") == 0) || (strcmp(argv[1], "tree") == 0) || (strcmp(argv[1], "commit") == 0) || (strcmp(argv[1], "tag") == 0 ))
+		opt = '0';
+	else if (argv[1][0] == '-' && strchr("epst", argv[1][1]) && argv[1][1] && !argv[1][2])
+		opt = argv[1][1];
+	else
+		please_git_do_it_for_me(FALLBACK_USAGE);
+
+	git_repository *repo = get_git_repository();
+	git_odb *odb = git_repository_database(repo);
+
+	git_oid oid;
+	int e = resolve_revision(&oid, repo, argv[argc-1]);
+	if (e == GIT_ENOTFOUND)
+		die("Not a valid object name %s", argv[argc-1]);
+	else if (e != GIT_SUCCESS)
+		please_git_do_it_for_me(FALLBACK_OBJECTS);
+
+	if (opt == 'e')
+		return git_odb_exists(odb, &oid) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+	/* The object itself is only read when its contents are printed */
+	size_t size;
+	git_otype type;
+	e = odb_read_object_header(&size, &type, odb, &oid);
+	if (e == GIT_ENOTFOUND) {
+		/* a full oid of an object the repository does not have : git words it by option */
+		if (opt == 'p')
+			die("Not a valid object name %s", argv[argc-1]);
+		else if (opt == '0')
+			die("git cat-file %s: bad file", argv[argc-1]);
+		die("git cat-file: could not get object info");
+	} else if (e != GIT_SUCCESS)
+		libgit_error();
 
 	const char *type_string = git_object_type2string(type);
 
 	switch (opt) {
 		case 'p':
 			if (strcmp(type_string, "tree") == 0) {
-				printf("vous etes là\n");
-
- 				char ** arg = malloc(2);
- 				strcpy(arg[0], "ls-tree");
- 				strcpy(arg[1], argv[2]);
- 				int e = cmd_ls_tree(2, (const char **)arg);
- 				if (e == 0 )
- 					printf("succes\n");
- 				else
- 					printf("echec\n");
+				/* the repository and its odb are shared with ls-tree */
+				const char *ls_tree_argv[] = {"ls-tree", argv[argc-1], NULL};
+				return run_builtin(2, ls_tree_argv);
 			}
 			else {
-				for(int i=0; i < (int)size; i++)
-					printf("%c", *((char *)git_odb_object_data(odb_object)+i));
+				write_object_contents(odb, &oid);
 			}
 			break;
 		case 't':
-			printf("%s\n",type_string);
+			output_addf(get_stdout_output(), "%s\n", type_string);
 			break;
 		case 's':
-			printf("%zu\n",size);
-			break;
-		case 'e':
-			if(git_odb_exists(odb, &oid) == 1) {
-				return 0;
-			}
+			output_addf(get_stdout_output(), "%zu\n", size);
 			break;
 		case '0' :
-			if (strcmp(type_string, argv[1]) == 0) {
-				for (int i=0; i < (int)size; i++)
-					printf("%c", *((char *)git_odb_object_data(odb_object)+i));
-			}
+			if (strcmp(type_string, argv[1]) == 0)
+				write_object_contents(odb, &oid);
  			else
- 				please_git_do_it_for_me();
-			break;
-		case 'a' :
-			please_git_do_it_for_me();
-// 			if (strbuf_read(&buf, 0, 4096) < 0)
-// 				die_errno("could not read from stdin");
-// 
-// 			git_oid id;
-// 			if (git_oid_mkstr(&id, buf.buf))
-// 				please_git_do_it_for_me();
-// 
-// 			git_odb_object *odb_object1;
-// 			if(git_odb_read(&odb_object1, odb, &id) == GIT_ENOTFOUND)
-// 				libgit_error();
-// 			size_t size1 = git_odb_object_size(odb_object1);
-// 			git_otype type1 = git_odb_object_type(odb_object1);
-// 
-// 			printf("bla bla %s %s %zu\n",buf.buf, git_object_type2string(type1), size1);
-// 			for(int i=0; i < (int)size1; i++)
-// 				printf("%c", *((char *)git_odb_object_data(odb_object1)+i));
-// 			fflush(stdout);
+ 				please_git_do_it_for_me(FALLBACK_ERROR);
 			break;
 	}
-	//git_odb_object_close(odb_object);
+
 	return EXIT_SUCCESS;
 }
@@ -4,6 +4,10 @@
 #include <git2.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <fcntl.h>
+#ifndef NO_PTHREADS
+#include <pthread.h>
+#endif
 #include "errors.h"
 #include "git-support.h"
 #include "repository.h"
@@ -11,6 +15,13 @@
 #include "git-parse-mode.h"
 #include "strbuf.h"
 #include "fileops.h"
+#include "thread-pool.h"
+#include "string-set.h"
+#include "environment.h"
+#include "odb-stream.h"
+#include "pack-reader.h"
+#include "index-map.h"
+#include "file-batch.h"
 
 enum ci_type {
 	CI_NON_EXIST,
@@ -20,6 +31,87 @@ enum ci_type {
 	CI_ERROR
 };
 
+/*
+ * A checkout session remembers the directories known to exist, so that
+ * writing many files in the same directory does not lstat() it and all
+ * its parents again and again.
+ */
+struct checkout_session {
+	struct string_set known_dirs;
+#ifndef NO_PTHREADS
+	pthread_mutex_t lock;
+#endif
+};
+
+static void session_init(struct checkout_session *session)
+{
+	struct string_set empty = STRING_SET_INIT;
+
+	session->known_dirs = empty;
+#ifndef NO_PTHREADS
+	pthread_mutex_init(&session->lock, NULL);
+#endif
+}
+
+static void session_release(struct checkout_session *session)
+{
+	string_set_clear(&session->known_dirs);
+#ifndef NO_PTHREADS
+	pthread_mutex_destroy(&session->lock);
+#endif
+}
+
+static void session_lock(struct checkout_session *session)
+{
+#ifndef NO_PTHREADS
+	pthread_mutex_lock(&session->lock);
+#else
+	(void)session;
+#endif
+}
+
+static void session_unlock(struct checkout_session *session)
+{
+#ifndef NO_PTHREADS
+	pthread_mutex_unlock(&session->lock);
+#else
+	(void)session;
+#endif
+}
+
+static int session_knows_dir(struct checkout_session *session, const char *path)
+{
+	int known;
+
+	session_lock(session);
+	known = string_set_contains(&session->known_dirs, path);
+	session_unlock(session);
+
+	return known;
+}
+
+static void session_add_dir(struct checkout_session *session, const char *path)
+{
+	session_lock(session);
+	string_set_add(&session->known_dirs, path);
+	session_unlock(session);
+}
+
+/* path has been removed : forget it and everything below it */
+static void session_forget_dir(struct checkout_session *session, const char *path)
+{
+	struct strbuf below = STRBUF_INIT;
+
+	strbuf_addf(&below, "%s/", path);
+
+	session_lock(session);
+	string_set_remove(&session->known_dirs, path);
+	string_set_remove_prefix(&session->known_dirs, below.buf);
+	session_unlock(session);
+
+	strbuf_release(&below);
+}
+
 /* return the type of objpath */
 enum ci_type type_of_obj(const char *objpath) {
 	struct stat bufstat;
@@ -44,7 +136,10 @@ enum ci_type type_of_obj(const char *objpath) {
 	}
 }
 
-void create_force_dir(const char *objpath) {
+void create_force_dir(struct checkout_session *session, const char *objpath) {
+
+	if (session_knows_dir(session, objpath))
+		return;
 
 	switch (type_of_obj(objpath)) {
 		case CI_NON_EXIST: {
@@ -56,11 +151,12 @@ void create_force_dir(const char *objpath) {
 				printf("Failed to determine parent path of %s\n", objpath);
 				return;
 			}
-			create_force_dir(target_folder_path);
+			create_force_dir(session, target_folder_path);
 		}
 		break;
 		case CI_DIR:
 			//nothing to do
+			session_add_dir(session, objpath);
 			return;
 		case CI_FILE:
 		case CI_SYMLINK:
@@ -78,13 +174,16 @@ void create_force_dir(const char *objpath) {
 	//create directory
 	if( mkdir(objpath, 0755) != 0)
 		printf("Failed to create '%s' directory\n", objpath);
+	else
+		session_add_dir(session, objpath);
 }
 
-void create_force_file(const char *objpath, int mode, const void * data, size_t data_size) {
+/* Below this size preallocating the file is not worth a system call */
+#define PREALLOCATE_THRESHOLD (1024 * 1024)
 
-	int p = -1;
-
-	/* prepare */
+/* Make room for the file objpath. Returns -1 if something is in the way */
+static int prepare_file(struct checkout_session *session, const char *objpath)
+{
 	switch (type_of_obj(objpath)) {
 		case CI_NON_EXIST: {
 			/* force parent dir to exist */
@@ -93,9 +192,9 @@ void create_force_file(const char *objpath, int mode, const void * data, size_t
 			error = dirname_r(target_folder_path, sizeof(target_folder_path), objpath);
 			if (error < GIT_SUCCESS) {
 				printf("Failed to determine parent directory of %s.\n", objpath);
-				return;
+				return -1;
 			}
-			create_force_dir(target_folder_path);
+			create_force_dir(session, target_folder_path);
 			}
 			break;
 		case CI_DIR: {
@@ -104,9 +203,10 @@ void create_force_file(const char *objpath, int mode, const void * data, size_t
 			char * buf_path = xmalloc(strlen(objpath)*sizeof(char));
 			memcpy(buf_path, objpath, strlen(objpath)*sizeof(char));
 			strbuf_attach(&pathbuf, (void *)buf_path, strlen(objpath)*sizeof(char), strlen(objpath)*sizeof(char));
+			session_forget_dir(session, objpath);
 			if (remove_dir_recursively(&pathbuf) != 0) {
 				printf("Failed to remove '%s'\n", objpath);
-				return;
+				return -1;
 			}
 			}
 			break;
@@ -116,12 +216,41 @@ void create_force_file(const char *objpath, int mode, const void * data, size_t
 			//rm link
 			if (unlink(objpath) != 0) {
 				printf("Failed to remove %s\n", objpath);
-				return;
+				return -1;
 			}
 			break;
 		case CI_ERROR:
 			printf("Don't know how to manage file %s\n", objpath);
-			return;
+			return -1;
+	}
+
+	return 0;
+}
+
+static void release_blob(void *obj)
+{
+	git_odb_object_close(obj);
+}
+
+void create_force_file(struct checkout_session *session, const char *objpath, int mode, git_odb *odb, const git_oid *oid,
+		       struct file_batch *batch) {
+
+	int p = -1;
+	size_t size;
+	git_otype type;
+	git_odb_object *obj;
+	int header;
+
+	if (prepare_file(session, objpath) < 0)
+		return;
+
+	/* small blobs are written by the batch from memory, big ones streamed */
+	header = odb_read_object_header(&size, &type, odb, oid);
+	if (batch && header == GIT_SUCCESS && size < PREALLOCATE_THRESHOLD) {
+		if (odb_read_object(&obj, odb, oid) != GIT_SUCCESS)
+			libgit_error();
+		file_batch_add(batch, objpath, mode, git_odb_object_data(obj), size, release_blob, obj);
+		return;
 	}
 
 	/* write file */
@@ -132,11 +261,20 @@ void create_force_file(const char *objpath, int mode, const void * data, size_t
 		return;
 	}
 	
-	write(p, data, data_size);
+	/* helps the filesystem keep big files contiguous, best effort */
+	if (header == GIT_SUCCESS && size >= PREALLOCATE_THRESHOLD)
+		posix_fallocate(p, 0, size);
+
+	/* the blob goes to the file by chunks when the backend can stream it */
+	int e = odb_write_object_to_fd(odb, oid, p);
+	if (e == GIT_EOSERR)
+		printf("Failed to write '%s'\n", objpath);
+	else if (e != GIT_SUCCESS)
+		libgit_error();
 	close(p);
 }
 
-void create_force_symlinks(const char *objpath, const char * dest) {
+void create_force_symlinks(struct checkout_session *session, const char *objpath, const char * dest) {
 
 	/* prepare file */
 	switch (type_of_obj(objpath)) {
@@ -148,7 +286,7 @@ void create_force_symlinks(const char *objpath, const char * dest) {
 				printf("Failed to remove '%s'\n", objpath);
 				return;
 			}
-			create_force_dir(target_folder_path);
+			create_force_dir(session, target_folder_path);
 		}
 		break;
 		case CI_DIR: {
@@ -157,6 +295,7 @@ void create_force_symlinks(const char *objpath, const char * dest) {
 			char * buf_path = xmalloc(strlen(objpath)*sizeof(char));
 			memcpy(buf_path, objpath, strlen(objpath)*sizeof(char));
 			strbuf_attach(&pathbuf, (void *)buf_path, strlen(objpath)*sizeof(char), strlen(objpath)*sizeof(char));
+			session_forget_dir(session, objpath);
 			if (remove_dir_recursively(&pathbuf) != 0) {
 				printf("Failed to remove '%s'\n", objpath);
 				return;
@@ -182,54 +321,307 @@ void create_force_symlinks(const char *objpath, const char * dest) {
 
 
 
+/* Below this number of entries threads cost more than they bring */
+#define PARALLEL_CHECKOUT_THRESHOLD 128
+
+struct checkout_job {
+	struct checkout_session session;
+	const struct index_map *index;
+	unsigned int *skipped; /* up-to-date entries, per worker */
+	int trust_filemode; /* core.filemode */
+	const char *repository_path;
+	git_repository **repositories; /* one per worker */
+	int use_uring;
+	struct file_batch **batches; /* one per worker, NULL without io_uring */
+	unsigned int *order; /* of the entries to check out, NULL for all of them in the index order */
+};
+
+static void checkout_entry(struct checkout_session *session, git_odb *odb, git_index_entry *gie, struct file_batch *batch)
+{
+	git_odb_object * obj;
+	int e;
+
+	switch (gie->mode >>12 ) {
+		case 0xA:
+			e = odb_read_object(&obj, odb, &gie->oid);
+			if(e != GIT_SUCCESS)
+				libgit_error();
+			create_force_symlinks(session, gie->path, (char *)git_odb_object_data(obj));
+			git_odb_object_close(obj);
+			break;
+		case 0x8:
+			create_force_file(session, gie->path, gie->mode, odb, &gie->oid, batch);
+			break;
+		default:
+			printf("Don't know this kind of file : %06o\t%s\n", gie->mode, gie->path);
+	}
+}
+
+/*
+ * A file whose stat data matches its index entry has not been touched
+ * since it was checked out, unless it was modified in the same second
+ * the index was written ("racy git"): then only its contents can tell.
+ */
+static int entry_is_uptodate(struct checkout_job *job, const git_index_entry *gie)
+{
+	struct stat st;
+
+	if (lstat(gie->path, &st) || !index_entry_matches_stat(gie, gie->path, &st, job->trust_filemode))
+		return 0;
+
+	if (gie->mtime.seconds >= (git_time_t)job->index->mtime)
+		return index_entry_matches_file(gie, gie->path, &st);
+
+	return 1;
+}
+
+/*
+ * libgit2 objects are not thread safe : every worker but the first one
+ * (the main thread) reads objects through its own repository.
+ */
+static void checkout_worker_init(void *context, unsigned int worker)
+{
+	struct checkout_job *job = context;
+
+	if (worker == 0) {
+		job->repositories[0] = get_git_repository();
+	} else if (git_repository_open(&job->repositories[worker], job->repository_path) < GIT_SUCCESS ||
+		   attach_pack_reader(job->repositories[worker]) < GIT_SUCCESS) {
+		libgit_error();
+	}
+
+	/* the files are then written by the threads when io_uring is missing */
+	if (job->use_uring)
+		job->batches[worker] = file_batch_start();
+}
+
+static void checkout_worker_process(void *context, unsigned int worker, unsigned int item)
+{
+	struct checkout_job *job = context;
+	git_odb *odb = git_repository_database(job->repositories[worker]);
+	git_index_entry entry;
+
+	index_map_entry(job->index, job->order ? job->order[item] : item, &entry);
+	if (entry_is_uptodate(job, &entry)) {
+		job->skipped[worker]++;
+		return;
+	}
+
+	checkout_entry(&job->session, odb, &entry, job->batches[worker]);
+}
+
+static void checkout_worker_release(void *context, unsigned int worker)
+{
+	struct checkout_job *job = context;
+
+	/* the blobs of the files pending belong to the repository of the worker */
+	file_batch_free(job->batches[worker]);
+	if (worker != 0)
+		git_repository_free(job->repositories[worker]);
+}
+
+/*
+ * Create the leading directories of all the entries up front, from a
+ * single thread, so that workers never race on the same directory.
+ * The index is sorted : entries of a directory are next to each other.
+ */
+static void create_leading_directories(struct checkout_session *session, const struct index_map *index,
+	const unsigned int *entries, unsigned int nr)
+{
+	char previous[GIT_PATH_MAX] = "";
+	char directory[GIT_PATH_MAX];
+
+	for (unsigned i = 0; i < nr; i++) {
+		const char *path = index_map_path(index, entries ? entries[i] : i);
+
+		if (!strchr(path, '/'))
+			continue;
+
+		if (dirname_r(directory, sizeof(directory), path) < GIT_SUCCESS)
+			continue;
+
+		if (!strcmp(directory, previous))
+			continue;
+
+		create_force_dir(session, directory);
+		strcpy(previous, directory);
+	}
+}
+
+struct ordered_entry {
+	struct pack_position pos;
+	unsigned int n;
+};
+
+static int ordered_entry_cmp(const void *a, const void *b)
+{
+	const struct ordered_entry *ea = a, *eb = b;
+	int cmp = pack_position_cmp(&ea->pos, &eb->pos);
+
+	if (cmp)
+		return cmp;
+	return ea->n < eb->n ? -1 : ea->n > eb->n;
+}
+
+/*
+ * The entries in the order of their blobs in the packs, so that a cold
+ * checkout reads the packs forward instead of seeking through them as
+ * the paths go. Loose blobs come last, in the order of the index. Only
+ * the nr entries of subset (all of them if it is NULL) are ordered.
+ */
+static unsigned int *pack_order(git_repository *repo, const struct index_map *index,
+	const unsigned int *subset, unsigned int nr)
+{
+	struct ordered_entry *entries = xmalloc(nr * sizeof(*entries));
+	struct pack_position *positions = xmalloc(nr * sizeof(*positions));
+	git_oid *oids = xmalloc(nr * sizeof(*oids));
+	unsigned int *order = xmalloc(nr * sizeof(*order));
+
+	for (unsigned int i = 0; i < nr; i++) {
+		git_index_entry entry;
+
+		index_map_entry(index, subset ? subset[i] : i, &entry);
+		git_oid_cpy(&oids[i], &entry.oid);
+	}
+	pack_positions(repo, oids, nr, positions);
+
+	for (unsigned int i = 0; i < nr; i++) {
+		entries[i].pos = positions[i];
+		entries[i].n = subset ? subset[i] : i;
+	}
+	qsort(entries, nr, sizeof(*entries), ordered_entry_cmp);
+	for (unsigned int i = 0; i < nr; i++)
+		order[i] = entries[i].n;
+
+	free(oids);
+	free(positions);
+	free(entries);
+	return order;
+}
+
+/*
+ * The entries which are in the work tree, NULL if all of them are : as
+ * git does, checkout-index leaves out the skip-worktree ones, out of the
+ * sparse checkout cone (the sparse directory entries among them).
+ */
+static unsigned int *worktree_entries(const struct index_map *index, unsigned int *nr)
+{
+	unsigned int *entries = NULL;
+
+	*nr = 0;
+	for (unsigned int i = 0; i < index->nr; i++) {
+		git_index_entry entry;
+
+		index_map_entry(index, i, &entry);
+		if (entry.flags_extended & GIT_IDXENTRY_SKIP_WORKTREE) {
+			/* the entries before were all in */
+			if (!entries) {
+				entries = xmalloc(index->nr * sizeof(*entries));
+				for (unsigned int n = 0; n < i; n++)
+					entries[n] = n;
+			}
+			continue;
+		}
+		if (entries)
+			entries[*nr] = i;
+		(*nr)++;
+	}
+
+	return entries;
+}
+
+/* get the number of workers from -j<n>, --jobs=<n> or the environment */
+static int parse_workers(const char *value)
+{
+	unsigned int workers;
+
+	if (strtoul_ui(value, 10, &workers) < 0)
+		please_git_do_it_for_me(FALLBACK_SETTING);
+
+	/* 0 means one worker per processor */
+	return workers ? (int)workers : online_cpus();
+}
+
 int cmd_checkout_index(int argc, const char **argv)
 {
+	int force = 0, all = 0;
+	int workers = 1;
+	const char *workers_env = getenv(GIT2_CHECKOUT_WORKERS_ENVIRONMENT);
+	const char *order_env = getenv(GIT2_CHECKOUT_ORDER_ENVIRONMENT);
+	const char *uring_env = getenv(GIT2_CHECKOUT_URING_ENVIRONMENT);
+
+	if (workers_env && *workers_env)
+		workers = parse_workers(workers_env);
+
 	/* options parsing */
-	if (argc != 3)
-		please_git_do_it_for_me();
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-f"))
+			force = 1;
+		else if (!strcmp(argv[i], "-a"))
+			all = 1;
+		else if (!prefixcmp(argv[i], "-j") && argv[i][2])
+			workers = parse_workers(argv[i] + 2);
+		else if (!prefixcmp(argv[i], "--jobs="))
+			workers = parse_workers(argv[i] + 7);
+		else
+			please_git_do_it_for_option(argv[i]);
+	}
 
-	
-	if (!(strcmp(argv[1], "-f") == 0 && strcmp(argv[2], "-a") == 0))
-		please_git_do_it_for_me();
+	if (!force || !all)
+		please_git_do_it_for_me(FALLBACK_OPTION);
 
 
 	git_repository *repo = get_git_repository();
 	
-	git_index *index_cur;
-	int e = git_repository_index(&index_cur, repo);
-	if (e) libgit_error();
+	/* The index is only read : decode its entries from the file as needed */
+	const struct index_map *index = get_git_sparse_index_map();
 
-	
-	char *buf = (char*)xmalloc(GIT_OID_HEXSZ+1);
-	
-// 	const char *prefix = get_git_prefix();
-// 	size_t prefix_len = strlen(prefix);
-	
-	for (unsigned i = 0; i < git_index_entrycount(index_cur); i++) {
-		git_index_entry *gie = git_index_get(index_cur, i);
-// 		printf("%06o\t%s\n", gie->mode, gie->path);
-		git_odb_object * obj;
-		e = git_odb_read(&obj, git_repository_database(repo), &gie->oid);
-		if(e != GIT_SUCCESS)
-			libgit_error();
-		//TODO:tester le type et lancer le bon cretae_force_* en fonction...
-		switch (gie->mode >>12 ) {
-			case 0xA:
-				create_force_symlinks(gie->path, (char *)git_odb_object_data(obj));
-				break;
-			case 0x8:
-				create_force_file(gie->path, gie->mode, git_odb_object_data(obj), git_odb_object_size(obj));
-				break;
-			default:
-				printf("Don't know this kind of file : %06o\t%s\n", gie->mode, gie->path);
-		}
-		
-		
+	unsigned int entrycount;
+	unsigned int *entries = worktree_entries(index, &entrycount);
+
+	if (entrycount < PARALLEL_CHECKOUT_THRESHOLD)
+		workers = 1;
+
+	struct checkout_job job;
+	session_init(&job.session);
+	job.index = index;
+	job.trust_filemode = get_git_config_bool(repo, "core.filemode", 1);
+	job.repository_path = git_repository_path(repo, GIT_REPO_PATH);
+	job.repositories = xcalloc(workers, sizeof(git_repository *));
+	job.skipped = xcalloc(workers, sizeof(unsigned int));
+	job.use_uring = uring_env && *uring_env && strcmp(uring_env, "0");
+	job.batches = xcalloc(workers, sizeof(struct file_batch *));
+	job.order = entries;
+	if (order_env && !strcmp(order_env, "pack"))
+		job.order = pack_order(repo, index, entries, entrycount);
+
+	struct parallel_job parallel = {
+		entrycount, 0,
+		checkout_worker_init, checkout_worker_process, checkout_worker_release,
+		&job
+	};
+
+	if (workers > 1)
+		create_leading_directories(&job.session, index, entries, entrycount);
+
+	run_parallel(&parallel, workers);
+
+	if (getenv(GIT2_CHECKOUT_STATS_ENVIRONMENT)) {
+		unsigned int skipped = 0;
+
+		for (int i = 0; i < workers; i++)
+			skipped += job.skipped[i];
+
+		fprintf(stderr, "checkout-index: %u files written, %u up to date\n", entrycount - skipped, skipped);
 	}
 
-	
-	free(buf);
-	git_index_free(index_cur);
+	session_release(&job.session);
+	free(job.repositories);
+	free(job.skipped);
+	free(job.batches);
+	if (job.order != entries)
+		free(job.order);
+	free(entries);
 	
 	return EXIT_SUCCESS;
 }
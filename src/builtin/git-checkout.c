@@ -5,15 +5,16 @@
 #include "errors.h"
 #include "git-checkout.h"
 #include "git-support.h"
+#include "repository.h"
 
 
 int cmd_checkout(int argc, const char **argv) 
 {
 	/* Delete the following line once gits tests pass */
-	please_git_do_it_for_me();
+	please_git_do_it_for_me(FALLBACK_NOT_ENABLED);
 
 	if (argc != 1)
-		please_git_do_it_for_me();
+		please_git_do_it_for_me(FALLBACK_USAGE);
 	
 	git_index *index;
 	git_repository *repo;
@@ -26,7 +27,7 @@ int cmd_checkout(int argc, const char **argv)
 	}
 
 	/* Get the Index file of a Git repository */
-	if (git_repository_index(&index,repo)) {
+	if (get_git_repository_index(&index,repo)) {
 		libgit_error();
 	}
 	
@@ -7,9 +7,16 @@
 #include "git-commit-tree.h"
 #include "git-support.h"
 #include "repository.h"
-#include "date.h"
+#include "ident.h"
 #include "strbuf.h"
-#include "environment.h"
+#include "output.h"
+#include "hex.h"
+#include "revision.h"
+#include "pack-writer.h"
+#include "date.h"
+#include "utils.h"
+#include "fsync.h"
+#include "run-command.h"
 
 git_signature *author_signature = NULL;
 git_signature *committer_signature = NULL;
@@ -35,14 +42,255 @@ static void cleanup() {
 	}
 }
 
+/* Fill oid with the object named by arg, falls back to git for what we cannot resolve */
+static void resolve_object(git_oid *oid, git_repository *repo, const char *arg)
+{
+	int e = resolve_revision(oid, repo, arg);
+
+	if (e == GIT_EAMBIGUOUSOIDPREFIX) {
+		cleanup();
+		error("%s is an ambiguous prefix", arg);
+	} else if (e != GIT_SUCCESS) {
+		/* Not found, or named in a way we do not know */
+		please_git_do_it_for_me(FALLBACK_REVISION);
+	}
+}
+
+/*
+ * commit-tree --import (git2 only) : create the commits described on
+ * stdin, in a new pack, and print their oids in order once it is in
+ * place. Each commit is
+ *
+ *   commit
+ *   tree <tree-ish>
+ *   parent <commit>                  (any number of them)
+ *   author <name> <<email>> <date>   (optional)
+ *   committer <name> <<email>> <date> (optional)
+ *   data <length>
+ *   <message of length bytes>
+ *
+ * A parent ":<n>" is the nth commit of the stream. Such parents, and
+ * those given by the oid of a commit of the stream, come from memory :
+ * the odb does not know them before the end. Missing identities are
+ * those of a plain commit-tree, computed once for the whole import.
+ * The names git2 does not resolve are asked to a single "git cat-file
+ * --batch-check", started for the first of them.
+ */
+struct import {
+	git_repository *repo;
+	struct pack_writer *writer;
+	git_oid *commits;
+	unsigned int nr, alloc;
+	struct strbuf author, committer; /* the defaults */
+	struct child_process resolver; /* its pid is 0 until it is started */
+	FILE *answers; /* its standard output */
+};
+
+static void add_ident(struct strbuf *out, const char *name, const char *email, unsigned long timestamp, int offset)
+{
+	int minutes = offset < 0 ? -offset : offset;
+
+	strbuf_addf(out, "%s <%s> %lu %c%02d%02d", name, email, timestamp,
+		    offset < 0 ? '-' : '+', minutes / 60, minutes % 60);
+}
+
+static void default_ident(struct strbuf *out, git_repository *repo, enum ident_role role)
+{
+	const char *name, *email;
+	unsigned long timestamp;
+	int offset;
+
+	if (get_ident(&name, &email, repo, role))
+		die("unable to find the %s identity : set user.name and user.email",
+		    role == IDENT_AUTHOR ? "author" : "committer");
+	if (get_ident_date(&timestamp, &offset, role))
+		die("invalid date format in the environment");
+
+	add_ident(out, name, email, timestamp, offset);
+}
+
+/* "name <email> date" : the date is written as git does, in seconds and offset */
+static void parse_ident(struct strbuf *out, const char *line)
+{
+	const char *lt = strchr(line, '<');
+	const char *gt = lt ? strchr(lt, '>') : NULL;
+	unsigned long timestamp;
+	int offset;
+
+	if (!gt || gt[1] != ' ' || parse_date_basic(gt + 2, &timestamp, &offset))
+		die("invalid identity: %s", line);
+
+	int minutes = offset < 0 ? -offset : offset;
+	strbuf_add(out, line, gt + 1 - line);
+	strbuf_addf(out, " %lu %c%02d%02d", timestamp, offset < 0 ? '-' : '+', minutes / 60, minutes % 60);
+}
+
+/* Ask git cat-file for the oid of name^{type_name} */
+static int import_resolve_with_git(git_oid *oid, struct import *import, const char *name, const char *type_name)
+{
+	static const char *argv[] = {"git", "cat-file", "--batch-check", NULL};
+	struct strbuf line = STRBUF_INIT;
+	int e = GIT_ENOTFOUND;
+
+	if (!import->resolver.pid) {
+		import->resolver.argv = argv;
+		import->resolver.in = -1;
+		import->resolver.out = -1;
+		if (start_command(&import->resolver) < 0 || !(import->answers = fdopen(import->resolver.out, "r")))
+			die_errno("Failed to run git cat-file");
+	}
+
+	strbuf_addf(&line, "%s^{%s}\n", name, type_name);
+	if (write_in_full(import->resolver.in, line.buf, line.len) < 0)
+		die_errno("Failed to write to git cat-file");
+	if (strbuf_getline(&line, import->answers, '\n') == EOF)
+		die("git cat-file stopped answering");
+
+	/* "<oid> <type> <size>", or "<name> missing" (or "ambiguous") */
+	if (line.len > GIT_OID_HEXSZ && line.buf[GIT_OID_HEXSZ] == ' ' &&
+	    git_oid_fromstrn(oid, line.buf, GIT_OID_HEXSZ) == GIT_SUCCESS)
+		e = GIT_SUCCESS;
+
+	strbuf_release(&line);
+	return e;
+}
+
+static void import_resolve(git_oid *oid, struct import *import, const char *name, git_otype type)
+{
+	const char *type_name = git_object_type2string(type);
+	int e;
+
+	if (type == GIT_OBJ_COMMIT) {
+		if (*name == ':') {
+			char *end;
+			unsigned long n = strtoul(name + 1, &end, 10);
+
+			if (!n || *end || n > import->nr)
+				die("invalid mark %s", name);
+			git_oid_cpy(oid, &import->commits[n - 1]);
+			return;
+		}
+		if (strlen(name) == GIT_OID_HEXSZ && git_oid_fromstr(oid, name) == GIT_SUCCESS &&
+		    pack_writer_has(import->writer, oid))
+			return;
+	}
+
+	e = resolve_revision_type(oid, import->repo, name, type);
+	if (e == GIT_ENOTIMPLEMENTED)
+		e = import_resolve_with_git(oid, import, name, type_name);
+
+	if (e == GIT_EINVALIDTYPE)
+		die("%s is not a valid '%s' object", name, type_name);
+	else if (e != GIT_SUCCESS)
+		die("Not a valid object name %s", name);
+}
+
+/* Read one commit description, and add the commit to the pack. Returns 0 at the end of the stream */
+static int import_commit(struct import *import, struct strbuf *line, struct strbuf *commit)
+{
+	struct strbuf author = STRBUF_INIT, committer = STRBUF_INIT;
+	int has_tree = 0;
+	git_oid oid;
+
+	do {
+		if (strbuf_getline(line, stdin, '\n') == EOF)
+			return 0;
+	} while (!line->len);
+
+	if (strcmp(line->buf, "commit"))
+		die("expected a commit: %s", line->buf);
+
+	strbuf_reset(commit);
+	for (;;) {
+		char hex[GIT_OID_HEXSZ];
+
+		if (strbuf_getline(line, stdin, '\n') == EOF)
+			die("unexpected end of the stream");
+
+		if (!prefixcmp(line->buf, "tree ") && !has_tree) {
+			import_resolve(&oid, import, line->buf + strlen("tree "), GIT_OBJ_TREE);
+			strbuf_addstr(commit, "tree ");
+			strbuf_add(commit, hex, oid_to_hex(hex, &oid) - hex);
+			strbuf_addch(commit, '\n');
+			has_tree = 1;
+		} else if (!prefixcmp(line->buf, "parent ") && has_tree && !author.len && !committer.len) {
+			import_resolve(&oid, import, line->buf + strlen("parent "), GIT_OBJ_COMMIT);
+			strbuf_addstr(commit, "parent ");
+			strbuf_add(commit, hex, oid_to_hex(hex, &oid) - hex);
+			strbuf_addch(commit, '\n');
+		} else if (!prefixcmp(line->buf, "author ") && !author.len) {
+			parse_ident(&author, line->buf + strlen("author "));
+		} else if (!prefixcmp(line->buf, "committer ") && !committer.len) {
+			parse_ident(&committer, line->buf + strlen("committer "));
+		} else if (!prefixcmp(line->buf, "data ") && has_tree) {
+			break;
+		} else {
+			die("unexpected line in a commit: %s", line->buf);
+		}
+	}
+
+	strbuf_addf(commit, "author %s\ncommitter %s\n\n",
+		    author.len ? author.buf : import->author.buf,
+		    committer.len ? committer.buf : import->committer.buf);
+	strbuf_release(&author);
+	strbuf_release(&committer);
+
+	char *end;
+	unsigned long len = strtoul(line->buf + strlen("data "), &end, 10);
+	if (*end || end == line->buf + strlen("data "))
+		die("invalid data length: %s", line->buf);
+	if (strbuf_fread(commit, len, stdin) != len)
+		die("unexpected end of the stream");
+
+	if (git_odb_hash(&oid, commit->buf, commit->len, GIT_OBJ_COMMIT) != GIT_SUCCESS)
+		libgit_error();
+	pack_writer_add(import->writer, &oid, GIT_OBJ_COMMIT, commit->buf, commit->len);
+
+	ALLOC_GROW(import->commits, import->nr + 1, import->alloc);
+	git_oid_cpy(&import->commits[import->nr++], &oid);
+	return 1;
+}
+
+static int import_commits()
+{
+	struct import import = {NULL, NULL, NULL, 0, 0, STRBUF_INIT, STRBUF_INIT, {NULL}, NULL};
+	struct strbuf line = STRBUF_INIT, commit = STRBUF_INIT;
+	struct output *out = get_stdout_output();
+
+	import.repo = get_git_repository();
+	default_ident(&import.author, import.repo, IDENT_AUTHOR);
+	default_ident(&import.committer, import.repo, IDENT_COMMITTER);
+	import.writer = pack_writer_start(import.repo);
+
+	while (import_commit(&import, &line, &commit))
+		;
+	if (import.resolver.pid) {
+		close(import.resolver.in);
+		fclose(import.answers);
+		finish_command(&import.resolver);
+	}
+	pack_writer_finish(import.writer);
+
+	for (unsigned int i = 0; i < import.nr; i++) {
+		output_add_oid(out, &import.commits[i]);
+		output_addch(out, '\n');
+		output_end_record(out);
+	}
+
+	free(import.commits);
+	strbuf_release(&import.author);
+	strbuf_release(&import.committer);
+	strbuf_release(&line);
+	strbuf_release(&commit);
+	return EXIT_SUCCESS;
+}
+
 int cmd_commit_tree(int argc, const char **argv)
 {
-	char *author_name = NULL;
-	char *author_email = NULL;
-	char *author_date = NULL;
-	char *committer_name = NULL;
-	char *committer_email = NULL;
-	char *committer_date = NULL;
+	const char *author_name = NULL;
+	const char *author_email = NULL;
+	const char *committer_name = NULL;
+	const char *committer_email = NULL;
 	unsigned long author_timestamp;
 	int author_offset;
 	unsigned long committer_timestamp;
@@ -50,138 +298,83 @@ int cmd_commit_tree(int argc, const char **argv)
 	int e;
 	git_repository *repo = NULL;
 	git_oid tree_oid;
-	char commit_oid_string[GIT_OID_HEXSZ+1];
 	char tree_oid_string[GIT_OID_HEXSZ+1];
 	git_oid commit_oid;
-	size_t len;
 	int i;
 
+	if (argc == 2 && !strcmp(argv[1], "--import"))
+		return import_commits();
+
 	if (argc < 2 || !strcmp(argv[1], "-h")) {
 		/* Show usage */
-		please_git_do_it_for_me();
+		please_git_do_it_for_me(FALLBACK_USAGE);
 	}
 
 	if (argc > 2 && argc%2 != 0) {
 		/* If parents are specified they are preceded by '-p'
 		 * => even number of arguments */
-		please_git_do_it_for_me();
+		please_git_do_it_for_me(FALLBACK_USAGE);
 	}
 
-	author_name = getenv(GIT_AUTHOR_NAME_ENVIRONMENT);
-	author_email = getenv(GIT_AUTHOR_EMAIL_ENVIRONMENT);
-	author_date = getenv(GIT_AUTHOR_DATE_ENVIRONMENT);
-	committer_name = getenv(GIT_COMMITTER_NAME_ENVIRONMENT);
-	committer_email = getenv(GIT_COMMITTER_EMAIL_ENVIRONMENT);
-	committer_date = getenv(GIT_COMMITTER_DATE_ENVIRONMENT);
-	
-	if (!author_name || !author_email || !author_date ||
-		!committer_name || !committer_email || !committer_date) {
-		/* Read from config file. Ask git for help for now */
-		please_git_do_it_for_me();
+	/* Parents are preceded by '-p' : know it before any repository work */
+	parent_count = argc / 2 - 1;
+	for (i = 2; i < argc; i += 2) {
+		if (strcmp(argv[i], "-p")) {
+			/* Bad use : show usage */
+			please_git_do_it_for_me(FALLBACK_USAGE);
+		}
 	}
 
-	e = parse_date_basic(author_date, &author_timestamp, &author_offset);
-	if (e) {
-		/* Bad date format. Git will apparently use system time */
-		please_git_do_it_for_me();
-	}
+	/* Dates default to now : only formats we do not parse need git */
+	if (get_ident_date(&author_timestamp, &author_offset, IDENT_AUTHOR) ||
+	    get_ident_date(&committer_timestamp, &committer_offset, IDENT_COMMITTER))
+		please_git_do_it_for_me(FALLBACK_SETTING);
 
-	e = parse_date_basic(committer_date, &committer_timestamp, &committer_offset);
-	if (e) {
-		please_git_do_it_for_me();
-	}
+	repo = get_git_repository();
 
-	/* Supported object specifications are full or short oid */
-	/* Create the partial oid (filled with '0's) from the given argument */
-	len = strlen(argv[1]);
-	if (len > GIT_OID_HEXSZ) {
-		/* It's not a sha1 */
-		please_git_do_it_for_me();
-	}
-	memcpy(tree_oid_string, argv[1], len * sizeof(char));
-	memset(tree_oid_string + len, '0', (GIT_OID_HEXSZ - len) * sizeof(char));
-	tree_oid_string[GIT_OID_HEXSZ] = '\0';
-	e = git_oid_fromstr(&tree_oid, tree_oid_string);
-	if (e) {
-		/* Not an OID. The object can be specified in a lot
-		 * of different ways (not supported by libgit2 yet).
-		 * Fall back to git.
-		 */
-		please_git_do_it_for_me();
-	}
+	/* Without user.name or user.email, git makes them up from the system */
+	if (get_ident(&author_name, &author_email, repo, IDENT_AUTHOR) ||
+	    get_ident(&committer_name, &committer_email, repo, IDENT_COMMITTER))
+		please_git_do_it_for_me(FALLBACK_SETTING);
 
-	repo = get_git_repository();
 	/* Lookup the tree object */
-	e = git_object_lookup_prefix((git_object **)&tree, repo, &tree_oid, len, GIT_OBJ_ANY);
+	resolve_object(&tree_oid, repo, argv[1]);
+	e = git_object_lookup((git_object **)&tree, repo, &tree_oid, GIT_OBJ_ANY);
 	if (e != GIT_SUCCESS) {
-		if (e == GIT_ENOTFOUND) {
-			/* Maybe the given argument is not a sha1
-			 * but a tag name (which looks like a sha1)
-			 * Fall back to git.
-			 */
-			 please_git_do_it_for_me();
-		} else if (e == GIT_EAMBIGUOUSOIDPREFIX) {
-			error("%s is an ambiguous prefix", argv[1]);
-		} else {
-			libgit_error();
-		}
+		if (e == GIT_ENOTFOUND)
+			please_git_do_it_for_me(FALLBACK_ERROR);
+		libgit_error();
 	}
 	if (git_object_type((git_object *)tree) != GIT_OBJ_TREE) {
-		if (len < GIT_OID_HEXSZ) {
-			/* Get the full oid, in case the given argument was a short oid */
-			git_oid_fmt(tree_oid_string, git_tree_id(tree));
-		}
+		oid_to_hex(tree_oid_string, &tree_oid);
+		tree_oid_string[GIT_OID_HEXSZ] = '\0';
 
 		cleanup();
 		error("%s is not a valid 'tree' object", tree_oid_string);
 	}
 
 	/* Get parent commits */
-	parent_count = argc / 2 - 1;
 	parents = (git_commit **)malloc(parent_count * sizeof(git_commit *));
 	for (i = 0; i < parent_count; ++i)
 		parents[i] = NULL;
 
 	for (i = 2; i < argc; i += 2) {
 		char parent_oid_string[GIT_OID_HEXSZ+1];
-		git_oid parent_oid;
 		git_commit **parent_commit;
+		git_oid parent_oid;
 
-		if (strcmp(argv[i], "-p")) {
-			/* Bad use : show usage */
-			please_git_do_it_for_me();
-		}
-
-		len = strlen(argv[i+1]);
-		if (len > GIT_OID_HEXSZ) {
-			/* It's not a sha1 */
-			please_git_do_it_for_me();
-		}
-		memcpy(parent_oid_string, argv[i+1], len * sizeof(char));
-		memset(parent_oid_string + len, '0', (GIT_OID_HEXSZ - len) * sizeof(char));
-		parent_oid_string[GIT_OID_HEXSZ] = '\0';
-		e = git_oid_fromstr(&parent_oid, parent_oid_string);
-		if (e) {
-			/* Not an oid. Maybe parent is specified in another way */
-			please_git_do_it_for_me();
-		}
 		parent_commit = &parents[i/2 - 1];
-		e = git_object_lookup_prefix((git_object **)parent_commit, repo, &parent_oid, len, GIT_OBJ_ANY);
+		resolve_object(&parent_oid, repo, argv[i+1]);
+		e = git_object_lookup((git_object **)parent_commit, repo, &parent_oid, GIT_OBJ_ANY);
 		if (e != GIT_SUCCESS) {
-			if (e == GIT_ENOTFOUND) {
-				 please_git_do_it_for_me();
-			} else if (e == GIT_EAMBIGUOUSOIDPREFIX) {
-				error("%s is an ambiguous prefix", argv[i+1]);
-			} else {
-				cleanup();
-				libgit_error();
-			}
+			if (e == GIT_ENOTFOUND)
+				please_git_do_it_for_me(FALLBACK_ERROR);
+			cleanup();
+			libgit_error();
 		}
 		if (git_object_type((git_object *)*parent_commit) != GIT_OBJ_COMMIT) {
-			if (len < GIT_OID_HEXSZ) {
-				/* Get the full oid, in case the given argument was a short oid */
-				git_oid_fmt(parent_oid_string, git_commit_id(*parent_commit));
-			}
+			oid_to_hex(parent_oid_string, &parent_oid);
+			parent_oid_string[GIT_OID_HEXSZ] = '\0';
 
 			cleanup();
 			error("%s is not a valid 'commit' object", parent_oid_string);
@@ -211,11 +404,13 @@ int cmd_commit_tree(int argc, const char **argv)
 		cleanup();
 		libgit_error();
 	}
+	fsync_loose_object(repo, &commit_oid);
 
 	/* Print to stdout */
-	git_oid_fmt(commit_oid_string, &commit_oid);
-	commit_oid_string[GIT_OID_HEXSZ] = '\0';
-	printf("%s\n", commit_oid_string);
+	struct output *out = get_stdout_output();
+	output_add_oid(out, &commit_oid);
+	output_addch(out, '\n');
+	output_end_record(out);
 	
 	cleanup();
 
@@ -33,7 +33,7 @@ int cmd_init(int argc, const char **argv){
 	 * config files or shared repository.
 	 * Other than that, it works fine.
 	 */
-	please_git_do_it_for_me();
+	please_git_do_it_for_me(FALLBACK_NOT_ENABLED);
 
 	char cwd[PATH_MAX];
 	const char *real_git_dir = NULL;
@@ -68,24 +68,24 @@ int cmd_init(int argc, const char **argv){
 
 	if (argc > 1) {
 		/* invalid use : show usage */
-		please_git_do_it_for_me();
+		please_git_do_it_for_me(FALLBACK_USAGE);
 	}
 
 	if (template_dir) {
 		/* Unimplemented : cannot specify a template directory yet */
-		please_git_do_it_for_me();
+		please_git_do_it_for_option("--template");
 	} else if (init_shared_repository != -1) {
 		/* Unimplemented : cannot create a shared repository yet */
-		please_git_do_it_for_me();
+		please_git_do_it_for_option("--shared");
 	} else if (real_git_dir) {
 		/* Unimplemented : cannot create separate git dir yet */
-		please_git_do_it_for_me();
+		please_git_do_it_for_option("--separate-git-dir");
 	}
 
 	if (getenv(GIT_OBJECT_DIR_ENVIRONMENT)) {
-		please_git_do_it_for_me();
+		please_git_do_it_for_me(FALLBACK_SETTING);
 	} else if (getenv(GIT_TEMPLATE_DIR_ENVIRONMENT)) {
-		please_git_do_it_for_me();
+		please_git_do_it_for_me(FALLBACK_SETTING);
 	}
 
 	git_config *cfg;
@@ -95,7 +95,7 @@ int cmd_init(int argc, const char **argv){
 		/* libgit2 does not handle template dirs for now */
 		e = git_config_get_string(cfg, "init.templatedir", &init_template_dir);
 		if (e == GIT_SUCCESS && init_template_dir != NULL) {
-			please_git_do_it_for_me();
+			please_git_do_it_for_me(FALLBACK_SETTING);
 		}
 
 		git_config_free(cfg);
@@ -114,7 +114,7 @@ int cmd_init(int argc, const char **argv){
 		git2_chdir(cwd);
 	} else if (argc > 1) {
 		/* show usage */
-		please_git_do_it_for_me();
+		please_git_do_it_for_me(FALLBACK_USAGE);
 	}
 
 	git_repository *repo;
@@ -129,7 +129,7 @@ int cmd_init(int argc, const char **argv){
 
 	if (e == GIT_ENOTIMPLEMENTED) {
 		/* Will happen when trying to reinitialize a repo */
-		please_git_do_it_for_me();
+		please_git_do_it_for_me(FALLBACK_REPOSITORY);
 	} else if (e) {
 		libgit_error();
 	}
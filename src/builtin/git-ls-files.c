@@ -9,6 +9,14 @@
 #include "git-parse-mode.h"
 #include "strbuf.h"
 #include "quote.h"
+#include "output.h"
+#include "index-map.h"
+#include "environment.h"
+#include "thread-pool.h"
+#include "abspath.h"
+#include "untracked.h"
+#include "pathspec.h"
+#include "fileops.h"
 
 /*
  * => see http://www.kernel.org/pub/software/scm/git/docs/git-ls-files.html
@@ -16,54 +24,475 @@
  * Works :
  * nothing, there's an inner bug in libgit2
  * git ls-files --stage
+ * git ls-files -o / --others [--exclude-standard]
+ * git ls-files -m / --modified
  * 
  */
 
-int cmd_ls_files(int argc, const char **argv)
+/* Below this number of entries, -m stats them on one thread */
+#define LS_FILES_PARALLEL_MIN 64
+
+#define UNTRACKED_CACHE_FILE "git2-untracked-cache"
+
+/* A slice [begin, end) of the index entries */
+struct index_range {
+	unsigned int begin, end;
+};
+
+/* The slice of the entries whose path starts with the len first bytes of path */
+static struct index_range index_prefix_range(const struct index_map *index, const char *path, size_t len)
 {
-	/* Delete the following line once git tests pass */
-	please_git_do_it_for_me();
+	struct index_range range;
 
-	int show_cached = 1;
+	range.begin = index_map_lower_bound(index, path, len);
+	range.end = index_map_prefix_end(index, range.begin, path, len);
 
-	/* options parsing */
-	if (argc > 1) {
-		if (argc > 2)
-			please_git_do_it_for_me();
-
-		if (strcmp(argv[1], "--stage") == 0 || strcmp(argv[1], "-s") == 0)
-			show_cached = 0;
-		else if (strcmp(argv[1], "--cached") == 0 || strcmp(argv[1], "-c") == 0)
-			show_cached = 1;
-		else
-			please_git_do_it_for_me();
+	return range;
+}
+
+/* As git, "sub/" names the submodule sub, not what would be below it */
+static void strip_submodule_slashes(struct pathspec *pathspec, const struct index_map *index)
+{
+	for (unsigned int i = 0; i < pathspec->nr; i++) {
+		struct pathspec_item *item = &pathspec->items[i];
+		git_index_entry entry;
+		unsigned int pos;
+
+		if (item->literal_len != item->len || item->match[item->len - 1] != '/')
+			continue;
+		pos = index_map_lower_bound(index, item->match, item->len - 1);
+		if (pos >= index->nr)
+			continue;
+		index_map_entry(index, pos, &entry);
+		if ((entry.mode & S_IFMT) == S_IFGITLINK && strlen(entry.path) == item->len - 1 &&
+		    !memcmp(entry.path, item->match, item->len - 1))
+			item->len = item->literal_len = item->len - 1;
+	}
+}
+
+static int range_cmp(const void *a, const void *b)
+{
+	const struct index_range *ra = a, *rb = b;
+
+	if (ra->begin != rb->begin)
+		return ra->begin < rb->begin ? -1 : 1;
+	return 0;
+}
+
+/* get the number of workers from the environment, one per processor by default */
+static unsigned int ls_files_workers(void)
+{
+	const char *value = getenv(GIT2_LS_FILES_WORKERS_ENVIRONMENT);
+	unsigned int workers;
+
+	if (!value || !*value)
+		return (unsigned int)online_cpus();
+	if (strtoul_ui(value, 10, &workers) < 0)
+		please_git_do_it_for_me(FALLBACK_SETTING);
+	return workers ? workers : (unsigned int)online_cpus();
+}
+
+/* What of the configuration changes what -o and -m find */
+struct worktree_config {
+	int ignore_case;
+	int trust_filemode;
+	char *excludes_file; /* NULL if there is none */
+	char *fsmonitor_hook; /* core.fsmonitor, when it is a hook : NULL otherwise */
+};
+
+/* "~/" is the home directory, as git expands core.excludesFile */
+static char *expand_home(const char *path)
+{
+	struct strbuf expanded = STRBUF_INIT;
+	const char *home = getenv("HOME");
+
+	if (strncmp(path, "~/", 2))
+		return xstrdup(path);
+	if (!home)
+		return NULL;
+	strbuf_addstr(&expanded, home);
+	strbuf_addstr(&expanded, path + 1);
+	return strbuf_detach(&expanded, NULL);
+}
+
+/* core.quotepath, for the names output_add_name_quoted() quotes : none is with -z */
+static void read_quote_path_config(git_repository *repo, int terminator)
+{
+	if (terminator)
+		quote_path_fully = get_git_config_bool(repo, "core.quotepath", 1);
+}
+
+static void read_worktree_config(struct worktree_config *config, git_repository *repo)
+{
+	git_config *cfg = get_git_config(repo);
+	const char *value;
+
+	config->ignore_case = 0;
+	config->trust_filemode = 1;
+	config->excludes_file = NULL;
+	config->fsmonitor_hook = NULL;
+
+	git_config_get_bool(cfg, "core.ignorecase", &config->ignore_case);
+	git_config_get_bool(cfg, "core.filemode", &config->trust_filemode);
+	if (git_config_get_string(cfg, "core.excludesfile", &value) == GIT_SUCCESS && value)
+		config->excludes_file = expand_home(value);
+	/* a boolean asks for the fsmonitor daemon of git, which git2 does not talk to */
+	if (git_config_get_string(cfg, "core.fsmonitor", &value) == GIT_SUCCESS && value && *value &&
+	    strcasecmp(value, "true") && strcasecmp(value, "false") && strcasecmp(value, "yes") &&
+	    strcasecmp(value, "no") && strcasecmp(value, "on") && strcasecmp(value, "off") &&
+	    strcmp(value, "1") && strcmp(value, "0"))
+		config->fsmonitor_hook = expand_home(value);
+	git_config_free(cfg);
+
+	if (!config->excludes_file) {
+		struct strbuf path = STRBUF_INIT;
+		const char *xdg = getenv("XDG_CONFIG_HOME");
+
+		if (xdg && *xdg) {
+			strbuf_addf(&path, "%s/git/ignore", xdg);
+		} else if (getenv("HOME")) {
+			strbuf_addf(&path, "%s/.config/git/ignore", getenv("HOME"));
+		}
+		if (path.len)
+			config->excludes_file = strbuf_detach(&path, NULL);
+		strbuf_release(&path);
 	}
+}
 
+struct modified_job {
+	const struct index_map *index;
+	const struct pathspec *pathspec;
+	const char *work_tree; /* with a trailing '/' */
+	unsigned int begin;
+	int trust_filemode;
+	unsigned char *modified; /* of each entry from begin */
+};
 
+/* Whether the file of the entry differs from it, as "git ls-files -m" tells */
+static int entry_modified(const struct modified_job *job, const git_index_entry *entry, const char *path)
+{
+	struct stat st;
+
+	if (lstat(path, &st))
+		return 1;
+	if (entry->flags & GIT_IDXENTRY_VALID)
+		return 0;
+	if (entry->flags_extended & INDEX_ENTRY_INTENT_TO_ADD)
+		return 1;
+
+	if (index_entry_matches_stat(entry, path, &st, job->trust_filemode)) {
+		/* racily clean : only the contents can tell */
+		return entry->mtime.seconds >= (git_time_t)job->index->mtime &&
+			!index_entry_matches_file(entry, path, &st);
+	}
+
+	if (S_ISLNK(entry->mode) ? !S_ISLNK(st.st_mode) : !S_ISREG(st.st_mode))
+		return 1;
+	if (job->trust_filemode && S_ISREG(entry->mode) && ((entry->mode ^ st.st_mode) & S_IXUSR))
+		return 1;
+	/* a size of 0 is what git records to force a comparison */
+	if (entry->file_size && (uint32_t)entry->file_size != (uint32_t)st.st_size)
+		return 1;
+	return !index_entry_matches_file(entry, path, &st);
+}
+
+static void modified_worker_process(void *context, unsigned int worker, unsigned int n)
+{
+	struct modified_job *job = context;
+	struct strbuf path = STRBUF_INIT;
+	git_index_entry entry;
+
+	(void)worker; /* hashing needs no repository */
+	index_map_entry(job->index, job->begin + n, &entry);
+	/* sparse entries are not in the work tree */
+	if ((entry.flags_extended & INDEX_ENTRY_SKIP_WORKTREE) ||
+	    !pathspec_match(job->pathspec, entry.path, strlen(entry.path))) {
+		job->modified[n] = 0;
+		return;
+	}
+
+	strbuf_addstr(&path, job->work_tree);
+	strbuf_addstr(&path, entry.path);
+	job->modified[n] = entry_modified(job, &entry, path.buf);
+	strbuf_release(&path);
+}
+
+/* Whether a directory between the prefix and the top of the pathspecs is another repository */
+static int in_nested_repository(struct strbuf *work_tree, const char *prefix, const struct pathspec *pathspec)
+{
+	size_t len = work_tree->len;
+	int nested = 0;
+	struct stat st;
+
+	for (const char *slash = pathspec->common + strlen(prefix); !nested && (slash = strchr(slash, '/')); slash++) {
+		strbuf_setlen(work_tree, len);
+		strbuf_add(work_tree, pathspec->common, slash + 1 - pathspec->common);
+		strbuf_addstr(work_tree, ".git");
+		nested = !lstat(work_tree->buf, &st);
+	}
+	strbuf_setlen(work_tree, len);
+	return nested;
+}
+
+/*
+ * "ls-files -o" and "-m" : the untracked files first, then the tracked
+ * ones which differ from the index, below the prefix and matching the
+ * pathspecs. Only the directories below what all the pathspecs share are
+ * read
+ */
+static int ls_files_worktree(int others, int modified, int exclude_standard, int terminator,
+	const char **specs, unsigned int nr_specs)
+{
+	struct pathspec pathspec = PATHSPEC_INIT;
 	git_repository *repo = get_git_repository();
+	const char *work_tree_path = getenv(GIT_WORK_TREE_ENVIRONMENT);
+	struct output *out = get_stdout_output();
+	unsigned int workers = ls_files_workers();
+	struct worktree_config config;
+	struct strbuf work_tree = STRBUF_INIT;
 
-	git_index *index_cur;
-	int e = git_repository_index(&index_cur, repo);
-	if (e) libgit_error();
+	if (!work_tree_path)
+		work_tree_path = git_repository_path(repo, GIT_REPO_PATH_WORKDIR);
+	if (!work_tree_path)
+		please_git_do_it_for_me(FALLBACK_WORK_TREE);
 
-	char buf[GIT_OID_HEXSZ+1];
+	read_worktree_config(&config, repo);
+	read_quote_path_config(repo, terminator);
+	/* git folds the case of the names : leave it to git */
+	if (config.ignore_case)
+		please_git_do_it_for_me(FALLBACK_SETTING);
 
+	strbuf_addstr(&work_tree, real_path(work_tree_path));
+	if (work_tree.len && work_tree.buf[work_tree.len - 1] != '/')
+		strbuf_addch(&work_tree, '/');
+
+	const struct index_map *index = get_git_index_map();
 	const char *prefix = get_git_prefix();
 	size_t prefix_len = strlen(prefix);
 
-	for (unsigned i = 0; i < git_index_entrycount(index_cur); i++) {
-		git_index_entry *gie = git_index_get(index_cur, i);
+	if (pathspec_parse(&pathspec, prefix, specs, nr_specs) < 0 ||
+	    in_nested_repository(&work_tree, prefix, &pathspec))
+		please_git_do_it_for_me(FALLBACK_PATH);
 
-		if (prefixcmp(gie->path, prefix))
-			continue;
+	unsigned int begin = index_map_lower_bound(index, pathspec.common, pathspec.common_len);
+	unsigned int end = index_map_prefix_end(index, begin, pathspec.common, pathspec.common_len);
+
+	struct modified_job job = {index, &pathspec, work_tree.buf, begin, config.trust_filemode, NULL};
+
+	/* Conflicts and submodules which are checked out : git knows better */
+	for (unsigned int i = begin; modified && i < end; i++) {
+		git_index_entry entry;
+		struct stat st;
+
+		index_map_entry(index, i, &entry);
+		if (git_index_entry_stage(&entry))
+			please_git_do_it_for_me(FALLBACK_INDEX);
+		if ((entry.mode & S_IFMT) == S_IFGITLINK) {
+			strbuf_addstr(&work_tree, entry.path);
+			if (!lstat(work_tree.buf, &st))
+				please_git_do_it_for_me(FALLBACK_WORK_TREE);
+			strbuf_setlen(&work_tree, work_tree.len - strlen(entry.path));
+		}
+	}
+
+	if (others) {
+		struct strbuf info_exclude = STRBUF_INIT;
+		struct strbuf cache_file = STRBUF_INIT;
+		const char *use_cache = getenv(GIT2_UNTRACKED_CACHE_ENVIRONMENT);
+		struct untracked untracked;
+
+		strbuf_addstr(&info_exclude, git_repository_path(repo, GIT_REPO_PATH));
+		if (info_exclude.len && info_exclude.buf[info_exclude.len - 1] != '/')
+			strbuf_addch(&info_exclude, '/');
+		if (use_cache && *use_cache && strcmp(use_cache, "0")) {
+			strbuf_addbuf(&cache_file, &info_exclude);
+			strbuf_addstr(&cache_file, UNTRACKED_CACHE_FILE);
+		}
+		strbuf_addstr(&info_exclude, "info/exclude");
+
+		struct untracked_options options = {
+			work_tree.buf, pathspec.common, exclude_standard,
+			info_exclude.buf, config.excludes_file, workers,
+			cache_file.len ? cache_file.buf : NULL, config.fsmonitor_hook
+		};
+		list_untracked(&untracked, index, &options);
+
+		for (unsigned int i = 0; i < untracked.nr; i++) {
+			if (!pathspec_match(&pathspec, untracked.paths[i], strlen(untracked.paths[i])))
+				continue;
+			output_add_name_quoted(out, untracked.paths[i] + prefix_len, terminator);
+			output_end_record(out);
+		}
+
+		untracked_release(&untracked);
+		strbuf_release(&cache_file);
+		strbuf_release(&info_exclude);
+	}
+
+	if (modified) {
+		job.work_tree = work_tree.buf;
+		job.modified = xmalloc(end - begin ? end - begin : 1);
+		struct parallel_job parallel = {
+			end - begin, 0,
+			NULL, modified_worker_process, NULL,
+			&job
+		};
+
+		if (end - begin < LS_FILES_PARALLEL_MIN)
+			workers = 1;
+		run_parallel(&parallel, workers);
+
+		for (unsigned int i = begin; i < end; i++) {
+			if (!job.modified[i - begin])
+				continue;
+			output_add_name_quoted(out, index_map_path(index, i) + prefix_len, terminator);
+			output_end_record(out);
+		}
+		free(job.modified);
+	}
+
+	pathspec_clear(&pathspec);
+	free(config.excludes_file);
+	free(config.fsmonitor_hook);
+	strbuf_release(&work_tree);
+	return EXIT_SUCCESS;
+}
+
+/* Only -o, -m and the options they take are listed without git */
+static int parse_worktree_options(int argc, const char **argv, int *others, int *modified,
+	int *exclude_standard, int *terminator, const char ***specs, unsigned int *nr_specs)
+{
+	unsigned int specs_alloc = 0;
+	int no_more_options = 0;
+
+	*others = *modified = *exclude_standard = 0;
+	*terminator = '\n';
+	*specs = NULL;
+	*nr_specs = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (no_more_options || argv[i][0] != '-') {
+			ALLOC_GROW(*specs, *nr_specs + 1, specs_alloc);
+			(*specs)[(*nr_specs)++] = argv[i];
+		} else if (!strcmp(argv[i], "--"))
+			no_more_options = 1;
+		else if (!strcmp(argv[i], "-o") || !strcmp(argv[i], "--others"))
+			*others = 1;
+		else if (!strcmp(argv[i], "-m") || !strcmp(argv[i], "--modified"))
+			*modified = 1;
+		else if (!strcmp(argv[i], "--exclude-standard"))
+			*exclude_standard = 1;
+		else if (!strcmp(argv[i], "-z"))
+			*terminator = '\0';
+		else
+			return 0;
+	}
+	return *others || *modified;
+}
+
+int cmd_ls_files(int argc, const char **argv)
+{
+	int others, modified, exclude_standard, worktree_terminator;
+	const char **specs;
+	unsigned int nr_specs;
+
+	if (parse_worktree_options(argc, argv, &others, &modified, &exclude_standard, &worktree_terminator,
+			&specs, &nr_specs)) {
+		int status = ls_files_worktree(others, modified, exclude_standard, worktree_terminator, specs, nr_specs);
+
+		free(specs);
+		return status;
+	}
+	free(specs);
+
+	int show_stage = 0;
+	int terminator = '\n';
+	const char **pathspecs = NULL;
+	unsigned int nr_pathspecs = 0, pathspecs_alloc = 0;
+	int no_more_options = 0;
+
+	/* options parsing */
+	for (int i = 1; i < argc; i++) {
+		if (no_more_options || argv[i][0] != '-') {
+			ALLOC_GROW(pathspecs, nr_pathspecs + 1, pathspecs_alloc);
+			pathspecs[nr_pathspecs++] = argv[i];
+		} else if (strcmp(argv[i], "--") == 0)
+			no_more_options = 1;
+		else if (strcmp(argv[i], "--stage") == 0 || strcmp(argv[i], "-s") == 0)
+			show_stage = 1;
+		else if (strcmp(argv[i], "-z") == 0)
+			terminator = '\0';
+		/* --cached lists what is listed by default : with -s too, in full */
+		else if (strcmp(argv[i], "--cached") != 0 && strcmp(argv[i], "-c") != 0)
+			please_git_do_it_for_option(argv[i]);
+	}
+
+
+	/* Nothing is changed : read the entries straight from the index file */
+	const struct index_map *index = get_git_index_map();
+	read_quote_path_config(get_git_repository(), terminator);
+
+	struct output *out = get_stdout_output();
+
+	const char *prefix = get_git_prefix();
+	size_t prefix_len = strlen(prefix);
+
+	/*
+	 * Pathspecs are relative to the prefix. The literal start of each one
+	 * is looked up in the sorted index, and only the entries of those
+	 * slices are visited.
+	 */
+	struct pathspec pathspec = PATHSPEC_INIT;
+	struct index_range *ranges;
+	unsigned int nr_ranges = 0;
+
+	if (pathspec_parse(&pathspec, prefix, pathspecs, nr_pathspecs) < 0)
+		please_git_do_it_for_me(FALLBACK_PATH);
+
+	if (pathspec.nr) {
+		strip_submodule_slashes(&pathspec, index);
+		ranges = xmalloc(pathspec.nr * sizeof(*ranges));
+		for (unsigned int i = 0; i < pathspec.nr; i++)
+			ranges[i] = index_prefix_range(index, pathspec.items[i].match, pathspec.items[i].literal_len);
+
+		/* Overlapping slices are merged, so that entries come out once and in order */
+		qsort(ranges, pathspec.nr, sizeof(*ranges), range_cmp);
+		for (unsigned int i = 0; i < pathspec.nr; i++) {
+			if (nr_ranges && ranges[i].begin <= ranges[nr_ranges - 1].end) {
+				if (ranges[i].end > ranges[nr_ranges - 1].end)
+					ranges[nr_ranges - 1].end = ranges[i].end;
+			} else {
+				ranges[nr_ranges++] = ranges[i];
+			}
+		}
+	} else {
+		ranges = xmalloc(sizeof(*ranges));
+		ranges[nr_ranges++] = index_prefix_range(index, prefix, prefix_len);
+	}
+
+	for (unsigned int r = 0; r < nr_ranges; r++) {
+		for (unsigned int i = ranges[r].begin; i < ranges[r].end; i++) {
+			const char *path = index_map_path(index, i);
+			git_index_entry entry;
+
+			if (!pathspec_match(&pathspec, path, strlen(path)))
+				continue;
 
-		if (!show_cached)
-			printf("%06o %s %i\t", gie->mode, git_oid_to_string(buf, GIT_OID_HEXSZ+1, &gie->oid), git_index_entry_stage(gie));
+			if (show_stage) {
+				index_map_entry(index, i, &entry);
+				output_addf(out, "%06o ", entry.mode);
+				output_add_oid(out, &entry.oid);
+				output_addf(out, " %i\t", git_index_entry_stage(&entry));
+			}
 
-		write_name_quoted(gie->path + prefix_len, stdout, '\n');
+			output_add_name_quoted(out, path + prefix_len, terminator);
+			output_end_record(out);
+		}
 	}
 
-	git_index_free(index_cur);
+	pathspec_clear(&pathspec);
+	free(ranges);
+	free(pathspecs);
 
 	return EXIT_SUCCESS;
 }
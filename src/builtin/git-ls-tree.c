@@ -7,72 +7,310 @@
 #include "git-support.h"
 #include "repository.h"
 #include "quote.h"
+#include "output.h"
+#include "strbuf.h"
+#include "utils.h"
+#include "thread-pool.h"
+#include "environment.h"
+#include "tree-cache.h"
+#include "revision.h"
+#include "arena.h"
+
+struct ls_tree_options {
+	int recursive; /* -r */
+	int show_trees; /* -t : show the trees -r goes into */
+	int name_only; /* --name-only, --name-status */
+	int terminator;
+};
+
+static void show_entry(const struct ls_tree_options *options, struct output *out,
+	const git_tree_entry *entry, const char *path)
+{
+	if (!options->name_only) {
+		output_addf(out, "%06o %s ", git_tree_entry_attributes(entry), git_object_type2string(git_tree_entry_type(entry)));
+		output_add_oid(out, git_tree_entry_id(entry));
+		output_addch(out, '\t');
+	}
+
+	output_add_name_quoted(out, path, options->terminator);
+	output_end_record(out);
+}
+
+static git_tree *lookup_tree(git_repository *repo, const git_oid *oid)
+{
+	git_tree *tree;
+
+	if (tree_cache_lookup(&tree, repo, oid) != GIT_SUCCESS)
+		libgit_error();
+	return tree;
+}
+
+/* List the tree at oid, whose entries are named path + their name */
+static void list_tree(const struct ls_tree_options *options, git_repository *repo,
+	const git_oid *oid, struct strbuf *path, struct output *out)
+{
+	git_tree *tree = lookup_tree(repo, oid);
+	size_t len = path->len;
+
+	for (unsigned int i = 0; i < git_tree_entrycount(tree); i++) {
+		const git_tree_entry *entry = git_tree_entry_byindex(tree, i);
+		int is_tree = git_tree_entry_type(entry) == GIT_OBJ_TREE;
+
+		strbuf_addstr(path, git_tree_entry_name(entry));
+		if (!is_tree || !options->recursive || options->show_trees)
+			show_entry(options, out, entry, path->buf);
+		if (is_tree && options->recursive) {
+			strbuf_addch(path, '/');
+			list_tree(options, repo, git_tree_entry_id(entry), path, out);
+		}
+		strbuf_setlen(path, len);
+	}
+
+	tree_cache_close(tree);
+}
+
+/*
+ * ls-tree -r on several threads : the top of the tree is listed first
+ * and cut in segments, each one made of the lines of some entries
+ * followed by the listing of a subtree. The workers list the subtrees,
+ * each into the buffer of its segment, and the segments are written in
+ * order, so the output is the same as a serial listing.
+ */
+struct ls_tree_segment {
+	struct output out;
+	git_oid subtree;
+	const char *path; /* of the subtree, with a trailing '/' */
+};
+
+struct ls_tree_job {
+	const struct ls_tree_options *options;
+	struct ls_tree_segment *segments;
+	unsigned int nr, alloc;
+	struct arena paths; /* of the segments */
+	const char *repository_path;
+	git_repository **repositories; /* one per worker */
+};
+
+static struct ls_tree_segment *new_segment(struct ls_tree_job *job)
+{
+	struct ls_tree_segment *segment;
+
+	ALLOC_GROW(job->segments, job->nr + 1, job->alloc);
+	segment = &job->segments[job->nr++];
+	output_init_buffer(&segment->out);
+	segment->path = NULL;
+	return segment;
+}
+
+/* List the trees above the given depth, cutting the segments at the subtrees below it */
+static void plan_tree(struct ls_tree_job *job, git_repository *repo, const git_oid *oid,
+	struct strbuf *path, unsigned int depth)
+{
+	git_tree *tree = lookup_tree(repo, oid);
+	size_t len = path->len;
+
+	for (unsigned int i = 0; i < git_tree_entrycount(tree); i++) {
+		const git_tree_entry *entry = git_tree_entry_byindex(tree, i);
+		struct ls_tree_segment *segment = &job->segments[job->nr - 1];
+
+		strbuf_addstr(path, git_tree_entry_name(entry));
+		if (git_tree_entry_type(entry) != GIT_OBJ_TREE) {
+			show_entry(job->options, &segment->out, entry, path->buf);
+		} else {
+			if (job->options->show_trees)
+				show_entry(job->options, &segment->out, entry, path->buf);
+			strbuf_addch(path, '/');
+			if (depth) {
+				plan_tree(job, repo, git_tree_entry_id(entry), path, depth - 1);
+			} else {
+				git_oid_cpy(&segment->subtree, git_tree_entry_id(entry));
+				segment->path = arena_memdupz(&job->paths, path->buf, path->len);
+				new_segment(job);
+			}
+		}
+		strbuf_setlen(path, len);
+	}
+
+	tree_cache_close(tree);
+}
+
+static void release_segments(struct ls_tree_job *job)
+{
+	for (unsigned int i = 0; i < job->nr; i++)
+		strbuf_release(&job->segments[i].out.buf);
+	free(job->segments);
+	arena_release(&job->paths);
+	job->segments = NULL;
+	job->nr = job->alloc = 0;
+}
+
+static void ls_tree_worker_init(void *context, unsigned int worker)
+{
+	struct ls_tree_job *job = context;
+
+	/* a repository cannot be shared between threads */
+	if (worker == 0) {
+		job->repositories[0] = get_git_repository();
+	} else if (git_repository_open(&job->repositories[worker], job->repository_path) < GIT_SUCCESS) {
+		libgit_error();
+	}
+}
+
+static void ls_tree_worker_process(void *context, unsigned int worker, unsigned int item)
+{
+	struct ls_tree_job *job = context;
+	struct ls_tree_segment *segment = &job->segments[item];
+	struct strbuf path = STRBUF_INIT;
+
+	/* the last segment has no subtree */
+	if (!segment->path)
+		return;
+
+	strbuf_addstr(&path, segment->path);
+	list_tree(job->options, job->repositories[worker], &segment->subtree, &path, &segment->out);
+	strbuf_release(&path);
+}
+
+static void ls_tree_worker_release(void *context, unsigned int worker)
+{
+	struct ls_tree_job *job = context;
+
+	if (worker != 0)
+		git_repository_free(job->repositories[worker]);
+}
+
+/* Segments per worker, for the big subtrees not to keep a worker alone at the end */
+#define SEGMENTS_PER_WORKER 4
+/* How deep the top of the tree is listed to find enough segments */
+#define MAX_PLAN_DEPTH 3
+
+static void list_tree_parallel(const struct ls_tree_options *options, git_repository *repo,
+	const git_oid *oid, unsigned int workers, struct output *out)
+{
+	struct ls_tree_job job = {options, NULL, 0, 0, ARENA_INIT, git_repository_path(repo, GIT_REPO_PATH), NULL};
+	struct strbuf path = STRBUF_INIT;
+
+	/* the tops of the tree are small : listing them again costs little */
+	for (unsigned int depth = 0; depth <= MAX_PLAN_DEPTH; depth++) {
+		release_segments(&job);
+		new_segment(&job);
+		plan_tree(&job, repo, oid, &path, depth);
+		if (job.nr > SEGMENTS_PER_WORKER * workers)
+			break;
+	}
+
+	if (job.nr - 1 < workers)
+		workers = job.nr - 1 ? job.nr - 1 : 1;
+
+	/* one segment at a time : workers which are done take the next one */
+	struct parallel_job parallel = {
+		job.nr, 1,
+		ls_tree_worker_init, ls_tree_worker_process, ls_tree_worker_release,
+		&job
+	};
+
+	job.repositories = xcalloc(workers, sizeof(git_repository *));
+	run_parallel(&parallel, workers);
+
+	for (unsigned int i = 0; i < job.nr; i++) {
+		output_add(out, job.segments[i].out.buf.buf, job.segments[i].out.buf.len);
+		output_end_record(out);
+	}
+
+	release_segments(&job);
+	free(job.repositories);
+	strbuf_release(&path);
+}
+
+/* get the number of workers from the environment, one per processor by default */
+static unsigned int ls_tree_workers(void)
+{
+	const char *value = getenv(GIT2_LS_TREE_WORKERS_ENVIRONMENT);
+	unsigned int workers;
+
+	if (!value || !*value)
+		return (unsigned int)online_cpus();
+	if (strtoul_ui(value, 10, &workers) < 0)
+		please_git_do_it_for_me(FALLBACK_SETTING);
+	return workers ? workers : (unsigned int)online_cpus();
+}
 
 int cmd_ls_tree(int argc, const char **argv)
 {
-	please_git_do_it_for_me();
+	struct ls_tree_options options = {0, 0, 0, '\n'};
+	const char *tree_name = NULL;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-z"))
+			options.terminator = '\0';
+		else if (!strcmp(argv[i], "-r"))
+			options.recursive = 1;
+		else if (!strcmp(argv[i], "-t"))
+			options.show_trees = 1;
+		else if (!strcmp(argv[i], "--name-only") || !strcmp(argv[i], "--name-status"))
+			options.name_only = 1;
+		else if (*argv[i] == '-')
+			please_git_do_it_for_option(argv[i]);
+		else if (tree_name)
+			please_git_do_it_for_me(FALLBACK_PATH);
+		else
+			tree_name = argv[i];
+	}
 
-	if (argc != 2)
-		please_git_do_it_for_me();
+	if (!tree_name)
+		please_git_do_it_for_me(FALLBACK_USAGE);
 
 	int e;
-	/* Find the current repository */
-	git_repository *repo = get_git_repository();
-	
-	/*Find the tree*/
 	git_tree *tree;
 	git_oid oid_tree;
-	
-	e = git_oid_fromstr(&oid_tree, (const char *)argv[1]);
-
-	if (e == GIT_ENOTOID) {
-		//libgit do not handle extended sha1 expressions for now
-		//so we fallback to git if not found.
-		please_git_do_it_for_me();
-	} else if (e < GIT_SUCCESS) {
-		libgit_error();
+
+	/* In a subdirectory only its part of the tree is shown : leave it to git */
+	if (*get_git_prefix())
+		please_git_do_it_for_me(FALLBACK_PATH);
+
+	/* Find the current repository */
+	git_repository *repo = get_git_repository();
+	if (options.terminator)
+		quote_path_fully = get_git_config_bool(repo, "core.quotepath", 1);
+
+	/* A tree-ish : the tree of a commit is listed */
+	e = resolve_revision_type(&oid_tree, repo, tree_name, GIT_OBJ_TREE);
+	switch (e) {
+		case GIT_EINVALIDTYPE:
+			die("not a tree object");
+		case GIT_ENOTFOUND:
+			die("Not a valid object name %s", tree_name);
+		case GIT_SUCCESS:
+			break;
+		default:
+			please_git_do_it_for_me(FALLBACK_REVISION);
 	}
-	
-	e = git_tree_lookup(&tree, repo, &oid_tree);
+
+	e = tree_cache_lookup(&tree, repo, &oid_tree);
 	switch (e) {
 		case GIT_EINVALIDTYPE:
 			die("not a tree object");
 		case GIT_ENOTFOUND:
-			die("Not a valid object name %s", argv[1]);
+			die("Not a valid object name %s", tree_name);
 		case GIT_SUCCESS:
 			break;
 		default:
 			libgit_error();
 	}
 
-	char buf[GIT_OID_HEXSZ + 1];
-	unsigned int i;
-	unsigned int max = git_tree_entrycount(tree);
-	
-	for (i = 0; i < max; ++i) {
-		/* Get the tree entry */
-		const git_tree_entry *tree_entry;
-		tree_entry = git_tree_entry_byindex(tree, i);
-		assert(tree_entry);
-
-		/* Get the tree entry type */
-		git_otype type_entry_tree;
-		type_entry_tree = git_tree_entry_type(tree_entry);
-
-		/* Get the tree entry name */
-		const char *name_entry;
-		name_entry = git_tree_entry_name(tree_entry);
-
-		/* Get the oid of a tree entry */
-		const git_oid *entry_oid = git_tree_entry_id (tree_entry);
+	struct output *out = get_stdout_output();
+	unsigned int workers = options.recursive ? ls_tree_workers() : 1;
 
-		printf("%06o %s %s\t",git_tree_entry_attributes(tree_entry), git_object_type2string(type_entry_tree),
-			git_oid_to_string(buf, GIT_OID_HEXSZ + 1, entry_oid));
+	if (workers > 1) {
+		list_tree_parallel(&options, repo, git_tree_id(tree), workers, out);
+	} else {
+		struct strbuf path = STRBUF_INIT;
 
-		write_name_quoted(name_entry, stdout, '\n');
+		list_tree(&options, repo, git_tree_id(tree), &path, out);
+		strbuf_release(&path);
 	}
 
-	git_tree_close(tree);
+	tree_cache_close(tree);
 
 	return EXIT_SUCCESS;
 }
@@ -6,39 +6,272 @@
 #include "git-support.h"
 #include "repository.h"
 #include "strbuf.h"
+#include "output.h"
+#include "fsync.h"
+#include "hex.h"
+#include "odb-batch.h"
+#include "utils.h"
 
+/* stdin is read by blocks of this size */
+#define MKTAG_CHUNK_SIZE (64 * 1024)
 
+/*
+ * The header of a tag as git's verify_tag() checks it, in one pass :
+ *     object <sha1>
+ *     type <type>
+ *     tag <name without spaces or control characters>
+ *     tagger <name> <<email>> <timestamp> <[+-]hhmm>
+ *     <blank line>
+ * Contents are NUL terminated (the separator of --batch, or the end of
+ * the strbuf), so the scan never goes past them.
+ */
+struct tag {
+	const char *buf;
+	size_t len;
+	git_oid object;
+	git_otype type;
+};
 
-int cmd_mktag(int argc, const char **argv)
+/* Why a tag is invalid, at which char, as git reports it */
+struct tag_error {
+	const char *reason;
+	long pos; /* -1 when the reason is not about a char */
+};
+
+static int fail(struct tag_error *err, const char *at, const char *start, const char *reason)
+{
+	err->reason = reason;
+	err->pos = at ? at - start : -1;
+	return -1;
+}
+
+static int parse_tag(struct tag *tag, struct tag_error *err)
 {
-	please_git_do_it_for_me();
-	
-	(void)argc;
-	(void)argv;
-	int e;
-	
-	if (argc != 1) {
-		printf("git mktag < signaturefile\n");
-		return 1;
+	const char *buf = tag->buf, *p, *type_line, *tag_line, *tagger, *lb, *rb;
+	char type[20];
+	size_t len;
+
+	if (tag->len < 84)
+		return fail(err, NULL, buf, "wanna fool me ? you obviously got the size wrong !");
+
+	if (strncmp(buf, "object ", 7))
+		return fail(err, buf, buf, "does not start with \"object \"");
+	for (int i = 0; i < GIT_OID_RAWSZ; i++) {
+		int hi = hex_value((unsigned char)buf[7 + 2 * i]);
+		int lo = hex_value((unsigned char)buf[8 + 2 * i]);
+		if (hi < 0 || lo < 0)
+			return fail(err, buf + 7, buf, "could not get SHA1 hash");
+		tag->object.id[i] = (hi << 4) | lo;
+	}
+
+	type_line = buf + 48;
+	if (strncmp(type_line - 1, "\ntype ", 6))
+		return fail(err, buf + 47, buf, "could not find \"\\ntype \"");
+
+	tag_line = strchr(type_line, '\n');
+	if (!tag_line)
+		return fail(err, type_line, buf, "could not find next \"\\n\"");
+	tag_line++;
+	if (strncmp(tag_line, "tag ", 4) || tag_line[4] == '\n')
+		return fail(err, tag_line, buf, "no \"tag \" found");
+
+	len = tag_line - type_line - strlen("type \n");
+	if (len >= sizeof(type))
+		return fail(err, type_line + 5, buf, "type too long");
+	memcpy(type, type_line + 5, len);
+	type[len] = '\0';
+	tag->type = git_object_string2type(type);
+	if (tag->type == GIT_OBJ_BAD)
+		return fail(err, buf + 7, buf, "could not verify object");
+
+	/* no control characters or spaces in the name */
+	for (p = tag_line + 4; *p != '\n'; p++) {
+		if ((unsigned char)*p <= ' ')
+			return fail(err, p + 1, buf, "could not verify tag name");
 	}
 
+	tagger = p + 1;
+	if (strncmp(tagger, "tagger ", 7))
+		return fail(err, tagger, buf, "could not find \"tagger \"");
+	tagger += 7;
+
+	/* " <" then "> " on this line, no brackets in the name, nor spaces in the email */
+	for (p = tagger; *p && !strchr("<>\n", *p); p++)
+		;
+	if (*p != '<' || p == tagger || p[-1] != ' ')
+		return fail(err, tagger, buf, "malformed tagger field");
+	lb = p - 1;
+	for (p = lb + 2; *p && !strchr("<>\n ", *p); p++)
+		;
+	if (*p != '>' || p[1] != ' ')
+		return fail(err, tagger, buf, "malformed tagger field");
+	rb = p;
+	if (lb == tagger)
+		return fail(err, tagger, buf, "missing tagger name");
+
+	p = rb + 2;
+	if (!(len = strspn(p, "0123456789")))
+		return fail(err, p, buf, "missing tag timestamp");
+	p += len;
+	if (*p != ' ')
+		return fail(err, p, buf, "malformed tag timestamp");
+	p++;
+
+	if (!((p[0] == '+' || p[0] == '-') && strspn(p + 1, "0123456789") == 4 &&
+	      p[5] == '\n' && atoi(p + 1) <= 1400))
+		return fail(err, p, buf, "malformed tag timezone");
+	p += 6;
+
+	if (*p != '\n')
+		return fail(err, p, buf, "trailing garbage in tag header");
+
+	return 0;
+}
+
+/* Whether the object of the tag is there, with the type the tag gives it */
+static int tag_object_matches(git_odb *odb, const struct tag *tag)
+{
+	size_t len;
+	git_otype type;
+
+	return git_odb_read_header(&len, &type, odb, &tag->object) == GIT_SUCCESS && type == tag->type;
+}
+
+static void write_tag(git_repository *repo, git_odb *odb, git_oid *oid, const struct tag *tag)
+{
+	if (git_odb_write(oid, odb, tag->buf, tag->len, GIT_OBJ_TAG) < GIT_SUCCESS)
+		die("unable to write tag file");
+	fsync_loose_object(repo, oid);
+}
+
+static int mktag_one(git_repository *repo)
+{
 	struct strbuf buf = STRBUF_INIT;
-	if (strbuf_read(&buf, 0, 4096) < 0) {
+	struct tag_error err;
+	struct tag tag;
+	git_odb *odb = git_repository_database(repo);
+	git_oid oid;
+
+	if (strbuf_read(&buf, 0, 4096) < 0)
 		die_errno("could not read from stdin");
-	}
-	git_oid oid_tag;
-	git_repository *repo = get_git_repository();
-	
-	e = git_tag_create_frombuffer(&oid_tag,repo,buf.buf);
-	if( e != GIT_EEXISTS && e != GIT_SUCCESS )
+
+	/* git reports the invalid tags : its messages are what scripts expect */
+	tag.buf = buf.buf;
+	tag.len = buf.len;
+	if (parse_tag(&tag, &err) < 0 || !tag_object_matches(odb, &tag))
+		please_git_do_it_with_input(FALLBACK_ERROR, buf.buf, buf.len);
+
+	if (git_odb_hash(&oid, tag.buf, tag.len, GIT_OBJ_TAG) < GIT_SUCCESS)
 		libgit_error();
-	
-	char *oid_tag_string = malloc(sizeof(char)*41);
-	git_oid_fmt(oid_tag_string, &oid_tag);
-	oid_tag_string[40] = '\0';
-	printf("%s\n", oid_tag_string);
-	
-	
+	if (git_odb_exists(odb, &oid) != 1)
+		write_tag(repo, odb, &oid, &tag);
+
+	struct output *out = get_stdout_output();
+	output_add_oid(out, &oid);
+	output_addch(out, '\n');
+	output_end_record(out);
+
+	strbuf_release(&buf);
+	return EXIT_SUCCESS;
+}
+
+static int oid_cmp(const void *a, const void *b)
+{
+	return git_oid_cmp(a, b);
+}
+
+static void NORETURN invalid_tag(unsigned int n, const struct tag_error *err)
+{
+	if (err->pos < 0)
+		die("invalid tag signature file %u: %s", n + 1, err->reason);
+	die("invalid tag signature file %u: char%ld: %s", n + 1, err->pos, err->reason);
+}
+
+/*
+ * --batch : NUL separated tags on stdin, which are all checked before
+ * any is written. The objects they point to are looked up in a single
+ * sweep of the pack indexes ; they may also be tags of the batch.
+ */
+static int mktag_batch(git_repository *repo)
+{
+	struct strbuf input = STRBUF_INIT;
+	struct tag *tags = NULL;
+	git_oid *objects = NULL, *oids, *sorted;
+	unsigned char *found;
+	unsigned int nr = 0, alloc = 0;
+	struct tag_error err;
+	git_odb *odb = git_repository_database(repo);
+
+	if (strbuf_read(&input, 0, MKTAG_CHUNK_SIZE) < 0)
+		die_errno("could not read from stdin");
+
+	for (const char *p = input.buf, *end = input.buf + input.len; p < end; nr++) {
+		const char *sep = memchr(p, '\0', end - p);
+		size_t len = sep ? (size_t)(sep - p) : (size_t)(end - p);
+
+		ALLOC_GROW(tags, nr + 1, alloc);
+		tags[nr].buf = p;
+		tags[nr].len = len;
+		if (parse_tag(&tags[nr], &err) < 0)
+			invalid_tag(nr, &err);
+		p += len + 1;
+	}
+	if (!nr) {
+		strbuf_release(&input);
+		return EXIT_SUCCESS;
+	}
+
+	objects = xmalloc(3 * nr * sizeof(git_oid));
+	oids = objects + nr;
+	sorted = oids + nr;
+	found = xmalloc(nr);
+	for (unsigned int i = 0; i < nr; i++) {
+		git_oid_cpy(&objects[i], &tags[i].object);
+		if (git_odb_hash(&oids[i], tags[i].buf, tags[i].len, GIT_OBJ_TAG) < GIT_SUCCESS)
+			libgit_error();
+	}
+	memcpy(sorted, oids, nr * sizeof(git_oid));
+	qsort(sorted, nr, sizeof(git_oid), oid_cmp);
+
+	odb_exists_batch(repo, objects, nr, found);
+	for (unsigned int i = 0; i < nr; i++) {
+		int valid = found[i] ? tag_object_matches(odb, &tags[i]) :
+			tags[i].type == GIT_OBJ_TAG &&
+			bsearch(&tags[i].object, sorted, nr, sizeof(git_oid), oid_cmp);
+		if (!valid) {
+			char hex[GIT_OID_HEXSZ + 1];
+			git_oid_fmt(hex, &tags[i].object);
+			hex[GIT_OID_HEXSZ] = '\0';
+			die("invalid tag signature file %u: char7: could not verify object %s", i + 1, hex);
+		}
+	}
+
+	/* the tags we already have (packed, loose or in an alternate) are not written again */
+	odb_exists_batch(repo, oids, nr, found);
+	struct output *out = get_stdout_output();
+	for (unsigned int i = 0; i < nr; i++) {
+		if (!found[i])
+			write_tag(repo, odb, &oids[i], &tags[i]);
+		output_add_oid(out, &oids[i]);
+		output_addch(out, '\n');
+		output_end_record(out);
+	}
+
+	free(found);
+	free(objects);
+	free(tags);
+	strbuf_release(&input);
 	return EXIT_SUCCESS;
 }
 
+int cmd_mktag(int argc, const char **argv)
+{
+	int batch = argc == 2 && !strcmp(argv[1], "--batch");
+
+	if (argc != 1 && !batch)
+		please_git_do_it_for_me(FALLBACK_USAGE);
+
+	git_repository *repo = get_git_repository();
+
+	return batch ? mktag_batch(repo) : mktag_one(repo);
+}
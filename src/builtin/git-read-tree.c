@@ -1,43 +1,81 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <sys/stat.h>
 #include <git2.h>
 #include "errors.h"
 #include "git-ls-tree.h"
 #include "git-support.h"
 #include "repository.h"
 #include "utils.h"
+#include "strbuf.h"
+#include "tree-cache.h"
+#include "revision.h"
+#include "cache-tree.h"
+#include "sparse-checkout.h"
+#include "tree-merge.h"
+#include "index-map.h"
+#include "environment.h"
+#include "abspath.h"
 
 
 int e;
-git_index *index_cur;
 git_repository *repo;
 
-void add_tree_to_index(git_tree * tree, const char * prefix) {
+/* the new index, its entries added in order as the trees are walked */
+static struct index_builder builder;
+
+/*
+ * Add the blobs (and submodules) of tree to the index, named path + their
+ * name. Trees sort their subdirectories as if their names ended with a
+ * '/', so that the walk gives the entries in the order of the index. The
+ * cache-tree of the index gets tree for the directory, since
+ * it is exactly what write-tree would make of it.
+ */
+void add_tree_to_index(git_tree * tree, struct strbuf *path, struct cache_tree *directory) {
+	size_t len = path->len;
+
+	git_oid_cpy(&directory->oid, git_tree_id(tree));
+	directory->entry_count = 0;
+	/* most names are short : room for the whole directory at once */
+	index_builder_reserve(&builder, git_tree_entrycount(tree), len + 16);
+
 	for (size_t i = 0; i < git_tree_entrycount(tree); i++) {
 		/* Get the tree entry */
 		const git_tree_entry *tree_entry;
 		tree_entry = git_tree_entry_byindex(tree,(unsigned int)i);
 		
-		if (tree_entry == NULL) {
-			printf("Tree entry not found");
+		if (tree_entry == NULL)
 			libgit_error();
-		}
 
 		/* Get the oid of a tree entry */
 		const git_oid *entry_oid = git_tree_entry_id (tree_entry);
 
-		/* is a sub directory ? */
-		git_tree * subtree;
-		if (git_tree_lookup(&subtree, repo, entry_oid) == 0) {
-			char * subprefix = xmalloc(sizeof(char)*1024);
-			const char * dirname = git_tree_entry_name (tree_entry);
-			git2__joinpath(subprefix, prefix, dirname);
-			add_tree_to_index(subtree, subprefix);
+		strbuf_addstr(path, git_tree_entry_name(tree_entry));
+
+		/* is a sub directory ? The mode tells, no need to look it up */
+		if (S_ISDIR(git_tree_entry_attributes(tree_entry))) {
+			git_tree * subtree;
+			struct cache_tree *subdirectory = cache_tree_new(git_tree_entry_name(tree_entry), strlen(git_tree_entry_name(tree_entry)));
+
+			strbuf_addch(path, '/');
+			if (tree_cache_lookup(&subtree, repo, entry_oid) != GIT_SUCCESS) {
+				char hex[GIT_OID_HEXSZ + 1];
+
+				git_oid_fmt(hex, entry_oid);
+				hex[GIT_OID_HEXSZ] = '\0';
+				die("unable to read tree %s", hex);
+			}
+			add_tree_to_index(subtree, path, subdirectory);
+			tree_cache_close(subtree);
+
+			ALLOC_GROW(directory->subtrees, directory->nr + 1, directory->alloc);
+			directory->subtrees[directory->nr++] = subdirectory;
+			directory->entry_count += subdirectory->entry_count;
+			strbuf_setlen(path, len);
 			continue;
 		}
 		
-		char * completename = xmalloc(sizeof(char)*1024);
-		git2__joinpath(completename, prefix, git_tree_entry_name (tree_entry));
+		/* the builder encodes the path right away */
 		git_index_entry source_entry = {
 			{0,0},//git_index_time 	ctime
 			{0,0},//git_index_time 	mtime
@@ -50,59 +88,164 @@ void add_tree_to_index(git_tree * tree, const char * prefix) {
 			*entry_oid,
 			0,
 			0,//unsigned short 	flags_extended
-			completename
+			path->buf
 		};
 		
 		
-		git_index_append2(index_cur, &source_entry);
-		
+		index_builder_add(&builder, &source_entry, 0);
+		directory->entry_count++;
+		strbuf_setlen(path, len);
 	}
 }
 
-int cmd_read_tree(int argc, const char **argv)
+/* The tree of a tree-ish, falling back to git for what it does not find */
+static void resolve_tree(git_oid *oid, const char *name)
 {
-	please_git_do_it_for_me();
-	if (argc != 2)
-		please_git_do_it_for_me();
+	/* A tree-ish : the tree of a commit is read */
+	switch (resolve_revision_type(oid, repo, name, GIT_OBJ_TREE)) {
+		case GIT_SUCCESS:
+			break;
+		case GIT_EINVALIDTYPE:
+			die("failed to unpack tree object %s", name);
+		case GIT_ENOTFOUND:
+			die("Not a valid object name %s", name);
+		default:
+			please_git_do_it_for_me(FALLBACK_REVISION);
+	}
+}
+
+/*
+ * "read-tree -m" with one to three trees : the new index is merged from
+ * the trees and the current one in a single walk (see tree-merge.h), then
+ * written at once with its cache-tree.
+ */
+static int read_tree_merge(const char **names, unsigned int nr)
+{
+	struct tree_merge merge;
+	git_oid oids[MAX_MERGE_TREES];
+	struct sparse_checkout sparse_cone;
+	int sparse_index_config;
+	const char *work_tree_path = getenv(GIT_WORK_TREE_ENVIRONMENT);
+	struct strbuf work_tree = STRBUF_INIT;
+	struct index_builder result;
+	struct strbuf tree = STRBUF_INIT;
+
+	/* several merge bases, or none at all : git tells */
+	if (!nr || nr > MAX_MERGE_TREES)
+		please_git_do_it_for_me(FALLBACK_USAGE);
+
+	/* "--", or a tree after it which looks like an option */
+	for (unsigned int i = 0; i < nr; i++)
+		if (names[i][0] == '-')
+			please_git_do_it_for_me(FALLBACK_OPTION);
 
-	/* Find the current repository */
 	repo = get_git_repository();
+	for (unsigned int i = 0; i < nr; i++)
+		resolve_tree(&oids[i], names[i]);
+
+	if (!work_tree_path)
+		work_tree_path = git_repository_path(repo, GIT_REPO_PATH_WORKDIR);
+	if (!work_tree_path)
+		please_git_do_it_for_me(FALLBACK_WORK_TREE);
+
+	/* the skip-worktree bits move with the entries : left to git */
+	if (sparse_checkout_load(&sparse_cone, repo, &sparse_index_config)) {
+		sparse_checkout_clear(&sparse_cone);
+		please_git_do_it_for_me(FALLBACK_SPARSE);
+	}
+
+	const struct index_map *index = get_git_index_map();
+
+	/* git asks for the conflicts to be resolved first, and knows what to do with the extended flags */
+	for (unsigned int i = 0; i < index->nr; i++) {
+		git_index_entry entry;
+
+		index_map_entry(index, i, &entry);
+		if ((entry.flags & GIT_IDXENTRY_STAGEMASK) || entry.flags_extended)
+			please_git_do_it_for_me(FALLBACK_INDEX);
+	}
+
+	strbuf_addstr(&work_tree, real_path(work_tree_path));
+	if (work_tree.len && work_tree.buf[work_tree.len - 1] != '/')
+		strbuf_addch(&work_tree, '/');
+
+	memset(&merge, 0, sizeof(merge));
+	merge.repo = repo;
+	merge.index = index;
+	merge.index_tree = cache_tree_read(index);
+	merge.work_tree = work_tree.buf;
+	merge.nr_trees = nr;
+	for (unsigned int i = 0; i < nr; i++)
+		merge.trees[i] = &oids[i];
+	merge.initial_checkout = !index->mtime && !index->nr;
+
+	struct cache_tree *root = cache_tree_new("", 0);
+	index_builder_init(&result, index);
+	if (merge_trees(&result, root, &merge) < 0)
+		please_git_do_it_for_me(FALLBACK_INDEX);
+
+	cache_tree_write(&tree, root);
+	index_builder_extension(&result, CACHE_TREE_SIGNATURE, &tree);
+	if (index_builder_write(&result, repo) != GIT_SUCCESS)
+		die("unable to write new index file");
+
+	strbuf_release(&tree);
+	index_builder_release(&result);
+	cache_tree_free(root);
+	cache_tree_free((struct cache_tree *)merge.index_tree);
+	strbuf_release(&work_tree);
+
+	return EXIT_SUCCESS;
+}
+
+int cmd_read_tree(int argc, const char **argv)
+{
+	if (argc > 1 && !strcmp(argv[1], "-m"))
+		return read_tree_merge(argv + 2, argc - 2);
+
+	/* several trees are merged into stages, --prefix, -u and the other options : git knows */
+	if (argc != 2)
+		please_git_do_it_for_me(FALLBACK_USAGE);
 
 	/*Find the tree*/
 	git_tree *tree;
 	git_oid oid_tree;
 
-	switch (git_oid_fromstr(&oid_tree, (const char *)argv[argc-1])) {
-		case GIT_ENOTOID:
-			please_git_do_it_for_me();
-			break;
-		case GIT_SUCCESS:
-			break;
-		default:
-			libgit_error();
-	}
-	
-	e = git_tree_lookup(&tree, repo, &oid_tree);
+	/* Find the current repository */
+	repo = get_git_repository();
+
+	resolve_tree(&oid_tree, argv[argc-1]);
+
+	e = tree_cache_lookup(&tree, repo, &oid_tree);
 	if (e) {
 		if (e == GIT_EINVALIDTYPE || e == GIT_ENOTFOUND) {
-			error("Tree object not found");
+			die("failed to unpack tree object %s", argv[argc-1]);
 		} else {
 			libgit_error();
 		}
 	}
 
-	/* Open the index */
-	if (git_repository_index(&index_cur, repo) < 0)
-		libgit_error();
-
-	/* Clear the index */
-	git_index_clear(index_cur);
-
-	/* add objects of the tree to the index */
-	add_tree_to_index(tree, "");
+	/*
+	 * The entries of the tree replace those of the index. As git does
+	 * without -u, a sparse checkout is not applied : the skip-worktree
+	 * bits are dropped and the index is a full one.
+	 */
+	struct strbuf path = STRBUF_INIT;
+	struct strbuf extension = STRBUF_INIT;
+	struct cache_tree *root = cache_tree_new("", 0);
+	index_builder_init(&builder, get_git_sparse_index_map());
+	add_tree_to_index(tree, &path, root);
+	strbuf_release(&path);
+	tree_cache_close(tree);
 
-	/* write the index */
-	git_index_write(index_cur);
+	/* written once, with its cache-tree */
+	cache_tree_write(&extension, root);
+	index_builder_extension(&builder, CACHE_TREE_SIGNATURE, &extension);
+	if (index_builder_write(&builder, repo) != GIT_SUCCESS)
+		die("unable to write new index file");
+	strbuf_release(&extension);
+	index_builder_release(&builder);
+	cache_tree_free(root);
 
 	return EXIT_SUCCESS;
 }
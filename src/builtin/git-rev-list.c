@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <git2.h>
 #include "git-rev-list.h"
 #include "repository.h"
@@ -7,137 +8,587 @@
 #include "errors.h"
 #include "parse-options.h"
 #include "strbuf.h"
+#include "utils.h"
+#include "revision.h"
+#include "commit-cache.h"
+#include "ctype.h"
+#include "output.h"
+#include "oid-set.h"
 
-git_commit* commit = NULL;
-git_revwalk *walk = NULL;
+/*
+ * A commit waiting in a walk queue : highest key first, that is the
+ * latest commit for the commits to show, and the highest generation for
+ * the hidden ones.
+ */
+struct rev_list_item {
+	uint32_t pos;
+	git_time_t time; /* the key */
+	unsigned int order; /* commits of the same key come out in insertion order */
+};
 
-static void cleanup() {
-	git_commit_close(commit);
-	git_revwalk_free(walk);
+struct rev_list_queue {
+	struct rev_list_item *items;
+	unsigned int nr, alloc;
+	unsigned int order;
+};
+
+static int item_before(const struct rev_list_item *a, const struct rev_list_item *b)
+{
+	if (a->time != b->time)
+		return a->time > b->time;
+	return a->order < b->order;
 }
 
-int cmd_rev_list(int argc, const char **argv)
+static void queue_swap(struct rev_list_queue *queue, unsigned int i, unsigned int j)
 {
-	/* Doesn't pass the tests due to bug in libgit2 apparently */
-	please_git_do_it_for_me();
-
-	const char *commit_string = NULL;
-	const char *format = NULL;
-	int i = 0;
-	git_repository *repository=NULL;
-	git_oid commit_oid;
-	git_oid current_oid;
-	char commit_oid_string[GIT_OID_HEXSZ+1];
-	size_t len;
-	int e;
+	struct rev_list_item tmp = queue->items[i];
+
+	queue->items[i] = queue->items[j];
+	queue->items[j] = tmp;
+}
+
+static void queue_put(struct rev_list_queue *queue, uint32_t pos, git_time_t time)
+{
+	unsigned int i = queue->nr;
+
+	ALLOC_GROW(queue->items, queue->nr + 1, queue->alloc);
+	queue->items[i].pos = pos;
+	queue->items[i].time = time;
+	queue->items[i].order = queue->order++;
+	queue->nr++;
 
-	/* For now, we only implement --format=oneline */
-	if (argc != 3) {
-		please_git_do_it_for_me();
+	while (i && item_before(&queue->items[i], &queue->items[(i - 1) / 2])) {
+		queue_swap(queue, i, (i - 1) / 2);
+		i = (i - 1) / 2;
 	}
+}
 
-	for (i = 1; i < 3; ++i) {
-		if (*argv[i] == '-') {
-			if (!prefixcmp(argv[i], "--pretty=")) {
-				format = argv[i] + strlen("--pretty=");
-			}
-		} else {
-			commit_string = argv[i];
+static uint32_t queue_get(struct rev_list_queue *queue)
+{
+	uint32_t pos = queue->items[0].pos;
+	unsigned int i = 0;
+
+	queue->items[0] = queue->items[--queue->nr];
+
+	for (;;) {
+		unsigned int child = 2 * i + 1;
+
+		if (child >= queue->nr)
+			break;
+		if (child + 1 < queue->nr && item_before(&queue->items[child + 1], &queue->items[child]))
+			child++;
+		if (!item_before(&queue->items[child], &queue->items[i]))
+			break;
+		queue_swap(queue, i, child);
+		i = child;
+	}
+
+	return pos;
+}
+
+/* Grafts, shallow clones and replacements rewrite parents : leave them to git */
+static int history_is_rewritten(git_repository *repository)
+{
+	static const char *files[] = {"info/grafts", "shallow", "refs/replace", NULL};
+	struct strbuf path = STRBUF_INIT;
+	struct stat st;
+	int rewritten = getenv("GIT_GRAFT_FILE") != NULL;
+
+	for (int i = 0; files[i] && !rewritten; i++) {
+		strbuf_reset(&path);
+		strbuf_addstr(&path, git_repository_path(repository, GIT_REPO_PATH));
+		if (path.len && path.buf[path.len - 1] != '/')
+			strbuf_addch(&path, '/');
+		strbuf_addstr(&path, files[i]);
+		rewritten = !lstat(path.buf, &st);
+	}
+
+	strbuf_release(&path);
+	return rewritten;
+}
+
+/* Fill oid with the commit named by arg : git runs the whole walk for names we do not resolve */
+static void resolve_commit(git_repository *repository, const char *arg, git_oid *oid)
+{
+	if (resolve_revision_type(oid, repository, arg, GIT_OBJ_COMMIT) != GIT_SUCCESS)
+		please_git_do_it_for_me(FALLBACK_REVISION);
+}
+
+/* The subject of a commit, as --pretty=oneline shows it : its first paragraph on one line */
+static void add_subject(struct strbuf *out, const char *message)
+{
+	int first = 1;
+
+	while (*message == '\n')
+		message++;
+
+	while (*message) {
+		const char *eol = strchrnul(message, '\n');
+		const char *end = eol;
+
+		while (end > message && isspace(end[-1]))
+			end--;
+		if (end == message)
+			break;
+
+		if (!first)
+			strbuf_addch(out, ' ');
+		strbuf_add(out, message, end - message);
+		first = 0;
+
+		message = *eol ? eol + 1 : eol;
+	}
+}
+
+static void show_commit(git_repository *repository, const git_oid *oid, int oneline, struct output *out)
+{
+	output_add_oid(out, oid);
+
+	/* Only the subject needs the commit itself */
+	if (oneline) {
+		git_commit *commit;
+
+		if (git_commit_lookup(&commit, repository, oid) != GIT_SUCCESS)
+			libgit_error();
+
+		output_addch(out, ' ');
+		add_subject(&out->buf, git_commit_message(commit));
+		git_commit_close(commit);
+	}
+
+	output_addch(out, '\n');
+	output_end_record(out);
+}
+
+/* "-n 20", "-n20", "--max-count=20" or "-20", returns the number of arguments used */
+static int parse_max_count(int argc, const char **argv, int i, unsigned int *max_count)
+{
+	const char *value;
+	int used = 1;
+
+	if (!strcmp(argv[i], "-n")) {
+		if (i + 1 >= argc)
+			please_git_do_it_for_me(FALLBACK_USAGE);
+		value = argv[i + 1];
+		used = 2;
+	} else if (!prefixcmp(argv[i], "--max-count=")) {
+		value = argv[i] + strlen("--max-count=");
+	} else if (!prefixcmp(argv[i], "-n")) {
+		value = argv[i] + 2;
+	} else if (argv[i][0] == '-' && isdigit(argv[i][1])) {
+		value = argv[i] + 1;
+	} else {
+		return 0;
+	}
+
+	if (strtoul_ui(value, 10, max_count) < 0)
+		please_git_do_it_for_option(argv[i]);
+
+	return used;
+}
+
+static void add_tip(git_oid **tips, unsigned int *nr, unsigned int *alloc, git_repository *repository, const char *arg)
+{
+	ALLOC_GROW(*tips, *nr + 1, *alloc);
+	resolve_commit(repository, *arg ? arg : "HEAD", &(*tips)[(*nr)++]);
+}
+
+/* Walk flags, per cache position */
+#define SEEN 01 /* queued to be shown */
+#define HIDDEN 02 /* reachable from an excluded commit */
+
+/*
+ * Mark as hidden everything reachable from the hidden commits whose
+ * generation is above the given one. A commit of that generation can
+ * only be reached from those, so once they are done we know for sure
+ * whether it is hidden.
+ */
+static void expand_hidden(struct commit_cache *cache, unsigned char *flags,
+	struct rev_list_queue *hidden, uint32_t generation,
+	uint32_t **parents, unsigned int *parents_alloc)
+{
+	while (hidden->nr && hidden->items[0].time > generation) {
+		uint32_t pos = queue_get(hidden);
+		unsigned int nr_parents = commit_cache_parents(cache, pos, parents, parents_alloc);
+
+		for (unsigned int i = 0; i < nr_parents; i++) {
+			uint32_t parent = (*parents)[i];
+
+			if (flags[parent] & HIDDEN)
+				continue;
+			flags[parent] |= HIDDEN;
+			queue_put(hidden, parent, commit_cache_generation(cache, parent));
 		}
 	}
+}
 
-	if (!commit_string) {
-		/* Show usage : ask git for now */
-		please_git_do_it_for_me();
+/*
+ * --objects : after the commits, the tags named on the command line (or
+ * by the refs of --all), then the trees and blobs of the commits shown,
+ * each object once, with its path.
+ */
+struct rev_list_objects {
+	git_odb *odb;
+	struct oid_set seen;
+	struct rev_list_tag {
+		git_oid oid;
+		char *name;
+	} *tags;
+	unsigned int nr_tags, tags_alloc;
+	struct strbuf path;
+};
+
+/* "<oid> <path>", the path up to its first newline as git shows it */
+static void show_object(struct output *out, const git_oid *oid, const char *path, size_t len)
+{
+	const char *eol = memchr(path, '\n', len);
+
+	output_add_oid(out, oid);
+	output_addch(out, ' ');
+	output_add(out, path, eol ? (size_t)(eol - path) : len);
+	output_addch(out, '\n');
+	output_end_record(out);
+}
+
+static void show_tree_objects(struct rev_list_objects *objects, const git_oid *oid, struct output *out)
+{
+	git_odb_object *tree;
+	const char *data, *end;
+	size_t baselen = objects->path.len;
+
+	/* a tree seen is a whole subtree seen */
+	if (!oid_set_add(&objects->seen, oid))
+		return;
+	show_object(out, oid, objects->path.buf, objects->path.len);
+
+	if (git_odb_read(&tree, objects->odb, oid) != GIT_SUCCESS)
+		libgit_error();
+	if (git_odb_object_type(tree) != GIT_OBJ_TREE)
+		die("bad tree object %s", objects->path.buf);
+
+	/* "<octal mode> <name>\0<raw oid>" entries */
+	data = git_odb_object_data(tree);
+	end = data + git_odb_object_size(tree);
+	while (data < end) {
+		const char *name = memchr(data, ' ', end - data);
+		const char *nul = name ? memchr(name, '\0', end - name) : NULL;
+		unsigned int mode = 0;
+		git_oid entry;
+
+		if (!nul || end - nul < 1 + GIT_OID_RAWSZ)
+			die("corrupt tree file %s", objects->path.buf);
+		for (; data < name; data++)
+			mode = (mode << 3) | (*data - '0');
+		name++;
+		memcpy(entry.id, nul + 1, GIT_OID_RAWSZ);
+		data = nul + 1 + GIT_OID_RAWSZ;
+
+		/* submodule commits are in another repository */
+		if ((mode & S_IFMT) == 0160000)
+			continue;
+
+		if (baselen)
+			strbuf_addch(&objects->path, '/');
+		strbuf_add(&objects->path, name, nul - name);
+		if (S_ISDIR(mode))
+			show_tree_objects(objects, &entry, out);
+		else if (oid_set_add(&objects->seen, &entry))
+			show_object(out, &entry, objects->path.buf, objects->path.len);
+		strbuf_setlen(&objects->path, baselen);
 	}
-	if (!format) {
-		/* No option or not handled option */
-		please_git_do_it_for_me();
+
+	git_odb_object_close(tree);
+}
+
+/* The tree of a commit : its first header */
+static void commit_tree(git_oid *oid, git_odb *odb, const git_oid *commit_oid)
+{
+	git_odb_object *commit;
+	const char *data;
+
+	if (git_odb_read(&commit, odb, commit_oid) != GIT_SUCCESS)
+		libgit_error();
+	data = git_odb_object_data(commit);
+	if (git_odb_object_size(commit) < 5 + GIT_OID_HEXSZ || prefixcmp(data, "tree ") ||
+	    git_oid_fromstrn(oid, data + 5, GIT_OID_HEXSZ) != GIT_SUCCESS)
+		die("bad commit object %s", data);
+	git_odb_object_close(commit);
+}
+
+static void show_objects(struct rev_list_objects *objects, struct commit_cache *cache,
+	const uint32_t *shown, unsigned int nr_shown, struct output *out)
+{
+	git_oid tree;
+
+	for (unsigned int i = 0; i < objects->nr_tags; i++) {
+		struct rev_list_tag *tag = &objects->tags[i];
+
+		if (oid_set_add(&objects->seen, &tag->oid))
+			show_object(out, &tag->oid, tag->name, strlen(tag->name));
+	}
+
+	for (unsigned int i = 0; i < nr_shown; i++) {
+		commit_tree(&tree, objects->odb, commit_cache_oid(cache, shown[i]));
+		show_tree_objects(objects, &tree, out);
+	}
+}
+
+/*
+ * Peel the tags from oid down to a commit, keeping them for --objects
+ * (objects is NULL without). Returns 0 for a commit, -1 when it is
+ * something else
+ */
+static int peel_tip(git_repository *repository, git_oid *oid, struct rev_list_objects *objects)
+{
+	for (;;) {
+		size_t len;
+		git_otype type;
+		git_tag *tag;
+
+		if (git_odb_read_header(&len, &type, git_repository_database(repository), oid) != GIT_SUCCESS)
+			please_git_do_it_for_me(FALLBACK_OBJECTS);
+		if (type == GIT_OBJ_COMMIT)
+			return 0;
+		if (type != GIT_OBJ_TAG)
+			return -1;
+
+		if (git_tag_lookup(&tag, repository, oid) != GIT_SUCCESS)
+			please_git_do_it_for_me(FALLBACK_OBJECTS);
+		if (objects) {
+			ALLOC_GROW(objects->tags, objects->nr_tags + 1, objects->tags_alloc);
+			git_oid_cpy(&objects->tags[objects->nr_tags].oid, oid);
+			objects->tags[objects->nr_tags++].name = xstrdup(git_tag_name(tag));
+		}
+		git_oid_cpy(oid, git_tag_target_oid(tag));
+		git_tag_close(tag);
 	}
-	if (strcmp(format, "oneline")) {
-		/* Format not supported for now */
-		please_git_do_it_for_me();
+}
+
+struct all_refs {
+	git_repository *repository;
+	git_oid **tips;
+	unsigned int *nr, *alloc;
+	struct rev_list_objects *objects;
+};
+
+static void add_peeled_tip(struct all_refs *all, const git_oid *oid)
+{
+	git_oid peeled;
+
+	git_oid_cpy(&peeled, oid);
+	if (peel_tip(all->repository, &peeled, all->objects) < 0) {
+		/* without --objects, git leaves out the refs to trees and blobs */
+		if (all->objects)
+			please_git_do_it_for_me(FALLBACK_OBJECTS);
+		return;
 	}
 
-	/* Supported object specifications are full or short oid */
-	/* Create the partial oid (filled with '0's) from the given argument */
-	len = strlen(commit_string);
-	if (len > GIT_OID_HEXSZ) {
-		/* It's not a sha1 */
-		please_git_do_it_for_me();
+	ALLOC_GROW(*all->tips, *all->nr + 1, *all->alloc);
+	git_oid_cpy(&(*all->tips)[(*all->nr)++], &peeled);
+}
+
+static int add_ref_tip(const char *name, const git_oid *oid, void *data)
+{
+	(void)name;
+	add_peeled_tip(data, oid);
+	return GIT_SUCCESS;
+}
+
+/* --all : the refs, then HEAD */
+static void add_all_tips(struct all_refs *all)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct stat st;
+	git_oid head;
+	int e;
+
+	/* the HEADs of the other work trees are in too */
+	strbuf_addstr(&path, git_repository_path(all->repository, GIT_REPO_PATH));
+	if (path.len && path.buf[path.len - 1] != '/')
+		strbuf_addch(&path, '/');
+	strbuf_addstr(&path, "worktrees");
+	e = stat(path.buf, &st);
+	strbuf_release(&path);
+	if (!e)
+		please_git_do_it_for_me(FALLBACK_WORK_TREE);
+
+	if (for_each_ref(all->repository, add_ref_tip, all) != GIT_SUCCESS)
+		please_git_do_it_for_me(FALLBACK_REPOSITORY);
+
+	e = resolve_revision(&head, all->repository, "HEAD");
+	if (e == GIT_SUCCESS)
+		add_peeled_tip(all, &head);
+	else if (e != GIT_ENOTFOUND)
+		please_git_do_it_for_me(FALLBACK_REPOSITORY);
+}
+
+int cmd_rev_list(int argc, const char **argv)
+{
+	struct commit_cache cache = COMMIT_CACHE_INIT;
+	struct rev_list_queue queue = {NULL, 0, 0, 0};
+	struct rev_list_queue hidden = {NULL, 0, 0, 0};
+	struct output *out = get_stdout_output();
+	git_repository *repository;
+	git_oid *tips = NULL, *excluded = NULL;
+	unsigned int nr_tips = 0, tips_alloc = 0;
+	unsigned int nr_excluded = 0, excluded_alloc = 0;
+	uint32_t *parents = NULL;
+	unsigned int parents_alloc = 0;
+	unsigned int max_count = UINT_MAX, shown = 0;
+	unsigned char *flags;
+	struct rev_list_objects objects = {NULL, OID_SET_INIT, NULL, 0, 0, STRBUF_INIT};
+	uint32_t *shown_commits = NULL;
+	unsigned int shown_alloc = 0;
+	int oneline = 0, has_tips = 0, with_objects = 0, has_excluded = 0;
+	int e;
+
+	/* For now, we only implement --pretty=oneline, -n, --all, --objects and plain revisions or ranges */
+	for (int i = 1; i < argc; ++i) {
+		int used;
+
+		if (!strcmp(argv[i], "--pretty=oneline"))
+			oneline = 1;
+		else if (!strcmp(argv[i], "--objects"))
+			with_objects = 1;
+		else if (!strcmp(argv[i], "--all"))
+			has_tips = 1;
+		else if ((used = parse_max_count(argc, argv, i, &max_count)))
+			i += used - 1;
+		else if (*argv[i] == '-')
+			please_git_do_it_for_option(argv[i]);
+		else if (strstr(argv[i], "..."))
+			please_git_do_it_for_me(FALLBACK_REVISION);
+		else if (*argv[i] == '^' || strstr(argv[i], ".."))
+			has_excluded = 1;
+		else
+			has_tips = 1;
 	}
-	memcpy(commit_oid_string, commit_string, len * sizeof(char));
-	memset(commit_oid_string + len, '0', (GIT_OID_HEXSZ - len) * sizeof(char));
-	commit_oid_string[GIT_OID_HEXSZ] = '\0';
-	e = git_oid_fromstr(&commit_oid, commit_oid_string);
-	if (e) {
-		/* Not an OID. The object can be specified in a lot
-		 * of different ways (not supported by libgit2 yet).
-		 * Fall back to git.
-		 */
-		please_git_do_it_for_me();
+
+	/* the objects of the excluded commits are not shown either : left to git */
+	if (with_objects && has_excluded)
+		please_git_do_it_for_me(FALLBACK_OPTION);
+
+	if (!has_tips) {
+		/* Show usage : ask git for now */
+		please_git_do_it_for_me(FALLBACK_USAGE);
 	}
 
 	repository = get_git_repository();
+	if (history_is_rewritten(repository))
+		please_git_do_it_for_me(FALLBACK_OBJECTS);
+	objects.odb = git_repository_database(repository);
 
-	/* Lookup the commit object */
-	e = git_object_lookup_prefix((git_object **)&commit, repository, &commit_oid, len, GIT_OBJ_ANY);
-	if (e != GIT_SUCCESS) {
-		if (e == GIT_ENOTFOUND) {
-			/* Maybe the given argument is not a sha1
-			 * but a tag name (which looks like a sha1)
-			 * Fall back to git.
-			 */
-			 please_git_do_it_for_me();
-		} else if (e == GIT_EAMBIGUOUSOIDPREFIX) {
-			error("%s is an ambiguous prefix", commit_string);
+	struct all_refs tip_list = {repository, &tips, &nr_tips, &tips_alloc, with_objects ? &objects : NULL};
+	for (int i = 1; i < argc; ++i) {
+		const char *dots;
+		int used;
+
+		if (!strcmp(argv[i], "--pretty=oneline") || !strcmp(argv[i], "--objects")) {
+			continue;
+		} else if (!strcmp(argv[i], "--all")) {
+			add_all_tips(&tip_list);
+		} else if ((used = parse_max_count(argc, argv, i, &max_count))) {
+			i += used - 1;
+		} else if (*argv[i] == '^') {
+			add_tip(&excluded, &nr_excluded, &excluded_alloc, repository, argv[i] + 1);
+		} else if ((dots = strstr(argv[i], ".."))) {
+			/* A..B is ^A B, a missing end is HEAD */
+			char *from = xstrndup(argv[i], dots - argv[i]);
+
+			add_tip(&excluded, &nr_excluded, &excluded_alloc, repository, from);
+			add_tip(&tips, &nr_tips, &tips_alloc, repository, dots + 2);
+			free(from);
+		} else if (with_objects) {
+			/* the tags named are shown too */
+			git_oid oid;
+
+			if (resolve_revision(&oid, repository, argv[i]) != GIT_SUCCESS)
+				please_git_do_it_for_me(FALLBACK_REVISION);
+			add_peeled_tip(&tip_list, &oid);
 		} else {
-			libgit_error();
+			add_tip(&tips, &nr_tips, &tips_alloc, repository, argv[i]);
 		}
 	}
-	if (git_object_type((git_object *)commit) != GIT_OBJ_COMMIT) {
-		/* Not a commit : nothing to do */
-		cleanup();
 
-		return EXIT_SUCCESS;
+	/* Past this point the walk does not touch the odb but for subjects */
+	for (unsigned int i = 0; i < nr_excluded; i++) {
+		ALLOC_GROW(tips, nr_tips + i + 1, tips_alloc);
+		git_oid_cpy(&tips[nr_tips + i], &excluded[i]);
 	}
 
-	if (git_revwalk_new(&walk, repository)) {
-		cleanup();
+	commit_cache_load(&cache, repository);
+	e = commit_cache_update(&cache, repository, tips, nr_tips + nr_excluded);
+	if (e != GIT_SUCCESS)
 		libgit_error();
+
+	flags = xcalloc(cache.nr ? cache.nr : 1, 1);
+
+	for (unsigned int i = 0; i < nr_excluded; i++) {
+		uint32_t pos;
+
+		commit_cache_find(&cache, &excluded[i], &pos);
+		if (flags[pos] & HIDDEN)
+			continue;
+		flags[pos] |= HIDDEN;
+		queue_put(&hidden, pos, commit_cache_generation(&cache, pos));
 	}
 
-	git_revwalk_sorting(walk, GIT_SORT_TIME);
+	for (unsigned int i = 0; i < nr_tips; i++) {
+		uint32_t pos;
 
-	if (git_revwalk_push(walk, &commit_oid)) {
-		cleanup();
-		libgit_error();
+		commit_cache_find(&cache, &tips[i], &pos);
+		if (flags[pos] & SEEN)
+			continue;
+		flags[pos] |= SEEN;
+		queue_put(&queue, pos, commit_cache_time(&cache, pos));
 	}
 
-	git_commit_close(commit);
-	if ((git_revwalk_next(&current_oid, walk)) == GIT_SUCCESS) {
-		char oid_string[GIT_OID_HEXSZ+1];
-		oid_string[GIT_OID_HEXSZ] = '\0';
-		const char *cmsg;
+	/*
+	 * Commits come out in date order and each one is shown as soon as
+	 * it is known not to be hidden, so a limited walk stops early.
+	 */
+	while (queue.nr && shown < max_count) {
+		uint32_t pos = queue_get(&queue);
+		unsigned int nr_parents;
 
-		while (1) {
-			git_oid_fmt(oid_string, &current_oid);
-			if (git_commit_lookup(&commit, repository, &current_oid)) {
-				libgit_error();
-			}
+		if (hidden.nr)
+			expand_hidden(&cache, flags, &hidden, commit_cache_generation(&cache, pos), &parents, &parents_alloc);
+		if (flags[pos] & HIDDEN)
+			continue;
 
-			cmsg  = git_commit_message_short(commit);
-			
-			git_oid_fmt(oid_string, git_commit_id(commit));
-			printf("%s %s\n", oid_string, cmsg);
+		nr_parents = commit_cache_parents(&cache, pos, &parents, &parents_alloc);
+		for (unsigned int i = 0; i < nr_parents; i++) {
+			if (flags[parents[i]] & (SEEN | HIDDEN))
+				continue;
+			flags[parents[i]] |= SEEN;
+			queue_put(&queue, parents[i], commit_cache_time(&cache, parents[i]));
+		}
 
-			if ((git_revwalk_next(&current_oid, walk)) != GIT_SUCCESS)
-				break;
-			git_commit_close(commit);
+		show_commit(repository, commit_cache_oid(&cache, pos), oneline, out);
+		if (with_objects) {
+			ALLOC_GROW(shown_commits, shown + 1, shown_alloc);
+			shown_commits[shown] = pos;
 		}
+		shown++;
+	}
+
+	if (with_objects) {
+		show_objects(&objects, &cache, shown_commits, shown, out);
+		for (unsigned int i = 0; i < objects.nr_tags; i++)
+			free(objects.tags[i].name);
+		free(objects.tags);
+		oid_set_clear(&objects.seen);
+		strbuf_release(&objects.path);
+		free(shown_commits);
 	}
-	
-	cleanup();
+
+	free(flags);
+	free(parents);
+	free(queue.items);
+	free(hidden.items);
+	free(tips);
+	free(excluded);
+	commit_cache_release(&cache);
 
 	return EXIT_SUCCESS;
 }
@@ -2,103 +2,635 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 
 #include <git2.h>
 
 #include "errors.h"
 #include "git-support.h"
 #include "repository.h"
+#include "index-map.h"
+#include "byte-order.h"
+#include "cache-tree.h"
+#include "strbuf.h"
+#include "utils.h"
+#include "arena.h"
+#include "thread-pool.h"
+#include "environment.h"
+#include "output.h"
+#include "pack-on-write.h"
+#include "fsync.h"
 
-#define UNSUPORTED_OPTIONS_NUM 25
+/* Below this many paths, hashing them on other threads costs more than it saves */
+#define UPDATE_INDEX_PARALLEL_MIN 64
 
-const char * unsuported_options[UNSUPORTED_OPTIONS_NUM] = 
+enum update_status {
+	UPDATE_CHANGED,
+	UPDATE_UNCHANGED, /* the entry is up to date */
+	UPDATE_FALLBACK, /* something git has to explain (missing file, directory...) */
+	UPDATE_ERROR /* libgit2 failed */
+};
+
+struct update_item {
+	const char *path; /* in the index : the prefix and the path given */
+	git_index_entry *old; /* the entry of path, NULL if it is new */
+	git_index_entry entry; /* the new one, when UPDATE_CHANGED */
+	enum update_status status;
+};
+
+struct update_job {
+	struct update_item *items;
+	const char *workdir;
+	time_t index_mtime;
+	int trust_filemode; /* core.filemode */
+	const char *repository_path;
+	git_repository **repositories; /* one per worker */
+};
+
+/* Paths git would have to normalize (or reject) : empty components, ".", "..", ".git", absolute */
+static int is_normal_path(const char *path, size_t len)
+{
+	const char *end = path + len;
+
+	if (!len || memchr(path, '\0', len))
+		return 0;
+
+	while (path < end) {
+		const char *slash = memchr(path, '/', end - path);
+		size_t component = (slash ? slash : end) - path;
+
+		if (!component || (path[0] == '.' && (component == 1 || (component == 2 && path[1] == '.'))))
+			return 0;
+		if (component == 4 && !strncasecmp(path, ".git", 4))
+			return 0;
+		if (!slash)
+			break;
+		path = slash + 1;
+		if (path == end)
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Once the standard input is read, git needs it again */
+static void NORETURN fall_back(enum fallback_reason reason, const struct strbuf *input)
+{
+	if (input)
+		please_git_do_it_with_input(reason, input->buf, input->len);
+	please_git_do_it_for_me(reason);
+}
+
+static void update_worker_init(void *context, unsigned int worker)
+{
+	struct update_job *job = context;
+
+	/* a repository cannot be shared between threads */
+	if (worker == 0) {
+		job->repositories[0] = get_git_repository();
+	} else if (git_repository_open(&job->repositories[worker], job->repository_path) < GIT_SUCCESS ||
+		   attach_pack_on_write(job->repositories[worker]) < GIT_SUCCESS) {
+		libgit_error();
+	}
+}
+
+static void update_worker_release(void *context, unsigned int worker)
+{
+	struct update_job *job = context;
+
+	if (worker != 0)
+		git_repository_free(job->repositories[worker]);
+}
+
+/* Hash the file of an item as a blob, write it if the odb does not have it yet */
+static void update_worker_process(void *context, unsigned int worker, unsigned int n)
+{
+	struct update_job *job = context;
+	struct update_item *item = &job->items[n];
+	git_odb *odb = git_repository_database(job->repositories[worker]);
+	struct strbuf path = STRBUF_INIT;
+	struct strbuf contents = STRBUF_INIT;
+	git_index_entry *entry = &item->entry;
+	struct stat st;
+	int e;
+
+	item->status = UPDATE_FALLBACK;
+
+	strbuf_addstr(&path, job->workdir);
+	strbuf_addstr(&path, item->path);
+	if (lstat(path.buf, &st) || (!S_ISREG(st.st_mode) && !S_ISLNK(st.st_mode)))
+		goto done;
+
+	/* as git, trust the stat data unless the entry could be racily clean */
+	if (item->old && index_entry_matches_stat(item->old, path.buf, &st, job->trust_filemode) &&
+	    item->old->mtime.seconds < (git_time_t)job->index_mtime) {
+		item->status = UPDATE_UNCHANGED;
+		goto done;
+	}
+
+	if (S_ISLNK(st.st_mode))
+		e = strbuf_readlink(&contents, path.buf, st.st_size);
+	else
+		e = strbuf_read_file(&contents, path.buf, st.st_size);
+	if (e < 0)
+		goto done;
+
+	e = git_odb_hash(&entry->oid, contents.buf, contents.len, GIT_OBJ_BLOB);
+	if (e == GIT_SUCCESS && git_odb_exists(odb, &entry->oid) != 1)
+		if ((e = git_odb_write(&entry->oid, odb, contents.buf, contents.len, GIT_OBJ_BLOB)) == GIT_SUCCESS)
+			fsync_loose_object(job->repositories[worker], &entry->oid);
+	if (e != GIT_SUCCESS) {
+		item->status = UPDATE_ERROR;
+		goto done;
+	}
+
+	entry->ctime.seconds = (git_time_t)st.st_ctime;
+	entry->ctime.nanoseconds = ST_CTIME_NSEC(st);
+	entry->mtime.seconds = (git_time_t)st.st_mtime;
+	entry->mtime.nanoseconds = ST_MTIME_NSEC(st);
+	entry->dev = (unsigned int)st.st_dev;
+	entry->ino = (unsigned int)st.st_ino;
+	entry->uid = (unsigned int)st.st_uid;
+	entry->gid = (unsigned int)st.st_gid;
+	entry->file_size = st.st_size;
+	if (S_ISLNK(st.st_mode))
+		entry->mode = S_IFLNK;
+	else if (!job->trust_filemode)
+		/* as git, the mode is the one the entry had, without the executable bit of the file */
+		entry->mode = item->old && S_ISREG(item->old->mode) ? item->old->mode : S_IFREG | 0644;
+	else
+		entry->mode = S_IFREG | ((st.st_mode & S_IXUSR) ? 0755 : 0644);
+	entry->path = (char *)item->path;
+	item->status = UPDATE_CHANGED;
+
+done:
+	strbuf_release(&contents);
+	strbuf_release(&path);
+}
+
+/* get the number of workers from the environment, one per processor by default */
+static unsigned int update_index_workers(void)
+{
+	const char *value = getenv(GIT2_UPDATE_INDEX_WORKERS_ENVIRONMENT);
+	unsigned int workers;
+
+	if (!value || !*value)
+		return (unsigned int)online_cpus();
+	if (strtoul_ui(value, 10, &workers) < 0)
+		please_git_do_it_for_me(FALLBACK_SETTING);
+	return workers ? workers : (unsigned int)online_cpus();
+}
+
+static int item_path_cmp(const void *a, const void *b)
+{
+	const struct update_item *x = *(const struct update_item * const *)a;
+	const struct update_item *y = *(const struct update_item * const *)b;
+	int cmp = strcmp(x->path, y->path);
+
+	/* the same path given twice : the last one wins, as with git */
+	if (!cmp)
+		return x < y ? -1 : x > y;
+	return cmp;
+}
+
+/* Paths which would be both a file and a directory of the index */
+static int is_directory_conflict(git_index *index, const struct index_map *map, const char *path)
 {
-	"--nonsense", "-h",
-	"--remove", "--force-remove", "--replace",
-	"--refresh", "-q", "--unmerged", "--ignore-missing",
-	"--cacheinfo",
-	"--chmod",
-	"--assume-unchanged", "--no-assume-unchanged",
-	"--skip-worktree", "--no-skip-worktree",
-	"--ignore-submodules",
-	"--really-refresh", "--unresolve", "--again", "-g",
-	"--info-only", "--index-info",
-	"-z", "--stdin",
-	"--verbose"
+	size_t len = strlen(path);
+	char *prefix = xmalloc(len + 2);
+	unsigned int pos;
+	int conflict = 0;
+
+	memcpy(prefix, path, len);
+	for (size_t i = 0; i < len && !conflict; i++) {
+		if (path[i] != '/')
+			continue;
+		prefix[i] = '\0';
+		conflict = git_index_find(index, prefix) >= 0;
+		prefix[i] = '/';
+	}
+
+	prefix[len] = '/';
+	prefix[len + 1] = '\0';
+	pos = index_map_lower_bound(map, prefix, len + 1);
+	if (pos < map->nr && !strncmp(index_map_path(map, pos), prefix, len + 1))
+		conflict = 1;
+
+	free(prefix);
+	return conflict;
+}
+
+/*
+ * update-index --refresh : the entries whose stat data changed but not
+ * their contents get the new stat data, the others are reported. The
+ * files are lstat()ed by several threads, each taking consecutive
+ * entries, that is whole directories.
+ */
+
+enum refresh_status {
+	REFRESH_UPTODATE,
+	REFRESH_UPDATED, /* same contents, new stat data */
+	REFRESH_MISSING,
+	REFRESH_NEEDS_UPDATE
 };
 
-int cmd_update_index(int argc, const char **argv)
+struct refresh_job {
+	const struct index_map *index;
+	const char *workdir;
+	struct strbuf *entries; /* the header and entries of the index, updated in place */
+	unsigned char *status;
+	int trust_filemode; /* core.filemode */
+};
+
+/* Record the stat data of a file in its entry, as the index stores it */
+static void update_stat_data(char *data, const struct stat *st)
+{
+	put_be32_at(data, (uint32_t)st->st_ctime);
+	put_be32_at(data + 4, ST_CTIME_NSEC(*st));
+	put_be32_at(data + 8, (uint32_t)st->st_mtime);
+	put_be32_at(data + 12, ST_MTIME_NSEC(*st));
+	put_be32_at(data + 16, (uint32_t)st->st_dev);
+	put_be32_at(data + 20, (uint32_t)st->st_ino);
+	put_be32_at(data + 28, (uint32_t)st->st_uid);
+	put_be32_at(data + 32, (uint32_t)st->st_gid);
+	put_be32_at(data + 36, (uint32_t)st->st_size);
+}
+
+/* The file is still what the entry records : a symlink, or a file executable or not */
+static int same_kind_of_file(const git_index_entry *entry, const struct stat *st, int trust_filemode)
+{
+	if (S_ISLNK(entry->mode))
+		return S_ISLNK(st->st_mode);
+	return S_ISREG(st->st_mode) && !(trust_filemode && ((entry->mode ^ st->st_mode) & S_IXUSR));
+}
+
+static void refresh_worker_process(void *context, unsigned int worker, unsigned int n)
+{
+	struct refresh_job *job = context;
+	struct strbuf path = STRBUF_INIT;
+	git_index_entry entry;
+	struct stat st;
+	unsigned char status = REFRESH_NEEDS_UPDATE;
+
+	(void)worker; /* hashing needs no repository */
+	index_map_entry(job->index, n, &entry);
+	/* assume-unchanged and sparse entries are not looked at */
+	if ((entry.flags & GIT_IDXENTRY_VALID) || (entry.flags_extended & INDEX_ENTRY_SKIP_WORKTREE)) {
+		job->status[n] = REFRESH_UPTODATE;
+		return;
+	}
+
+	strbuf_addstr(&path, job->workdir);
+	strbuf_addstr(&path, entry.path);
+
+	if (lstat(path.buf, &st)) {
+		if (errno == ENOENT || errno == ENOTDIR)
+			status = REFRESH_MISSING;
+	} else if (index_entry_matches_stat(&entry, path.buf, &st, job->trust_filemode)) {
+		/* racily clean : only the contents can tell */
+		if (entry.mtime.seconds < (git_time_t)job->index->mtime ||
+		    index_entry_matches_file(&entry, path.buf, &st))
+			status = REFRESH_UPTODATE;
+	} else if (same_kind_of_file(&entry, &st, job->trust_filemode) &&
+		   /* a size of 0 is what git records to force a comparison */
+		   (!entry.file_size || (uint32_t)entry.file_size == (uint32_t)st.st_size) &&
+		   index_entry_matches_file(&entry, path.buf, &st)) {
+		update_stat_data(job->entries->buf + job->index->offsets[n], &st);
+		status = REFRESH_UPDATED;
+	}
+
+	job->status[n] = status;
+	strbuf_release(&path);
+}
+
+/*
+ * The files modified in the second we started reading them could have
+ * changed again since, and the index is going to be newer than them :
+ * as git, check those once more right before writing the index, and
+ * clear the size of the ones which changed so that they do not look up
+ * to date.
+ */
+static void smudge_racily_clean_entries(const struct index_map *index, const char *workdir,
+	struct strbuf *entries, time_t start)
 {
-	please_git_do_it_for_me();
+	struct strbuf path = STRBUF_INIT;
 
+	for (unsigned int i = 0; i < index->nr; i++) {
+		char *data = entries->buf + index->offsets[i];
+		git_index_entry entry;
+		struct stat st;
+		uint32_t mtime;
+
+		memcpy(&mtime, data + 8, sizeof(mtime));
+		if ((time_t)ntohl(mtime) < start)
+			continue;
+
+		index_map_entry(index, i, &entry);
+		strbuf_reset(&path);
+		strbuf_addstr(&path, workdir);
+		strbuf_addstr(&path, entry.path);
+		if (lstat(path.buf, &st) || !index_entry_matches_file(&entry, path.buf, &st))
+			memset(data + 36, 0, 4);
+	}
+
+	strbuf_release(&path);
+}
+
+static int refresh_index(int quiet, int ignore_missing, int really)
+{
+	git_repository *repo = get_git_repository();
+	const char *workdir = git_repository_path(repo, GIT_REPO_PATH_WORKDIR);
+	struct output *out = get_stdout_output();
+	struct strbuf entries = STRBUF_INIT;
+	unsigned int workers = update_index_workers();
+	int has_errors = 0, changed = 0;
+	time_t start = time(NULL);
+
+	if (!workdir)
+		please_git_do_it_for_me(FALLBACK_WORK_TREE);
+
+	const struct index_map *index = get_git_index_map();
+
+	/* Conflicts, submodules and intent-to-add entries : git knows better */
+	for (unsigned int i = 0; i < index->nr; i++) {
+		git_index_entry entry;
+
+		index_map_entry(index, i, &entry);
+		if (git_index_entry_stage(&entry) || (entry.mode & S_IFMT) == S_IFGITLINK ||
+		    (entry.flags_extended & INDEX_ENTRY_INTENT_TO_ADD) ||
+		    (really && (entry.flags & GIT_IDXENTRY_VALID)))
+			please_git_do_it_for_me(FALLBACK_INDEX);
+	}
+
+	if (index->data)
+		strbuf_add(&entries, index->data, index->extensions);
+
+	struct refresh_job job = {
+		index, workdir, &entries, xmalloc(index->nr ? index->nr : 1),
+		get_git_config_bool(repo, "core.filemode", 1)
+	};
+	struct parallel_job parallel = {
+		index->nr, 0,
+		NULL, refresh_worker_process, NULL,
+		&job
+	};
+
+	if (index->nr < UPDATE_INDEX_PARALLEL_MIN)
+		workers = 1;
+	run_parallel(&parallel, workers);
+
+	for (unsigned int i = 0; i < index->nr; i++) {
+		switch (job.status[i]) {
+		case REFRESH_UPDATED:
+			changed = 1;
+			break;
+		case REFRESH_MISSING:
+			if (ignore_missing)
+				break;
+			/* fall through */
+		case REFRESH_NEEDS_UPDATE:
+			if (quiet)
+				break;
+			output_addf(out, "%s: needs update\n", index_map_path(index, i));
+			output_end_record(out);
+			has_errors = 1;
+			break;
+		}
+	}
+
+	if (changed) {
+		smudge_racily_clean_entries(index, workdir, &entries, start);
+		if (index_map_write(index, repo, &entries, 0, NULL, NULL) != GIT_SUCCESS)
+			die("Unable to write new index file");
+	}
+
+	free(job.status);
+	strbuf_release(&entries);
+
+	return has_errors ? 1 : EXIT_SUCCESS;
+}
+
+int cmd_update_index(int argc, const char **argv)
+{
 	if (argc < 2)
-		please_git_do_it_for_me();
-	
+		please_git_do_it_for_me(FALLBACK_USAGE);
+
+	/* "-q", "--ignore-missing" then "--refresh" (or "--really-refresh") */
+	if (!strcmp(argv[argc - 1], "--refresh") || !strcmp(argv[argc - 1], "--really-refresh")) {
+		int quiet = 0, ignore_missing = 0;
+
+		for (int i = 1; i < argc - 1; i++) {
+			if (!strcmp(argv[i], "-q"))
+				quiet = 1;
+			else if (!strcmp(argv[i], "--ignore-missing"))
+				ignore_missing = 1;
+			else
+				please_git_do_it_for_option(argv[i]);
+		}
+
+		return refresh_index(quiet, ignore_missing, !strcmp(argv[argc - 1], "--really-refresh"));
+	}
+
 	int filec = argc - 1;
 	const char **filev = argv + 1;
-	
+
 	int only_update_entry = 1;
-	
-	if (strcmp(argv[1], "--add") == 0) {
-		only_update_entry = 0;
-		filec--;
-		filev++;
+	int read_stdin = 0, nul_terminated = 0;
+
+	/* the options must come first, --stdin being the last one */
+	for (; filec; filec--, filev++) {
+		if (strcmp(filev[0], "--add") == 0)
+			only_update_entry = 0;
+		else if (strcmp(filev[0], "-z") == 0)
+			nul_terminated = 1;
+		else if (strcmp(filev[0], "--stdin") == 0 && !read_stdin)
+			read_stdin = 1;
+		else
+			break;
 	}
+	if (read_stdin && filec)
+		please_git_do_it_for_me(FALLBACK_USAGE);
 
-	
-	if (strcmp(filev[0], "--") == 0) {
+	if (filec && strcmp(filev[0], "--") == 0) {
 		filec--;
 		filev++;
 	} else {
-		for (int i = 0; i < filec; i++) {
-			for (int j = 0; j < UNSUPORTED_OPTIONS_NUM; j++) {
-				if (strcmp(filev[i], unsuported_options[j]) == 0 )
-					please_git_do_it_for_me();
-			}
-		}
+		/*
+		 * Options we do not know never get here (see run_builtin()) :
+		 * those we know, after the paths, are git's to report
+		 */
+		for (int i = 0; i < filec; i++)
+			if (filev[i][0] == '-' && filev[i][1])
+				please_git_do_it_for_me(FALLBACK_PATH);
 	}
-	
 
-	
-	int exit_status = EXIT_SUCCESS;
-	
 	/* Open the repo */
 	git_repository *repo = get_git_repository();
-	
+	const char *workdir = git_repository_path(repo, GIT_REPO_PATH_WORKDIR);
+	const char *prefix = get_git_prefix();
+	size_t prefix_len = strlen(prefix);
+	unsigned int workers = update_index_workers();
+
+	if (!workdir)
+		please_git_do_it_for_me(FALLBACK_WORK_TREE);
+
+	/* libgit2 drops the cache-tree : keep it, less the directories we change */
+	const struct index_map *index_file = get_git_index_map();
+	struct cache_tree *cache_tree = cache_tree_read(index_file);
+
+	/* Past this point, falling back to git has to give it its input again */
+	struct strbuf input = STRBUF_INIT;
+	if (read_stdin && strbuf_read(&input, 0, 0) < 0)
+		die_errno("could not read from stdin");
+	const struct strbuf *replay = read_stdin ? &input : NULL;
+
+	struct arena paths = ARENA_INIT;
+	struct update_item *items = NULL;
+	unsigned int nr = 0, alloc = 0;
+
+	for (size_t offset = 0, i = 0; read_stdin ? offset < input.len : i < (size_t)filec; i++) {
+		const char *path;
+		size_t len;
+
+		if (read_stdin) {
+			const char *end = memchr(input.buf + offset, nul_terminated ? '\0' : '\n', input.len - offset);
+
+			path = input.buf + offset;
+			len = (end ? end : input.buf + input.len) - path;
+			offset += len + 1;
+			/* as git's strbuf_getline(), lines may end with "\r\n" */
+			if (!nul_terminated && len && path[len - 1] == '\r')
+				len--;
+			/* quoted names : let git unquote them */
+			if (!nul_terminated && *path == '"')
+				fall_back(FALLBACK_PATH, replay);
+		} else {
+			path = filev[i];
+			len = strlen(path);
+		}
+
+		if (!is_normal_path(path, len))
+			fall_back(FALLBACK_PATH, replay);
+
+		char *complete_path = arena_alloc(&paths, prefix_len + len + 1);
+		memcpy(complete_path, prefix, prefix_len);
+		memcpy(complete_path + prefix_len, path, len);
+		complete_path[prefix_len + len] = '\0';
+
+		ALLOC_GROW(items, nr + 1, alloc);
+		memset(&items[nr], 0, sizeof(items[nr]));
+		items[nr++].path = complete_path;
+	}
+
 	/* Open the index */
 	git_index *index_cur;
-	if (git_repository_index(&index_cur, repo) < 0)
+	if (get_git_repository_index(&index_cur, repo) < 0)
 		libgit_error();
-	
-
-	char complete_path[5000];
-	for (int i = 0; i < filec; i++) {
-		int stage = 0;
-		strcpy(complete_path, get_git_prefix());
-		strcat(complete_path, filev[i]);
-		
-
-		if (only_update_entry) {
-			if (git_index_find(index_cur, complete_path) < 0) {
-				printf("error: %s: cannot add to the index - missing --add option?\n", filev[i]);
-				printf("fatal: Unable to process path %s\n", filev[i]);
-				return 1;
-			}
+
+
+	/* git explains paths missing --add and resolves conflicts */
+	for (unsigned int i = 0; i < nr; i++) {
+		int pos = git_index_find(index_cur, items[i].path);
+
+		if (pos >= 0) {
+			items[i].old = git_index_get(index_cur, pos);
+			if (git_index_entry_stage(items[i].old))
+				fall_back(FALLBACK_INDEX, replay);
+		} else if (only_update_entry || is_directory_conflict(index_cur, index_file, items[i].path)) {
+			fall_back(FALLBACK_ERROR, replay);
 		}
+	}
+
+	/* Hash and write the blobs, on several threads for the big batches */
+	struct update_job job = {
+		items, workdir, index_file->mtime, get_git_config_bool(repo, "core.filemode", 1),
+		git_repository_path(repo, GIT_REPO_PATH), NULL
+	};
+	struct parallel_job parallel = {
+		nr, 0,
+		update_worker_init, update_worker_process, update_worker_release,
+		&job
+	};
 
-		int e = git_index_add(index_cur, complete_path, stage);
-		
+	if (nr < UPDATE_INDEX_PARALLEL_MIN)
+		workers = 1;
+	job.repositories = xcalloc(workers, sizeof(git_repository *));
+	run_parallel(&parallel, workers);
+	free(job.repositories);
 
-		if (e != 0)
+	for (unsigned int i = 0; i < nr; i++) {
+		if (items[i].status == UPDATE_FALLBACK)
+			fall_back(FALLBACK_ERROR, replay);
+		if (items[i].status == UPDATE_ERROR)
 			libgit_error();
 	}
 
-	
-	if (exit_status == EXIT_SUCCESS)
-		git_index_write(index_cur);
+	/*
+	 * Apply the batch : the entries already there are updated in place,
+	 * the new ones are appended in path order and git_index_write() sorts
+	 * the index once.
+	 */
+	struct update_item **added = xmalloc((nr ? nr : 1) * sizeof(*added));
+	unsigned int nr_added = 0, changed = 0;
 
-	
+	for (unsigned int i = 0; i < nr; i++) {
+		struct update_item *item = &items[i];
 
-	return exit_status;
-}
+		if (item->status != UPDATE_CHANGED)
+			continue;
+		changed++;
+		if (cache_tree)
+			cache_tree_invalidate_path(cache_tree, item->path);
+
+		if (!item->old) {
+			added[nr_added++] = item;
+			continue;
+		}
+		item->old->ctime = item->entry.ctime;
+		item->old->mtime = item->entry.mtime;
+		item->old->dev = item->entry.dev;
+		item->old->ino = item->entry.ino;
+		item->old->mode = item->entry.mode;
+		item->old->uid = item->entry.uid;
+		item->old->gid = item->entry.gid;
+		item->old->file_size = item->entry.file_size;
+		git_oid_cpy(&item->old->oid, &item->entry.oid);
+	}
+
+	qsort(added, nr_added, sizeof(*added), item_path_cmp);
+	for (unsigned int i = 0; i < nr_added; i++) {
+		const char *path = added[i]->path;
+		size_t len = strlen(path);
+
+		if (i + 1 < nr_added && !strcmp(path, added[i + 1]->path))
+			continue;
+		/* "a" and "a/b" both added : "a/b" comes after "a" and the "a..." before '/' */
+		for (unsigned int j = i + 1; j < nr_added && !strncmp(added[j]->path, path, len); j++) {
+			if (added[j]->path[len] == '/')
+				fall_back(FALLBACK_ERROR, replay);
+			if (added[j]->path[len] > '/')
+				break;
+		}
 
+		if (git_index_append2(index_cur, &added[i]->entry) < GIT_SUCCESS)
+			libgit_error();
+	}
+	free(added);
+
+	if (changed) {
+		/* the objects first : the index must not name objects which are lost */
+		fsync_batch();
+		if (git_index_write(index_cur) < GIT_SUCCESS)
+			libgit_error();
+		fsync_written_path(git_repository_path(repo, GIT_REPO_PATH_INDEX));
+		if (cache_tree)
+			cache_tree_write_index(cache_tree, repo, 0);
+	}
+	cache_tree_free(cache_tree);
+
+	free(items);
+	arena_release(&paths);
+	strbuf_release(&input);
+
+	return EXIT_SUCCESS;
+}
@@ -10,50 +10,61 @@
 #include "repository.h"
 #include "strbuf.h"
 #include "utils.h"
+#include "output.h"
+#include "index-map.h"
+#include "cache-tree.h"
 
 
 int cmd_write_tree(int argc, const char **argv)
 {
-	please_git_do_it_for_me();
-
 	int verify_index = 1;
 	if (argc == 1)
 		verify_index = 1;
 	else if (argc == 2 && strcmp(argv[1], "--missing-ok") == 0 )
 		verify_index = 0;
 	else
-		please_git_do_it_for_me();
+		please_git_do_it_for_option(argv[1]);
 	
 
-	char sha1buf[GIT_OID_HEXSZ + 1];
+	struct output *out = get_stdout_output();
 
 	git_repository *repo = get_git_repository();
-	git_index *index_cur;
-	int e = git_repository_index(&index_cur, repo);
-	if(e != GIT_SUCCESS)
-		libgit_error();
+	const struct index_map *index = get_git_index_map();
+
+	/* Only the trees of the directories changed since the last write-tree are written */
+	struct cache_tree *root = cache_tree_read(index);
+	int was_valid = root->entry_count >= 0;
+	unsigned int bad_entry;
 
-	/* check the index */
-	if (verify_index) {
-		git_odb * odb = git_repository_database(repo);
-		for (unsigned i = 0; i < git_index_entrycount(index_cur); i++) {
-			git_index_entry *gie = git_index_get(index_cur, i);
-
-			if (git_odb_exists(odb, &gie->oid) != 1) {
-				printf("error: invalid object %06o %s for '%s'\n", gie->mode, git_oid_to_string(sha1buf, GIT_OID_HEXSZ+1, &gie->oid), gie->path);
-				printf("fatal: git-write-tree: error building trees\n");
-				return EXIT_FAILURE;
-			}
-		}
+	int e = cache_tree_update(root, index, repo, !verify_index, &bad_entry);
+	if (e == GIT_ENOTIMPLEMENTED) {
+		/* Unmerged or intent-to-add entries : let git explain */
+		please_git_do_it_for_me(FALLBACK_INDEX);
+	} else if (e == GIT_ENOTFOUND) {
+		char hex[GIT_OID_HEXSZ + 1];
+		git_index_entry gie;
+
+		/* as git, on stderr, and error() would exit */
+		index_map_entry(index, bad_entry, &gie);
+		git_oid_fmt(hex, &gie.oid);
+		hex[GIT_OID_HEXSZ] = '\0';
+		fprintf(stderr, "error: invalid object %06o %s for '%s'\n", gie.mode, hex, gie.path);
+		die("git-write-tree: error building trees");
+	} else if (e != GIT_SUCCESS) {
+		libgit_error();
 	}
-	
-	/* create the tree */
+
+	/* Keep what was computed for the next time, if the index can be locked */
+	if (!was_valid)
+		cache_tree_write_index(root, repo, 0);
+
 	git_oid oid;
-	e = git_tree_create_fromindex(&oid, index_cur);
-	if(e != GIT_SUCCESS)
-		libgit_error();
+	git_oid_cpy(&oid, &root->oid);
+	cache_tree_free(root);
 
-	printf("%s\n", git_oid_to_string(sha1buf, GIT_OID_HEXSZ+1, &oid));
+	output_add_oid(out, &oid);
+	output_addch(out, '\n');
+	output_end_record(out);
 
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,61 @@
+#ifndef BYTE_ORDER_H
+#define BYTE_ORDER_H
+
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "strbuf.h"
+
+/*
+ * The big-endian integers of the files git2 maps and writes (the index
+ * and its extensions, packs and their indexes, the commit cache, the
+ * prefix tables and the untracked cache). They are read and written
+ * through memcpy() : nothing in these files is aligned for the host.
+ */
+
+static inline uint16_t get_be16_at(const void *data)
+{
+	uint16_t value;
+
+	memcpy(&value, data, sizeof(value));
+	return ntohs(value);
+}
+
+static inline uint32_t get_be32_at(const void *data)
+{
+	uint32_t value;
+
+	memcpy(&value, data, sizeof(value));
+	return ntohl(value);
+}
+
+static inline uint64_t get_be64_at(const void *data)
+{
+	return (uint64_t)get_be32_at(data) << 32 | get_be32_at((const unsigned char *)data + 4);
+}
+
+static inline void put_be32_at(void *data, uint32_t value)
+{
+	value = htonl(value);
+	memcpy(data, &value, sizeof(value));
+}
+
+static inline void add_be16(struct strbuf *sb, uint16_t value)
+{
+	value = htons(value);
+	strbuf_add(sb, &value, sizeof(value));
+}
+
+static inline void add_be32(struct strbuf *sb, uint32_t value)
+{
+	value = htonl(value);
+	strbuf_add(sb, &value, sizeof(value));
+}
+
+static inline void add_be64(struct strbuf *sb, uint64_t value)
+{
+	add_be32(sb, (uint32_t)(value >> 32));
+	add_be32(sb, (uint32_t)value);
+}
+
+#endif
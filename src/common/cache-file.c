@@ -0,0 +1,38 @@
+#include "git-compat-util.h"
+#include <sys/file.h>
+#include "cache-file.h"
+#include "strbuf.h"
+#include "utils.h"
+
+int write_cache_file(const char *file, const void *data, size_t len)
+{
+	struct strbuf lock = STRBUF_INIT;
+	struct strbuf tmp = STRBUF_INIT;
+	int lock_fd, fd, e = -1;
+
+	strbuf_addf(&lock, "%s.lock", file);
+	strbuf_addf(&tmp, "%s.tmp", file);
+
+	/* reading is enough to flock(), and opens the read-only lock files of the older git2 */
+	lock_fd = open(lock.buf, O_RDONLY | O_CREAT | O_CLOEXEC, 0444);
+	if (lock_fd >= 0 && !flock(lock_fd, LOCK_EX | LOCK_NB)) {
+		/* what a writer which died left, if anything */
+		unlink(tmp.buf);
+		fd = open(tmp.buf, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0444);
+		if (fd >= 0) {
+			int failed = write_in_full(fd, data, len) < 0;
+
+			if (close(fd) || failed || rename(tmp.buf, file))
+				unlink(tmp.buf);
+			else
+				e = 0;
+		}
+	}
+	/* which releases the flock() */
+	if (lock_fd >= 0)
+		close(lock_fd);
+
+	strbuf_release(&tmp);
+	strbuf_release(&lock);
+	return e;
+}
@@ -0,0 +1,26 @@
+#ifndef CACHE_FILE_H
+#define CACHE_FILE_H
+
+#include <stddef.h>
+
+/*
+ * The files of the caches git2 keeps beside those of git (the commit
+ * cache, the prefix table of the packs, the discovery and untracked
+ * caches) are rewritten whole, by one process at a time. The writer
+ * holds a flock() on "<file>.lock", which is never removed, and writes
+ * "<file>.tmp" before moving it over the file : readers take no lock,
+ * they see the old file or the new one.
+ *
+ * The kernel releases the lock of a process as it dies, so that a writer
+ * killed in the middle (or a full disk) leaves no lock behind which
+ * would keep the others from writing the cache again, as a lock file
+ * created with O_EXCL does.
+ */
+
+int write_cache_file(const char *file, const void *data, size_t len);
+//write the len bytes at data to file (read-only, as git's packs) unless
+//another process is writing it. Returns 0 once it is in place, -1 if it
+//is being written or cannot be : the caches are accelerators, callers
+//go on without them
+
+#endif
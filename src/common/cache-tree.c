@@ -0,0 +1,393 @@
+#include "git-compat-util.h"
+#include "cache-tree.h"
+#include "utils.h"
+#include "odb-batch.h"
+#include "trace.h"
+#include "ctype.h"
+#include "fsync.h"
+
+struct cache_tree *cache_tree_new(const char *name, size_t len)
+{
+	struct cache_tree *tree = xcalloc(1, sizeof(*tree) + len + 1);
+
+	tree->entry_count = -1;
+	tree->name_len = len;
+	memcpy(tree->name, name, len);
+	return tree;
+}
+
+void cache_tree_free(struct cache_tree *tree)
+{
+	if (!tree)
+		return;
+
+	for (unsigned int i = 0; i < tree->nr; i++)
+		cache_tree_free(tree->subtrees[i]);
+	free(tree->subtrees);
+	free(tree);
+}
+
+static struct cache_tree *find_subtree(struct cache_tree *tree, const char *name, size_t len, int create)
+{
+	struct cache_tree *subtree;
+
+	for (unsigned int i = 0; i < tree->nr; i++) {
+		subtree = tree->subtrees[i];
+		if (subtree->name_len == len && !memcmp(subtree->name, name, len))
+			return subtree;
+	}
+
+	if (!create)
+		return NULL;
+
+	subtree = cache_tree_new(name, len);
+	ALLOC_GROW(tree->subtrees, tree->nr + 1, tree->alloc);
+	tree->subtrees[tree->nr++] = subtree;
+	return subtree;
+}
+
+const struct cache_tree *cache_tree_subtree(const struct cache_tree *tree, const char *name, size_t len)
+{
+	return find_subtree((struct cache_tree *)tree, name, len, 0);
+}
+
+struct cache_tree *cache_tree_copy(const struct cache_tree *tree)
+{
+	struct cache_tree *copy = cache_tree_new(tree->name, tree->name_len);
+
+	copy->entry_count = tree->entry_count;
+	git_oid_cpy(&copy->oid, &tree->oid);
+	for (unsigned int i = 0; i < tree->nr; i++) {
+		ALLOC_GROW(copy->subtrees, copy->nr + 1, copy->alloc);
+		copy->subtrees[copy->nr++] = cache_tree_copy(tree->subtrees[i]);
+	}
+	return copy;
+}
+
+/* A decimal number ended by stop, -1 is allowed when signed_value */
+static int read_number(const unsigned char **p, const unsigned char *end, int stop, int signed_value, int *value)
+{
+	const unsigned char *q = *p;
+	long number = 0;
+	int negative = 0;
+
+	if (signed_value && q < end && *q == '-') {
+		negative = 1;
+		q++;
+	}
+	if (q == end || !isdigit(*q))
+		return -1;
+	for (; q < end && isdigit(*q); q++) {
+		number = number * 10 + (*q - '0');
+		if (number > INT_MAX)
+			return -1;
+	}
+	if (q == end || *q != stop)
+		return -1;
+
+	*value = negative ? -(int)number : (int)number;
+	*p = q + 1;
+	return 0;
+}
+
+static struct cache_tree *read_one(const unsigned char **p, const unsigned char *end)
+{
+	const unsigned char *name = *p;
+	const unsigned char *nul = memchr(name, '\0', end - name);
+	struct cache_tree *tree;
+	int entry_count, nr;
+
+	if (!nul)
+		return NULL;
+	*p = nul + 1;
+
+	if (read_number(p, end, ' ', 1, &entry_count) < 0 || entry_count < -1 ||
+	    read_number(p, end, '\n', 0, &nr) < 0)
+		return NULL;
+
+	tree = cache_tree_new((const char *)name, nul - name);
+	tree->entry_count = entry_count;
+	if (entry_count >= 0) {
+		if (end - *p < GIT_OID_RAWSZ) {
+			cache_tree_free(tree);
+			return NULL;
+		}
+		memcpy(tree->oid.id, *p, GIT_OID_RAWSZ);
+		*p += GIT_OID_RAWSZ;
+	}
+
+	for (int i = 0; i < nr; i++) {
+		struct cache_tree *subtree = read_one(p, end);
+
+		if (!subtree) {
+			cache_tree_free(tree);
+			return NULL;
+		}
+		ALLOC_GROW(tree->subtrees, tree->nr + 1, tree->alloc);
+		tree->subtrees[tree->nr++] = subtree;
+	}
+
+	return tree;
+}
+
+struct cache_tree *cache_tree_read(const struct index_map *map)
+{
+	const unsigned char *data;
+	uint32_t size;
+	struct cache_tree *root = NULL;
+
+	if (index_map_extension(map, CACHE_TREE_SIGNATURE, &data, &size)) {
+		root = read_one(&data, data + size);
+		/* the root has an empty name */
+		if (root && root->name_len) {
+			cache_tree_free(root);
+			root = NULL;
+		}
+	}
+
+	return root ? root : cache_tree_new("", 0);
+}
+
+void cache_tree_invalidate_path(struct cache_tree *root, const char *path)
+{
+	struct cache_tree *tree = root;
+
+	while (tree) {
+		const char *slash = strchr(path, '/');
+
+		tree->entry_count = -1;
+		if (!slash)
+			return;
+		tree = find_subtree(tree, path, slash - path, 0);
+		path = slash + 1;
+	}
+}
+
+void cache_tree_write(struct strbuf *out, const struct cache_tree *tree)
+{
+	strbuf_add(out, tree->name, tree->name_len);
+	strbuf_addch(out, '\0');
+	strbuf_addf(out, "%d %u\n", tree->entry_count, tree->nr);
+	if (tree->entry_count >= 0)
+		strbuf_add(out, tree->oid.id, GIT_OID_RAWSZ);
+
+	for (unsigned int i = 0; i < tree->nr; i++)
+		cache_tree_write(out, tree->subtrees[i]);
+}
+
+struct update_state {
+	const struct index_map *map;
+	git_repository *repo;
+	git_odb *odb;
+	int missing_ok;
+	unsigned int *bad_entry;
+
+	/* the entries whose objects are checked, and whether they were found */
+	unsigned int *checked;
+	unsigned int nr, alloc;
+	unsigned char *found;
+};
+
+/* Forget the subdirectories which are not in the index anymore */
+static void drop_unused_subtrees(struct cache_tree *tree)
+{
+	unsigned int kept = 0;
+
+	for (unsigned int i = 0; i < tree->nr; i++) {
+		if (tree->subtrees[i]->used)
+			tree->subtrees[kept++] = tree->subtrees[i];
+		else
+			cache_tree_free(tree->subtrees[i]);
+	}
+	tree->nr = kept;
+}
+
+/*
+ * Before computing anything, find the directories which can be reused
+ * and invalidate the others, and gather the entries these have directly
+ * so that their objects are all checked in one batch.
+ */
+static void prepare_one(struct update_state *state, struct cache_tree *tree, size_t baselen, unsigned int begin, unsigned int end)
+{
+	const struct index_map *map = state->map;
+	unsigned int i = begin;
+
+	if (tree->entry_count >= 0) {
+		if ((unsigned int)tree->entry_count == end - begin &&
+		    git_odb_exists(state->odb, &tree->oid) == 1)
+			return;
+		tree->entry_count = -1;
+	}
+
+	while (i < end) {
+		const char *path = index_map_path(map, i);
+		const char *name = path + baselen;
+		const char *slash = strchr(name, '/');
+		git_index_entry entry;
+
+		if (slash) {
+			size_t len = slash - name;
+			struct cache_tree *subtree = find_subtree(tree, name, len, 1);
+			unsigned int subtree_end = index_map_prefix_end(map, i, path, baselen + len + 1);
+
+			prepare_one(state, subtree, baselen + len + 1, i, subtree_end);
+			i = subtree_end;
+			continue;
+		}
+
+		index_map_entry(map, i, &entry);
+		/* submodules are commits of other repositories */
+		if (!state->missing_ok && (entry.mode & S_IFMT) != S_IFGITLINK) {
+			ALLOC_GROW(state->checked, state->nr + 1, state->alloc);
+			state->checked[state->nr++] = i;
+		}
+		i++;
+	}
+}
+
+/* Whether the object of the entry at pos was found, the checked entries being in index order */
+static int entry_found(const struct update_state *state, unsigned int pos)
+{
+	unsigned int lo = 0, hi = state->nr;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (state->checked[mid] < pos)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo == state->nr || state->checked[lo] != pos || state->found[lo];
+}
+
+static const git_oid null_oid;
+
+/* Compute the tree of the entries [begin, end), which are below a directory whose path is baselen long */
+static int update_one(struct update_state *state, struct cache_tree *tree, size_t baselen, unsigned int begin, unsigned int end)
+{
+	const struct index_map *map = state->map;
+	struct strbuf buf = STRBUF_INIT;
+	unsigned int i = begin;
+	int e = GIT_SUCCESS;
+
+	/* prepare_one() kept it valid */
+	if (tree->entry_count >= 0)
+		return GIT_SUCCESS;
+
+	for (unsigned int j = 0; j < tree->nr; j++)
+		tree->subtrees[j]->used = 0;
+
+	while (i < end) {
+		const char *path = index_map_path(map, i);
+		const char *name = path + baselen;
+		const char *slash = strchr(name, '/');
+		git_index_entry entry;
+
+		if (slash) {
+			size_t len = slash - name;
+			struct cache_tree *subtree = find_subtree(tree, name, len, 1);
+			unsigned int subtree_end = index_map_prefix_end(map, i, path, baselen + len + 1);
+
+			subtree->used = 1;
+			e = update_one(state, subtree, baselen + len + 1, i, subtree_end);
+			if (e != GIT_SUCCESS)
+				goto done;
+
+			strbuf_addstr(&buf, "40000 ");
+			strbuf_add(&buf, name, len);
+			strbuf_addch(&buf, '\0');
+			strbuf_add(&buf, subtree->oid.id, GIT_OID_RAWSZ);
+
+			i = subtree_end;
+			continue;
+		}
+
+		index_map_entry(map, i, &entry);
+		if (git_index_entry_stage(&entry) || (entry.flags_extended & INDEX_ENTRY_INTENT_TO_ADD)) {
+			e = GIT_ENOTIMPLEMENTED;
+			goto done;
+		}
+		/* as git, the null oid is invalid, even with --missing-ok or for a submodule */
+		if (!git_oid_cmp(&entry.oid, &null_oid) || !entry_found(state, i)) {
+			*state->bad_entry = i;
+			e = GIT_ENOTFOUND;
+			goto done;
+		}
+
+		strbuf_addf(&buf, "%o ", entry.mode);
+		strbuf_add(&buf, name, strlen(name) + 1);
+		strbuf_add(&buf, entry.oid.id, GIT_OID_RAWSZ);
+		i++;
+	}
+
+	drop_unused_subtrees(tree);
+
+	e = git_odb_hash(&tree->oid, buf.buf, buf.len, GIT_OBJ_TREE);
+	if (e == GIT_SUCCESS && git_odb_exists(state->odb, &tree->oid) != 1)
+		if ((e = git_odb_write(&tree->oid, state->odb, buf.buf, buf.len, GIT_OBJ_TREE)) == GIT_SUCCESS)
+			fsync_loose_object(state->repo, &tree->oid);
+	if (e == GIT_SUCCESS)
+		tree->entry_count = end - begin;
+
+done:
+	strbuf_release(&buf);
+	return e;
+}
+
+int cache_tree_update(struct cache_tree *root, const struct index_map *map, git_repository *repo, int missing_ok, unsigned int *bad_entry)
+{
+	struct update_state state = {map, repo, git_repository_database(repo), missing_ok, bad_entry, NULL, 0, 0, NULL};
+	uint64_t start = trace_perf_start();
+	int e;
+
+	prepare_one(&state, root, 0, 0, map->nr);
+	if (state.nr) {
+		git_oid *oids = xmalloc(state.nr * sizeof(*oids));
+		git_index_entry entry;
+
+		for (unsigned int i = 0; i < state.nr; i++) {
+			index_map_entry(map, state.checked[i], &entry);
+			git_oid_cpy(&oids[i], &entry.oid);
+		}
+		state.found = xmalloc(state.nr);
+		odb_exists_batch(repo, oids, state.nr, state.found);
+		free(oids);
+	}
+
+	e = update_one(&state, root, 0, 0, map->nr);
+
+	free(state.checked);
+	free(state.found);
+	trace_perf_stop("cache_tree_update", start);
+	return e;
+}
+
+int cache_tree_write_index(const struct cache_tree *root, git_repository *repo, int sparse)
+{
+	struct index_map map = INDEX_MAP_INIT;
+	struct strbuf entries = STRBUF_INIT;
+	struct strbuf tree = STRBUF_INIT;
+	int e;
+
+	e = index_map_load(&map, repo);
+	if (e != GIT_SUCCESS || !map.data)
+		goto done;
+
+	strbuf_add(&entries, map.data, map.extensions);
+	cache_tree_write(&tree, root);
+
+	/* the "sdir" extension is empty : it tells git the index is sparse */
+	if (sparse && !index_map_sparse(&map))
+		strbuf_add(&entries, SPARSE_INDEX_SIGNATURE "\0\0\0\0", 8);
+
+	/* the entries written in the same second as the index could be racily clean */
+	e = index_map_write(&map, repo, &entries, map.mtime, CACHE_TREE_SIGNATURE, &tree);
+
+done:
+	strbuf_release(&tree);
+	strbuf_release(&entries);
+	index_map_release(&map);
+	return e;
+}
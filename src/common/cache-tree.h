@@ -0,0 +1,69 @@
+#ifndef CACHE_TREE_H
+#define CACHE_TREE_H
+
+#include <git2.h>
+#include "index-map.h"
+#include "strbuf.h"
+
+/*
+ * The cache-tree of the index (its "TREE" extension) : for the
+ * directories of the index, the tree object they were last written as
+ * and how many entries it covers. write-tree only computes again the
+ * trees of the directories which changed since ; the commands changing
+ * the index invalidate the directories of the paths they touch.
+ *
+ * In the extension, each directory is written as its name, a NUL, its
+ * number of entries (-1 if it is invalid), a space, its number of
+ * subdirectories and a newline, then its raw oid when it is valid, then
+ * its subdirectories in the same way. The root has an empty name.
+ */
+
+#define CACHE_TREE_SIGNATURE "TREE"
+
+struct cache_tree {
+	int entry_count; /* index entries below, -1 if the tree must be computed again */
+	git_oid oid;
+	unsigned int nr, alloc;
+	struct cache_tree **subtrees;
+	int used; /* while updating : still a directory of the index */
+	size_t name_len;
+	char name[];
+};
+
+struct cache_tree *cache_tree_new(const char *name, size_t len);
+//a new invalid directory
+
+void cache_tree_free(struct cache_tree *tree);
+
+const struct cache_tree *cache_tree_subtree(const struct cache_tree *tree, const char *name, size_t len);
+//the subdirectory name of tree, NULL if it has none
+
+struct cache_tree *cache_tree_copy(const struct cache_tree *tree);
+//a copy of tree and of all its subdirectories
+
+struct cache_tree *cache_tree_read(const struct index_map *map);
+//the cache-tree of the index, an invalid root if it has none (or an
+//invalid one)
+
+void cache_tree_invalidate_path(struct cache_tree *root, const char *path);
+//the directories of path have changed
+
+void cache_tree_write(struct strbuf *out, const struct cache_tree *root);
+//add root in the format of the extension to out
+
+int cache_tree_update(struct cache_tree *root, const struct index_map *map, git_repository *repo, int missing_ok, unsigned int *bad_entry);
+//write the trees of the invalid directories of the index in the odb of
+//repo, so that root->oid is the tree of the whole index. The objects of
+//their entries are checked at once with odb_exists_batch(). Returns GIT_SUCCESS,
+//GIT_ENOTFOUND if the object of an entry is missing (unless missing_ok)
+//or null (*bad_entry is that entry), GIT_ENOTIMPLEMENTED if the index has
+//unmerged or intent-to-add entries, or the libgit2 error of a write
+
+int cache_tree_write_index(const struct cache_tree *root, git_repository *repo, int sparse);
+//save root in the index file of repo, in place of the cache-tree it has.
+//If sparse, the index has sparse directory entries (see read-tree) and
+//is marked as a sparse index.
+//Entries which could be racily clean are smudged, as git does. Returns
+//GIT_SUCCESS, GIT_EFLOCKFAIL if the index is locked or GIT_EOSERR
+
+#endif
@@ -0,0 +1,163 @@
+/*
+ * Daemon: a long-lived git2 which runs the commands of git2 invocations
+ * that forward them (GIT2_DAEMON_SOCKET), with the same protocol as the
+ * fallback helper.
+ *
+ * The daemon opens the repository of each request and maps its index,
+ * keeping both from one request to the next while they stay the same.
+ * Each command then runs in a process forked from it, which finds them
+ * already there: a crash, a die() or an exec of git in a command never
+ * takes the daemon down, and nothing a command does lingers in it.
+ */
+#include <signal.h>
+#include "git-compat-util.h"
+#include "daemon.h"
+#include "environment.h"
+#include "ipc.h"
+#include "utils.h"
+#include "errors.h"
+#include "git-support.h"
+#include "repository.h"
+#include "trace.h"
+
+static volatile sig_atomic_t stop_requested;
+
+/* the strings of the environment of the last request, putenv()ed */
+static char **request_env;
+static int request_env_nr;
+
+static void handle_signal(int sig)
+{
+	(void)sig;
+	stop_requested = 1;
+}
+
+static void set_request_environment(const struct ipc_request *request)
+{
+	int i;
+
+	clearenv();
+	for (i = 0; i < request_env_nr; i++)
+		free(request_env[i]);
+	free(request_env);
+
+	request_env = xmalloc((request->envc + 1) * sizeof(*request_env));
+	request_env_nr = request->envc;
+	for (i = 0; i < request->envc; i++) {
+		request_env[i] = xstrdup(request->env[i]);
+		putenv(request_env[i]);
+	}
+	/* the command must not forward itself back to us */
+	unsetenv(GIT2_DAEMON_SOCKET_ENVIRONMENT);
+}
+
+static void NORETURN run_request(struct ipc_request *request, int (*run)(int argc, const char **argv))
+{
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		dup2(request->fds[i], i);
+		close(request->fds[i]);
+	}
+
+	/* a fallback runs git with the command line of the request */
+	git_support_free_arguments();
+	git_support_register_arguments(request->argc, request->argv);
+
+	do_exit(run(request->argc - 1, request->argv + 1));
+}
+
+static void NORETURN serve_request(int client, struct ipc_request *request,
+	int (*run)(int argc, const char **argv))
+{
+	pid_t pid;
+	int status, code;
+
+	signal(SIGCHLD, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGINT, SIG_DFL);
+
+	pid = fork();
+	if (pid < 0)
+		_exit(1);
+	if (!pid) {
+		close(client);
+		run_request(request, run);
+	}
+
+	while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+		; /* nothing */
+
+	if (WIFSIGNALED(status))
+		code = 128 + WTERMSIG(status);
+	else
+		code = WEXITSTATUS(status);
+
+	ipc_send_status(client, code);
+	_exit(0);
+}
+
+void run_daemon(const char *socket_path, int (*run)(int argc, const char **argv))
+{
+	struct sigaction action;
+	int listener;
+
+	listener = ipc_listen(socket_path);
+	if (listener < 0)
+		die_errno("cannot listen on '%s'", socket_path);
+
+	/* no SA_RESTART: accept() must return to look at the flag */
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = handle_signal;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGTERM, &action, NULL);
+	sigaction(SIGINT, &action, NULL);
+	/* session processes are reaped automatically */
+	signal(SIGCHLD, SIG_IGN);
+
+	while (!stop_requested) {
+		struct ipc_request request;
+		int client;
+		pid_t pid;
+
+		client = accept(listener, NULL, NULL);
+		if (client < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			die_errno("accept failed on '%s'", socket_path);
+		}
+
+		if (ipc_recv_request(client, &request) < 0 || request.argc < 2) {
+			if (request.argv)
+				ipc_release_request(&request);
+			close(client);
+			continue;
+		}
+
+		if (chdir(request.cwd)) {
+			ipc_send_status(client, 128);
+			ipc_release_request(&request);
+			close(client);
+			continue;
+		}
+		set_request_environment(&request);
+		trace_perf_reset();
+		/* a repository which cannot be opened is reported by the command */
+		prepare_git_repository();
+
+		pid = fork();
+		if (!pid) {
+			close(listener);
+			serve_request(client, &request, run);
+		}
+		if (pid < 0)
+			ipc_send_status(client, 128);
+
+		ipc_release_request(&request);
+		close(client);
+	}
+
+	close(listener);
+	unlink(socket_path);
+	do_exit(0);
+}
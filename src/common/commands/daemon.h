@@ -0,0 +1,8 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+void run_daemon(const char *socket_path, int (*run)(int argc, const char **argv)) __attribute__((noreturn));
+//serve the commands forwarded on socket_path (see ipc_forward()) with
+//run, which gets them without "git", until SIGTERM/SIGINT
+
+#endif
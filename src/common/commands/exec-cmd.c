@@ -8,6 +8,9 @@
 
 static const char *argv_exec_path;
 static char *argv0_path = NULL;
+/* argv0_path is only copied from argv[0] when it is needed */
+static const char *argv0_dir = NULL;
+static size_t argv0_dir_len = 0;
 
 /*const char *system_path(const char *path)
 {
@@ -53,7 +56,8 @@ const char *git_extract_argv0_path(const char *argv0)
 		slash--;
 
 	if (slash >= argv0) {
-		argv0_path = xstrndup(argv0, slash - argv0);
+		argv0_dir = argv0;
+		argv0_dir_len = slash - argv0;
 		return slash + 1;
 	}
 
@@ -108,6 +112,9 @@ void setup_path(void)
 	const char *old_path = getenv("PATH");
 	struct strbuf new_path = STRBUF_INIT;
 
+	if (argv0_dir && !argv0_path)
+		argv0_path = xstrndup(argv0_dir, argv0_dir_len);
+
 	//add_path(&new_path, git_exec_path());
 	add_path(&new_path, argv0_path);
 
@@ -5,9 +5,18 @@
 
 typedef int (*cmd_handler)(int, const char**);
 
+/* The options a builtin handles natively, see run_builtin() */
+struct native_options {
+	const char *const *names; /* sorted */
+	unsigned int nr_names;
+	const char *const *patterns; /* "-j*", "-n#" */
+	unsigned int nr_patterns;
+};
+
 typedef struct cmd_struct{
 	char *cmd;
 	cmd_handler handler;
+	const struct native_options *options;
 } cmd_struct;
 
 //void git_set_argv_exec_path(const char *exec_path);
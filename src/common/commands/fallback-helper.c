@@ -0,0 +1,183 @@
+/*
+ * Fallback helper: a small long-lived process that runs git on behalf
+ * of git2 invocations which cannot do their job natively.
+ *
+ * Without it, every unsupported call pays for our whole startup and then
+ * for an execvp() of git from our (possibly big) address space. With it,
+ * git2 only sends its argv, cwd, environ and standard fds over a unix
+ * socket and waits for the exit code; the helper, which stays tiny and
+ * warm, does the fork/exec and counts how often each command falls back.
+ */
+#include <signal.h>
+#include "git-compat-util.h"
+#include "fallback-helper.h"
+#include "environment.h"
+#include "ipc.h"
+#include "utils.h"
+#include "errors.h"
+
+struct fallback_counter {
+	char *cmd;
+	unsigned long count;
+};
+
+static struct fallback_counter *counters;
+static int counters_nr, counters_alloc;
+
+static volatile sig_atomic_t dump_requested;
+static volatile sig_atomic_t stop_requested;
+
+static void count_fallback(const char *cmd)
+{
+	int i;
+
+	for (i = 0; i < counters_nr; i++) {
+		if (!strcmp(counters[i].cmd, cmd)) {
+			counters[i].count++;
+			return;
+		}
+	}
+
+	ALLOC_GROW(counters, counters_nr + 1, counters_alloc);
+	counters[counters_nr].cmd = xstrdup(cmd);
+	counters[counters_nr].count = 1;
+	counters_nr++;
+}
+
+static void dump_counters(void)
+{
+	unsigned long total = 0;
+	int i;
+
+	for (i = 0; i < counters_nr; i++) {
+		fprintf(stderr, "fallback: %-20s %lu\n", counters[i].cmd, counters[i].count);
+		total += counters[i].count;
+	}
+	fprintf(stderr, "fallback: %-20s %lu\n", "(total)", total);
+	fflush(stderr);
+}
+
+static void handle_signal(int sig)
+{
+	if (sig == SIGUSR1)
+		dump_requested = 1;
+	else
+		stop_requested = 1;
+}
+
+static void NORETURN exec_git(struct ipc_request *request)
+{
+	int i;
+
+	if (chdir(request->cwd))
+		_exit(127);
+
+	clearenv();
+	for (i = 0; i < request->envc; i++)
+		putenv((char *)request->env[i]);
+	/* never bounce back to ourselves if "git" happens to be git2 */
+	unsetenv(GIT2_FALLBACK_SOCKET_ENVIRONMENT);
+
+	for (i = 0; i < 3; i++) {
+		dup2(request->fds[i], i);
+		close(request->fds[i]);
+	}
+
+	execvp(request->argv[0], (char *const *)request->argv);
+	_exit(127);
+}
+
+static void NORETURN serve_request(int client, struct ipc_request *request)
+{
+	pid_t pid;
+	int status, code;
+
+	signal(SIGCHLD, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGINT, SIG_DFL);
+	signal(SIGUSR1, SIG_DFL);
+
+	pid = fork();
+	if (pid < 0)
+		_exit(1);
+	if (!pid) {
+		close(client);
+		exec_git(request);
+	}
+
+	ipc_release_request(request);
+
+	while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+		; /* nothing */
+
+	if (WIFSIGNALED(status))
+		code = 128 + WTERMSIG(status);
+	else
+		code = WEXITSTATUS(status);
+
+	ipc_send_status(client, code);
+	_exit(0);
+}
+
+void run_fallback_helper(const char *socket_path)
+{
+	struct sigaction action;
+	int listener;
+
+	listener = ipc_listen(socket_path);
+	if (listener < 0)
+		die_errno("cannot listen on '%s'", socket_path);
+
+	/* no SA_RESTART: accept() must return to look at the flags */
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = handle_signal;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGUSR1, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	sigaction(SIGINT, &action, NULL);
+	/* session processes are reaped automatically */
+	signal(SIGCHLD, SIG_IGN);
+
+	while (!stop_requested) {
+		struct ipc_request request;
+		int client;
+		pid_t pid;
+
+		if (dump_requested) {
+			dump_requested = 0;
+			dump_counters();
+		}
+
+		client = accept(listener, NULL, NULL);
+		if (client < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			die_errno("accept failed on '%s'", socket_path);
+		}
+
+		if (ipc_recv_request(client, &request) < 0 || request.argc < 1) {
+			if (request.argv)
+				ipc_release_request(&request);
+			close(client);
+			continue;
+		}
+
+		count_fallback(request.argc > 1 ? request.argv[1] : "(none)");
+
+		pid = fork();
+		if (!pid) {
+			close(listener);
+			serve_request(client, &request);
+		}
+		if (pid < 0)
+			ipc_send_status(client, 128);
+
+		ipc_release_request(&request);
+		close(client);
+	}
+
+	close(listener);
+	unlink(socket_path);
+	dump_counters();
+	do_exit(0);
+}
@@ -0,0 +1,9 @@
+#ifndef FALLBACK_HELPER_H
+#define FALLBACK_HELPER_H
+
+void run_fallback_helper(const char *socket_path) __attribute__((noreturn));
+//serve fallback requests on socket_path until SIGTERM/SIGINT.
+//Per-command fallback counters are dumped on stderr on SIGUSR1
+//and when the helper stops
+
+#endif
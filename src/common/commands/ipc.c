@@ -0,0 +1,268 @@
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stdint.h>
+#include "git-compat-util.h"
+#include "ipc.h"
+#include "utils.h"
+#include "errors.h"
+
+extern char **environ;
+
+/* argv and environ of a command line never come close to this */
+#define IPC_MAX_PAYLOAD (16 * 1024 * 1024)
+
+struct ipc_header {
+	uint32_t payload_len;
+	uint32_t argc;
+	uint32_t envc;
+};
+
+static int fill_address(struct sockaddr_un *address, const char *socket_path)
+{
+	memset(address, 0, sizeof(*address));
+	address->sun_family = AF_UNIX;
+
+	if (strlen(socket_path) >= sizeof(address->sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	strcpy(address->sun_path, socket_path);
+	return 0;
+}
+
+int ipc_listen(const char *socket_path)
+{
+	struct sockaddr_un address;
+	int sock;
+
+	if (fill_address(&address, socket_path) < 0)
+		return -1;
+
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0)
+		return -1;
+
+	unlink(socket_path);
+	if (bind(sock, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+	    listen(sock, 64) < 0) {
+		close(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+int ipc_connect(const char *socket_path)
+{
+	struct sockaddr_un address;
+	int sock;
+
+	if (fill_address(&address, socket_path) < 0)
+		return -1;
+
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0)
+		return -1;
+
+	if (connect(sock, (struct sockaddr *)&address, sizeof(address)) < 0) {
+		close(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+int ipc_send_request(int sock, const struct ipc_request *request)
+{
+	struct strbuf payload = STRBUF_INIT;
+	struct ipc_header header;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char control[CMSG_SPACE(sizeof(request->fds))];
+	int i, ret = -1;
+
+	strbuf_add(&payload, request->cwd, strlen(request->cwd) + 1);
+	for (i = 0; i < request->argc; i++)
+		strbuf_add(&payload, request->argv[i], strlen(request->argv[i]) + 1);
+	for (i = 0; i < request->envc; i++)
+		strbuf_add(&payload, request->env[i], strlen(request->env[i]) + 1);
+
+	header.payload_len = payload.len;
+	header.argc = request->argc;
+	header.envc = request->envc;
+
+	/* the fds travel with the header, the payload follows as plain data */
+	memset(&msg, 0, sizeof(msg));
+	memset(control, 0, sizeof(control));
+	iov.iov_base = &header;
+	iov.iov_len = sizeof(header);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(request->fds));
+	memcpy(CMSG_DATA(cmsg), request->fds, sizeof(request->fds));
+
+	if (sendmsg(sock, &msg, 0) != (ssize_t)sizeof(header))
+		goto cleanup;
+
+	if (write_in_full(sock, payload.buf, payload.len) < 0)
+		goto cleanup;
+
+	ret = 0;
+
+cleanup:
+	strbuf_release(&payload);
+	return ret;
+}
+
+int ipc_recv_request(int sock, struct ipc_request *request)
+{
+	struct ipc_header header;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char control[CMSG_SPACE(sizeof(request->fds))];
+	const char *p, *end;
+	int i;
+
+	memset(request, 0, sizeof(*request));
+	strbuf_init(&request->payload, 0);
+	request->fds[0] = request->fds[1] = request->fds[2] = -1;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &header;
+	iov.iov_len = sizeof(header);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	if (recvmsg(sock, &msg, 0) != (ssize_t)sizeof(header))
+		return -1;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS ||
+	    cmsg->cmsg_len != CMSG_LEN(sizeof(request->fds)))
+		return -1;
+	memcpy(request->fds, CMSG_DATA(cmsg), sizeof(request->fds));
+
+	if (header.payload_len > IPC_MAX_PAYLOAD) {
+		ipc_release_request(request);
+		return -1;
+	}
+
+	strbuf_grow(&request->payload, header.payload_len);
+	if (read_in_full(sock, request->payload.buf, header.payload_len) != (ssize_t)header.payload_len) {
+		ipc_release_request(request);
+		return -1;
+	}
+	strbuf_setlen(&request->payload, header.payload_len);
+
+	request->argc = header.argc;
+	request->envc = header.envc;
+	request->argv = xcalloc(request->argc + 1, sizeof(*request->argv));
+	request->env = xcalloc(request->envc + 1, sizeof(*request->env));
+
+	/* split the payload on the NULs: cwd, argv[], env[] */
+	p = request->payload.buf;
+	end = p + request->payload.len;
+	for (i = -1; i < request->argc + request->envc; i++) {
+		if (p >= end) {
+			ipc_release_request(request);
+			return -1;
+		}
+
+		if (i < 0)
+			request->cwd = p;
+		else if (i < request->argc)
+			request->argv[i] = p;
+		else
+			request->env[i - request->argc] = p;
+
+		p += strlen(p) + 1;
+	}
+
+	return 0;
+}
+
+void ipc_release_request(struct ipc_request *request)
+{
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		if (request->fds[i] >= 0)
+			close(request->fds[i]);
+		request->fds[i] = -1;
+	}
+
+	free(request->argv);
+	free(request->env);
+	request->argv = NULL;
+	request->env = NULL;
+	strbuf_release(&request->payload);
+}
+
+int ipc_send_status(int sock, int status)
+{
+	int32_t value = status;
+	return write_in_full(sock, &value, sizeof(value)) < 0 ? -1 : 0;
+}
+
+int ipc_recv_status(int sock, int *status)
+{
+	int32_t value;
+
+	if (read_in_full(sock, &value, sizeof(value)) != sizeof(value))
+		return -1;
+
+	*status = value;
+	return 0;
+}
+
+int ipc_forward(const char *socket_path, const char **argv)
+{
+	struct ipc_request request;
+	char cwd[PATH_MAX];
+	int sock, status;
+
+	if (!getcwd(cwd, sizeof(cwd)))
+		return -1;
+
+	sock = ipc_connect(socket_path);
+	if (sock < 0)
+		return -1;
+
+	memset(&request, 0, sizeof(request));
+	for (request.argc = 0; argv[request.argc]; request.argc++)
+		; /* just counting */
+	request.argv = argv;
+	for (request.envc = 0; environ[request.envc]; request.envc++)
+		; /* just counting */
+	request.env = (const char **)environ;
+	request.cwd = cwd;
+	request.fds[0] = 0;
+	request.fds[1] = 1;
+	request.fds[2] = 2;
+
+	/* the peer will write to our fds: do not let our buffers overtake it */
+	fflush(NULL);
+
+	if (ipc_send_request(sock, &request) < 0) {
+		close(sock);
+		return -1;
+	}
+
+	/* From now on the command may have started: we cannot retry it */
+	if (ipc_recv_status(sock, &status) < 0)
+		die("lost connection to '%s'", socket_path);
+
+	close(sock);
+	return status;
+}
@@ -0,0 +1,46 @@
+#ifndef IPC_H
+#define IPC_H
+
+#include "strbuf.h"
+
+/*
+ * A request forwarded over a unix socket: the command line, the working
+ * directory and the environment of the caller, plus its standard file
+ * descriptors (passed with SCM_RIGHTS) so that the peer can act exactly
+ * as if it were the caller.
+ */
+struct ipc_request {
+	int argc;
+	const char **argv;
+	const char *cwd;
+	int envc;
+	const char **env;
+	int fds[3];
+	struct strbuf payload; /* owns the strings of a received request */
+};
+
+int ipc_listen(const char *socket_path);
+//bind a listening unix socket, replacing any stale one
+
+int ipc_connect(const char *socket_path);
+//connect to a listening unix socket, returns -1 on failure
+
+int ipc_send_request(int sock, const struct ipc_request *request);
+//send the request and our fds, returns -1 on failure
+
+int ipc_recv_request(int sock, struct ipc_request *request);
+//receive a request, returns -1 on failure
+
+void ipc_release_request(struct ipc_request *request);
+//free a received request and close its fds
+
+int ipc_send_status(int sock, int status);
+int ipc_recv_status(int sock, int *status);
+
+int ipc_forward(const char *socket_path, const char **argv);
+//ask the process listening on socket_path to run argv on our behalf, in
+//our cwd and environment and on our standard fds. Returns the exit code
+//of the command, or -1 when the process cannot be reached (the caller
+//should run the command itself)
+
+#endif
@@ -1,4 +1,7 @@
 #include <unistd.h>
+#ifndef WIN32
+#include <spawn.h>
+#endif
 #include "run-command.h"
 #include "exec-cmd.h"
 #include "utils.h"
@@ -141,6 +144,82 @@ static int wait_or_whine(pid_t pid, const char *argv0, int silent_exec_failure)
 	return code;
 }
 
+#ifndef WIN32
+extern char **environ;
+
+/* Make fd the descriptor target of the child, closing the pipe it comes from */
+static void spawn_redirect(posix_spawn_file_actions_t *actions, int fd, int target, int *pair)
+{
+	posix_spawn_file_actions_adddup2(actions, fd, target);
+	if (pair) {
+		posix_spawn_file_actions_addclose(actions, pair[0]);
+		posix_spawn_file_actions_addclose(actions, pair[1]);
+	} else if (fd != target) {
+		posix_spawn_file_actions_addclose(actions, fd);
+	}
+}
+
+/*
+ * Start the child with posix_spawn(), which the libc does with vfork()
+ * or clone(CLONE_VM) : the page tables of a process which loaded a big
+ * index are not copied to be thrown away at the exec. The redirections
+ * are those of the fork() path of start_command(), which is kept for
+ * what needs code to run in the child (a directory, an environment, a
+ * pre-exec callback). Returns the pid, or -1 with errno set
+ */
+static pid_t spawn_command(struct child_process *cmd, int need_in, int *fdin,
+	int need_out, int *fdout, int need_err, int *fderr)
+{
+	posix_spawn_file_actions_t actions;
+	const char **argv = cmd->argv;
+	pid_t pid;
+	int e;
+
+	if (posix_spawn_file_actions_init(&actions))
+		return -1;
+
+	if (cmd->no_stdin)
+		posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDWR, 0);
+	else if (need_in)
+		spawn_redirect(&actions, fdin[0], 0, fdin);
+	else if (cmd->in)
+		spawn_redirect(&actions, cmd->in, 0, NULL);
+
+	if (cmd->no_stderr)
+		posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_RDWR, 0);
+	else if (need_err)
+		spawn_redirect(&actions, fderr[1], 2, fderr);
+	else if (cmd->err > 1)
+		spawn_redirect(&actions, cmd->err, 2, NULL);
+
+	if (cmd->no_stdout)
+		posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_RDWR, 0);
+	else if (cmd->stdout_to_stderr)
+		posix_spawn_file_actions_adddup2(&actions, 2, 1);
+	else if (need_out)
+		spawn_redirect(&actions, fdout[1], 1, fdout);
+	else if (cmd->out > 1)
+		spawn_redirect(&actions, cmd->out, 1, NULL);
+
+	if (cmd->git_cmd)
+		argv = prepare_git_cmd(cmd->argv);
+	else if (cmd->use_shell)
+		argv = prepare_shell_cmd(cmd->argv);
+
+	e = posix_spawnp(&pid, argv[0], &actions, NULL, (char *const *)argv, environ);
+
+	posix_spawn_file_actions_destroy(&actions);
+	if (argv != cmd->argv)
+		free(argv);
+
+	if (e) {
+		errno = e;
+		return -1;
+	}
+	return pid;
+}
+#endif
+
 int start_command(struct child_process *cmd)
 {
 	int need_in, need_out, need_err;
@@ -203,7 +282,18 @@ fail_pipe:
 	fflush(NULL);
 
 #ifndef WIN32
-{
+if (!cmd->preexec_cb && !cmd->dir && !cmd->env) {
+	cmd->pid = spawn_command(cmd, need_in, fdin, need_out, fdout, need_err, fderr);
+	if (cmd->pid < 0) {
+		failed_errno = errno;
+		/* as the exit code 127 of the fork() path would have it */
+		if (errno != ENOENT)
+			error("cannot exec '%s': %s", cmd->argv[0], strerror(errno));
+		else if (!cmd->silent_exec_failure)
+			error("cannot run %s: %s", cmd->argv[0], strerror(ENOENT));
+		errno = failed_errno;
+	}
+} else {
 	int notify_pipe[2];
 	if (pipe(notify_pipe))
 		notify_pipe[0] = notify_pipe[1] = -1;
@@ -426,6 +516,178 @@ int run_command(struct child_process *cmd)
 	return finish_command(cmd);
 }
 
+int capture_command(struct child_process *cmd, struct strbuf *buf, size_t hint)
+{
+	int code;
+	ssize_t len;
+
+	cmd->out = -1;
+	code = start_command(cmd);
+	if (code)
+		return code;
+
+	/* read before waiting : a child with more than a pipe of output would block */
+	len = strbuf_read(buf, cmd->out, hint);
+	close(cmd->out);
+	code = finish_command(cmd);
+
+	return len < 0 ? -1 : code;
+}
+
+/* A command of run_commands_parallel(), from its start to its report */
+struct parallel_task {
+	struct child_process cmd;
+	struct strbuf out, err;
+	void *task_data;
+	int code;
+	int running; /* 0 once both pipes are closed and the child waited for */
+};
+
+struct parallel_run {
+	struct parallel_task **tasks; /* in start order, from the first not reported */
+	unsigned int nr, alloc;
+	unsigned int running;
+	int failed;
+	struct pollfd *pfd;
+	struct parallel_task **pfd_task;
+};
+
+#define PARALLEL_READ_SIZE 8192
+
+static int start_parallel_task(struct parallel_run *run, start_task_fn start_task, void *data)
+{
+	struct parallel_task *task = xcalloc(1, sizeof(*task));
+
+	if (start_task(&task->cmd, data, &task->task_data)) {
+		free(task);
+		return 1;
+	}
+
+	strbuf_init(&task->out, 0);
+	strbuf_init(&task->err, 0);
+	task->cmd.out = -1;
+	task->cmd.err = -1;
+	task->cmd.no_stdout = 0;
+	task->cmd.no_stderr = 0;
+	task->cmd.stdout_to_stderr = 0;
+	if (start_command(&task->cmd) < 0) {
+		task->code = -1;
+		task->cmd.out = task->cmd.err = -1;
+	} else {
+		task->running = 1;
+		run->running++;
+	}
+
+	ALLOC_GROW(run->tasks, run->nr + 1, run->alloc);
+	run->tasks[run->nr++] = task;
+	return 0;
+}
+
+/* Read what is there on one of the pipes of a child, close it at its end */
+static void read_parallel_pipe(struct parallel_run *run, struct parallel_task *task, int *fd, struct strbuf *buf)
+{
+	ssize_t len;
+
+	strbuf_grow(buf, PARALLEL_READ_SIZE);
+	len = xread(*fd, buf->buf + buf->len, buf->alloc - buf->len - 1);
+	if (len > 0) {
+		strbuf_setlen(buf, buf->len + len);
+		return;
+	}
+
+	strbuf_setlen(buf, buf->len); /* terminated even if the child wrote nothing */
+	close(*fd);
+	*fd = -1;
+	if (task->cmd.out < 0 && task->cmd.err < 0) {
+		task->code = finish_command(&task->cmd);
+		task->running = 0;
+		run->running--;
+	}
+}
+
+/* Report the tasks which ended, up to the first still running */
+static void report_parallel_tasks(struct parallel_run *run, task_done_fn task_done, void *data)
+{
+	unsigned int done = 0;
+
+	while (done < run->nr && !run->tasks[done]->running) {
+		struct parallel_task *task = run->tasks[done++];
+
+		if (task->code)
+			run->failed++;
+		task_done(task->code, &task->out, &task->err, data, task->task_data);
+		strbuf_release(&task->out);
+		strbuf_release(&task->err);
+		free(task);
+	}
+
+	run->nr -= done;
+	memmove(run->tasks, run->tasks + done, run->nr * sizeof(*run->tasks));
+}
+
+int run_commands_parallel(unsigned int max_children, start_task_fn start_task, task_done_fn task_done, void *data)
+{
+	struct parallel_run run;
+	int no_more_tasks = 0;
+
+	if (!max_children)
+		max_children = 1;
+	memset(&run, 0, sizeof(run));
+	run.pfd = xmalloc(2 * max_children * sizeof(*run.pfd));
+	run.pfd_task = xmalloc(2 * max_children * sizeof(*run.pfd_task));
+
+	for (;;) {
+		unsigned int nfds = 0;
+
+		while (!no_more_tasks && run.running < max_children)
+			no_more_tasks = start_parallel_task(&run, start_task, data);
+		report_parallel_tasks(&run, task_done, data);
+		if (!run.running) {
+			if (no_more_tasks)
+				break;
+			continue;
+		}
+
+		for (unsigned int i = 0; i < run.nr; i++) {
+			struct parallel_task *task = run.tasks[i];
+			int fds[2] = {task->cmd.out, task->cmd.err};
+
+			if (!task->running)
+				continue;
+			for (int j = 0; j < 2; j++) {
+				if (fds[j] < 0)
+					continue;
+				run.pfd[nfds].fd = fds[j];
+				run.pfd[nfds].events = POLLIN;
+				run.pfd[nfds].revents = 0;
+				run.pfd_task[nfds++] = task;
+			}
+		}
+
+		if (poll(run.pfd, nfds, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			die_errno("poll failed");
+		}
+
+		for (unsigned int i = 0; i < nfds; i++) {
+			struct parallel_task *task = run.pfd_task[i];
+
+			if (!(run.pfd[i].revents & (POLLIN | POLLHUP | POLLERR)))
+				continue;
+			if (run.pfd[i].fd == task->cmd.out)
+				read_parallel_pipe(&run, task, &task->cmd.out, &task->out);
+			else
+				read_parallel_pipe(&run, task, &task->cmd.err, &task->err);
+		}
+	}
+
+	free(run.tasks);
+	free(run.pfd);
+	free(run.pfd_task);
+	return run.failed;
+}
+
 static void prepare_run_command_v_opt(struct child_process *cmd,
 				      const char **argv,
 				      int opt)
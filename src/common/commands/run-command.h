@@ -47,6 +47,15 @@ int start_command(struct child_process *);
 int finish_command(struct child_process *);
 int run_command(struct child_process *);
 
+struct strbuf;
+/*
+ * Run cmd and append its standard output to buf, read straight into it
+ * (hint is the size to expect, 0 when unknown). Returns the exit code
+ * of the child as run_command() does, or -1 if its output could not be
+ * read
+ */
+int capture_command(struct child_process *cmd, struct strbuf *buf, size_t hint);
+
 //int run_hook(const char *index_file, const char *name, ...);
 
 #define RUN_COMMAND_NO_STDIN 1
@@ -62,6 +71,20 @@ int run_command_v_opt(const char **argv, int opt);
  */
 int run_command_v_opt_cd_env(const char **argv, int opt, const char *dir, const char *const *env);
 
+/*
+ * Run up to max_children commands at once. start_task() fills cmd for
+ * the next command (zeroed before, its .out and .err are then pipes to
+ * git2) and returns 0, or 1 when there is none left. Everything a child
+ * writes is kept, and task_done() gets it with the exit code of the
+ * child, in the order the commands were started whatever the order they
+ * end in. task_data is what start_task() set for this command.
+ * Returns the number of commands whose exit code was not 0
+ */
+typedef int (*start_task_fn)(struct child_process *cmd, void *data, void **task_data);
+typedef void (*task_done_fn)(int code, struct strbuf *out, struct strbuf *err, void *data, void *task_data);
+
+int run_commands_parallel(unsigned int max_children, start_task_fn start_task, task_done_fn task_done, void *data);
+
 /*
  * The purpose of the following functions is to feed a pipe by running
  * a function asynchronously and providing output that the caller reads.
@@ -0,0 +1,565 @@
+#include "git-compat-util.h"
+#include "commit-cache.h"
+#include "cache-file.h"
+#include "byte-order.h"
+#include "string-set.h"
+#include "strbuf.h"
+#include "utils.h"
+#include "errors.h"
+#include "trace.h"
+#include "hex.h"
+
+#define COMMIT_CACHE_SIGNATURE 0x47324343 /* "G2CC" */
+#define COMMIT_CACHE_VERSION 1
+#define COMMIT_CACHE_FILE "git2-commit-cache"
+
+#define HEADER_SIZE (4 * 4)
+#define FANOUT_SIZE (256 * 4)
+#define COMMIT_SIZE (5 * 4)
+
+/* A commit parsed from the odb, not in the cache yet */
+struct new_commit {
+	git_oid oid;
+	git_time_t time;
+	unsigned int nr_parents;
+	git_oid *parents;
+};
+
+/* The decoded form of a cache, only built to add commits to it */
+struct cache_builder {
+	uint32_t nr;
+	git_oid *oids;
+	uint32_t (*parents)[2];
+	uint32_t *generations;
+	git_time_t *times;
+	uint32_t nr_extra, extra_alloc;
+	uint32_t *extra_parents;
+};
+
+static void cache_path(struct strbuf *path, git_repository *repo)
+{
+	strbuf_addstr(path, git_repository_path(repo, GIT_REPO_PATH));
+	if (path->len && path->buf[path->len - 1] != '/')
+		strbuf_addch(path, '/');
+	strbuf_addstr(path, COMMIT_CACHE_FILE);
+}
+
+static uint32_t commit_field(const struct commit_cache *cache, uint32_t pos, int field)
+{
+	return get_be32_at(cache->commits + (size_t)pos * COMMIT_SIZE + field * 4);
+}
+
+/* Point the cache into data, which must hold a whole cache file */
+static int parse_cache(struct commit_cache *cache)
+{
+	const unsigned char *data = cache->data;
+	uint32_t nr, nr_extra;
+
+	if (cache->size < HEADER_SIZE + FANOUT_SIZE ||
+	    get_be32_at(data) != COMMIT_CACHE_SIGNATURE ||
+	    get_be32_at(data + 4) != COMMIT_CACHE_VERSION)
+		return -1;
+
+	nr = get_be32_at(data + 8);
+	nr_extra = get_be32_at(data + 12);
+	if (nr >= COMMIT_CACHE_NONE || nr_extra >= COMMIT_CACHE_NONE ||
+	    (uint64_t)cache->size != HEADER_SIZE + FANOUT_SIZE + (uint64_t)nr * (GIT_OID_RAWSZ + COMMIT_SIZE) + (uint64_t)nr_extra * 4)
+		return -1;
+
+	cache->nr = nr;
+	cache->nr_extra = nr_extra;
+	cache->fanout = data + HEADER_SIZE;
+	cache->oids = cache->fanout + FANOUT_SIZE;
+	cache->commits = cache->oids + (size_t)nr * GIT_OID_RAWSZ;
+	cache->extra_parents = cache->commits + (size_t)nr * COMMIT_SIZE;
+
+	if (get_be32_at(cache->fanout + 255 * 4) != nr)
+		return -1;
+
+	return 0;
+}
+
+int commit_cache_load(struct commit_cache *cache, git_repository *repo)
+{
+	struct strbuf path = STRBUF_INIT;
+	uint64_t start = trace_perf_start();
+	struct stat st;
+	int fd;
+
+	memset(cache, 0, sizeof(*cache));
+
+	cache_path(&path, repo);
+	fd = open(path.buf, O_RDONLY);
+	strbuf_release(&path);
+	if (fd < 0)
+		goto done;
+
+	if (fstat(fd, &st) || !st.st_size) {
+		close(fd);
+		goto done;
+	}
+	cache->size = st.st_size;
+
+#ifndef NO_MMAP
+	cache->data = mmap(NULL, cache->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (cache->data == MAP_FAILED)
+		cache->data = NULL;
+	else
+		cache->mapped = 1;
+#endif
+	if (!cache->data) {
+		cache->data = xmalloc(cache->size);
+		if (read_in_full(fd, cache->data, cache->size) != (ssize_t)cache->size) {
+			close(fd);
+			commit_cache_release(cache);
+			goto done;
+		}
+	}
+	close(fd);
+
+	/* an invalid cache is rebuilt from scratch */
+	if (parse_cache(cache) < 0)
+		commit_cache_release(cache);
+
+done:
+	trace_perf_stop("commit_cache_load", start);
+	return GIT_SUCCESS;
+}
+
+int commit_cache_find(const struct commit_cache *cache, const git_oid *oid, uint32_t *pos)
+{
+	uint32_t first, last;
+
+	if (!cache->nr)
+		return 0;
+
+	first = oid->id[0] ? get_be32_at(cache->fanout + (oid->id[0] - 1) * 4) : 0;
+	last = get_be32_at(cache->fanout + oid->id[0] * 4);
+	if (last > cache->nr)
+		last = cache->nr;
+
+	while (first < last) {
+		uint32_t middle = first + (last - first) / 2;
+		int cmp = memcmp(oid->id, cache->oids + (size_t)middle * GIT_OID_RAWSZ, GIT_OID_RAWSZ);
+
+		if (!cmp) {
+			*pos = middle;
+			return 1;
+		}
+		if (cmp < 0)
+			last = middle;
+		else
+			first = middle + 1;
+	}
+
+	return 0;
+}
+
+const git_oid *commit_cache_oid(const struct commit_cache *cache, uint32_t pos)
+{
+	return (const git_oid *)(cache->oids + (size_t)pos * GIT_OID_RAWSZ);
+}
+
+git_time_t commit_cache_time(const struct commit_cache *cache, uint32_t pos)
+{
+	return (git_time_t)(((uint64_t)commit_field(cache, pos, 3) << 32) | commit_field(cache, pos, 4));
+}
+
+uint32_t commit_cache_generation(const struct commit_cache *cache, uint32_t pos)
+{
+	return commit_field(cache, pos, 2);
+}
+
+static void NORETURN corrupt_cache(void)
+{
+	die("corrupt commit cache, remove $GIT_DIR/%s", COMMIT_CACHE_FILE);
+}
+
+static uint32_t checked_parent(const struct commit_cache *cache, uint32_t parent)
+{
+	if (parent >= cache->nr)
+		corrupt_cache();
+	return parent;
+}
+
+unsigned int commit_cache_parents(const struct commit_cache *cache, uint32_t pos, uint32_t **parents, unsigned int *alloc)
+{
+	uint32_t first = commit_field(cache, pos, 0);
+	uint32_t second = commit_field(cache, pos, 1);
+	unsigned int nr = 0;
+
+	if (first == COMMIT_CACHE_NONE)
+		return 0;
+
+	ALLOC_GROW(*parents, nr + 1, *alloc);
+	(*parents)[nr++] = checked_parent(cache, first);
+
+	if (second == COMMIT_CACHE_NONE)
+		return nr;
+
+	if (!(second & COMMIT_CACHE_EXTRA)) {
+		ALLOC_GROW(*parents, nr + 1, *alloc);
+		(*parents)[nr++] = checked_parent(cache, second);
+		return nr;
+	}
+
+	for (uint32_t i = second & ~COMMIT_CACHE_EXTRA; ; i++) {
+		uint32_t extra;
+
+		if (i >= cache->nr_extra)
+			corrupt_cache();
+		extra = get_be32_at(cache->extra_parents + (size_t)i * 4);
+
+		ALLOC_GROW(*parents, nr + 1, *alloc);
+		(*parents)[nr++] = checked_parent(cache, extra & ~COMMIT_CACHE_LAST);
+		if (extra & COMMIT_CACHE_LAST)
+			break;
+	}
+
+	return nr;
+}
+
+/* Parse the commits reachable from tips that the cache does not know */
+static int collect_new_commits(struct commit_cache *cache, git_repository *repo,
+	const git_oid *tips, unsigned int nr_tips,
+	struct new_commit **commits, unsigned int *nr_commits)
+{
+	struct string_set seen = STRING_SET_INIT;
+	git_oid *stack = NULL;
+	unsigned int stack_nr = 0, stack_alloc = 0, commits_alloc = 0;
+	char hex[GIT_OID_HEXSZ + 1];
+	uint32_t pos;
+	int e = GIT_SUCCESS;
+
+	hex[GIT_OID_HEXSZ] = '\0';
+
+	for (unsigned int i = 0; i < nr_tips; i++) {
+		ALLOC_GROW(stack, stack_nr + 1, stack_alloc);
+		git_oid_cpy(&stack[stack_nr++], &tips[i]);
+	}
+
+	while (stack_nr) {
+		git_oid oid;
+		git_commit *commit;
+		struct new_commit *new_commit;
+
+		git_oid_cpy(&oid, &stack[--stack_nr]);
+		if (commit_cache_find(cache, &oid, &pos))
+			continue;
+
+		oid_to_hex(hex, &oid);
+		if (!string_set_add(&seen, hex))
+			continue;
+
+		e = git_commit_lookup(&commit, repo, &oid);
+		if (e != GIT_SUCCESS)
+			break;
+
+		ALLOC_GROW(*commits, *nr_commits + 1, commits_alloc);
+		new_commit = &(*commits)[(*nr_commits)++];
+		git_oid_cpy(&new_commit->oid, &oid);
+		new_commit->time = git_commit_time(commit);
+		new_commit->nr_parents = git_commit_parentcount(commit);
+		new_commit->parents = xmalloc((new_commit->nr_parents ? new_commit->nr_parents : 1) * sizeof(git_oid));
+
+		for (unsigned int i = 0; i < new_commit->nr_parents; i++) {
+			git_oid_cpy(&new_commit->parents[i], git_commit_parent_oid(commit, i));
+			ALLOC_GROW(stack, stack_nr + 1, stack_alloc);
+			git_oid_cpy(&stack[stack_nr++], &new_commit->parents[i]);
+		}
+
+		git_commit_close(commit);
+	}
+
+	free(stack);
+	string_set_clear(&seen);
+
+	return e;
+}
+
+static int compare_new_commits(const void *a, const void *b)
+{
+	return git_oid_cmp(&((const struct new_commit *)a)->oid, &((const struct new_commit *)b)->oid);
+}
+
+static int builder_find(const struct cache_builder *builder, const git_oid *oid, uint32_t *pos)
+{
+	uint32_t first = 0, last = builder->nr;
+
+	while (first < last) {
+		uint32_t middle = first + (last - first) / 2;
+		int cmp = git_oid_cmp(oid, &builder->oids[middle]);
+
+		if (!cmp) {
+			*pos = middle;
+			return 1;
+		}
+		if (cmp < 0)
+			last = middle;
+		else
+			first = middle + 1;
+	}
+
+	return 0;
+}
+
+static unsigned int builder_parents(const struct cache_builder *builder, uint32_t pos, uint32_t **parents, unsigned int *alloc)
+{
+	uint32_t first = builder->parents[pos][0];
+	uint32_t second = builder->parents[pos][1];
+	unsigned int nr = 0;
+
+	if (first == COMMIT_CACHE_NONE)
+		return 0;
+
+	ALLOC_GROW(*parents, nr + 1, *alloc);
+	(*parents)[nr++] = first;
+
+	if (second == COMMIT_CACHE_NONE)
+		return nr;
+
+	if (!(second & COMMIT_CACHE_EXTRA)) {
+		ALLOC_GROW(*parents, nr + 1, *alloc);
+		(*parents)[nr++] = second;
+		return nr;
+	}
+
+	for (uint32_t i = second & ~COMMIT_CACHE_EXTRA; i < builder->nr_extra; i++) {
+		ALLOC_GROW(*parents, nr + 1, *alloc);
+		(*parents)[nr++] = builder->extra_parents[i] & ~COMMIT_CACHE_LAST;
+		if (builder->extra_parents[i] & COMMIT_CACHE_LAST)
+			break;
+	}
+
+	return nr;
+}
+
+/*
+ * Give the commits without a generation number (0) theirs. Parents are
+ * done before their children with an explicit stack, as histories are
+ * far too deep for recursion.
+ */
+static void compute_generations(struct cache_builder *builder)
+{
+	uint32_t *stack = NULL, *parents = NULL;
+	unsigned int stack_nr = 0, stack_alloc = 0, parents_alloc = 0;
+
+	for (uint32_t i = 0; i < builder->nr; i++) {
+		if (builder->generations[i])
+			continue;
+
+		ALLOC_GROW(stack, stack_nr + 1, stack_alloc);
+		stack[stack_nr++] = i;
+
+		while (stack_nr) {
+			uint32_t pos = stack[stack_nr - 1];
+			unsigned int nr_parents;
+			uint32_t generation = 0;
+			int ready = 1;
+
+			if (builder->generations[pos]) {
+				stack_nr--;
+				continue;
+			}
+
+			nr_parents = builder_parents(builder, pos, &parents, &parents_alloc);
+			for (unsigned int j = 0; j < nr_parents; j++) {
+				uint32_t parent_generation = builder->generations[parents[j]];
+
+				if (!parent_generation) {
+					ALLOC_GROW(stack, stack_nr + 1, stack_alloc);
+					stack[stack_nr++] = parents[j];
+					ready = 0;
+				} else if (parent_generation > generation) {
+					generation = parent_generation;
+				}
+			}
+
+			if (ready) {
+				builder->generations[pos] = generation + 1;
+				stack_nr--;
+			}
+		}
+	}
+
+	free(stack);
+	free(parents);
+}
+
+/* Decode the cache and the sorted new commits into one builder */
+static void merge_new_commits(struct cache_builder *builder, const struct commit_cache *cache,
+	struct new_commit *commits, unsigned int nr_commits)
+{
+	uint32_t *old_positions = xmalloc((cache->nr ? cache->nr : 1) * sizeof(uint32_t));
+	uint32_t i = 0, j = 0, k = 0;
+
+	builder->nr = cache->nr + nr_commits;
+	builder->oids = xmalloc(builder->nr * sizeof(git_oid));
+	builder->parents = xmalloc(builder->nr * sizeof(*builder->parents));
+	builder->generations = xcalloc(builder->nr, sizeof(uint32_t));
+	builder->times = xmalloc(builder->nr * sizeof(git_time_t));
+	builder->nr_extra = builder->extra_alloc = cache->nr_extra;
+	builder->extra_parents = xmalloc((cache->nr_extra ? cache->nr_extra : 1) * sizeof(uint32_t));
+
+	/* the oids first, parents can only be found once they are all there */
+	while (i < cache->nr || j < nr_commits) {
+		if (j == nr_commits || (i < cache->nr && git_oid_cmp(commit_cache_oid(cache, i), &commits[j].oid) < 0)) {
+			old_positions[i] = k;
+			git_oid_cpy(&builder->oids[k++], commit_cache_oid(cache, i++));
+		} else {
+			git_oid_cpy(&builder->oids[k++], &commits[j++].oid);
+		}
+	}
+
+	for (i = 0; i < cache->nr; i++) {
+		uint32_t pos = old_positions[i];
+		uint32_t first = commit_field(cache, i, 0);
+		uint32_t second = commit_field(cache, i, 1);
+
+		builder->parents[pos][0] = first == COMMIT_CACHE_NONE ? first : old_positions[checked_parent(cache, first)];
+		if (second == COMMIT_CACHE_NONE || (second & COMMIT_CACHE_EXTRA))
+			builder->parents[pos][1] = second;
+		else
+			builder->parents[pos][1] = old_positions[checked_parent(cache, second)];
+		builder->generations[pos] = commit_cache_generation(cache, i);
+		builder->times[pos] = commit_cache_time(cache, i);
+	}
+	for (i = 0; i < cache->nr_extra; i++) {
+		uint32_t extra = get_be32_at(cache->extra_parents + (size_t)i * 4);
+
+		builder->extra_parents[i] = old_positions[checked_parent(cache, extra & ~COMMIT_CACHE_LAST)] |
+			(extra & COMMIT_CACHE_LAST);
+	}
+
+	for (j = 0; j < nr_commits; j++) {
+		struct new_commit *commit = &commits[j];
+		uint32_t pos, parent;
+
+		builder_find(builder, &commit->oid, &pos);
+		builder->times[pos] = commit->time;
+		builder->parents[pos][0] = builder->parents[pos][1] = COMMIT_CACHE_NONE;
+
+		for (unsigned int p = 0; p < commit->nr_parents; p++) {
+			/* every parent was either cached or collected */
+			builder_find(builder, &commit->parents[p], &parent);
+
+			if (p == 0) {
+				builder->parents[pos][0] = parent;
+			} else if (commit->nr_parents == 2) {
+				builder->parents[pos][1] = parent;
+			} else {
+				if (p == 1)
+					builder->parents[pos][1] = COMMIT_CACHE_EXTRA | builder->nr_extra;
+				ALLOC_GROW(builder->extra_parents, builder->nr_extra + 1, builder->extra_alloc);
+				builder->extra_parents[builder->nr_extra++] = parent |
+					(p == commit->nr_parents - 1 ? COMMIT_CACHE_LAST : 0);
+			}
+		}
+	}
+
+	free(old_positions);
+	compute_generations(builder);
+}
+
+static void write_builder(struct strbuf *out, const struct cache_builder *builder)
+{
+	uint32_t i = 0;
+
+	strbuf_grow(out, HEADER_SIZE + FANOUT_SIZE + (size_t)builder->nr * (GIT_OID_RAWSZ + COMMIT_SIZE) + builder->nr_extra * 4);
+
+	add_be32(out, COMMIT_CACHE_SIGNATURE);
+	add_be32(out, COMMIT_CACHE_VERSION);
+	add_be32(out, builder->nr);
+	add_be32(out, builder->nr_extra);
+
+	for (unsigned int byte = 0; byte < 256; byte++) {
+		while (i < builder->nr && builder->oids[i].id[0] <= byte)
+			i++;
+		add_be32(out, i);
+	}
+
+	for (i = 0; i < builder->nr; i++)
+		strbuf_add(out, builder->oids[i].id, GIT_OID_RAWSZ);
+	for (i = 0; i < builder->nr; i++) {
+		add_be32(out, builder->parents[i][0]);
+		add_be32(out, builder->parents[i][1]);
+		add_be32(out, builder->generations[i]);
+		add_be32(out, (uint32_t)((uint64_t)builder->times[i] >> 32));
+		add_be32(out, (uint32_t)builder->times[i]);
+	}
+	for (i = 0; i < builder->nr_extra; i++)
+		add_be32(out, builder->extra_parents[i]);
+}
+
+static void release_builder(struct cache_builder *builder)
+{
+	free(builder->oids);
+	free(builder->parents);
+	free(builder->generations);
+	free(builder->times);
+	free(builder->extra_parents);
+}
+
+/* Best effort : the cache is only an accelerator */
+static void save_cache(const struct strbuf *contents, git_repository *repo)
+{
+	struct strbuf path = STRBUF_INIT;
+
+	cache_path(&path, repo);
+	/* whoever is writing it writes the same commits, or more */
+	write_cache_file(path.buf, contents->buf, contents->len);
+	strbuf_release(&path);
+}
+
+int commit_cache_update(struct commit_cache *cache, git_repository *repo, const git_oid *tips, unsigned int nr_tips)
+{
+	struct new_commit *commits = NULL;
+	unsigned int nr_commits = 0;
+	uint64_t start = trace_perf_start();
+	int e;
+
+	e = collect_new_commits(cache, repo, tips, nr_tips, &commits, &nr_commits);
+
+	if (e == GIT_SUCCESS && nr_commits) {
+		struct cache_builder builder;
+		struct strbuf contents = STRBUF_INIT;
+
+		if ((uint64_t)cache->nr + nr_commits >= COMMIT_CACHE_NONE)
+			die("too many commits for the commit cache");
+
+		memset(&builder, 0, sizeof(builder));
+		qsort(commits, nr_commits, sizeof(*commits), compare_new_commits);
+		merge_new_commits(&builder, cache, commits, nr_commits);
+		write_builder(&contents, &builder);
+		release_builder(&builder);
+
+		save_cache(&contents, repo);
+
+		/* from now on the cache reads what was just written */
+		commit_cache_release(cache);
+		cache->size = contents.len;
+		cache->data = (unsigned char *)strbuf_detach(&contents, NULL);
+		parse_cache(cache);
+	}
+
+	for (unsigned int i = 0; i < nr_commits; i++)
+		free(commits[i].parents);
+	free(commits);
+	trace_perf_stop("commit_cache_update", start);
+
+	return e;
+}
+
+void commit_cache_release(struct commit_cache *cache)
+{
+	if (cache->data) {
+#ifndef NO_MMAP
+		if (cache->mapped)
+			munmap(cache->data, cache->size);
+		else
+#endif
+			free(cache->data);
+	}
+
+	memset(cache, 0, sizeof(*cache));
+}
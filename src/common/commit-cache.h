@@ -0,0 +1,74 @@
+#ifndef COMMIT_CACHE_H
+#define COMMIT_CACHE_H
+
+#include <stdint.h>
+#include <git2.h>
+
+/*
+ * The commit cache keeps, for every commit it knows, the parents, the
+ * committer time and the generation number (1 for a root commit, one
+ * more than the highest of its parents otherwise) in flat arrays
+ * indexed by the position of the commit in a sorted table of oids.
+ * History walks go through it instead of parsing commits in the odb.
+ *
+ * It lives in $GIT_DIR/git2-commit-cache, in network byte order :
+ *
+ *   "G2CC", version, number of commits, number of extra parents (uint32)
+ *   fanout : 256 uint32, commits whose oid starts with a byte <= i
+ *   oids : sorted raw oids
+ *   commits : first parent, second parent, generation, time (high,
+ *             low) as uint32
+ *   extra parents : uint32
+ *
+ * A missing parent is COMMIT_CACHE_NONE. When a commit has more than two
+ * parents, its second parent is COMMIT_CACHE_EXTRA | i and its other
+ * parents are in the extra parents from i on, the last one being marked
+ * with COMMIT_CACHE_LAST.
+ *
+ * The file is mapped and read in place : loading it costs the same for
+ * any history size, and a walk only touches the commits it visits.
+ */
+
+#define COMMIT_CACHE_NONE  0x7fffffffu
+#define COMMIT_CACHE_EXTRA 0x80000000u
+#define COMMIT_CACHE_LAST  0x80000000u
+
+struct commit_cache {
+	unsigned char *data;
+	size_t size;
+	int mapped; /* data is mmap()ed, malloc()ed otherwise */
+
+	uint32_t nr;
+	uint32_t nr_extra;
+	const unsigned char *fanout;
+	const unsigned char *oids;
+	const unsigned char *commits;
+	const unsigned char *extra_parents;
+};
+
+#define COMMIT_CACHE_INIT { NULL, 0, 0, 0, 0, NULL, NULL, NULL, NULL }
+
+int commit_cache_load(struct commit_cache *cache, git_repository *repo);
+//load the cache of repo, an empty cache if there is none (or if it is
+//invalid). Returns GIT_SUCCESS
+
+int commit_cache_update(struct commit_cache *cache, git_repository *repo, const git_oid *tips, unsigned int nr_tips);
+//add the commits reachable from tips which are not in the cache yet, and
+//save the cache if some were added (a failure to save is not an error).
+//Returns GIT_SUCCESS or the libgit2 error of a commit lookup
+
+int commit_cache_find(const struct commit_cache *cache, const git_oid *oid, uint32_t *pos);
+//returns 1 and sets *pos if oid is in the cache, 0 otherwise
+
+const git_oid *commit_cache_oid(const struct commit_cache *cache, uint32_t pos);
+git_time_t commit_cache_time(const struct commit_cache *cache, uint32_t pos);
+uint32_t commit_cache_generation(const struct commit_cache *cache, uint32_t pos);
+
+unsigned int commit_cache_parents(const struct commit_cache *cache, uint32_t pos, uint32_t **parents, unsigned int *alloc);
+//store the positions of the parents of the commit at pos in *parents
+//(grown as needed, *alloc is its size) and returns their number.
+//Dies if the cache is corrupt
+
+void commit_cache_release(struct commit_cache *cache);
+
+#endif
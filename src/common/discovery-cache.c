@@ -0,0 +1,119 @@
+#include "git-compat-util.h"
+#include "discovery-cache.h"
+#include "environment.h"
+#include "strbuf.h"
+#include "utils.h"
+#include "cache-file.h"
+
+/* the oldest entries are dropped beyond */
+#define DISCOVERY_CACHE_MAX_ENTRIES 256
+
+/* An entry is "<dev> <ino> <mtime> <mtime nsec>\t<ceiling>\t<repository>" */
+static void format_key(struct strbuf *key, const struct stat *cwd)
+{
+	strbuf_addf(key, "%lu %lu ", (unsigned long)cwd->st_dev, (unsigned long)cwd->st_ino);
+}
+
+static int usable(const char *s)
+{
+	return !strpbrk(s, "\t\n");
+}
+
+/* The line of the cache for key and ceiling, NULL when there is none */
+static const char *find_entry(const struct strbuf *cache, const struct strbuf *key, const char *ceiling, const char **end)
+{
+	const char *line = cache->buf, *cache_end = cache->buf + cache->len;
+	size_t ceiling_len = strlen(ceiling);
+
+	while (line < cache_end) {
+		const char *eol = memchr(line, '\n', cache_end - line);
+		if (!eol)
+			break;
+		if ((size_t)(eol - line) > key->len && !memcmp(line, key->buf, key->len)) {
+			const char *tab = memchr(line + key->len, '\t', eol - line - key->len);
+			if (tab && (size_t)(eol - tab) > ceiling_len + 1 &&
+			    !memcmp(tab + 1, ceiling, ceiling_len) && tab[ceiling_len + 1] == '\t') {
+				*end = eol;
+				return line;
+			}
+		}
+		line = eol + 1;
+	}
+	return NULL;
+}
+
+int discovery_cache_lookup(char *path, size_t size, const struct stat *cwd, const char *ceiling)
+{
+	const char *cache_path = getenv(GIT2_DISCOVERY_CACHE_ENVIRONMENT);
+	struct strbuf cache = STRBUF_INIT, key = STRBUF_INIT;
+	const char *line, *end, *repository;
+	unsigned long mtime, mtime_nsec;
+	struct stat st;
+	int e = -1;
+
+	if (!cache_path || !*cache_path || !usable(ceiling))
+		return -1;
+	if (strbuf_read_file(&cache, cache_path, 0) < 0)
+		return -1;
+
+	format_key(&key, cwd);
+	line = find_entry(&cache, &key, ceiling, &end);
+	if (line && sscanf(line + key.len, "%lu %lu", &mtime, &mtime_nsec) == 2) {
+		repository = (const char *)memchr(line + key.len, '\t', end - line - key.len) + strlen(ceiling) + 2;
+		if ((size_t)(end - repository) < size) {
+			memcpy(path, repository, end - repository);
+			path[end - repository] = '\0';
+			/* still there, and not made again */
+			if (!stat(path, &st) && S_ISDIR(st.st_mode) &&
+			    (unsigned long)st.st_mtime == mtime && (unsigned long)ST_MTIME_NSEC(st) == mtime_nsec)
+				e = 0;
+		}
+	}
+
+	strbuf_release(&key);
+	strbuf_release(&cache);
+	return e;
+}
+
+void discovery_cache_store(const char *path, const struct stat *cwd, const char *ceiling)
+{
+	const char *cache_path = getenv(GIT2_DISCOVERY_CACHE_ENVIRONMENT);
+	struct strbuf cache = STRBUF_INIT, key = STRBUF_INIT, out = STRBUF_INIT;
+	const char *line, *end, *p;
+	unsigned int nr = 0;
+	struct stat st;
+
+	if (!cache_path || !*cache_path || !usable(ceiling) || !usable(path))
+		return;
+	if (stat(path, &st))
+		return;
+
+	/* a missing or unreadable cache is started again */
+	if (strbuf_read_file(&cache, cache_path, 0) < 0)
+		strbuf_reset(&cache);
+
+	format_key(&key, cwd);
+	line = find_entry(&cache, &key, ceiling, &end);
+
+	/* the entries but the one replaced, the newest last */
+	for (p = cache.buf; p < cache.buf + cache.len; p = end + 1) {
+		end = memchr(p, '\n', cache.buf + cache.len - p);
+		if (!end)
+			break;
+		if (p != line) {
+			strbuf_add(&out, p, end + 1 - p);
+			nr++;
+		}
+	}
+	for (; nr >= DISCOVERY_CACHE_MAX_ENTRIES; nr--)
+		strbuf_remove(&out, 0, (char *)memchr(out.buf, '\n', out.len) + 1 - out.buf);
+	strbuf_addf(&out, "%s%lu %lu\t%s\t%s\n", key.buf, (unsigned long)st.st_mtime,
+		(unsigned long)ST_MTIME_NSEC(st), ceiling, path);
+
+	/* a store which loses the race to another one is dropped */
+	write_cache_file(cache_path, out.buf, out.len);
+
+	strbuf_release(&out);
+	strbuf_release(&key);
+	strbuf_release(&cache);
+}
@@ -0,0 +1,25 @@
+#ifndef DISCOVERY_CACHE_H
+#define DISCOVERY_CACHE_H
+
+#include <sys/stat.h>
+
+/*
+ * The repositories git_repository_discover() found, in the file named by
+ * GIT2_DISCOVERY_CACHE : one line for each directory (by device and
+ * inode) and GIT_CEILING_DIRECTORIES, with the repository found and the
+ * mtime of its directory then. An entry is used while that mtime did not
+ * change, so a repository moved or created again is discovered again.
+ * A repository created since between the directory and the one cached
+ * is not noticed : the cache is opt-in.
+ */
+
+int discovery_cache_lookup(char *path, size_t size, const struct stat *cwd, const char *ceiling);
+//copy in path the repository cached for the directory cwd and ceiling
+//(GIT_CEILING_DIRECTORIES, "" when not set). Returns 0,
+//or -1 when there is no valid entry (or no cache)
+
+void discovery_cache_store(const char *path, const struct stat *cwd, const char *ceiling);
+//remember that path was discovered from cwd. Errors are ignored : the
+//cache is only an optimization
+
+#endif
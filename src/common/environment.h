@@ -12,5 +12,24 @@
 #define GIT_COMMITTER_EMAIL_ENVIRONMENT "GIT_COMMITTER_EMAIL"
 #define GIT_AUTHOR_DATE_ENVIRONMENT "GIT_AUTHOR_DATE"
 #define GIT_COMMITTER_DATE_ENVIRONMENT "GIT_COMMITTER_DATE"
+#define GIT2_FALLBACK_SOCKET_ENVIRONMENT "GIT2_FALLBACK_SOCKET"
+#define GIT2_DAEMON_SOCKET_ENVIRONMENT "GIT2_DAEMON_SOCKET"
+#define GIT2_CHECKOUT_WORKERS_ENVIRONMENT "GIT2_CHECKOUT_WORKERS"
+#define GIT2_CHECKOUT_STATS_ENVIRONMENT "GIT2_CHECKOUT_STATS"
+#define GIT2_CHECKOUT_ORDER_ENVIRONMENT "GIT2_CHECKOUT_ORDER"
+#define GIT2_CHECKOUT_URING_ENVIRONMENT "GIT2_CHECKOUT_URING"
+#define GIT2_LS_TREE_WORKERS_ENVIRONMENT "GIT2_LS_TREE_WORKERS"
+#define GIT2_LS_FILES_WORKERS_ENVIRONMENT "GIT2_LS_FILES_WORKERS"
+#define GIT2_UPDATE_INDEX_WORKERS_ENVIRONMENT "GIT2_UPDATE_INDEX_WORKERS"
+#define GIT2_INDEX_WORKERS_ENVIRONMENT "GIT2_INDEX_WORKERS"
+#define GIT2_TRACE_PERF_ENVIRONMENT "GIT2_TRACE_PERF"
+#define GIT2_FALLBACK_LOG_ENVIRONMENT "GIT2_FALLBACK_LOG"
+#define GIT2_PREFIX_TABLE_ENVIRONMENT "GIT2_PREFIX_TABLE"
+#define GIT2_PACK_ON_WRITE_ENVIRONMENT "GIT2_PACK_ON_WRITE"
+#define GIT2_FSYNC_ENVIRONMENT "GIT2_FSYNC"
+#define GIT2_DISCOVERY_CACHE_ENVIRONMENT "GIT2_DISCOVERY_CACHE"
+#define GIT2_DELTA_BASE_CACHE_ENVIRONMENT "GIT2_DELTA_BASE_CACHE"
+#define GIT2_SHARED_OBJECT_CACHE_ENVIRONMENT "GIT2_SHARED_OBJECT_CACHE"
+#define GIT2_UNTRACKED_CACHE_ENVIRONMENT "GIT2_UNTRACKED_CACHE"
 
 #endif
@@ -0,0 +1,331 @@
+#include "git-compat-util.h"
+#include "file-batch.h"
+#include "errors.h"
+#include "utils.h"
+#include "trace.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#endif
+#endif
+
+/* openat to a direct descriptor needs the headers (and kernel) of 5.15 */
+#if defined(IORING_FILE_INDEX_ALLOC) && defined(__NR_io_uring_setup)
+
+/* open, write and close per file */
+#define FILE_BATCH_RING_ENTRIES (4 * FILE_BATCH_SIZE)
+
+enum { FILE_OPEN, FILE_WRITE, FILE_CLOSE };
+
+struct pending_file {
+	char *path;
+	const void *data;
+	size_t len;
+	int mode;
+	file_batch_release_fn release;
+	void *owner;
+	int open_error, write_error;
+};
+
+struct file_batch {
+	int fd;
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	struct pending_file files[FILE_BATCH_SIZE];
+	unsigned int nr;
+};
+
+static int ring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int ring_enter(int fd, unsigned to_submit, unsigned min_complete)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, IORING_ENTER_GETEVENTS, NULL, 0);
+}
+
+static int ring_register_files(int fd, const int *files, unsigned nr)
+{
+	return syscall(__NR_io_uring_register, fd, IORING_REGISTER_FILES, files, nr);
+}
+
+static void unmap_rings(struct file_batch *batch)
+{
+	if (batch->sqes)
+		munmap(batch->sqes, batch->sqes_size);
+	if (batch->cq_ring && batch->cq_ring != batch->sq_ring)
+		munmap(batch->cq_ring, batch->cq_ring_size);
+	if (batch->sq_ring)
+		munmap(batch->sq_ring, batch->sq_ring_size);
+}
+
+static int map_rings(struct file_batch *batch, const struct io_uring_params *p)
+{
+	unsigned char *sq, *cq;
+
+	batch->sq_ring_size = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+	batch->cq_ring_size = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+	if (p->features & IORING_FEAT_SINGLE_MMAP) {
+		if (batch->cq_ring_size > batch->sq_ring_size)
+			batch->sq_ring_size = batch->cq_ring_size;
+		batch->cq_ring_size = batch->sq_ring_size;
+	}
+
+	batch->sq_ring = mmap(NULL, batch->sq_ring_size, PROT_READ | PROT_WRITE,
+			      MAP_SHARED | MAP_POPULATE, batch->fd, IORING_OFF_SQ_RING);
+	if (batch->sq_ring == MAP_FAILED) {
+		batch->sq_ring = NULL;
+		return -1;
+	}
+	if (p->features & IORING_FEAT_SINGLE_MMAP) {
+		batch->cq_ring = batch->sq_ring;
+	} else {
+		batch->cq_ring = mmap(NULL, batch->cq_ring_size, PROT_READ | PROT_WRITE,
+				      MAP_SHARED | MAP_POPULATE, batch->fd, IORING_OFF_CQ_RING);
+		if (batch->cq_ring == MAP_FAILED) {
+			batch->cq_ring = NULL;
+			return -1;
+		}
+	}
+	batch->sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+	batch->sqes = mmap(NULL, batch->sqes_size, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, batch->fd, IORING_OFF_SQES);
+	if (batch->sqes == MAP_FAILED) {
+		batch->sqes = NULL;
+		return -1;
+	}
+
+	sq = batch->sq_ring;
+	batch->sq_head = (unsigned *)(sq + p->sq_off.head);
+	batch->sq_tail = (unsigned *)(sq + p->sq_off.tail);
+	batch->sq_mask = (unsigned *)(sq + p->sq_off.ring_mask);
+	batch->sq_array = (unsigned *)(sq + p->sq_off.array);
+	cq = batch->cq_ring;
+	batch->cq_head = (unsigned *)(cq + p->cq_off.head);
+	batch->cq_tail = (unsigned *)(cq + p->cq_off.tail);
+	batch->cq_mask = (unsigned *)(cq + p->cq_off.ring_mask);
+	batch->cqes = (struct io_uring_cqe *)(cq + p->cq_off.cqes);
+	return 0;
+}
+
+static struct io_uring_sqe *next_sqe(struct file_batch *batch, unsigned *tail, uint8_t opcode, uint64_t user_data)
+{
+	unsigned index = *tail & *batch->sq_mask;
+	struct io_uring_sqe *sqe = &batch->sqes[index];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->user_data = user_data;
+	batch->sq_array[index] = index;
+	(*tail)++;
+	return sqe;
+}
+
+/* The open, write and close of the nth file, in slot n of the file table */
+static void queue_file(struct file_batch *batch, unsigned *tail, unsigned int n)
+{
+	struct pending_file *file = &batch->files[n];
+	struct io_uring_sqe *sqe;
+
+	sqe = next_sqe(batch, tail, IORING_OP_OPENAT, n * 4 + FILE_OPEN);
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (uintptr_t)file->path;
+	sqe->len = file->mode;
+	sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+	sqe->file_index = n + 1;
+	sqe->flags = IOSQE_IO_LINK;
+
+	if (file->len) {
+		sqe = next_sqe(batch, tail, IORING_OP_WRITE, n * 4 + FILE_WRITE);
+		sqe->fd = n;
+		sqe->addr = (uintptr_t)file->data;
+		sqe->len = file->len;
+		/* the slot is closed even if the write fails */
+		sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+	}
+
+	sqe = next_sqe(batch, tail, IORING_OP_CLOSE, n * 4 + FILE_CLOSE);
+	sqe->file_index = n + 1;
+}
+
+/* Wait for nr completions, and note the failures of their files */
+static void reap(struct file_batch *batch, unsigned int nr)
+{
+	while (nr) {
+		unsigned head = *batch->cq_head;
+		unsigned tail = __atomic_load_n(batch->cq_tail, __ATOMIC_ACQUIRE);
+
+		if (head == tail) {
+			if (ring_enter(batch->fd, 0, nr) < 0 && errno != EINTR)
+				die_errno("io_uring_enter failed");
+			continue;
+		}
+		for (; head != tail && nr; head++, nr--) {
+			const struct io_uring_cqe *cqe = &batch->cqes[head & *batch->cq_mask];
+			struct pending_file *file = &batch->files[cqe->user_data / 4];
+
+			if (cqe->user_data % 4 == FILE_OPEN && cqe->res < 0)
+				file->open_error = 1;
+			else if (cqe->user_data % 4 == FILE_WRITE && (size_t)cqe->res != file->len)
+				file->write_error = 1;
+		}
+		__atomic_store_n(batch->cq_head, head, __ATOMIC_RELEASE);
+	}
+}
+
+/*
+ * Whether the kernel opens files in the slots of the file table : older
+ * ones reject the file_index of openat, or do not know the operation
+ */
+static int probe_direct_open(struct file_batch *batch)
+{
+	unsigned tail = *batch->sq_tail;
+	struct io_uring_sqe *sqe;
+
+	batch->files[0].open_error = 0;
+	sqe = next_sqe(batch, &tail, IORING_OP_OPENAT, FILE_OPEN);
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (uintptr_t)".";
+	sqe->open_flags = O_RDONLY | O_DIRECTORY;
+	sqe->file_index = 1;
+	sqe->flags = IOSQE_IO_LINK;
+	sqe = next_sqe(batch, &tail, IORING_OP_CLOSE, FILE_CLOSE);
+	sqe->file_index = 1;
+	__atomic_store_n(batch->sq_tail, tail, __ATOMIC_RELEASE);
+
+	if (ring_enter(batch->fd, 2, 2) != 2)
+		return -1;
+	reap(batch, 2);
+	return batch->files[0].open_error ? -1 : 0;
+}
+
+struct file_batch *file_batch_start(void)
+{
+	struct io_uring_params p;
+	struct file_batch *batch;
+	int slots[FILE_BATCH_SIZE];
+
+	memset(&p, 0, sizeof(p));
+	batch = xcalloc(1, sizeof(*batch));
+	batch->fd = ring_setup(FILE_BATCH_RING_ENTRIES, &p);
+	if (batch->fd < 0) {
+		free(batch);
+		return NULL;
+	}
+
+	for (unsigned int i = 0; i < FILE_BATCH_SIZE; i++)
+		slots[i] = -1;
+	if (map_rings(batch, &p) < 0 || ring_register_files(batch->fd, slots, FILE_BATCH_SIZE) < 0 ||
+	    probe_direct_open(batch) < 0) {
+		unmap_rings(batch);
+		close(batch->fd);
+		free(batch);
+		return NULL;
+	}
+
+	return batch;
+}
+
+void file_batch_flush(struct file_batch *batch)
+{
+	unsigned tail, submitted = 0, nr;
+
+	if (!batch->nr)
+		return;
+
+	uint64_t start = trace_perf_start();
+	tail = *batch->sq_tail;
+	for (unsigned int i = 0; i < batch->nr; i++)
+		queue_file(batch, &tail, i);
+	nr = tail - *batch->sq_tail;
+	__atomic_store_n(batch->sq_tail, tail, __ATOMIC_RELEASE);
+
+	while (submitted < nr) {
+		int e = ring_enter(batch->fd, nr - submitted, 0);
+
+		if (e < 0 && errno != EINTR)
+			die_errno("io_uring_enter failed");
+		if (e > 0)
+			submitted += e;
+	}
+	reap(batch, nr);
+
+	for (unsigned int i = 0; i < batch->nr; i++) {
+		struct pending_file *file = &batch->files[i];
+
+		if (file->open_error)
+			fprintf(stderr, "Error in opening file '%s'.\n", file->path);
+		else if (file->write_error)
+			fprintf(stderr, "Failed to write '%s'\n", file->path);
+		if (file->release)
+			file->release(file->owner);
+		free(file->path);
+		file->path = NULL;
+	}
+	trace_perf_add("file_batch_files", batch->nr);
+	batch->nr = 0;
+	trace_perf_stop("file_batch_flush", start);
+}
+
+void file_batch_add(struct file_batch *batch, const char *path, int mode,
+	const void *data, size_t len, file_batch_release_fn release, void *owner)
+{
+	struct pending_file *file = &batch->files[batch->nr++];
+
+	file->path = xstrdup(path);
+	file->data = data;
+	file->len = len;
+	file->release = release;
+	file->owner = owner;
+	file->mode = mode;
+	file->open_error = file->write_error = 0;
+
+	if (batch->nr == FILE_BATCH_SIZE)
+		file_batch_flush(batch);
+}
+
+void file_batch_free(struct file_batch *batch)
+{
+	if (!batch)
+		return;
+	file_batch_flush(batch);
+	unmap_rings(batch);
+	close(batch->fd);
+	free(batch);
+}
+
+#else
+
+struct file_batch *file_batch_start(void)
+{
+	return NULL;
+}
+
+void file_batch_add(struct file_batch *batch, const char *path, int mode,
+	const void *data, size_t len, file_batch_release_fn release, void *owner)
+{
+	(void)batch; (void)path; (void)mode; (void)data; (void)len; (void)release; (void)owner;
+}
+
+void file_batch_flush(struct file_batch *batch)
+{
+	(void)batch;
+}
+
+void file_batch_free(struct file_batch *batch)
+{
+	(void)batch;
+}
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef FILE_BATCH_H
+#define FILE_BATCH_H
+
+#include <stddef.h>
+
+/*
+ * Write many small files through io_uring : the open, write and close of
+ * each file are linked requests on a slot of the ring's file table, and
+ * those of up to FILE_BATCH_SIZE files go to the kernel in one system
+ * call instead of three calls per file. The files are created as open()
+ * creates them (mode masked by the umask), truncated if they exist.
+ *
+ * Linux only : file_batch_start() returns NULL where io_uring cannot be
+ * used (other systems, kernels before 5.15, seccomp filters), and the
+ * caller then writes the files itself. A batch belongs to one thread.
+ * Errors are printed as the files complete.
+ */
+
+#define FILE_BATCH_SIZE 64
+
+struct file_batch;
+
+typedef void (*file_batch_release_fn)(void *owner);
+
+struct file_batch *file_batch_start(void);
+
+void file_batch_add(struct file_batch *batch, const char *path, int mode,
+	const void *data, size_t len, file_batch_release_fn release, void *owner);
+//queue the file path with the len bytes of data (less than 4GB), and
+//submit the batch when it is full. data must stay valid until
+//release(owner) is called, once the file is written or failed
+
+void file_batch_flush(struct file_batch *batch);
+//submit the files queued and wait for all of them
+
+void file_batch_free(struct file_batch *batch);
+//flush, then release the ring
+
+#endif
@@ -0,0 +1,133 @@
+#include "git-compat-util.h"
+#include <pthread.h>
+#include "fsync.h"
+#include "environment.h"
+#include "strbuf.h"
+#include "utils.h"
+#include "trace.h"
+
+enum fsync_mode {
+	FSYNC_UNKNOWN,
+	FSYNC_NONE,
+	FSYNC_OBJECT,
+	FSYNC_BATCH,
+};
+
+static enum fsync_mode mode = FSYNC_UNKNOWN;
+
+/* a directory of the filesystem written since the last batch, NULL if none */
+static pthread_mutex_t batch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char *pending;
+
+static enum fsync_mode get_fsync_mode()
+{
+	if (mode == FSYNC_UNKNOWN) {
+		const char *value = getenv(GIT2_FSYNC_ENVIRONMENT);
+
+		if (value && !strcmp(value, "object"))
+			mode = FSYNC_OBJECT;
+		else if (value && !strcmp(value, "batch"))
+			mode = FSYNC_BATCH;
+		else
+			mode = FSYNC_NONE;
+	}
+	return mode;
+}
+
+static void fsync_or_die(int fd, const char *path)
+{
+	while (fsync(fd) < 0) {
+		if (errno != EINTR)
+			die_errno("fsync error on '%s'", path);
+	}
+}
+
+/* remember the directory of path : the file itself may be renamed by then */
+static void add_pending(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+
+	pthread_mutex_lock(&batch_mutex);
+	if (!pending)
+		pending = slash ? xstrndup(path, slash - path + 1) : xstrdup(".");
+	pthread_mutex_unlock(&batch_mutex);
+}
+
+void fsync_written_file(int fd, const char *path)
+{
+	switch (get_fsync_mode()) {
+	case FSYNC_OBJECT:
+		fsync_or_die(fd, path);
+		break;
+	case FSYNC_BATCH:
+		add_pending(path);
+		break;
+	default:
+		break;
+	}
+}
+
+void fsync_written_path(const char *path)
+{
+	int fd;
+
+	switch (get_fsync_mode()) {
+	case FSYNC_OBJECT:
+		/* not there when the object was already packed, or went to the pack in progress */
+		fd = open(path, O_RDONLY);
+		if (fd >= 0) {
+			fsync_or_die(fd, path);
+			close(fd);
+		}
+		break;
+	case FSYNC_BATCH:
+		add_pending(path);
+		break;
+	default:
+		break;
+	}
+}
+
+void fsync_loose_object(git_repository *repo, const git_oid *oid)
+{
+	struct strbuf path = STRBUF_INIT;
+	char name[GIT_OID_HEXSZ + 2];
+
+	if (get_fsync_mode() == FSYNC_NONE)
+		return;
+
+	strbuf_addstr(&path, git_repository_path(repo, GIT_REPO_PATH_ODB));
+	if (path.len && path.buf[path.len - 1] != '/')
+		strbuf_addch(&path, '/');
+	git_oid_pathfmt(name, oid);
+	strbuf_add(&path, name, GIT_OID_HEXSZ + 1);
+	fsync_written_path(path.buf);
+	strbuf_release(&path);
+}
+
+void fsync_batch()
+{
+	char *path;
+	int fd;
+
+	pthread_mutex_lock(&batch_mutex);
+	path = pending;
+	pending = NULL;
+	pthread_mutex_unlock(&batch_mutex);
+	if (!path)
+		return;
+
+	uint64_t start = trace_perf_start();
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		die_errno("unable to open '%s'", path);
+#ifdef __linux__
+	if (syncfs(fd) < 0)
+		die_errno("syncfs error on '%s'", path);
+#else
+	sync();
+#endif
+	close(fd);
+	free(path);
+	trace_perf_stop("fsync_batch", start);
+}
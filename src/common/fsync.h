@@ -0,0 +1,32 @@
+#ifndef FSYNC_H
+#define FSYNC_H
+
+#include <git2.h>
+
+/*
+ * How the files a command writes are made durable, chosen by GIT2_FSYNC :
+ *  - "none" (the default) : nothing is synced, as libgit2 does,
+ *  - "object" : each file is synced on its own before it is used : the
+ *    loose objects, the packs and their index, the index,
+ *  - "batch" : nothing is synced as it is written. One syncfs() of the
+ *    filesystem of the repository flushes all of it at once, before the
+ *    index is moved in place (so that it never names objects which are
+ *    not on disk) and at the end of the command.
+ *
+ * I/O errors die, as git's fsync_or_die().
+ */
+
+void fsync_written_file(int fd, const char *path);
+//a file git2 wrote itself (path is for the error message), before it
+//is closed and moved in place
+
+void fsync_written_path(const char *path);
+//a file libgit2 wrote and moved in place, as the index or a loose object
+
+void fsync_loose_object(git_repository *repo, const git_oid *oid);
+//after libgit2 wrote the loose object oid, which it does not sync
+
+void fsync_batch();
+//flush what was written without a sync since the last call, if any
+
+#endif
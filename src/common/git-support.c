@@ -1,74 +1,249 @@
 #include <unistd.h>
+#include <time.h>
 #include "git-support.h"
 #include "run-command.h"
 #include "utils.h"
 #include "errors.h"
+#include "environment.h"
+#include "ipc.h"
+#include "trace.h"
+#include "output.h"
+#include "pack-on-write.h"
+#include "fsync.h"
+#include "abspath.h"
 
 char *please_git_help_me(const char **argv) {
 	struct child_process process;
+	struct strbuf output = STRBUF_INIT;
 	memset(&process, 0, sizeof(process));
 	process.argv = argv;
-	process.out = -1;
 
-	run_command(&process);
-	char *buffer = (char*)xmalloc(sizeof(char) * (1024 + 1));
-	char *buf = buffer;
+	uint64_t start = trace_perf_start();
+	if (capture_command(&process, &output, 0) < 0 && !output.len)
+		die_errno("xread from child_process");
 
-	int count = 0;
-	int loaded;
+	if (output.len && output.buf[output.len - 1] == '\n')
+		strbuf_setlen(&output, output.len - 1);
 
-	while (1) {
-		loaded = xread(process.out, buffer, 1024);
+	trace_perf_stop("git_help", start);
 
-		if (loaded < 0) {
-			die_errno("xread from child_process");
-		}
+	return strbuf_detach(&output, NULL);
+}
 
-		if (loaded == 0) {
-			buffer[count] = '\0';
+/* the command line of main(), only copied if we fall back */
+static int registered_argc = 0;
+static const char **registered_argv = NULL;
+static const char **git_argv = NULL;
+static jmp_buf *fallback_env = NULL;
+static int *fallback_status = NULL;
+/* when the command was registered, to tell what a fallback cost */
+static uint64_t registered_ns = 0;
+
+static const char *fallback_reason_names[FALLBACK_REASONS] = {
+	"not-enabled",
+	"command",
+	"option",
+	"usage",
+	"error",
+	"setting",
+	"revision",
+	"path",
+	"objects",
+	"index",
+	"sparse",
+	"work-tree",
+	"repository"
+};
+
+const char *fallback_reason_name(enum fallback_reason reason) {
+	if ((unsigned int)reason >= FALLBACK_REASONS)
+		return "unknown";
+	return fallback_reason_names[reason];
+}
 
-			if (count > 0 && buffer[count - 1] == '\n') {
-				buffer [ count -1 ] = '\0';
-			}
-			break;
-		}
+static uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
 
-		count += loaded;
-		buf += loaded;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* the command : the first argument which is not a global option */
+static const char *registered_command(void)
+{
+	for (int i = 1; i < registered_argc; i++)
+		if (registered_argv[i][0] != '-')
+			return registered_argv[i];
+	return "-";
+}
 
-		if (loaded == 1024) {
-			buffer = (char*)xrealloc(buffer, sizeof(char) * (count + 1024 + 1));
-		}
+/* up to its value, which may be anything : "--format=%s" logs "--format" */
+static void add_log_detail(struct strbuf *line, const char *detail)
+{
+	if (!detail || !*detail) {
+		strbuf_addch(line, '-');
+		return;
 	}
+	for (; *detail && *detail != '='; detail++)
+		strbuf_addch(line, (unsigned char)*detail < ' ' ? '?' : *detail);
+}
 
-	return buffer;
+/*
+ * A line of GIT2_FALLBACK_LOG : the time, the command, the reason, the
+ * detail, where git2 fell back and the milliseconds spent until then,
+ * separated by tabs. It is written at once, in append mode, so that
+ * concurrent commands can share the log. Nothing stops the fallback :
+ * a log which cannot be written is left alone.
+ */
+static void log_fallback(enum fallback_reason reason, const char *detail, const char *file, int line)
+{
+	const char *path = getenv(GIT2_FALLBACK_LOG_ENVIRONMENT);
+	const char *name = strrchr(file, '/');
+	struct strbuf entry = STRBUF_INIT;
+	int fd;
+
+	if (!path || !is_absolute_path(path))
+		return;
+
+	strbuf_addf(&entry, "%ld\t%s\t%s\t", (long)time(NULL), registered_command(),
+		fallback_reason_name(reason));
+	add_log_detail(&entry, detail);
+	strbuf_addf(&entry, "\t%s:%d\t%.3f\n", name ? name + 1 : file, line,
+		registered_ns ? (monotonic_ns() - registered_ns) / 1e6 : 0.0);
+
+	fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0666);
+	if (fd >= 0) {
+		write_in_full(fd, entry.buf, entry.len);
+		close(fd);
+	}
+	strbuf_release(&entry);
 }
 
-static char **git_argv = NULL;
+/* git ran the command on our behalf */
+static void NORETURN fallback_done(int code)
+{
+	if (!fallback_env)
+		do_exit(code);
 
-void please_git_do_it_for_me() {
-	execvp(git_argv[0], git_argv);
-	die_errno("Failed to fallback to git.");
+	/* what comes after the command goes on */
+	*fallback_status = code;
+	longjmp(*fallback_env, 1);
 }
 
-void git_support_register_arguments(int argc, const char **argv) {
-	git_argv = (char**)xmalloc(sizeof(char*) * (argc + 1));
+static void NORETURN run_git_and_return(void)
+{
+	struct child_process process;
+
+	memset(&process, 0, sizeof(process));
+	process.argv = git_argv;
+
+	uint64_t start = trace_perf_start();
+	int code = run_command(&process);
+	trace_perf_stop("fallback_run", start);
+	if (code < 0)
+		die("Failed to fallback to git.");
 
-	git_argv[0] = (char*)xstrdup("git");
+	fallback_done(code);
+}
+
+/* git, then the registered command line but its argv[0] */
+static void prepare_git_argv(void) {
+	free(git_argv);
+	git_argv = xmalloc(sizeof(*git_argv) * (registered_argc + 1));
+
+	git_argv[0] = "git";
+	for (int i = 1; i < registered_argc; ++i)
+		git_argv[i] = registered_argv[i];
+	git_argv[registered_argc ? registered_argc : 1] = NULL;
+}
 
-	for (int i = 1; i < argc; ++i) {
-		git_argv[i] = (char*)xstrdup(argv[i]);
+void please_git_fall_back(enum fallback_reason reason, const char *detail, const char *file, int line) {
+	const char *socket_path = getenv(GIT2_FALLBACK_SOCKET_ENVIRONMENT);
+
+	trace_perf_mark("fallback");
+	log_fallback(reason, detail, file, line);
+	prepare_git_argv();
+
+	/* git writes after what we may already have written */
+	free_stdout_output();
+	/* and reads the objects we wrote */
+	finish_pack_on_write();
+	fsync_batch();
+
+	if (socket_path && *socket_path) {
+		uint64_t start = trace_perf_start();
+		int code = ipc_forward(socket_path, git_argv);
+		trace_perf_stop("fallback_forward", start);
+		if (code >= 0)
+			fallback_done(code);
+		//the helper is not there: run git ourselves
 	}
 
-	git_argv[argc] = NULL;
+	if (fallback_env)
+		run_git_and_return();
+
+	/* exec does not return : this is our last chance to report */
+	trace_perf_flush();
+	execvp(git_argv[0], (char *const *)git_argv);
+	die_errno("Failed to fallback to git.");
 }
 
-void git_support_free_arguments() {
-	if (git_argv) {
-		for (int i = 0; git_argv[i]; ++i) {
-			free(git_argv[i]);
-		}
+void please_git_fall_back_with_input(enum fallback_reason reason, const char *input, size_t len,
+	const char *file, int line) {
+	FILE *copy = tmpfile();
+
+	/* the standard input was consumed : git reads it again from a copy */
+	if (!copy || write_in_full(fileno(copy), input, len) < 0 ||
+	    lseek(fileno(copy), 0, SEEK_SET) < 0 || dup2(fileno(copy), 0) < 0)
+		die_errno("Failed to give the standard input back to git.");
+	fclose(copy);
 
-		free(git_argv);
+	please_git_fall_back(reason, NULL, file, line);
+}
+
+void please_git_fall_back_with_pending_input(enum fallback_reason reason, const char *input, size_t len,
+	const char *file, int line) {
+	int fds[2];
+	pid_t pid;
+
+	/* a child feeds git with input, then copies the standard input to it until its end */
+	if (pipe(fds) < 0 || (pid = fork()) < 0)
+		die_errno("Failed to give the standard input back to git.");
+	if (!pid) {
+		char buf[8192];
+		ssize_t n;
+
+		close(fds[0]);
+		if (write_in_full(fds[1], input, len) >= 0)
+			while ((n = xread(0, buf, sizeof(buf))) > 0 && write_in_full(fds[1], buf, n) >= 0)
+				;
+		/* nothing of the parent is flushed */
+		_exit(0);
 	}
+
+	close(fds[1]);
+	if (dup2(fds[0], 0) < 0)
+		die_errno("Failed to give the standard input back to git.");
+	close(fds[0]);
+
+	please_git_fall_back(reason, NULL, file, line);
+}
+
+void git_support_catch_fallbacks(jmp_buf *env, int *status) {
+	fallback_env = env;
+	fallback_status = status;
+}
+
+void git_support_register_arguments(int argc, const char **argv) {
+	registered_argc = argc;
+	registered_argv = argv;
+	registered_ns = getenv(GIT2_FALLBACK_LOG_ENVIRONMENT) ? monotonic_ns() : 0;
+}
+
+void git_support_free_arguments() {
+	free(git_argv);
+	git_argv = NULL;
+	registered_argc = 0;
+	registered_argv = NULL;
 }
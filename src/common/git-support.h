@@ -1,18 +1,79 @@
 #ifndef GIT_SUPPORT_H
 #define GIT_SUPPORT_H
 
+#include <stddef.h>
+#include <setjmp.h>
+
 char *please_git_help_me(const char **argv);
 //execute a git command and returns the results as a string.
 //You have to free the returned string when you don't need it
 //anymore
 
-void please_git_do_it_for_me() __attribute__((noreturn));
+/*
+ * Why a command is handed to git, so that the fallbacks can be counted
+ * (see GIT2_FALLBACK_LOG in the README) : what costs the most is what
+ * is worth doing natively next.
+ */
+enum fallback_reason {
+	FALLBACK_NOT_ENABLED,	/* the native code does not pass git's tests yet */
+	FALLBACK_COMMAND,	/* not a builtin of git2 */
+	FALLBACK_OPTION,	/* an option git2 does not handle */
+	FALLBACK_USAGE,		/* a command line git answers with its usage */
+	FALLBACK_ERROR,		/* an error git reports in its own words */
+	FALLBACK_SETTING,	/* a configuration or environment setting */
+	FALLBACK_REVISION,	/* a name of revision or object git2 does not resolve */
+	FALLBACK_PATH,		/* a path or pathspec git2 does not handle */
+	FALLBACK_OBJECTS,	/* alternates, replaced history, objects libgit2 cannot read */
+	FALLBACK_INDEX,		/* entries or a format of index git2 does not handle */
+	FALLBACK_SPARSE,	/* a sparse checkout, or a sparse index */
+	FALLBACK_WORK_TREE,	/* no work tree, submodules, other work trees */
+	FALLBACK_REPOSITORY,	/* a repository to reinitialize, refs libgit2 cannot read */
+	FALLBACK_REASONS
+};
+
+const char *fallback_reason_name(enum fallback_reason reason);
+//the name of reason in the fallback log, as "not-enabled"
+
+void please_git_fall_back(enum fallback_reason reason, const char *detail,
+	const char *file, int line) __attribute__((noreturn));
 //substitute the current executable to git
 //and execute the command call (registered by main
-//at the program call with git_support_register_arguments)
+//at the program call with git_support_register_arguments).
+//The fallback is logged with its reason, its detail (the option, or
+//NULL) and where it happened. Called through the macros below
+
+#define please_git_do_it_for_me(reason) \
+	please_git_fall_back(reason, NULL, __FILE__, __LINE__)
+//hand the command to git for reason
+
+#define please_git_do_it_for_option(option) \
+	please_git_fall_back(FALLBACK_OPTION, option, __FILE__, __LINE__)
+//hand the command to git for one of its options
+
+void please_git_fall_back_with_input(enum fallback_reason reason, const char *input, size_t len,
+	const char *file, int line) __attribute__((noreturn));
+#define please_git_do_it_with_input(reason, input, len) \
+	please_git_fall_back_with_input(reason, input, len, __FILE__, __LINE__)
+//please_git_do_it_for_me() for a command which already read its
+//standard input : git gets input on its standard input instead
+
+void please_git_fall_back_with_pending_input(enum fallback_reason reason, const char *input, size_t len,
+	const char *file, int line) __attribute__((noreturn));
+#define please_git_do_it_with_pending_input(reason, input, len) \
+	please_git_fall_back_with_pending_input(reason, input, len, __FILE__, __LINE__)
+//please_git_do_it_for_me() for a command which reads its standard input
+//as it comes (cat-file --batch) : git gets input, what was read and not
+//answered yet, then the rest of the standard input as it arrives
+
+void git_support_catch_fallbacks(jmp_buf *env, int *status);
+//while env is set, please_git_do_it_for_me() runs git as a child process
+//instead of becoming git, stores its exit status in status and
+//longjmp()s to env : the process goes on with what follows the command.
+//A NULL env restores the default behaviour
 
 void git_support_register_arguments(int argc, const char **argv);
-//register the command call
+//register the command call. argv is not copied : it must stay valid
+//as long as the command may fall back
 
 void git_support_free_arguments();
 //free registered arguments
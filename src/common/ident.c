@@ -0,0 +1,151 @@
+#include "git-compat-util.h"
+#include "ident.h"
+#include "environment.h"
+#include "strbuf.h"
+#include "utils.h"
+#include "trace.h"
+#include "date.h"
+#include "repository.h"
+
+#define NR_CONFIG_FILES 3
+
+/* user.name and user.email, as read from the files at their stat */
+static struct {
+	int loaded;
+	char *files[NR_CONFIG_FILES]; /* NULL when there is none */
+	struct stat st[NR_CONFIG_FILES];
+	char *name, *email;
+} config;
+
+static const char *env_names[][3] = {
+	{GIT_AUTHOR_NAME_ENVIRONMENT, GIT_AUTHOR_EMAIL_ENVIRONMENT, GIT_AUTHOR_DATE_ENVIRONMENT},
+	{GIT_COMMITTER_NAME_ENVIRONMENT, GIT_COMMITTER_EMAIL_ENVIRONMENT, GIT_COMMITTER_DATE_ENVIRONMENT},
+};
+
+void free_ident_cache()
+{
+	for (int i = 0; i < NR_CONFIG_FILES; i++) {
+		free(config.files[i]);
+		config.files[i] = NULL;
+	}
+	free(config.name);
+	free(config.email);
+	config.name = config.email = NULL;
+	config.loaded = 0;
+}
+
+/* The configuration files of repo, in the order of git_repository_config() */
+static void config_files(char *files[NR_CONFIG_FILES], git_repository *repo)
+{
+	struct strbuf path = STRBUF_INIT;
+	const char *file;
+
+	strbuf_addstr(&path, git_repository_path(repo, GIT_REPO_PATH));
+	if (path.len && path.buf[path.len - 1] != '/')
+		strbuf_addch(&path, '/');
+	strbuf_addstr(&path, "config");
+	files[0] = strbuf_detach(&path, NULL);
+
+	file = get_git_global_config_file();
+	files[1] = file ? xstrdup(file) : NULL;
+	file = get_git_system_config_file();
+	files[2] = file ? xstrdup(file) : NULL;
+}
+
+static void stat_config_file(struct stat *st, const char *file)
+{
+	if (!file || stat(file, st))
+		memset(st, 0, sizeof(*st));
+}
+
+static int same_file(const struct stat *a, const struct stat *b)
+{
+	return a->st_ino == b->st_ino && a->st_size == b->st_size &&
+		a->st_mtime == b->st_mtime && ST_MTIME_NSEC(*a) == ST_MTIME_NSEC(*b);
+}
+
+static int same_path(const char *a, const char *b)
+{
+	return a == b || (a && b && !strcmp(a, b));
+}
+
+static char *config_string(git_config *cfg, const char *name)
+{
+	const char *value;
+
+	if (git_config_get_string(cfg, name, &value) != GIT_SUCCESS || !value)
+		return NULL;
+	return xstrdup(value);
+}
+
+/* Read user.name and user.email again if a configuration file changed */
+static int load_config(git_repository *repo)
+{
+	char *files[NR_CONFIG_FILES];
+	struct stat st[NR_CONFIG_FILES];
+	int changed = !config.loaded;
+	git_config *cfg;
+
+	config_files(files, repo);
+	for (int i = 0; i < NR_CONFIG_FILES; i++) {
+		stat_config_file(&st[i], files[i]);
+		if (!same_path(files[i], config.files[i]) || !same_file(&st[i], &config.st[i]))
+			changed = 1;
+	}
+
+	if (!changed) {
+		for (int i = 0; i < NR_CONFIG_FILES; i++)
+			free(files[i]);
+		return 0;
+	}
+
+	uint64_t start = trace_perf_start();
+	free_ident_cache();
+	for (int i = 0; i < NR_CONFIG_FILES; i++) {
+		config.files[i] = files[i];
+		config.st[i] = st[i];
+	}
+
+	if (git_repository_config(&cfg, repo, files[1], files[2]) != GIT_SUCCESS) {
+		trace_perf_stop("load_ident_config", start);
+		return -1;
+	}
+	config.name = config_string(cfg, "user.name");
+	config.email = config_string(cfg, "user.email");
+	git_config_free(cfg);
+
+	config.loaded = 1;
+	trace_perf_stop("load_ident_config", start);
+	return 0;
+}
+
+int get_ident(const char **name, const char **email, git_repository *repo, enum ident_role role)
+{
+	*name = getenv(env_names[role][0]);
+	*email = getenv(env_names[role][1]);
+	if (*name && *email)
+		return 0;
+
+	if (load_config(repo) < 0)
+		return -1;
+
+	if (!*name)
+		*name = config.name;
+	if (!*email)
+		*email = config.email ? config.email : getenv("EMAIL");
+
+	return *name && *email ? 0 : -1;
+}
+
+int get_ident_date(unsigned long *timestamp, int *offset, enum ident_role role)
+{
+	const char *date = getenv(env_names[role][2]);
+	char now[50];
+
+	if (!date) {
+		datestamp(now, sizeof(now));
+		date = now;
+	}
+
+	return parse_date_basic(date, timestamp, offset) ? -1 : 0;
+}
@@ -0,0 +1,34 @@
+#ifndef IDENT_H
+#define IDENT_H
+
+#include <git2.h>
+
+/*
+ * The identities of the author and of the committer of new commits, as
+ * git makes them : the GIT_AUTHOR_* and GIT_COMMITTER_* variables first,
+ * then user.name and user.email from the configuration files (of the
+ * repository, global, then system), and the current time.
+ *
+ * The configuration is only read again when one of its files changed,
+ * so that the commits of a --batch run or of the daemon do not parse it
+ * each time.
+ */
+
+enum ident_role {
+	IDENT_AUTHOR,
+	IDENT_COMMITTER,
+};
+
+int get_ident(const char **name, const char **email, git_repository *repo, enum ident_role role);
+//the name and email of role. Returns -1 when neither the environment
+//nor the configuration has them (git then makes them up from the system
+//account) : the caller falls back
+
+int get_ident_date(unsigned long *timestamp, int *offset, enum ident_role role);
+//the date of role : its environment variable, or now in the local time
+//zone. Returns -1 when the variable has a format we do not parse
+
+void free_ident_cache();
+//forget the identity read from the configuration
+
+#endif
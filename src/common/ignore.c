@@ -0,0 +1,432 @@
+#include "git-compat-util.h"
+#include "ignore.h"
+#include "strbuf.h"
+#include "utils.h"
+#include "ctype.h"
+#include "wildmatch.h"
+#include <pthread.h>
+
+#define IGNORE_NEGATIVE 1
+#define IGNORE_MUST_BE_DIR 2
+#define IGNORE_BASENAME 4 /* no slash : matched against the basename */
+#define IGNORE_ENDS_WITH 8 /* '*' then a literal */
+
+/* What the literal patterns of a list are looked up by */
+enum literal_kind {
+	LITERAL_BASENAME, /* "name" */
+	LITERAL_SUFFIX, /* "*.ext" */
+	LITERAL_PATH /* "dir/name" */
+};
+
+/*
+ * The literal patterns of a list which have the same kind and text : the
+ * last of them decides, and it may only match directories
+ */
+struct ignore_literal {
+	const char *text;
+	size_t len;
+	enum literal_kind kind;
+	unsigned int hash;
+	unsigned int last; /* 1 + the index of the last pattern, 0 if the slot is free */
+	unsigned int last_file; /* the same without the patterns ending with '/' */
+};
+
+static unsigned int hash_literal(enum literal_kind kind, const char *text, size_t len)
+{
+	unsigned int hash = 2166136261u ^ kind;
+
+	while (len--) {
+		hash ^= (unsigned char)*text++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static struct ignore_literal *find_literal(const struct ignore_list *list, enum literal_kind kind,
+	const char *text, size_t len, unsigned int hash)
+{
+	size_t mask = list->literals_size - 1;
+
+	for (size_t i = hash & mask;; i = (i + 1) & mask) {
+		struct ignore_literal *literal = &list->literals[i];
+
+		if (!literal->last ||
+		    (literal->hash == hash && literal->kind == kind && literal->len == len &&
+		     !memcmp(literal->text, text, len)))
+			return literal;
+	}
+}
+
+/* The kind of a pattern which only needs a lookup, -1 for those wildmatch() has to try */
+static int literal_kind(const struct ignore_pattern *pattern)
+{
+	if (pattern->literal_len == pattern->len)
+		return pattern->flags & IGNORE_BASENAME ? LITERAL_BASENAME : LITERAL_PATH;
+	if ((pattern->flags & (IGNORE_BASENAME | IGNORE_ENDS_WITH)) == (IGNORE_BASENAME | IGNORE_ENDS_WITH) &&
+	    pattern->len - 1 < 64)
+		return LITERAL_SUFFIX;
+	return -1;
+}
+
+/*
+ * Put the literal patterns in a hash table and the others in the wild
+ * list, so that matching a path costs a few lookups, and wildmatch()
+ * only for the patterns after the last literal one which matched
+ */
+static void compile_list(struct ignore_list *list)
+{
+	unsigned int nr_literals = 0, wild_alloc = 0;
+
+	for (unsigned int i = 0; i < list->nr; i++)
+		if (literal_kind(&list->patterns[i]) >= 0)
+			nr_literals++;
+
+	list->literals_size = 0;
+	if (nr_literals) {
+		list->literals_size = 4;
+		while (list->literals_size < 2 * nr_literals)
+			list->literals_size *= 2;
+		list->literals = xcalloc(list->literals_size, sizeof(*list->literals));
+	}
+
+	for (unsigned int i = 0; i < list->nr; i++) {
+		const struct ignore_pattern *pattern = &list->patterns[i];
+		int kind = literal_kind(pattern);
+		const char *text = pattern->pattern;
+		size_t len = pattern->len;
+
+		if (kind < 0) {
+			ALLOC_GROW(list->wild, list->nr_wild + 1, wild_alloc);
+			list->wild[list->nr_wild++] = i;
+			continue;
+		}
+		if (kind == LITERAL_SUFFIX) {
+			text++;
+			len--;
+			list->suffix_lengths |= (uint64_t)1 << len;
+		}
+
+		unsigned int hash = hash_literal(kind, text, len);
+		struct ignore_literal *literal = find_literal(list, kind, text, len, hash);
+
+		literal->text = text;
+		literal->len = len;
+		literal->kind = kind;
+		literal->hash = hash;
+		literal->last = i + 1;
+		if (!(pattern->flags & IGNORE_MUST_BE_DIR))
+			literal->last_file = i + 1;
+	}
+}
+
+/* The last pattern of kind and text, if it is after *best */
+static void lookup_literal(const struct ignore_list *list, enum literal_kind kind,
+	const char *text, size_t len, int is_dir, unsigned int *best)
+{
+	const struct ignore_literal *literal;
+	unsigned int last;
+
+	if (!list->literals_size)
+		return;
+	literal = find_literal(list, kind, text, len, hash_literal(kind, text, len));
+	last = is_dir ? literal->last : literal->last_file;
+	if (last > *best)
+		*best = last;
+}
+
+static size_t literal_length(const char *pattern)
+{
+	size_t len = 0;
+
+	while (pattern[len] && !is_glob_special(pattern[len]))
+		len++;
+	return len;
+}
+
+/* Trailing spaces are dropped, unless they are escaped */
+static void trim_trailing_spaces(char *line)
+{
+	char *last_space = NULL;
+
+	for (char *p = line; *p; p++) {
+		switch (*p) {
+		case ' ':
+			if (!last_space)
+				last_space = p;
+			break;
+		case '\\':
+			if (!*++p)
+				return;
+			/* fall through */
+		default:
+			last_space = NULL;
+		}
+	}
+	if (last_space)
+		*last_space = '\0';
+}
+
+static void add_pattern(struct ignore_list *list, char *line)
+{
+	struct ignore_pattern *pattern;
+	unsigned int flags = 0;
+	size_t len;
+
+	if (*line == '!') {
+		flags |= IGNORE_NEGATIVE;
+		line++;
+	}
+	len = strlen(line);
+	if (len && line[len - 1] == '/') {
+		flags |= IGNORE_MUST_BE_DIR;
+		line[--len] = '\0';
+	}
+	if (!memchr(line, '/', len))
+		flags |= IGNORE_BASENAME;
+	else if (*line == '/') {
+		/* anchored already */
+		line++;
+		len--;
+	}
+	if (!len)
+		return;
+
+	ALLOC_GROW(list->patterns, list->nr + 1, list->alloc);
+	pattern = &list->patterns[list->nr++];
+	pattern->pattern = line;
+	pattern->len = len;
+	pattern->literal_len = literal_length(line);
+	if (*line == '*' && literal_length(line + 1) == len - 1)
+		flags |= IGNORE_ENDS_WITH;
+	pattern->flags = flags;
+}
+
+int ignore_list_read(struct ignore_list *list, const char *file, const char *base, size_t base_len)
+{
+	struct strbuf contents = STRBUF_INIT;
+	char *line;
+
+	if (strbuf_read_file(&contents, file, 0) < 0) {
+		strbuf_release(&contents);
+		return -1;
+	}
+
+	list->buf = strbuf_detach(&contents, NULL);
+	list->base = xmemdupz(base, base_len);
+	list->base_len = base_len;
+
+	line = list->buf;
+	/* an UTF-8 byte order mark */
+	if (!strncmp(line, "\xef\xbb\xbf", 3))
+		line += 3;
+	while (*line) {
+		char *eol = strchrnul(line, '\n');
+		char *next = *eol ? eol + 1 : eol;
+
+		if (eol > line && eol[-1] == '\r')
+			eol[-1] = '\0';
+		*eol = '\0';
+		/* "\#" and "\!" are literal chars : the '\' escapes them in wildmatch() */
+		if (*line != '#') {
+			trim_trailing_spaces(line);
+			if (*line)
+				add_pattern(list, line);
+		}
+		line = next;
+	}
+
+	compile_list(list);
+	return 0;
+}
+
+/* The basename of a path against a pattern with no slash */
+static int match_basename(const struct ignore_pattern *pattern, const char *name, size_t len)
+{
+	if (pattern->flags & IGNORE_ENDS_WITH)
+		return pattern->len - 1 <= len &&
+			!memcmp(name + len - (pattern->len - 1), pattern->pattern + 1, pattern->len - 1);
+	return wildmatch(pattern->pattern, name, WM_PATHNAME);
+}
+
+/* A path below the directory of the list against a pattern */
+static int match_path(const struct ignore_pattern *pattern, const char *name, size_t len)
+{
+	size_t literal = pattern->literal_len;
+
+	if (literal > len || memcmp(name, pattern->pattern, literal))
+		return 0;
+	return wildmatch(pattern->pattern + literal, name + literal, WM_PATHNAME);
+}
+
+int ignore_list_match(const struct ignore_list *list, const char *path, size_t len, int is_dir)
+{
+	const char *basename, *slash;
+	size_t basename_len;
+	unsigned int best = 0; /* 1 + the index of the last pattern which matches */
+
+	if (!list->nr || len < list->base_len || memcmp(path, list->base, list->base_len))
+		return -1;
+
+	slash = memrchr(path, '/', len);
+	basename = slash ? slash + 1 : path;
+	basename_len = path + len - basename;
+
+	lookup_literal(list, LITERAL_BASENAME, basename, basename_len, is_dir, &best);
+	for (uint64_t lengths = list->suffix_lengths; lengths; lengths &= lengths - 1) {
+		size_t suffix_len = __builtin_ctzll(lengths);
+
+		if (suffix_len > basename_len)
+			break;
+		lookup_literal(list, LITERAL_SUFFIX, basename + basename_len - suffix_len, suffix_len, is_dir, &best);
+	}
+	lookup_literal(list, LITERAL_PATH, path + list->base_len, len - list->base_len, is_dir, &best);
+
+	/* only the wild patterns after the best literal one can change the answer */
+	for (unsigned int i = list->nr_wild; i-- > 0 && list->wild[i] >= best;) {
+		const struct ignore_pattern *pattern = &list->patterns[list->wild[i]];
+		int matches;
+
+		if ((pattern->flags & IGNORE_MUST_BE_DIR) && !is_dir)
+			continue;
+		if (pattern->flags & IGNORE_BASENAME)
+			matches = match_basename(pattern, basename, basename_len);
+		else
+			matches = match_path(pattern, path + list->base_len, len - list->base_len);
+		if (matches) {
+			best = list->wild[i] + 1;
+			break;
+		}
+	}
+
+	return best ? !(list->patterns[best - 1].flags & IGNORE_NEGATIVE) : -1;
+}
+
+/*
+ * The files ignore_list_load() read, with their stat data to tell when
+ * they change. A list replaced by a newer read is kept (in retired) until
+ * free_ignore_cache(), as walks of the same process may still use it.
+ */
+struct cached_list {
+	char *file;
+	unsigned int hash;
+	struct stat st;
+	struct ignore_list list;
+	struct cached_list *retired;
+};
+
+static struct {
+	struct cached_list **slots;
+	size_t size, nr; /* size is a power of 2, or 0 */
+	struct cached_list *retired;
+	pthread_mutex_t lock;
+} cache = {NULL, 0, 0, NULL, PTHREAD_MUTEX_INITIALIZER};
+
+static int same_stat(const struct stat *a, const struct stat *b)
+{
+	return a->st_ino == b->st_ino && a->st_dev == b->st_dev && a->st_size == b->st_size &&
+		a->st_mtime == b->st_mtime && ST_MTIME_NSEC(*a) == ST_MTIME_NSEC(*b);
+}
+
+static struct cached_list **cache_slot(const char *file, unsigned int hash)
+{
+	size_t mask = cache.size - 1;
+
+	for (size_t i = hash & mask;; i = (i + 1) & mask) {
+		struct cached_list *cached = cache.slots[i];
+
+		if (!cached || (cached->hash == hash && !strcmp(cached->file, file)))
+			return &cache.slots[i];
+	}
+}
+
+static void cache_grow(void)
+{
+	struct cached_list **old = cache.slots;
+	size_t old_size = cache.size;
+
+	cache.size = cache.size ? cache.size * 2 : 64;
+	cache.slots = xcalloc(cache.size, sizeof(*cache.slots));
+	for (size_t i = 0; i < old_size; i++)
+		if (old[i])
+			*cache_slot(old[i]->file, old[i]->hash) = old[i];
+	free(old);
+}
+
+const struct ignore_list *ignore_list_load(const char *file, const char *base, size_t base_len)
+{
+	unsigned int hash = hash_literal(0, file, strlen(file));
+	struct cached_list *cached, **slot;
+	struct stat st;
+
+	if (stat(file, &st) || !S_ISREG(st.st_mode))
+		return NULL;
+
+	pthread_mutex_lock(&cache.lock);
+	if (cache.size) {
+		cached = *cache_slot(file, hash);
+		if (cached && same_stat(&cached->st, &st) && cached->list.base_len == base_len &&
+		    !memcmp(cached->list.base, base, base_len)) {
+			pthread_mutex_unlock(&cache.lock);
+			return &cached->list;
+		}
+	}
+	pthread_mutex_unlock(&cache.lock);
+
+	/* parsed without the lock : the threads of a walk read different files */
+	cached = xcalloc(1, sizeof(*cached));
+	if (ignore_list_read(&cached->list, file, base, base_len) < 0) {
+		free(cached);
+		return NULL;
+	}
+	cached->file = xstrdup(file);
+	cached->hash = hash;
+	cached->st = st;
+
+	pthread_mutex_lock(&cache.lock);
+	if (2 * (cache.nr + 1) > cache.size)
+		cache_grow();
+	slot = cache_slot(file, hash);
+	if (*slot) {
+		(*slot)->retired = cache.retired;
+		cache.retired = *slot;
+	} else {
+		cache.nr++;
+	}
+	*slot = cached;
+	pthread_mutex_unlock(&cache.lock);
+
+	return &cached->list;
+}
+
+static void free_cached_list(struct cached_list *cached)
+{
+	ignore_list_clear(&cached->list);
+	free(cached->file);
+	free(cached);
+}
+
+void free_ignore_cache()
+{
+	for (size_t i = 0; i < cache.size; i++)
+		if (cache.slots[i])
+			free_cached_list(cache.slots[i]);
+	while (cache.retired) {
+		struct cached_list *next = cache.retired->retired;
+
+		free_cached_list(cache.retired);
+		cache.retired = next;
+	}
+	free(cache.slots);
+	cache.slots = NULL;
+	cache.size = cache.nr = 0;
+}
+
+void ignore_list_clear(struct ignore_list *list)
+{
+	free(list->literals);
+	free(list->wild);
+	free(list->patterns);
+	free(list->buf);
+	free(list->base);
+	memset(list, 0, sizeof(*list));
+}
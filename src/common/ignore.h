@@ -0,0 +1,65 @@
+#ifndef IGNORE_H
+#define IGNORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The patterns of a .gitignore (or of info/exclude, core.excludesFile),
+ * parsed once : each keeps its flags and the length of its literal
+ * start, so that most paths are rejected by a memcmp(), and literal or
+ * "*.ext" patterns never go through wildmatch().
+ *
+ * As in git, the last pattern of a list which matches decides, and a
+ * pattern with no slash (but a trailing one) matches the basename of
+ * the paths at any depth below the directory of its file, the others
+ * the path from that directory on.
+ *
+ * The literal patterns ("name", "*.ext", "dir/name") are compiled into a
+ * hash table : a path is matched with one lookup per kind (and per
+ * length of suffix), and wildmatch() only runs for the other patterns
+ * which come after the last literal one matching it.
+ */
+
+struct ignore_pattern {
+	const char *pattern; /* NUL terminated, without its '!' and slashes at the ends */
+	size_t len;
+	size_t literal_len; /* before the first wildcard */
+	unsigned int flags;
+};
+
+struct ignore_list {
+	struct ignore_pattern *patterns;
+	unsigned int nr, alloc;
+	char *buf; /* the patterns point into it */
+	char *base; /* of the file, from the top of the work tree : "" or "dir/" */
+	size_t base_len;
+
+	struct ignore_literal *literals; /* hash table of the literal patterns */
+	size_t literals_size; /* a power of 2, or 0 */
+	uint64_t suffix_lengths; /* bit n is set if a "*suffix" of n chars is in literals */
+	unsigned int *wild; /* the indexes of the other patterns, in order */
+	unsigned int nr_wild;
+};
+
+#define IGNORE_LIST_INIT { NULL, 0, 0, NULL, NULL, 0, NULL, 0, 0, NULL, 0 }
+
+int ignore_list_read(struct ignore_list *list, const char *file, const char *base, size_t base_len);
+//fill the empty list with the patterns of file, whose paths are
+//relative to base. Returns -1 (list stays empty) if file cannot be read
+
+int ignore_list_match(const struct ignore_list *list, const char *path, size_t len, int is_dir);
+//whether path (from the top of the work tree, without a trailing slash,
+//NUL terminated) is ignored by list : 1 if its last matching pattern ignores it, 0 if it
+//is a negated one, -1 if no pattern matches
+
+void ignore_list_clear(struct ignore_list *list);
+
+const struct ignore_list *ignore_list_load(const char *file, const char *base, size_t base_len);
+//ignore_list_read() through a cache of the process : a file is parsed
+//again only if its stat data changed. Returns NULL if file cannot be
+//read. The list is valid until free_ignore_cache(). Thread safe
+
+void free_ignore_cache();
+
+#endif
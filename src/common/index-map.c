@@ -0,0 +1,1396 @@
+#include "git-compat-util.h"
+#include "index-map.h"
+#include "byte-order.h"
+#include "utils.h"
+#include "trace.h"
+#include "sha1.h"
+#include "fsync.h"
+#include "hex.h"
+#include "thread-pool.h"
+#include "environment.h"
+#include "abspath.h"
+
+#define INDEX_SIGNATURE 0x44495243 /* "DIRC" */
+#define INDEX_HEADER_SIZE 12
+
+/* ctime, mtime, dev, ino, mode, uid, gid, size, oid, flags */
+#define ENTRY_PATH_OFFSET (40 + GIT_OID_RAWSZ + 2)
+#define ENTRY_EXTENDED_PATH_OFFSET (ENTRY_PATH_OFFSET + 2)
+
+#define LINK_SIGNATURE "link"
+/* splitIndex.maxPercentChange, as git has it by default */
+#define SPLIT_INDEX_MAX_CHANGE 20
+
+#define OFFSET_TABLE_SIGNATURE "IEOT"
+#define OFFSET_TABLE_VERSION 1
+#define END_OF_ENTRIES_SIGNATURE "EOIE"
+/* where the entries end, then the hash of the headers of the extensions */
+#define END_OF_ENTRIES_SIZE (4 + SHA1_RAWSZ)
+/* below that many entries, threads cost more than they save (git's THREAD_COST) */
+#define INDEX_PARALLEL_MIN 10000
+
+/* Where the path of the entry at data starts : after its extended flags, if it has some */
+static size_t entry_path_offset(const unsigned char *data)
+{
+	if (get_be16_at(data + ENTRY_PATH_OFFSET - 2) & GIT_IDXENTRY_EXTENDED)
+		return ENTRY_EXTENDED_PATH_OFFSET;
+	return ENTRY_PATH_OFFSET;
+}
+
+static size_t entry_size(const unsigned char *data)
+{
+	size_t fixed = entry_path_offset(data);
+
+	return (fixed + strlen((const char *)data + fixed) + 8) & ~(size_t)7;
+}
+
+/* The order of the index : by path, then by stage */
+static int compare_entries(const unsigned char *a, const char *path, const unsigned char *b)
+{
+	int cmp = strcmp(path, (const char *)b + entry_path_offset(b));
+
+	if (cmp)
+		return cmp;
+	return (int)(get_be16_at(a + ENTRY_PATH_OFFSET - 2) & GIT_IDXENTRY_STAGEMASK) -
+		(int)(get_be16_at(b + ENTRY_PATH_OFFSET - 2) & GIT_IDXENTRY_STAGEMASK);
+}
+
+/* Append the stat data, oid and flags at data, for a path of len bytes */
+static void append_entry_header(struct strbuf *sb, const unsigned char *data, size_t len)
+{
+	size_t start = sb->len;
+	uint16_t flags = get_be16_at(data + ENTRY_PATH_OFFSET - 2) & ~GIT_IDXENTRY_NAMEMASK;
+
+	strbuf_add(sb, data, entry_path_offset(data));
+	flags = htons(flags | (len < GIT_IDXENTRY_NAMEMASK ? len : GIT_IDXENTRY_NAMEMASK));
+	memcpy(sb->buf + start + ENTRY_PATH_OFFSET - 2, &flags, sizeof(flags));
+}
+
+/* Append an entry of version 2 or 3 : the stat data, oid and flags at data, then path */
+static void append_entry(struct strbuf *sb, const unsigned char *data, const char *path, size_t len)
+{
+	size_t start = sb->len, fixed = entry_path_offset(data);
+
+	append_entry_header(sb, data, len);
+	strbuf_add(sb, path, len);
+
+	/* padded with 1 to 8 NULs to a multiple of 8 bytes */
+	while (sb->len < start + ((fixed + len + 8) & ~(size_t)7))
+		strbuf_addch(sb, '\0');
+}
+
+/*
+ * Find where count entries start from offset on (the first one being
+ * number first), checking they all fit in the file. Returns where they
+ * end, 0 if they do not fit.
+ */
+static size_t parse_entries(struct index_map *map, uint32_t version, size_t offset, uint32_t first, uint32_t count)
+{
+	const unsigned char *data = map->data;
+	/* the entries are followed by the checksum at least */
+	size_t end = map->size - GIT_OID_RAWSZ;
+
+	for (uint32_t i = first; i < first + count; i++) {
+		size_t path_offset = ENTRY_PATH_OFFSET, path_len;
+		uint16_t flags;
+		const unsigned char *nul;
+
+		if (end - offset < ENTRY_PATH_OFFSET)
+			return 0;
+
+		flags = get_be16_at(data + offset + ENTRY_PATH_OFFSET - 2);
+		if (flags & GIT_IDXENTRY_EXTENDED) {
+			if (version < 3)
+				return 0;
+			path_offset = ENTRY_EXTENDED_PATH_OFFSET;
+		}
+		if (end - offset < path_offset)
+			return 0;
+
+		/* the length is only recorded when below GIT_IDXENTRY_NAMEMASK */
+		nul = memchr(data + offset + path_offset, '\0', end - offset - path_offset);
+		if (!nul)
+			return 0;
+		path_len = nul - (data + offset + path_offset);
+		if ((flags & GIT_IDXENTRY_NAMEMASK) != GIT_IDXENTRY_NAMEMASK &&
+		    path_len != (flags & GIT_IDXENTRY_NAMEMASK))
+			return 0;
+
+		map->offsets[i] = offset;
+
+		/* entries are padded with 1 to 8 NULs to a multiple of 8 bytes */
+		offset += (path_offset + path_len + 8) & ~(size_t)7;
+		if (offset > end || offset > UINT32_MAX)
+			return 0;
+	}
+
+	return offset;
+}
+
+/*
+ * Find the extension with the given signature among those from offset to
+ * end : each is a 4 bytes signature and a 32 bits size, then the data.
+ */
+static int find_extension(const unsigned char *data, size_t offset, size_t end, const char *signature,
+	const unsigned char **ext, uint32_t *size)
+{
+	while (end - offset >= 8) {
+		uint32_t len = get_be32_at(data + offset + 4);
+
+		if (len > end - offset - 8)
+			break;
+		if (!memcmp(data + offset, signature, 4)) {
+			*ext = data + offset + 8;
+			*size = len;
+			return 1;
+		}
+		offset += 8 + len;
+	}
+	return 0;
+}
+
+/*
+ * The "EOIE" extension, last of all, tells where the entries end, with a
+ * hash of the signatures and sizes of the extensions which follow them
+ * (it is stale if another program added one). Returns that end, 0 if the
+ * index has no such extension or if it does not hold.
+ */
+static size_t read_end_of_entries(const struct index_map *map)
+{
+	const unsigned char *eoie;
+	unsigned char hash[SHA1_RAWSZ];
+	struct sha1_ctx sha1;
+	size_t offset, last;
+
+	if (map->size < INDEX_HEADER_SIZE + 8 + END_OF_ENTRIES_SIZE + GIT_OID_RAWSZ)
+		return 0;
+	eoie = map->data + map->size - GIT_OID_RAWSZ - 8 - END_OF_ENTRIES_SIZE;
+	if (memcmp(eoie, END_OF_ENTRIES_SIGNATURE, 4) || get_be32_at(eoie + 4) != END_OF_ENTRIES_SIZE)
+		return 0;
+
+	offset = get_be32_at(eoie + 8);
+	last = eoie - map->data;
+	if (offset < INDEX_HEADER_SIZE || offset > last)
+		return 0;
+
+	sha1_init(&sha1);
+	for (size_t pos = offset; pos < last; ) {
+		uint32_t len;
+
+		if (last - pos < 8 || (len = get_be32_at(map->data + pos + 4)) > last - pos - 8)
+			return 0;
+		sha1_update(&sha1, map->data + pos, 8);
+		pos += 8 + len;
+	}
+	sha1_final(hash, &sha1);
+	return memcmp(hash, eoie + 12, SHA1_RAWSZ) ? 0 : offset;
+}
+
+/* A block of consecutive entries, as the "IEOT" extension lists them */
+struct entry_block {
+	size_t offset, end; /* in the file */
+	uint32_t first, nr;
+	int failed;
+	int extended; /* some of its entries have extended flags */
+};
+
+/*
+ * The blocks of the "IEOT" extension, whose entries can be read on their
+ * own, for an index of nr entries ending at entries_end : NULL if it has
+ * none or if they do not add up.
+ */
+static struct entry_block *read_offset_table(const struct index_map *map, size_t entries_end, uint32_t nr,
+	unsigned int *nr_blocks)
+{
+	const unsigned char *table;
+	struct entry_block *blocks;
+	uint32_t size, first = 0;
+	unsigned int count;
+
+	if (!find_extension(map->data, entries_end, map->size - GIT_OID_RAWSZ, OFFSET_TABLE_SIGNATURE, &table, &size) ||
+	    size < 4 || (size - 4) % 8 || get_be32_at(table) != OFFSET_TABLE_VERSION)
+		return NULL;
+
+	count = (size - 4) / 8;
+	if (!count)
+		return NULL;
+	blocks = xmalloc(count * sizeof(*blocks));
+	for (unsigned int i = 0; i < count; i++) {
+		blocks[i].offset = get_be32_at(table + 4 + 8 * i);
+		blocks[i].nr = get_be32_at(table + 8 + 8 * i);
+		blocks[i].first = first;
+		blocks[i].failed = 0;
+		blocks[i].extended = 0;
+		if (blocks[i].offset < (i ? blocks[i - 1].offset + 1 : INDEX_HEADER_SIZE) ||
+		    blocks[i].offset >= entries_end || blocks[i].nr > nr - first) {
+			free(blocks);
+			return NULL;
+		}
+		if (i)
+			blocks[i - 1].end = blocks[i].offset;
+		first += blocks[i].nr;
+	}
+	blocks[count - 1].end = entries_end;
+
+	if (first != nr || blocks[0].offset != INDEX_HEADER_SIZE) {
+		free(blocks);
+		return NULL;
+	}
+	*nr_blocks = count;
+	return blocks;
+}
+
+/* the threads to read (and write) a big index with, one per processor by default */
+static unsigned int index_workers(void)
+{
+	const char *value = getenv(GIT2_INDEX_WORKERS_ENVIRONMENT);
+	unsigned int workers;
+
+	if (!value || !*value || strtoul_ui(value, 10, &workers) < 0 || !workers)
+		return (unsigned int)online_cpus();
+	return workers;
+}
+
+/* The blocks of an index worth reading on several threads, NULL to read it at once */
+static struct entry_block *parallel_blocks(struct index_map *map, uint32_t nr, unsigned int *nr_blocks,
+	unsigned int *workers, size_t *entries_end)
+{
+	struct entry_block *blocks;
+
+	*entries_end = read_end_of_entries(map);
+	if (!*entries_end)
+		return NULL;
+	blocks = read_offset_table(map, *entries_end, nr, nr_blocks);
+	/* written again with the index, as git does with index.recordEndOfIndexEntries */
+	map->end_of_entries = 1;
+	if (blocks && (nr < INDEX_PARALLEL_MIN || *nr_blocks < 2 || (*workers = index_workers()) < 2)) {
+		free(blocks);
+		blocks = NULL;
+	}
+	return blocks;
+}
+
+struct parse_job {
+	struct index_map *map;
+	uint32_t version;
+	struct entry_block *blocks;
+};
+
+static void parse_block(void *context, unsigned int worker, unsigned int item)
+{
+	struct parse_job *job = context;
+	struct entry_block *block = &job->blocks[item];
+
+	(void)worker;
+	if (parse_entries(job->map, job->version, block->offset, block->first, block->nr) != block->end)
+		block->failed = 1;
+}
+
+/* Find where each entry starts : by blocks on several threads when "IEOT" tells where they are */
+static int parse_index(struct index_map *map)
+{
+	const unsigned char *data = map->data;
+	uint32_t version, nr;
+	size_t offset, entries_end;
+	struct entry_block *blocks;
+	unsigned int nr_blocks, workers;
+
+	if (map->size < INDEX_HEADER_SIZE + GIT_OID_RAWSZ || get_be32_at(data) != INDEX_SIGNATURE)
+		return -1;
+
+	version = get_be32_at(data + 4);
+	if (version != 2 && version != 3)
+		return -1;
+
+	nr = get_be32_at(data + 8);
+	if (nr > (map->size - GIT_OID_RAWSZ - INDEX_HEADER_SIZE) / ENTRY_PATH_OFFSET)
+		return -1;
+
+	map->offsets = xmalloc((nr ? nr : 1) * sizeof(*map->offsets));
+
+	offset = 0;
+	blocks = parallel_blocks(map, nr, &nr_blocks, &workers, &entries_end);
+	if (blocks) {
+		struct parse_job context = { map, version, blocks };
+		struct parallel_job job = { nr_blocks, 1, NULL, parse_block, NULL, &context };
+
+		run_parallel(&job, workers < nr_blocks ? workers : nr_blocks);
+		offset = entries_end;
+		for (unsigned int i = 0; i < nr_blocks; i++)
+			if (blocks[i].failed)
+				offset = 0;
+		free(blocks);
+	}
+	/* a table which does not hold is only a table : the entries may still be right */
+	if (!offset)
+		offset = parse_entries(map, version, INDEX_HEADER_SIZE, 0, nr);
+	if (!offset)
+		return -1;
+
+	map->nr = nr;
+	map->extensions = offset;
+	return 0;
+}
+
+/* The variable length integers of git (varint.c), for the paths of version 4 */
+static void put_varint(struct strbuf *sb, uint64_t value)
+{
+	unsigned char varint[16];
+	unsigned int pos = sizeof(varint) - 1;
+
+	varint[pos] = value & 127;
+	while (value >>= 7)
+		varint[--pos] = 128 | (--value & 127);
+	strbuf_add(sb, varint + pos, sizeof(varint) - pos);
+}
+
+static int get_varint(const unsigned char **data, const unsigned char *end, uint64_t *value)
+{
+	const unsigned char *p = *data;
+	uint64_t v;
+
+	if (p >= end)
+		return -1;
+	v = *p & 127;
+	while (*p++ & 128) {
+		if (p >= end || v >> 56)
+			return -1;
+		v = ((v + 1) << 7) | (*p & 127);
+	}
+
+	*data = p;
+	*value = v;
+	return 0;
+}
+
+/* Drop the data of map and where its entries are, before it gets other data */
+static void release_data(struct index_map *map)
+{
+#ifndef NO_MMAP
+	if (map->mapped)
+		munmap(map->data, map->size);
+	else
+#endif
+		free(map->data);
+	free(map->offsets);
+	map->offsets = NULL;
+	map->nr = 0;
+}
+
+/* Make image (a whole index file of version 2 or 3) the data of map, as if it had been read */
+static int replace_data(struct index_map *map, struct strbuf *image)
+{
+	release_data(map);
+	map->data = (unsigned char *)strbuf_detach(image, &map->size);
+	map->mapped = 0;
+	return parse_index(map);
+}
+
+/*
+ * Append the extensions of data from offset to end, but the one of the
+ * given signature (if any) and the ones which are only valid for the
+ * file they were read from, so that the writer makes them again.
+ */
+static void copy_extensions(struct strbuf *sb, const unsigned char *data, size_t offset, size_t end,
+	const char *skip)
+{
+	while (end - offset >= 8) {
+		uint32_t len = get_be32_at(data + offset + 4);
+
+		if (len > end - offset - 8)
+			break;
+		if ((!skip || memcmp(data + offset, skip, 4)) && memcmp(data + offset, OFFSET_TABLE_SIGNATURE, 4) &&
+		    memcmp(data + offset, END_OF_ENTRIES_SIGNATURE, 4))
+			strbuf_add(sb, data + offset, 8 + len);
+		offset += 8 + len;
+	}
+}
+
+/*
+ * Version 4 only writes the end of each path which differs from the
+ * previous one : how many bytes of the previous one to drop, then what
+ * follows, NUL terminated, without any padding. The entries of block are
+ * decoded to the end of sb as entries of version 2 or 3, and offsets
+ * gets where each starts in sb. Since git starts each block of "IEOT"
+ * anew, its first path does not depend on the previous one. Returns
+ * where the block ends, 0 if it does not fit in the file.
+ */
+static size_t decode_block(const struct index_map *map, struct entry_block *block, struct strbuf *sb,
+	uint32_t *offsets)
+{
+	const unsigned char *p = map->data + block->offset;
+	const unsigned char *end = map->data + map->size - GIT_OID_RAWSZ;
+	struct strbuf path = STRBUF_INIT;
+	size_t block_end = 0;
+
+	for (uint32_t i = 0; i < block->nr; i++) {
+		const unsigned char *name, *nul;
+		uint64_t strip;
+		size_t fixed;
+
+		if (end - p < ENTRY_PATH_OFFSET || (size_t)(end - p) < (fixed = entry_path_offset(p)))
+			goto done;
+		if (fixed != ENTRY_PATH_OFFSET)
+			block->extended = 1;
+
+		name = p + fixed;
+		if (get_varint(&name, end, &strip) < 0 || (i && strip > path.len) ||
+		    !(nul = memchr(name, '\0', end - name)))
+			goto done;
+		strbuf_setlen(&path, i ? path.len - strip : 0);
+		strbuf_add(&path, name, nul - name);
+
+		offsets[i] = sb->len;
+		append_entry(sb, p, path.buf, path.len);
+		p = nul + 1;
+	}
+	block_end = p - map->data;
+
+done:
+	strbuf_release(&path);
+	return block_end;
+}
+
+struct decode_job {
+	const struct index_map *map;
+	struct entry_block *blocks;
+	struct strbuf *decoded; /* one per block */
+	uint32_t *offsets; /* in the decoded block */
+};
+
+static void decode_one_block(void *context, unsigned int worker, unsigned int item)
+{
+	struct decode_job *job = context;
+	struct entry_block *block = &job->blocks[item];
+
+	(void)worker;
+	if (decode_block(job->map, block, &job->decoded[item], job->offsets + block->first) != block->end)
+		block->failed = 1;
+}
+
+/*
+ * Decode an index of version 4 into the image of one of version 2 or 3,
+ * by blocks on several threads when "IEOT" tells where they are. The
+ * entries are found as they are decoded : the image is not parsed again.
+ */
+static int decode_compressed_paths(struct index_map *map)
+{
+	uint32_t nr = get_be32_at(map->data + 8), version = 2;
+	struct entry_block whole = { INDEX_HEADER_SIZE, 0, 0, nr, 0, 0 };
+	struct strbuf image = STRBUF_INIT;
+	struct entry_block *blocks;
+	unsigned int nr_blocks, workers;
+	size_t entries_end, extensions, end = 0;
+	uint32_t *offsets;
+
+	/* an entry takes its stat data, a strip length and a NUL at least */
+	if (nr > (map->size - GIT_OID_RAWSZ - INDEX_HEADER_SIZE) / (ENTRY_PATH_OFFSET + 2))
+		return -1;
+
+	offsets = xmalloc((nr ? nr : 1) * sizeof(*offsets));
+	strbuf_add(&image, map->data, INDEX_HEADER_SIZE);
+
+	blocks = parallel_blocks(map, nr, &nr_blocks, &workers, &entries_end);
+	if (blocks) {
+		struct strbuf *decoded = xcalloc(nr_blocks, sizeof(*decoded));
+		struct decode_job context = { map, blocks, decoded, offsets };
+		struct parallel_job job = { nr_blocks, 1, NULL, decode_one_block, NULL, &context };
+
+		run_parallel(&job, workers < nr_blocks ? workers : nr_blocks);
+		end = entries_end;
+		for (unsigned int i = 0; i < nr_blocks; i++) {
+			if (blocks[i].failed)
+				end = 0;
+			if (end) {
+				for (uint32_t j = blocks[i].first; j < blocks[i].first + blocks[i].nr; j++)
+					offsets[j] += image.len;
+				strbuf_addbuf(&image, &decoded[i]);
+				if (blocks[i].extended)
+					version = 3;
+			}
+			strbuf_release(&decoded[i]);
+		}
+		free(decoded);
+		free(blocks);
+		if (!end)
+			strbuf_setlen(&image, INDEX_HEADER_SIZE);
+	}
+	if (!end) {
+		end = decode_block(map, &whole, &image, offsets);
+		if (whole.extended)
+			version = 3;
+	}
+	if (!end || image.len > UINT32_MAX) {
+		free(offsets);
+		strbuf_release(&image);
+		return -1;
+	}
+
+	/* then the extensions and the checksum, as they are */
+	extensions = image.len;
+	copy_extensions(&image, map->data, end, map->size - GIT_OID_RAWSZ, NULL);
+	strbuf_add(&image, map->data + map->size - GIT_OID_RAWSZ, GIT_OID_RAWSZ);
+	version = htonl(version);
+	memcpy(image.buf + 4, &version, sizeof(version));
+
+	release_data(map);
+	map->data = (unsigned char *)strbuf_detach(&image, &map->size);
+	map->mapped = 0;
+	map->offsets = offsets;
+	map->nr = nr;
+	map->extensions = extensions;
+	return 0;
+}
+
+/*
+ * The bitmaps of the "link" extension are in the EWAH format of git : the
+ * number of bits and of 64 bits words, the words, then the position of
+ * the last "run length" word. Each of those tells how many words with
+ * all their bits 0 (or all 1) come next, then how many words follow it
+ * as they are. They are read back into plain words.
+ */
+static int read_ewah(const unsigned char **data, const unsigned char *end, uint64_t **words, size_t *nr_bits)
+{
+	const unsigned char *p = *data;
+	size_t out = 0, alloc;
+	uint32_t bits, nr;
+
+	if (end - p < 8)
+		return -1;
+	bits = get_be32_at(p);
+	nr = get_be32_at(p + 4);
+	p += 8;
+	if ((size_t)(end - p) / 8 < nr || (size_t)(end - p) - (size_t)nr * 8 < 4)
+		return -1;
+
+	alloc = ((size_t)bits + 63) / 64;
+	*words = xcalloc(alloc ? alloc : 1, sizeof(**words));
+	for (uint32_t i = 0; i < nr; ) {
+		uint64_t rlw = get_be64_at(p + 8 * (size_t)i++);
+		uint64_t run = (rlw >> 1) & 0xffffffff, literals = rlw >> 33;
+
+		if (run > alloc - out || literals > alloc - out - run || literals > nr - i) {
+			free(*words);
+			*words = NULL;
+			return -1;
+		}
+		if (rlw & 1)
+			memset(*words + out, 0xff, run * sizeof(**words));
+		out += run;
+		for (; literals; literals--)
+			(*words)[out++] = get_be64_at(p + 8 * (size_t)i++);
+	}
+
+	*data = p + 8 * (size_t)nr + 4;
+	*nr_bits = bits;
+	return 0;
+}
+
+static void write_ewah(struct strbuf *sb, const uint64_t *words, size_t nr_bits)
+{
+	size_t nr = (nr_bits + 63) / 64, i = 0, header;
+	uint32_t count = 0, last = 0;
+
+	add_be32(sb, (uint32_t)nr_bits);
+	header = sb->len;
+	add_be32(sb, 0);
+
+	/* even without any word, git wants a run length word */
+	do {
+		uint64_t clean = i < nr && words[i] == ~(uint64_t)0 ? ~(uint64_t)0 : 0;
+		uint64_t run = 0, literals = 0;
+
+		while (i < nr && words[i] == clean && run < 0xffffffff) {
+			run++;
+			i++;
+		}
+		while (i + literals < nr && words[i + literals] && ~words[i + literals] && literals < 0x7fffffff)
+			literals++;
+
+		last = count++;
+		add_be64(sb, (clean & 1) | run << 1 | literals << 33);
+		for (; literals; literals--, count++)
+			add_be64(sb, words[i++]);
+	} while (i < nr);
+
+	count = htonl(count);
+	memcpy(sb->buf + header, &count, sizeof(count));
+	add_be32(sb, last);
+}
+
+static int bit_is_set(const uint64_t *words, size_t nr_bits, size_t bit)
+{
+	return bit < nr_bits && (words[bit / 64] >> (bit % 64) & 1);
+}
+
+static void set_bit(uint64_t *words, size_t bit)
+{
+	words[bit / 64] |= (uint64_t)1 << (bit % 64);
+}
+
+/* The shared index of a split index sits next to it, named by its checksum */
+static void shared_index_path(struct strbuf *path, git_repository *repo, const unsigned char *id)
+{
+	char hex[GIT_OID_HEXSZ + 1];
+
+	strbuf_addstr(path, git_repository_path(repo, GIT_REPO_PATH));
+	if (path->len && path->buf[path->len - 1] != '/')
+		strbuf_addch(path, '/');
+	hex_encode(hex, id, GIT_OID_RAWSZ);
+	hex[GIT_OID_HEXSZ] = '\0';
+	strbuf_addf(path, "sharedindex.%s", hex);
+}
+
+static int load_file(struct index_map *map, const char *path);
+
+/*
+ * A split index holds the entries which replace some of those of its
+ * shared index (in their order), then the entries it adds. Its "link"
+ * extension names the shared index, then tells with two bitmaps which of
+ * its entries are deleted and which are replaced. The whole index is
+ * merged back as git does.
+ */
+static int merge_split_index(struct index_map *map, git_repository *repo, const unsigned char *link, uint32_t size)
+{
+	const unsigned char *p = link + GIT_OID_RAWSZ, *end = link + size;
+	uint64_t *deleted = NULL, *replaced = NULL;
+	size_t nr_deleted, nr_replaced;
+	struct strbuf path = STRBUF_INIT;
+	struct strbuf image = STRBUF_INIT;
+	struct index_map *shared;
+	unsigned int i, k = 0, added = 0, nr = 0;
+	uint32_t version = 2;
+	int e = -1;
+
+	shared = xcalloc(1, sizeof(*shared));
+	if (size < GIT_OID_RAWSZ || read_ewah(&p, end, &deleted, &nr_deleted) < 0 ||
+	    read_ewah(&p, end, &replaced, &nr_replaced) < 0)
+		goto done;
+
+	/* a null id leaves the index whole, which is for git to tell */
+	for (i = 0; i < GIT_OID_RAWSZ && !link[i]; i++)
+		;
+	if (i == GIT_OID_RAWSZ)
+		goto done;
+
+	shared_index_path(&path, repo, link);
+	if (load_file(shared, path.buf) != GIT_SUCCESS || !shared->data)
+		goto done;
+
+	for (i = 0; i < shared->nr; i++)
+		added += bit_is_set(replaced, nr_replaced, i);
+	if (added > map->nr)
+		goto done;
+
+	strbuf_add(&image, map->data, INDEX_HEADER_SIZE);
+	for (i = 0; i < shared->nr || added < map->nr; ) {
+		const unsigned char *entry = NULL;
+		const char *name = NULL;
+		int in_split = 0, cmp = 1;
+
+		if (i < shared->nr) {
+			in_split = bit_is_set(replaced, nr_replaced, i);
+			entry = in_split ? map->data + map->offsets[k] : shared->data + shared->offsets[i];
+			/* a replacing entry without a path keeps the one it replaces */
+			name = in_split ? index_map_path(map, k) : index_map_path(shared, i);
+			if (!*name)
+				name = index_map_path(shared, i);
+			if (bit_is_set(deleted, nr_deleted, i)) {
+				k += in_split;
+				i++;
+				continue;
+			}
+			cmp = added < map->nr ? compare_entries(entry, name, map->data + map->offsets[added]) : -1;
+		}
+
+		/* an added entry takes the place of the one with the same name */
+		if (cmp <= 0) {
+			k += in_split;
+			i++;
+		}
+		if (cmp >= 0) {
+			entry = map->data + map->offsets[added];
+			name = index_map_path(map, added++);
+		}
+
+		append_entry(&image, entry, name, strlen(name));
+		if (entry_path_offset(entry) != ENTRY_PATH_OFFSET)
+			version = 3;
+		nr++;
+	}
+
+	/* the other extensions of the split index are those of the whole */
+	copy_extensions(&image, map->data, map->extensions, map->size - GIT_OID_RAWSZ, LINK_SIGNATURE);
+	strbuf_add(&image, map->data + map->size - GIT_OID_RAWSZ, GIT_OID_RAWSZ);
+
+	version = htonl(version);
+	memcpy(image.buf + 4, &version, sizeof(version));
+	nr = htonl(nr);
+	memcpy(image.buf + 8, &nr, sizeof(nr));
+	/* link goes away with the data of the split index */
+	memcpy(map->shared_id.id, link, GIT_OID_RAWSZ);
+	e = replace_data(map, &image);
+	if (!e) {
+		map->shared = shared;
+		shared = NULL;
+	}
+
+done:
+	if (shared) {
+		index_map_release(shared);
+		free(shared);
+	}
+	strbuf_release(&image);
+	strbuf_release(&path);
+	free(deleted);
+	free(replaced);
+	return e;
+}
+
+/* Map the index file at path, decoding it if it is of version 4 */
+static int load_file(struct index_map *map, const char *path)
+{
+	struct stat st;
+	int fd, e = GIT_SUCCESS;
+
+	memset(map, 0, sizeof(*map));
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			e = GIT_EOSERR;
+		goto done;
+	}
+
+	if (fstat(fd, &st)) {
+		close(fd);
+		e = GIT_EOSERR;
+		goto done;
+	}
+	map->mtime = st.st_mtime;
+	map->size = st.st_size;
+
+#ifndef NO_MMAP
+	if (map->size) {
+		map->data = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map->data == MAP_FAILED)
+			map->data = NULL;
+		else
+			map->mapped = 1;
+	}
+#endif
+	if (!map->data) {
+		map->data = xmalloc(map->size ? map->size : 1);
+		if (read_in_full(fd, map->data, map->size) != (ssize_t)map->size) {
+			close(fd);
+			index_map_release(map);
+			e = GIT_EOSERR;
+			goto done;
+		}
+	}
+	close(fd);
+
+	if (map->size >= INDEX_HEADER_SIZE)
+		map->version = get_be32_at(map->data + 4);
+	if ((map->version == 4 && map->size >= INDEX_HEADER_SIZE + GIT_OID_RAWSZ ?
+	     decode_compressed_paths(map) : parse_index(map)) < 0) {
+		index_map_release(map);
+		e = GIT_ENOTIMPLEMENTED;
+	}
+
+done:
+	return e;
+}
+
+int index_map_load(struct index_map *map, git_repository *repo)
+{
+	uint64_t start = trace_perf_start();
+	const unsigned char *link;
+	uint32_t size;
+	int e;
+
+	e = load_file(map, git_repository_path(repo, GIT_REPO_PATH_INDEX));
+	if (e == GIT_SUCCESS && index_map_extension(map, LINK_SIGNATURE, &link, &size) &&
+	    merge_split_index(map, repo, link, size) < 0) {
+		index_map_release(map);
+		e = GIT_ENOTIMPLEMENTED;
+	}
+
+	trace_perf_stop("index_map_load", start);
+	return e;
+}
+
+static size_t path_offset(const struct index_map *map, unsigned int n)
+{
+	return entry_path_offset(map->data + map->offsets[n]);
+}
+
+const char *index_map_path(const struct index_map *map, unsigned int n)
+{
+	return (const char *)map->data + map->offsets[n] + path_offset(map, n);
+}
+
+unsigned int index_map_lower_bound(const struct index_map *map, const char *path, size_t len)
+{
+	unsigned int lo = 0, hi = map->nr;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (strncmp(index_map_path(map, mid), path, len) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+unsigned int index_map_prefix_end(const struct index_map *map, unsigned int begin, const char *path, size_t len)
+{
+	unsigned int lo = begin, hi = map->nr;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (!strncmp(index_map_path(map, mid), path, len))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+void index_map_entry(const struct index_map *map, unsigned int n, git_index_entry *entry)
+{
+	const unsigned char *data = map->data + map->offsets[n];
+
+	entry->ctime.seconds = get_be32_at(data);
+	entry->ctime.nanoseconds = get_be32_at(data + 4);
+	entry->mtime.seconds = get_be32_at(data + 8);
+	entry->mtime.nanoseconds = get_be32_at(data + 12);
+	entry->dev = get_be32_at(data + 16);
+	entry->ino = get_be32_at(data + 20);
+	entry->mode = get_be32_at(data + 24);
+	entry->uid = get_be32_at(data + 28);
+	entry->gid = get_be32_at(data + 32);
+	entry->file_size = get_be32_at(data + 36);
+	memcpy(entry->oid.id, data + 40, GIT_OID_RAWSZ);
+	entry->flags = get_be16_at(data + 40 + GIT_OID_RAWSZ);
+	entry->flags_extended = entry->flags & GIT_IDXENTRY_EXTENDED ? get_be16_at(data + ENTRY_PATH_OFFSET) : 0;
+	entry->path = (char *)data + path_offset(map, n);
+}
+
+int index_map_extension(const struct index_map *map, const char *signature,
+	const unsigned char **data, uint32_t *size)
+{
+	if (!map->data)
+		return 0;
+	return find_extension(map->data, map->extensions, map->size - GIT_OID_RAWSZ, signature, data, size);
+}
+
+int index_map_sparse(const struct index_map *map)
+{
+	const unsigned char *data;
+	uint32_t size;
+
+	return index_map_extension(map, SPARSE_INDEX_SIGNATURE, &data, &size);
+}
+
+/*
+ * As git's ce_compare_gitlink() : the submodule at path matches its entry
+ * unless its HEAD is another commit. One which is not checked out, or
+ * whose HEAD cannot be resolved, matches.
+ */
+static int gitlink_matches(const git_index_entry *gie, const char *path)
+{
+	struct strbuf gitdir = STRBUF_INIT, gitfile = STRBUF_INIT;
+	git_repository *submodule;
+	git_reference *head, *resolved;
+	struct stat st;
+	int matches = 1;
+
+	strbuf_addf(&gitdir, "%s/.git", path);
+	if (lstat(gitdir.buf, &st))
+		goto done;
+	/* "gitdir: <path>", relative to the submodule, if it was absorbed */
+	if (S_ISREG(st.st_mode)) {
+		if (strbuf_read_file(&gitfile, gitdir.buf, st.st_size) < 0 ||
+		    prefixcmp(gitfile.buf, "gitdir: "))
+			goto done;
+		strbuf_rtrim(&gitfile);
+		strbuf_reset(&gitdir);
+		if (!is_absolute_path(gitfile.buf + 8))
+			strbuf_addf(&gitdir, "%s/", path);
+		strbuf_addstr(&gitdir, gitfile.buf + 8);
+	}
+
+	if (git_repository_open(&submodule, gitdir.buf) != GIT_SUCCESS)
+		goto done;
+	if (git_reference_lookup(&head, submodule, "HEAD") == GIT_SUCCESS &&
+	    git_reference_resolve(&resolved, head) == GIT_SUCCESS)
+		matches = !git_oid_cmp(git_reference_oid(resolved), &gie->oid);
+	git_repository_free(submodule);
+
+done:
+	strbuf_release(&gitdir);
+	strbuf_release(&gitfile);
+	return matches;
+}
+
+int index_entry_matches_stat(const git_index_entry *gie, const char *path, const struct stat *st,
+	int trust_filemode)
+{
+	switch (gie->mode >> 12) {
+		case 0xA:
+			if (!S_ISLNK(st->st_mode))
+				return 0;
+			break;
+		case 0x8:
+			if (!S_ISREG(st->st_mode) || (trust_filemode && ((gie->mode ^ st->st_mode) & S_IXUSR)))
+				return 0;
+			break;
+		case S_IFGITLINK >> 12:
+			/* as git, the stat data of a submodule is not looked at */
+			return S_ISDIR(st->st_mode) && gitlink_matches(gie, path);
+		default:
+			return 0;
+	}
+
+	return gie->mtime.seconds == (git_time_t)st->st_mtime &&
+		gie->ctime.seconds == (git_time_t)st->st_ctime &&
+		gie->ino == (unsigned int)st->st_ino &&
+		gie->uid == (unsigned int)st->st_uid &&
+		gie->gid == (unsigned int)st->st_gid &&
+		/* the index only records the low 32 bits of the size */
+		(unsigned int)gie->file_size == (unsigned int)st->st_size;
+}
+
+int index_entry_matches_file(const git_index_entry *entry, const char *path, const struct stat *st)
+{
+	struct strbuf contents = STRBUF_INIT;
+	git_oid oid;
+	int matches = 0;
+	int e;
+
+	/* a submodule has no contents of its own */
+	if ((entry->mode & S_IFMT) == S_IFGITLINK)
+		return S_ISDIR(st->st_mode) && gitlink_matches(entry, path);
+
+	if (S_ISLNK(st->st_mode))
+		e = strbuf_readlink(&contents, path, st->st_size);
+	else
+		e = strbuf_read_file(&contents, path, st->st_size);
+
+	if (e >= 0 && git_odb_hash(&oid, contents.buf, contents.len, GIT_OBJ_BLOB) == GIT_SUCCESS)
+		matches = !git_oid_cmp(&oid, &entry->oid);
+
+	strbuf_release(&contents);
+	return matches;
+}
+
+static int write_locked(const char *path, const struct strbuf *contents)
+{
+	struct strbuf lock = STRBUF_INIT;
+	int fd, e = GIT_SUCCESS;
+
+	strbuf_addf(&lock, "%s.lock", path);
+	fd = open(lock.buf, O_WRONLY | O_CREAT | O_EXCL, 0666);
+	if (fd < 0) {
+		e = errno == EEXIST ? GIT_EFLOCKFAIL : GIT_EOSERR;
+	} else if (write_in_full(fd, contents->buf, contents->len) < 0) {
+		close(fd);
+		unlink(lock.buf);
+		e = GIT_EOSERR;
+	} else {
+		fsync_written_file(fd, lock.buf);
+		/* with the objects it names */
+		fsync_batch();
+		if (close(fd) || rename(lock.buf, path)) {
+			unlink(lock.buf);
+			e = GIT_EOSERR;
+		}
+	}
+
+	strbuf_release(&lock);
+	return e;
+}
+
+static void add_checksum(struct strbuf *contents, unsigned char checksum[SHA1_RAWSZ])
+{
+	struct sha1_ctx sha1;
+
+	sha1_init(&sha1);
+	sha1_update(&sha1, contents->buf, contents->len);
+	sha1_final(checksum, &sha1);
+	strbuf_add(contents, checksum, SHA1_RAWSZ);
+}
+
+/*
+ * Append the header, then the entries of image in list (all of them if it
+ * is NULL), the nameless first ones without their path. Unless table is
+ * NULL, the entries go by blocks of block_size, which it lists as "IEOT"
+ * does : with version 4, the first path of each block is written whole.
+ */
+static void encode_entries(struct strbuf *sb, const struct index_map *image, uint32_t version,
+	const unsigned int *list, unsigned int nr, unsigned int nameless, struct strbuf *table,
+	unsigned int block_size)
+{
+	const char *previous = "";
+	size_t previous_len = 0;
+
+	add_be32(sb, INDEX_SIGNATURE);
+	add_be32(sb, version);
+	add_be32(sb, nr);
+
+	for (unsigned int j = 0; j < nr; j++) {
+		const unsigned char *entry = image->data + image->offsets[list ? list[j] : j];
+		size_t fixed = entry_path_offset(entry), len, common = 0;
+		const char *path = j < nameless ? "" : (const char *)entry + fixed;
+
+		if (table && !(j % block_size)) {
+			add_be32(table, sb->len);
+			add_be32(table, nr - j < block_size ? nr - j : block_size);
+			/* all of the previous path is stripped */
+			previous = "";
+		}
+
+		if (version != 4) {
+			if (j < nameless)
+				append_entry(sb, entry, "", 0);
+			else
+				strbuf_add(sb, entry, entry_size(entry));
+			continue;
+		}
+
+		len = strlen(path);
+		while (common < len && common < previous_len && path[common] == previous[common])
+			common++;
+		append_entry_header(sb, entry, len);
+		put_varint(sb, previous_len - common);
+		strbuf_add(sb, path + common, len - common + 1);
+		previous = path;
+		previous_len = len;
+	}
+}
+
+/*
+ * Only the entries which differ from the shared index of like go to the
+ * split index, unless they are too many : then image becomes the new
+ * shared index, and the split index is left with none.
+ */
+static int write_split_index(const struct index_map *like, git_repository *repo,
+	const struct index_map *image, uint32_t version, const char *extensions, size_t extensions_len)
+{
+	const struct index_map *shared = like->shared;
+	size_t words = ((size_t)shared->nr + 63) / 64;
+	uint64_t *deleted = xcalloc(words ? words : 1, sizeof(*deleted));
+	uint64_t *replaced = xcalloc(words ? words : 1, sizeof(*replaced));
+	unsigned int *changed = xmalloc((image->nr ? image->nr : 1) * sizeof(*changed));
+	unsigned int *added = xmalloc((image->nr ? image->nr : 1) * sizeof(*added));
+	unsigned int i = 0, n = 0, nr_replaced = 0, nr_added = 0;
+	unsigned char shared_id[SHA1_RAWSZ];
+	struct strbuf contents = STRBUF_INIT;
+	struct strbuf path = STRBUF_INIT;
+	size_t nr_bits = shared->nr, link;
+	uint32_t link_len;
+	int e = GIT_SUCCESS;
+
+	while (i < shared->nr || n < image->nr) {
+		const unsigned char *old = i < shared->nr ? shared->data + shared->offsets[i] : NULL;
+		const unsigned char *new = n < image->nr ? image->data + image->offsets[n] : NULL;
+		int cmp = !old ? 1 : !new ? -1 : compare_entries(old, index_map_path(shared, i), new);
+
+		if (cmp < 0) {
+			set_bit(deleted, i++);
+		} else if (cmp > 0) {
+			added[nr_added++] = n++;
+		} else {
+			if (entry_size(old) != entry_size(new) || memcmp(old, new, entry_size(old))) {
+				set_bit(replaced, i);
+				changed[nr_replaced++] = n;
+			}
+			i++;
+			n++;
+		}
+	}
+
+	if ((uint64_t)(nr_replaced + nr_added) * 100 > (uint64_t)SPLIT_INDEX_MAX_CHANGE * image->nr) {
+		encode_entries(&contents, image, version, NULL, image->nr, 0, NULL, 0);
+		add_checksum(&contents, shared_id);
+		shared_index_path(&path, repo, shared_id);
+		e = write_locked(path.buf, &contents);
+
+		strbuf_reset(&contents);
+		memset(deleted, 0, words * sizeof(*deleted));
+		memset(replaced, 0, words * sizeof(*replaced));
+		nr_replaced = nr_added = 0;
+		nr_bits = 0;
+	} else {
+		/* git expires the shared indexes which are not used any more */
+		shared_index_path(&path, repo, like->shared_id.id);
+		utime(path.buf, NULL);
+		memcpy(shared_id, like->shared_id.id, SHA1_RAWSZ);
+	}
+
+	if (e == GIT_SUCCESS) {
+		/*
+		 * The entries replacing some of the shared index, in its order
+		 * and without their paths as git wants them, then the added ones
+		 */
+		memcpy(changed + nr_replaced, added, nr_added * sizeof(*added));
+		encode_entries(&contents, image, version, changed, nr_replaced + nr_added, nr_replaced, NULL, 0);
+
+		strbuf_add(&contents, LINK_SIGNATURE, 4);
+		link = contents.len;
+		add_be32(&contents, 0);
+		strbuf_add(&contents, shared_id, SHA1_RAWSZ);
+		write_ewah(&contents, deleted, nr_bits);
+		write_ewah(&contents, replaced, nr_bits);
+		link_len = htonl((uint32_t)(contents.len - link - 4));
+		memcpy(contents.buf + link, &link_len, sizeof(link_len));
+
+		strbuf_add(&contents, extensions, extensions_len);
+		add_checksum(&contents, shared_id);
+		e = write_locked(git_repository_path(repo, GIT_REPO_PATH_INDEX), &contents);
+	}
+
+	strbuf_release(&path);
+	strbuf_release(&contents);
+	free(deleted);
+	free(replaced);
+	free(changed);
+	free(added);
+	return e;
+}
+
+/*
+ * Write contents (an index of version 2 or 3, without its checksum) as
+ * the index file of repo, in the format of the index like (if not NULL).
+ */
+static void add_extension(struct strbuf *sb, const char *signature, const struct strbuf *extension)
+{
+	strbuf_add(sb, signature, 4);
+	add_be32(sb, extension->len);
+	strbuf_addbuf(sb, extension);
+}
+
+/* Append "EOIE" for the entries ending at entries_end, followed by the extensions up to the end of sb */
+static void add_end_of_entries(struct strbuf *sb, size_t entries_end)
+{
+	unsigned char hash[SHA1_RAWSZ];
+	struct sha1_ctx sha1;
+
+	sha1_init(&sha1);
+	for (size_t offset = entries_end; offset < sb->len; offset += 8 + get_be32_at((unsigned char *)sb->buf + offset + 4))
+		sha1_update(&sha1, sb->buf + offset, 8);
+	sha1_final(hash, &sha1);
+
+	strbuf_add(sb, END_OF_ENTRIES_SIGNATURE, 4);
+	add_be32(sb, END_OF_ENTRIES_SIZE);
+	add_be32(sb, entries_end);
+	strbuf_add(sb, hash, SHA1_RAWSZ);
+}
+
+static int write_index_file(const struct index_map *like, git_repository *repo, struct strbuf *contents)
+{
+	unsigned char checksum[SHA1_RAWSZ];
+	struct strbuf encoded = STRBUF_INIT;
+	struct index_map image;
+	uint32_t version;
+	int e;
+
+	if (!like || (like->version != 4 && !like->shared && !like->end_of_entries)) {
+		add_checksum(contents, checksum);
+		return write_locked(git_repository_path(repo, GIT_REPO_PATH_INDEX), contents);
+	}
+
+	/* parsed as if it was followed by its checksum */
+	memset(&image, 0, sizeof(image));
+	image.data = (unsigned char *)contents->buf;
+	image.size = contents->len + GIT_OID_RAWSZ;
+	if (parse_index(&image) < 0) {
+		free(image.offsets);
+		return GIT_EOSERR;
+	}
+	version = like->version == 4 ? 4 : get_be32_at(image.data + 4);
+
+	if (like->shared) {
+		e = write_split_index(like, repo, &image, version,
+			contents->buf + image.extensions, contents->len - image.extensions);
+	} else {
+		unsigned int blocks = like->end_of_entries ? image.nr / INDEX_PARALLEL_MIN : 0;
+		struct strbuf table = STRBUF_INIT;
+		size_t entries_end;
+
+		/* a block per thread which would read it, as git does */
+		if (blocks > 1 && blocks > index_workers())
+			blocks = index_workers();
+		add_be32(&table, OFFSET_TABLE_VERSION);
+		encode_entries(&encoded, &image, version, NULL, image.nr, 0,
+			blocks > 1 ? &table : NULL, blocks > 1 ? DIV_ROUND_UP(image.nr, blocks) : 0);
+		entries_end = encoded.len;
+		if (blocks > 1)
+			add_extension(&encoded, OFFSET_TABLE_SIGNATURE, &table);
+		strbuf_add(&encoded, contents->buf + image.extensions, contents->len - image.extensions);
+		if (like->end_of_entries)
+			add_end_of_entries(&encoded, entries_end);
+		strbuf_release(&table);
+		add_checksum(&encoded, checksum);
+		e = write_locked(git_repository_path(repo, GIT_REPO_PATH_INDEX), &encoded);
+	}
+
+	free(image.offsets);
+	strbuf_release(&encoded);
+	return e;
+}
+
+int index_map_write(const struct index_map *map, git_repository *repo, struct strbuf *entries,
+	time_t racy, const char *signature, const struct strbuf *extension)
+{
+	uint32_t size;
+
+	/*
+	 * The index is going to be newer than the entries modified in the
+	 * same second as what they were last compared with : those could
+	 * have been modified again since, without their stat data telling.
+	 * Clear their size so that they do not look up to date.
+	 */
+	for (unsigned int i = 0; i < map->nr; i++) {
+		if (racy && (time_t)get_be32_at((unsigned char *)entries->buf + map->offsets[i] + 8) >= racy)
+			memset(entries->buf + map->offsets[i] + 36, 0, 4);
+	}
+
+	if (signature) {
+		size = htonl(extension->len);
+		strbuf_add(entries, signature, 4);
+		strbuf_add(entries, &size, sizeof(size));
+		strbuf_addbuf(entries, extension);
+	}
+
+	/* the other extensions are kept as they are */
+	copy_extensions(entries, map->data, map->extensions, map->size - GIT_OID_RAWSZ, signature);
+
+	return write_index_file(map, repo, entries);
+}
+
+void index_map_release(struct index_map *map)
+{
+	if (map->data) {
+#ifndef NO_MMAP
+		if (map->mapped)
+			munmap(map->data, map->size);
+		else
+#endif
+			free(map->data);
+	}
+	free(map->offsets);
+	if (map->shared) {
+		index_map_release(map->shared);
+		free(map->shared);
+	}
+
+	memset(map, 0, sizeof(*map));
+}
+
+void index_builder_init(struct index_builder *builder, const struct index_map *index)
+{
+	strbuf_init(&builder->entries, 0);
+	add_be32(&builder->entries, INDEX_SIGNATURE);
+	add_be32(&builder->entries, 2);
+	add_be32(&builder->entries, 0);
+	builder->nr = 0;
+	builder->extended = 0;
+	builder->racy = index ? index->mtime : 0;
+	builder->index = index;
+}
+
+void index_builder_reserve(struct index_builder *builder, unsigned int nr, size_t path_len)
+{
+	strbuf_grow(&builder->entries, nr * ((ENTRY_EXTENDED_PATH_OFFSET + path_len + 8) & ~(size_t)7));
+}
+
+void index_builder_add(struct index_builder *builder, const git_index_entry *entry, int stage)
+{
+	struct strbuf *sb = &builder->entries;
+	size_t len = strlen(entry->path);
+	size_t start = sb->len, path_offset = ENTRY_PATH_OFFSET;
+	uint16_t flags = entry->flags & GIT_IDXENTRY_VALID;
+
+	flags |= len < GIT_IDXENTRY_NAMEMASK ? len : GIT_IDXENTRY_NAMEMASK;
+	flags |= (stage << GIT_IDXENTRY_STAGESHIFT) & GIT_IDXENTRY_STAGEMASK;
+	if (entry->flags_extended) {
+		flags |= GIT_IDXENTRY_EXTENDED;
+		path_offset = ENTRY_EXTENDED_PATH_OFFSET;
+		builder->extended = 1;
+	}
+
+	add_be32(sb, (uint32_t)entry->ctime.seconds);
+	add_be32(sb, entry->ctime.nanoseconds);
+	add_be32(sb, (uint32_t)entry->mtime.seconds);
+	add_be32(sb, entry->mtime.nanoseconds);
+	add_be32(sb, entry->dev);
+	add_be32(sb, entry->ino);
+	add_be32(sb, entry->mode);
+	add_be32(sb, entry->uid);
+	add_be32(sb, entry->gid);
+	/* the size of a racily clean entry is cleared */
+	add_be32(sb, builder->racy && entry->mtime.seconds >= (git_time_t)builder->racy ? 0 : (uint32_t)entry->file_size);
+	strbuf_add(sb, entry->oid.id, GIT_OID_RAWSZ);
+	add_be16(sb, flags);
+	if (entry->flags_extended)
+		add_be16(sb, entry->flags_extended);
+	strbuf_add(sb, entry->path, len);
+
+	/* padded with 1 to 8 NULs to a multiple of 8 bytes */
+	while (sb->len < start + ((path_offset + len + 8) & ~(size_t)7))
+		strbuf_addch(sb, '\0');
+	builder->nr++;
+}
+
+void index_builder_copy(struct index_builder *builder, const struct index_map *map,
+	unsigned int begin, unsigned int end)
+{
+	struct strbuf *sb = &builder->entries;
+	size_t start = sb->len;
+
+	if (begin >= end)
+		return;
+
+	strbuf_add(sb, map->data + map->offsets[begin],
+		(end < map->nr ? map->offsets[end] : map->extensions) - map->offsets[begin]);
+	for (unsigned int i = begin; i < end; i++) {
+		unsigned char *entry = (unsigned char *)sb->buf + start + map->offsets[i] - map->offsets[begin];
+
+		if (get_be16_at(entry + ENTRY_PATH_OFFSET - 2) & GIT_IDXENTRY_EXTENDED)
+			builder->extended = 1;
+		if (builder->racy && (time_t)get_be32_at(entry + 8) >= builder->racy)
+			memset(entry + 36, 0, 4);
+	}
+	builder->nr += end - begin;
+}
+
+void index_builder_extension(struct index_builder *builder, const char *signature,
+	const struct strbuf *extension)
+{
+	add_extension(&builder->entries, signature, extension);
+}
+
+int index_builder_write(struct index_builder *builder, git_repository *repo)
+{
+	struct strbuf *sb = &builder->entries;
+	uint32_t value;
+
+	value = htonl(builder->extended ? 3 : 2);
+	memcpy(sb->buf + 4, &value, sizeof(value));
+	value = htonl(builder->nr);
+	memcpy(sb->buf + 8, &value, sizeof(value));
+
+	return write_index_file(builder->index, repo, sb);
+}
+
+void index_builder_release(struct index_builder *builder)
+{
+	strbuf_release(&builder->entries);
+}
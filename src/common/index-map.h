@@ -0,0 +1,158 @@
+#ifndef INDEX_MAP_H
+#define INDEX_MAP_H
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <git2.h>
+#include "strbuf.h"
+
+/*
+ * A read-only view of the index file for the commands which only list
+ * it. The file is mapped and its entries are decoded on demand, instead
+ * of being parsed and allocated one by one up front as
+ * git_repository_index() does : loading only costs one offset per entry.
+ *
+ * Versions 2 and 3 of the index are understood. The extensions are only
+ * found on demand, and the trailing checksum is not checked.
+ *
+ * An index of version 4 (prefix compressed paths) or a split index (the
+ * entries which changed since its shared index, with the "link"
+ * extension) is decoded at once into the image of a version 2 or 3
+ * index in memory, so that all the above works the same. Writing the
+ * index again keeps its format : see index_map_write().
+ *
+ * When the index ends with the "EOIE" extension (where the entries end)
+ * and has the "IEOT" one (where blocks of them start), as git writes
+ * them with index.recordEndOfIndexEntries and index.recordOffsetTable, a
+ * big index is read by blocks on several threads (GIT2_INDEX_WORKERS,
+ * one per processor by default). Writing it again keeps "EOIE", with
+ * a new "IEOT" for an index big enough to be read by blocks.
+ */
+
+struct index_map {
+	unsigned char *data;
+	size_t size;
+	int mapped; /* data is mmap()ed, malloc()ed otherwise */
+	time_t mtime; /* of the index file, 0 if there is none */
+
+	unsigned int nr;
+	uint32_t *offsets; /* of each entry in data */
+	size_t extensions; /* where the entries end */
+
+	unsigned int version; /* of the file, 4 if data was decoded from it */
+	struct index_map *shared; /* of a split index, NULL for the others */
+	git_oid shared_id; /* the checksum of shared, naming its file */
+	int end_of_entries; /* the file had the "EOIE" extension */
+};
+
+#define INDEX_MAP_INIT { NULL, 0, 0, 0, 0, NULL, 0, 0, NULL, {{0}}, 0 }
+
+/* the mode of the submodule entries (git's S_IFGITLINK) */
+#define S_IFGITLINK 0160000
+/* the extended flag of git's CE_SKIP_WORKTREE */
+#define INDEX_ENTRY_SKIP_WORKTREE 0x4000
+/* the extended flag of git's CE_INTENT_TO_ADD ("git add -N") */
+#define INDEX_ENTRY_INTENT_TO_ADD 0x2000
+
+int index_map_load(struct index_map *map, git_repository *repo);
+//map the index of repo, an empty one if there is none. Returns
+//GIT_SUCCESS, GIT_EOSERR if it cannot be read or GIT_ENOTIMPLEMENTED if
+//it is of an unknown (or invalid) format
+
+const char *index_map_path(const struct index_map *map, unsigned int n);
+//the path of the nth entry
+
+unsigned int index_map_lower_bound(const struct index_map *map, const char *path, size_t len);
+//the first entry whose path is not before the len first bytes of path
+//(the entries are sorted by path)
+
+unsigned int index_map_prefix_end(const struct index_map *map, unsigned int begin, const char *path, size_t len);
+//the first entry from begin on whose path does not start with the len
+//first bytes of path
+
+void index_map_entry(const struct index_map *map, unsigned int n, git_index_entry *entry);
+//decode the nth entry. Its path points into the map : it must not be
+//modified, and is valid until index_map_release()
+
+int index_map_extension(const struct index_map *map, const char *signature,
+	const unsigned char **data, uint32_t *size);
+//returns 1 and points data to the contents of the extension with the
+//given 4 letters signature ("TREE"), 0 if there is none
+
+#define SPARSE_INDEX_SIGNATURE "sdir"
+
+int index_map_sparse(const struct index_map *map);
+//whether the index has sparse directory entries : "dir/" entries for the
+//trees out of the sparse checkout cone, marked with the "sdir" extension
+
+int index_entry_matches_stat(const git_index_entry *entry, const char *path, const struct stat *st,
+	int trust_filemode);
+//returns 1 if the stat data recorded in entry is the one of the file at
+//path (st is its lstat()), 0 if the file may have changed. The executable
+//bit is only compared with trust_filemode (core.filemode). A submodule
+//matches unless its HEAD is not the commit of entry, as git has it
+
+int index_entry_matches_file(const git_index_entry *entry, const char *path, const struct stat *st);
+//hash the file at path (st is its lstat()) as a blob : returns 1 if it
+//is the object of entry, 0 otherwise or if it cannot be read. The HEAD of
+//a submodule is compared instead
+
+int index_map_write(const struct index_map *map, git_repository *repo, struct strbuf *entries,
+	time_t racy, const char *signature, const struct strbuf *extension);
+//write the index file of repo again, through its lock. entries holds the
+//header and the entries of map, as the caller changed them in place ; the
+//extension with the given signature is replaced by extension (unless
+//signature is NULL), the others are kept. Entries modified at or after
+//racy (unless it is 0) are smudged first, as git does. The file keeps
+//the format of map : a split index only gets the entries which differ
+//from its shared index (a new shared index is written once they are
+//more than a fifth of them), with compressed paths if it was of
+//version 4.
+//Returns GIT_SUCCESS, GIT_EFLOCKFAIL if the index is locked or GIT_EOSERR
+
+void index_map_release(struct index_map *map);
+
+/*
+ * A new index file, written in one pass : its entries are appended in
+ * order (sorted by path, then by stage), either encoded from entries or
+ * copied as they are from the map of an older index, a whole range at
+ * once. It is of version 3 only if an entry has extended flags, and
+ * written in the format of the index it replaces.
+ */
+
+struct index_builder {
+	struct strbuf entries; /* the header, then the entries */
+	unsigned int nr;
+	int extended;
+	time_t racy;
+	const struct index_map *index; /* the index replaced, NULL if none */
+};
+
+void index_builder_init(struct index_builder *builder, const struct index_map *index);
+//index is the map of the index file the new one replaces, or NULL : its
+//entries at or after its mtime are smudged as they are added, as
+//index_map_write() does, and the new file is of its format
+
+void index_builder_reserve(struct index_builder *builder, unsigned int nr, size_t path_len);
+//make room for nr more entries, with paths of about path_len bytes
+
+void index_builder_add(struct index_builder *builder, const git_index_entry *entry, int stage);
+//append entry (its path NUL terminated) at the given stage
+
+void index_builder_copy(struct index_builder *builder, const struct index_map *map,
+	unsigned int begin, unsigned int end);
+//append the entries of map from begin to end, with their stat data
+
+void index_builder_extension(struct index_builder *builder, const char *signature,
+	const struct strbuf *extension);
+//append the extension of the given signature, after all the entries
+
+int index_builder_write(struct index_builder *builder, git_repository *repo);
+//write the entries and extensions as the index file of repo, through its
+//lock. Returns GIT_SUCCESS, GIT_EFLOCKFAIL if the index is locked or
+//GIT_EOSERR
+
+void index_builder_release(struct index_builder *builder);
+
+#endif
@@ -0,0 +1,849 @@
+#include "git-compat-util.h"
+#include "odb-batch.h"
+#include "cache-file.h"
+#include "byte-order.h"
+#include "strbuf.h"
+#include "utils.h"
+#include "trace.h"
+#include "hex.h"
+#include "environment.h"
+#include "thread-pool.h"
+
+#define PACK_IDX_SIGNATURE 0xff744f63 /* "\377tOc" */
+#define PACK_IDX_FANOUT_SIZE (256 * 4)
+
+/* Fewer pack indexes than this are opened on the calling thread only */
+#define PACK_INDEX_PARALLEL_MIN 16
+
+/* A pack index, mapped : only its fanout and its sorted oids are used */
+struct pack_index {
+	unsigned char *data;
+	size_t size;
+	int mapped; /* data is mmap()ed, malloc()ed otherwise */
+
+	uint32_t nr;
+	const unsigned char *fanout;
+	const unsigned char *oids;
+	size_t stride; /* from an oid to the next one */
+};
+
+struct batch_item {
+	git_oid oid;
+	unsigned int pos; /* in the oids of the caller */
+	int found;
+};
+
+static void release_pack_index(struct pack_index *idx)
+{
+	if (idx->data) {
+#ifndef NO_MMAP
+		if (idx->mapped)
+			munmap(idx->data, idx->size);
+		else
+#endif
+			free(idx->data);
+	}
+
+	memset(idx, 0, sizeof(*idx));
+}
+
+/*
+ * Version 1 is the fanout then the offset and oid of each object ;
+ * version 2 a signature, the version and the fanout, then the oids,
+ * then the crcs and the offsets. Both end with the checksums of the pack
+ * and of the index.
+ */
+static int parse_pack_index(struct pack_index *idx)
+{
+	const unsigned char *data = idx->data;
+	size_t header = 0, per_object = 4 + GIT_OID_RAWSZ;
+
+	if (idx->size >= 8 && get_be32_at(data) == PACK_IDX_SIGNATURE) {
+		if (get_be32_at(data + 4) != 2)
+			return -1;
+		header = 8;
+		per_object = GIT_OID_RAWSZ + 4 + 4;
+	}
+
+	if (idx->size < header + PACK_IDX_FANOUT_SIZE + 2 * GIT_OID_RAWSZ)
+		return -1;
+
+	idx->fanout = data + header;
+	idx->nr = get_be32_at(idx->fanout + 255 * 4);
+	if (idx->nr > (idx->size - header - PACK_IDX_FANOUT_SIZE - 2 * GIT_OID_RAWSZ) / per_object)
+		return -1;
+
+	/* the searches trust the fanout to bound them */
+	for (unsigned int i = 1; i < 256; i++) {
+		if (get_be32_at(idx->fanout + (i - 1) * 4) > get_be32_at(idx->fanout + i * 4))
+			return -1;
+	}
+
+	if (header) {
+		idx->oids = idx->fanout + PACK_IDX_FANOUT_SIZE;
+		idx->stride = GIT_OID_RAWSZ;
+	} else {
+		idx->oids = idx->fanout + PACK_IDX_FANOUT_SIZE + 4;
+		idx->stride = 4 + GIT_OID_RAWSZ;
+	}
+
+	return 0;
+}
+
+/* Map the file at path in idx->data (or read it when it cannot be mapped) */
+static int map_file(struct pack_index *idx, const char *path)
+{
+	struct stat st;
+	int fd;
+
+	memset(idx, 0, sizeof(*idx));
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return -1;
+	}
+	idx->size = st.st_size;
+
+#ifndef NO_MMAP
+	if (idx->size) {
+		idx->data = mmap(NULL, idx->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (idx->data == MAP_FAILED)
+			idx->data = NULL;
+		else
+			idx->mapped = 1;
+	}
+#endif
+	if (!idx->data) {
+		idx->data = xmalloc(idx->size ? idx->size : 1);
+		if (read_in_full(fd, idx->data, idx->size) != (ssize_t)idx->size) {
+			close(fd);
+			release_pack_index(idx);
+			return -1;
+		}
+	}
+	close(fd);
+
+	return 0;
+}
+
+static int open_pack_index(struct pack_index *idx, const char *path)
+{
+	if (map_file(idx, path) < 0)
+		return -1;
+
+	if (parse_pack_index(idx) < 0) {
+		release_pack_index(idx);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Look for the sorted items in the pack index, in one forward pass : the
+ * search for an item starts where the one of the previous item ended,
+ * and is bounded by the fanout entry of its first byte.
+ */
+static unsigned int sweep_pack_index(const struct pack_index *idx, struct batch_item *items, unsigned int nr)
+{
+	unsigned int found = 0;
+	uint32_t lo = 0;
+
+	for (unsigned int i = 0; i < nr; i++) {
+		const unsigned char *id = items[i].oid.id;
+		uint32_t first = id[0] ? get_be32_at(idx->fanout + (id[0] - 1) * 4) : 0;
+		uint32_t hi = get_be32_at(idx->fanout + id[0] * 4);
+
+		if (hi > idx->nr)
+			hi = idx->nr;
+		if (lo < first)
+			lo = first;
+		if (items[i].found || lo >= hi)
+			continue;
+
+		/* the first oid of [lo, hi) which is not before id */
+		uint32_t end = hi;
+		while (lo < end) {
+			uint32_t mid = lo + (end - lo) / 2;
+
+			if (memcmp(idx->oids + mid * idx->stride, id, GIT_OID_RAWSZ) < 0)
+				lo = mid + 1;
+			else
+				end = mid;
+		}
+
+		if (lo < hi && !memcmp(idx->oids + lo * idx->stride, id, GIT_OID_RAWSZ)) {
+			items[i].found = 1;
+			found++;
+		}
+	}
+
+	return found;
+}
+
+static int item_cmp(const void *a, const void *b)
+{
+	return git_oid_cmp(&((const struct batch_item *)a)->oid, &((const struct batch_item *)b)->oid);
+}
+
+static void pack_path(struct strbuf *path, git_repository *repo)
+{
+	strbuf_addstr(path, git_repository_path(repo, GIT_REPO_PATH_ODB));
+	if (path->len && path->buf[path->len - 1] != '/')
+		strbuf_addch(path, '/');
+	strbuf_addstr(path, "pack/");
+}
+
+/*
+ * The pack indexes of the odb, opened once per process : they are only
+ * opened again when the pack directory changes (git adds and removes
+ * packs, it never rewrites one). They are kept most recently hit first,
+ * so that the packs of the objects a command works on are probed before
+ * the others.
+ */
+static struct {
+	char *pack_path;
+	struct stat st; /* of the pack directory, when they were opened */
+	struct pack_index *idxs;
+	unsigned int nr;
+	int complete; /* no index failed to open */
+} packs;
+
+void free_pack_indexes()
+{
+	for (unsigned int i = 0; i < packs.nr; i++)
+		release_pack_index(&packs.idxs[i]);
+	free(packs.idxs);
+	free(packs.pack_path);
+	memset(&packs, 0, sizeof(packs));
+}
+
+struct open_job {
+	const char *path;
+	char **names;
+	struct pack_index *idxs;
+	unsigned char *failed;
+};
+
+static void open_one_pack_index(void *context, unsigned int worker, unsigned int item)
+{
+	struct open_job *job = context;
+	struct strbuf file = STRBUF_INIT;
+
+	(void)worker;
+	strbuf_addf(&file, "%s%s", job->path, job->names[item]);
+	job->failed[item] = open_pack_index(&job->idxs[item], file.buf) < 0;
+	strbuf_release(&file);
+}
+
+static int same_directory(const struct stat *a, const struct stat *b)
+{
+	return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+		a->st_mtime == b->st_mtime && ST_MTIME_NSEC(*a) == ST_MTIME_NSEC(*b);
+}
+
+static int list_pack_indexes(const char *path, char ***names, unsigned int *nr, uint64_t *hash);
+static void free_names(char **names, unsigned int nr);
+
+/*
+ * Open the pack indexes of repo unless they are already. Many indexes
+ * (a repository which is never repacked) are mapped and checked by
+ * several threads : most of the time goes to open() and to the page
+ * faults of the fanouts, which do not depend on each other
+ */
+static void load_pack_indexes(git_repository *repo)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct stat st;
+	char **names;
+	unsigned int nr, opened = 0;
+
+	pack_path(&path, repo);
+	if (stat(path.buf, &st))
+		memset(&st, 0, sizeof(st));
+	if (packs.pack_path && !strcmp(packs.pack_path, path.buf) && same_directory(&packs.st, &st)) {
+		strbuf_release(&path);
+		return;
+	}
+
+	uint64_t start = trace_perf_start();
+	free_pack_indexes();
+	packs.pack_path = xstrdup(path.buf);
+	packs.st = st;
+	packs.complete = 1;
+	if (list_pack_indexes(path.buf, &names, &nr, NULL) < 0) {
+		strbuf_release(&path);
+		trace_perf_stop("load_pack_indexes", start);
+		return;
+	}
+
+	struct open_job job = {path.buf, names, xcalloc(nr ? nr : 1, sizeof(*packs.idxs)), xmalloc(nr ? nr : 1)};
+	struct parallel_job parallel = {nr, 1, NULL, open_one_pack_index, NULL, &job};
+	run_parallel(&parallel, nr >= PACK_INDEX_PARALLEL_MIN ? (unsigned int)online_cpus() : 1);
+
+	/* an index we cannot read is left to the odb */
+	for (unsigned int i = 0; i < nr; i++) {
+		if (job.failed[i])
+			packs.complete = 0;
+		else
+			job.idxs[opened++] = job.idxs[i];
+	}
+	packs.idxs = job.idxs;
+	packs.nr = opened;
+
+	free(job.failed);
+	free_names(names, nr);
+	strbuf_release(&path);
+	trace_perf_stop("load_pack_indexes", start);
+}
+
+/* What the function given to for_each_pack_index() returns, or-ed */
+#define PACK_INDEX_HIT 1 /* it found objects in the index : move it first */
+#define PACK_INDEX_DONE 2 /* the other indexes are not needed */
+
+static void for_each_pack_index(git_repository *repo, int (*fn)(const struct pack_index *idx, void *data), void *data)
+{
+	load_pack_indexes(repo);
+
+	for (unsigned int i = 0; i < packs.nr; i++) {
+		int ret = fn(&packs.idxs[i], data);
+
+		if ((ret & PACK_INDEX_HIT) && i) {
+			struct pack_index hit = packs.idxs[i];
+
+			memmove(packs.idxs + 1, packs.idxs, i * sizeof(*packs.idxs));
+			packs.idxs[0] = hit;
+		}
+		if (ret & PACK_INDEX_DONE)
+			break;
+	}
+}
+
+struct sweep_data {
+	struct batch_item *items;
+	unsigned int nr;
+	unsigned int left; /* not found yet */
+};
+
+static int sweep_one_pack(const struct pack_index *idx, void *data)
+{
+	struct sweep_data *sweep = data;
+	unsigned int found = sweep_pack_index(idx, sweep->items, sweep->nr);
+
+	sweep->left -= found;
+	return (found ? PACK_INDEX_HIT : 0) | (!sweep->left ? PACK_INDEX_DONE : 0);
+}
+
+unsigned int odb_exists_batch(git_repository *repo, const git_oid *oids, unsigned int nr, unsigned char *found)
+{
+	uint64_t start = trace_perf_start();
+	git_odb *odb = git_repository_database(repo);
+	struct batch_item *items;
+	unsigned int missing = 0;
+
+	if (!nr)
+		return 0;
+
+	items = xmalloc(nr * sizeof(*items));
+	for (unsigned int i = 0; i < nr; i++) {
+		git_oid_cpy(&items[i].oid, &oids[i]);
+		items[i].pos = i;
+		items[i].found = 0;
+	}
+	qsort(items, nr, sizeof(*items), item_cmp);
+
+	struct sweep_data sweep = {items, nr, nr};
+	for_each_pack_index(repo, sweep_one_pack, &sweep);
+
+	/* loose objects, alternates, and packs written since we looked */
+	for (unsigned int i = 0; i < nr; i++) {
+		if (!items[i].found) {
+			if (i && !git_oid_cmp(&items[i].oid, &items[i - 1].oid))
+				items[i].found = items[i - 1].found;
+			else
+				items[i].found = git_odb_exists(odb, &items[i].oid) == 1;
+		}
+		found[items[i].pos] = items[i].found;
+		if (!items[i].found)
+			missing++;
+	}
+
+	free(items);
+	trace_perf_stop("odb_exists_batch", start);
+	return missing;
+}
+
+/* An abbreviated oid : its first len hex digits, as bytes */
+struct prefix_search {
+	unsigned char bytes[GIT_OID_RAWSZ];
+	size_t len;
+	git_oid found;
+	unsigned int nr_found; /* distinct oids, up to 2 */
+};
+
+static int matches_prefix(const struct prefix_search *search, const unsigned char *id)
+{
+	size_t full = search->len / 2;
+
+	if (memcmp(id, search->bytes, full))
+		return 0;
+	return !(search->len & 1) || (id[full] & 0xf0) == search->bytes[full];
+}
+
+static void add_candidate(struct prefix_search *search, const unsigned char *id)
+{
+	if (search->nr_found && !memcmp(search->found.id, id, GIT_OID_RAWSZ))
+		return;
+	if (!search->nr_found)
+		memcpy(search->found.id, id, GIT_OID_RAWSZ);
+	search->nr_found++;
+}
+
+static int search_pack_index(const struct pack_index *idx, void *data)
+{
+	struct prefix_search *search = data;
+	unsigned int before = search->nr_found;
+	uint32_t lo = search->bytes[0] ? get_be32_at(idx->fanout + (search->bytes[0] - 1) * 4) : 0;
+	uint32_t hi = get_be32_at(idx->fanout + search->bytes[0] * 4);
+
+	if (hi > idx->nr)
+		hi = idx->nr;
+
+	/* the first oid not before the prefix completed with zeros */
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+
+		if (memcmp(idx->oids + mid * idx->stride, search->bytes, GIT_OID_RAWSZ) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (; lo < idx->nr && search->nr_found < 2; lo++) {
+		const unsigned char *id = idx->oids + lo * idx->stride;
+
+		if (!matches_prefix(search, id))
+			break;
+		add_candidate(search, id);
+	}
+
+	/* two distinct oids : it is ambiguous whatever the other packs have */
+	return (search->nr_found != before ? PACK_INDEX_HIT : 0) | (search->nr_found > 1 ? PACK_INDEX_DONE : 0);
+}
+
+static void search_loose_objects(git_repository *repo, struct prefix_search *search, const char *hex)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct dirent *de;
+	DIR *dir;
+
+	strbuf_addstr(&path, git_repository_path(repo, GIT_REPO_PATH_ODB));
+	if (path.len && path.buf[path.len - 1] != '/')
+		strbuf_addch(&path, '/');
+	strbuf_add(&path, hex, 2);
+
+	dir = opendir(path.buf);
+	strbuf_release(&path);
+	if (!dir)
+		return;
+
+	while (search->nr_found < 2 && (de = readdir(dir)) != NULL) {
+		char name[GIT_OID_HEXSZ + 1];
+		git_oid oid;
+
+		if (strlen(de->d_name) != GIT_OID_HEXSZ - 2 || strncasecmp(de->d_name, hex + 2, search->len - 2))
+			continue;
+
+		memcpy(name, hex, 2);
+		memcpy(name + 2, de->d_name, GIT_OID_HEXSZ - 2);
+		name[GIT_OID_HEXSZ] = '\0';
+		if (git_oid_fromstr(&oid, name) == GIT_SUCCESS)
+			add_candidate(search, oid.id);
+	}
+
+	closedir(dir);
+}
+
+/*
+ * The prefix table : the oids of all the pack indexes of the odb, merged
+ * into one sorted array with its own fanout, laid out as a version 2
+ * pack index without the crcs and offsets so that search_pack_index()
+ * works on it. It is valid for one set of pack indexes, identified by a
+ * hash of their names, sizes and mtimes.
+ *
+ * Persisted, it is the header (signature, version, the hash of the packs,
+ * the number of oids), then the fanout and the oids.
+ */
+#define PREFIX_TABLE_SIGNATURE 0xff673270 /* "\377g2p" */
+#define PREFIX_TABLE_VERSION 1
+#define PREFIX_TABLE_HEADER_SIZE 20
+#define PREFIX_TABLE_FILE "git2-prefix-table"
+
+enum prefix_table_mode {
+	PREFIX_TABLE_OFF,
+	PREFIX_TABLE_MEMORY,
+	PREFIX_TABLE_PERSIST,
+};
+
+static struct {
+	char *pack_path; /* of the packs it was built from */
+	uint64_t packs_hash;
+	struct pack_index idx;
+	unsigned int lookups; /* abbreviations searched in the pack path */
+} table;
+
+static enum prefix_table_mode prefix_table_mode()
+{
+	const char *value = getenv(GIT2_PREFIX_TABLE_ENVIRONMENT);
+
+	if (!value || !*value)
+		return PREFIX_TABLE_MEMORY;
+	if (!strcmp(value, "persist"))
+		return PREFIX_TABLE_PERSIST;
+	if (!strcmp(value, "0") || !strcmp(value, "off"))
+		return PREFIX_TABLE_OFF;
+	return PREFIX_TABLE_MEMORY;
+}
+
+/* FNV-1a, over the names, sizes and mtimes of the pack indexes */
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t len)
+{
+	const unsigned char *bytes = data;
+
+	for (size_t i = 0; i < len; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static int name_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/*
+ * The sorted names of the pack indexes in path, and the hash identifying
+ * them in their current state (unless hash is NULL). Returns -1 if the
+ * directory cannot be read
+ */
+static int list_pack_indexes(const char *path, char ***names, unsigned int *nr, uint64_t *hash)
+{
+	struct strbuf file = STRBUF_INIT;
+	unsigned int alloc = 0;
+	struct dirent *de;
+	DIR *dir;
+
+	*names = NULL;
+	*nr = 0;
+
+	dir = opendir(path);
+	if (!dir)
+		return -1;
+
+	while ((de = readdir(dir)) != NULL) {
+		if (suffixcmp(de->d_name, ".idx"))
+			continue;
+		ALLOC_GROW(*names, *nr + 1, alloc);
+		(*names)[(*nr)++] = xstrdup(de->d_name);
+	}
+	closedir(dir);
+
+	qsort(*names, *nr, sizeof(**names), name_cmp);
+	if (!hash)
+		return 0;
+
+	*hash = 0xcbf29ce484222325ULL;
+	for (unsigned int i = 0; i < *nr; i++) {
+		struct stat st;
+		uint64_t values[3] = {0, 0, 0};
+
+		strbuf_reset(&file);
+		strbuf_addf(&file, "%s%s", path, (*names)[i]);
+		if (!stat(file.buf, &st)) {
+			values[0] = st.st_size;
+			values[1] = st.st_mtime;
+			values[2] = ST_MTIME_NSEC(st);
+		}
+		*hash = hash_bytes(*hash, (*names)[i], strlen((*names)[i]) + 1);
+		*hash = hash_bytes(*hash, values, sizeof(values));
+	}
+
+	strbuf_release(&file);
+	return 0;
+}
+
+static void free_names(char **names, unsigned int nr)
+{
+	for (unsigned int i = 0; i < nr; i++)
+		free(names[i]);
+	free(names);
+}
+
+/* A min-heap of the pack indexes, on their next oid */
+struct merge_cursor {
+	const struct pack_index *idx;
+	uint32_t pos;
+};
+
+static const unsigned char *cursor_oid(const struct merge_cursor *cursor)
+{
+	return cursor->idx->oids + cursor->pos * cursor->idx->stride;
+}
+
+static void sift_down(struct merge_cursor *heap, unsigned int nr, unsigned int i)
+{
+	for (;;) {
+		unsigned int child = 2 * i + 1;
+		struct merge_cursor tmp;
+
+		if (child >= nr)
+			break;
+		if (child + 1 < nr && memcmp(cursor_oid(&heap[child + 1]), cursor_oid(&heap[child]), GIT_OID_RAWSZ) < 0)
+			child++;
+		if (memcmp(cursor_oid(&heap[child]), cursor_oid(&heap[i]), GIT_OID_RAWSZ) >= 0)
+			break;
+		tmp = heap[i];
+		heap[i] = heap[child];
+		heap[child] = tmp;
+		i = child;
+	}
+}
+
+/*
+ * Merge the sorted oids of the pack indexes into the table (an oid in
+ * several packs is only kept once), and compute its fanout
+ */
+static void merge_pack_indexes(struct pack_index *merged, const struct pack_index *idxs, unsigned int nr)
+{
+	struct merge_cursor *heap = xmalloc((nr ? nr : 1) * sizeof(*heap));
+	unsigned int heap_nr = 0;
+	size_t total = 0;
+	unsigned char *out, *fanout;
+	uint32_t count = 0, counts[256];
+
+	for (unsigned int i = 0; i < nr; i++) {
+		total += idxs[i].nr;
+		if (idxs[i].nr) {
+			heap[heap_nr].idx = &idxs[i];
+			heap[heap_nr].pos = 0;
+			heap_nr++;
+		}
+	}
+	for (unsigned int i = heap_nr / 2; i-- > 0;)
+		sift_down(heap, heap_nr, i);
+
+	memset(merged, 0, sizeof(*merged));
+	merged->size = PREFIX_TABLE_HEADER_SIZE + PACK_IDX_FANOUT_SIZE + total * GIT_OID_RAWSZ;
+	merged->data = xmalloc(merged->size);
+	fanout = merged->data + PREFIX_TABLE_HEADER_SIZE;
+	out = fanout + PACK_IDX_FANOUT_SIZE;
+	memset(counts, 0, sizeof(counts));
+
+	while (heap_nr) {
+		const unsigned char *id = cursor_oid(&heap[0]);
+
+		if (!count || memcmp(out - GIT_OID_RAWSZ, id, GIT_OID_RAWSZ)) {
+			memcpy(out, id, GIT_OID_RAWSZ);
+			out += GIT_OID_RAWSZ;
+			counts[id[0]]++;
+			count++;
+		}
+
+		if (++heap[0].pos == heap[0].idx->nr)
+			heap[0] = heap[--heap_nr];
+		sift_down(heap, heap_nr, 0);
+	}
+	free(heap);
+
+	for (unsigned int i = 0, sum = 0; i < 256; i++) {
+		sum += counts[i];
+		put_be32_at(fanout + i * 4, sum);
+	}
+
+	merged->size = PREFIX_TABLE_HEADER_SIZE + PACK_IDX_FANOUT_SIZE + (size_t)count * GIT_OID_RAWSZ;
+	merged->nr = count;
+	merged->fanout = fanout;
+	merged->oids = fanout + PACK_IDX_FANOUT_SIZE;
+	merged->stride = GIT_OID_RAWSZ;
+}
+
+static int build_prefix_table(struct pack_index *merged, git_repository *repo)
+{
+	uint64_t start = trace_perf_start();
+
+	load_pack_indexes(repo);
+	/* the table would miss objects : search the packs one by one */
+	if (!packs.complete) {
+		trace_perf_stop("build_prefix_table", start);
+		return -1;
+	}
+
+	merge_pack_indexes(merged, packs.idxs, packs.nr);
+	trace_perf_stop("build_prefix_table", start);
+	return 0;
+}
+
+static void table_file_path(struct strbuf *file, git_repository *repo)
+{
+	strbuf_addstr(file, git_repository_path(repo, GIT_REPO_PATH));
+	if (file->len && file->buf[file->len - 1] != '/')
+		strbuf_addch(file, '/');
+	strbuf_addstr(file, PREFIX_TABLE_FILE);
+}
+
+/* The persisted table, if it was built from the packs of hash */
+static int read_prefix_table(struct pack_index *idx, const char *file, uint64_t hash)
+{
+	const unsigned char *data;
+
+	if (map_file(idx, file) < 0)
+		return -1;
+
+	data = idx->data;
+	if (idx->size < PREFIX_TABLE_HEADER_SIZE + PACK_IDX_FANOUT_SIZE ||
+	    get_be32_at(data) != PREFIX_TABLE_SIGNATURE ||
+	    get_be32_at(data + 4) != PREFIX_TABLE_VERSION ||
+	    get_be32_at(data + 8) != (uint32_t)(hash >> 32) ||
+	    get_be32_at(data + 12) != (uint32_t)hash)
+		goto invalid;
+
+	idx->nr = get_be32_at(data + 16);
+	idx->fanout = data + PREFIX_TABLE_HEADER_SIZE;
+	idx->oids = idx->fanout + PACK_IDX_FANOUT_SIZE;
+	idx->stride = GIT_OID_RAWSZ;
+	if (idx->size != PREFIX_TABLE_HEADER_SIZE + PACK_IDX_FANOUT_SIZE + (size_t)idx->nr * GIT_OID_RAWSZ ||
+	    get_be32_at(idx->fanout + 255 * 4) != idx->nr)
+		goto invalid;
+
+	return 0;
+
+invalid:
+	release_pack_index(idx);
+	return -1;
+}
+
+/*
+ * Write the table next to the repository, with write_cache_file() : if
+ * another process is writing it, this one does not
+ */
+static void write_prefix_table(struct pack_index *idx, const char *file, uint64_t hash)
+{
+	put_be32_at(idx->data, PREFIX_TABLE_SIGNATURE);
+	put_be32_at(idx->data + 4, PREFIX_TABLE_VERSION);
+	put_be32_at(idx->data + 8, (uint32_t)(hash >> 32));
+	put_be32_at(idx->data + 12, (uint32_t)hash);
+	put_be32_at(idx->data + 16, idx->nr);
+	write_cache_file(file, idx->data, idx->size);
+}
+
+static void release_prefix_table()
+{
+	release_pack_index(&table.idx);
+	free(table.pack_path);
+	table.pack_path = NULL;
+}
+
+/*
+ * The prefix table of the packs of repo, NULL when the pack indexes are
+ * to be searched one by one : when it is off, or before a second
+ * abbreviation in memory mode (building it reads every pack index, which
+ * one search does not pay back)
+ */
+static const struct pack_index *get_prefix_table(git_repository *repo)
+{
+	enum prefix_table_mode mode = prefix_table_mode();
+	struct strbuf path = STRBUF_INIT;
+	struct strbuf file = STRBUF_INIT;
+	char **names;
+	unsigned int nr;
+	uint64_t hash;
+
+	if (mode == PREFIX_TABLE_OFF)
+		return NULL;
+
+	pack_path(&path, repo);
+	if (table.pack_path && strcmp(table.pack_path, path.buf)) {
+		release_prefix_table();
+		table.lookups = 0;
+	}
+
+	if (list_pack_indexes(path.buf, &names, &nr, &hash) < 0) {
+		strbuf_release(&path);
+		return NULL;
+	}
+
+	if (table.pack_path && table.packs_hash == hash)
+		goto done;
+
+	release_prefix_table();
+	if (mode == PREFIX_TABLE_MEMORY && ++table.lookups < 2)
+		goto done;
+
+	table_file_path(&file, repo);
+	if (mode == PREFIX_TABLE_PERSIST && !read_prefix_table(&table.idx, file.buf, hash)) {
+		table.pack_path = strbuf_detach(&path, NULL);
+		table.packs_hash = hash;
+		goto done;
+	}
+
+	if (!build_prefix_table(&table.idx, repo)) {
+		if (mode == PREFIX_TABLE_PERSIST)
+			write_prefix_table(&table.idx, file.buf, hash);
+		table.pack_path = strbuf_detach(&path, NULL);
+		table.packs_hash = hash;
+	}
+
+done:
+	free_names(names, nr);
+	strbuf_release(&path);
+	strbuf_release(&file);
+	return table.pack_path ? &table.idx : NULL;
+}
+
+void free_prefix_table()
+{
+	release_prefix_table();
+	table.lookups = 0;
+}
+
+int odb_find_prefix(git_repository *repo, const char *hex, size_t len, git_oid *oid)
+{
+	const struct pack_index *merged;
+	struct prefix_search search;
+	uint64_t start;
+
+	if (len < ODB_MIN_PREFIX_LEN || len > GIT_OID_HEXSZ)
+		return GIT_ENOTFOUND;
+
+	memset(&search, 0, sizeof(search));
+	search.len = len;
+	for (size_t i = 0; i < len; i++) {
+		int value = hex_value(hex[i]);
+
+		if (value < 0)
+			return GIT_ENOTFOUND;
+		search.bytes[i / 2] |= (i & 1) ? value : value << 4;
+	}
+
+	start = trace_perf_start();
+	merged = get_prefix_table(repo);
+	if (merged)
+		search_pack_index(merged, &search);
+	else
+		for_each_pack_index(repo, search_pack_index, &search);
+	/* loose objects come and go : they are never in the table */
+	search_loose_objects(repo, &search, hex);
+
+	trace_perf_stop("odb_find_prefix", start);
+	if (search.nr_found > 1)
+		return GIT_EAMBIGUOUSOIDPREFIX;
+	if (!search.nr_found)
+		return GIT_ENOTFOUND;
+
+	git_oid_cpy(oid, &search.found);
+	return GIT_SUCCESS;
+}
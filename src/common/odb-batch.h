@@ -0,0 +1,45 @@
+#ifndef ODB_BATCH_H
+#define ODB_BATCH_H
+
+#include <git2.h>
+
+/*
+ * Existence checks of many objects at once. git_odb_exists() searches
+ * every pack index and stats a loose object for each oid ; here the
+ * oids are sorted and each pack index of the repository is swept once,
+ * in order, so that checking a whole index costs one pass over the pack
+ * indexes. Only the oids found in no pack are asked to the odb, which
+ * also knows the loose objects and the alternates.
+ */
+
+/*
+ * The pack indexes are opened once per process (by several threads when
+ * there are many of them) and kept until the pack directory changes.
+ * They are searched most recently hit first, and a search stops as soon
+ * as it has all it needs.
+ */
+
+unsigned int odb_exists_batch(git_repository *repo, const git_oid *oids, unsigned int nr, unsigned char *found);
+//set found[i] to 1 if oids[i] is in the odb of repo, to 0 otherwise.
+//Returns the number of missing objects
+
+/* git does not take shorter abbreviations */
+#define ODB_MIN_PREFIX_LEN 4
+
+int odb_find_prefix(git_repository *repo, const char *hex, size_t len, git_oid *oid);
+//the object whose oid starts with the len hex digits of hex, searched
+//in the sorted oids of the pack indexes and in the loose objects.
+//Returns GIT_SUCCESS, GIT_EAMBIGUOUSOIDPREFIX if several objects match,
+//or GIT_ENOTFOUND (the alternates are not searched). From the second
+//search of a process on (or from the first with GIT2_PREFIX_TABLE set to
+//"persist"), the oids of all the packs are merged once into a single
+//sorted table, so that a search is one binary search whatever the number
+//of packs. The table is built again when the packs change
+
+void free_prefix_table();
+//release the table of odb_find_prefix()
+
+void free_pack_indexes();
+//unmap the pack indexes
+
+#endif
@@ -0,0 +1,76 @@
+#include "odb-stream.h"
+#include "utils.h"
+#include "trace.h"
+
+/* size of the chunks read from a stream and written to the fd */
+#define ODB_STREAM_CHUNK_SIZE (64 * 1024)
+
+int odb_read_object(git_odb_object **out, git_odb *odb, const git_oid *oid)
+{
+	uint64_t start = trace_perf_start();
+	int e = git_odb_read(out, odb, oid);
+
+	trace_perf_stop("odb_read", start);
+	return e;
+}
+
+int odb_read_object_header(size_t *size, git_otype *type, git_odb *odb, const git_oid *oid)
+{
+	uint64_t start = trace_perf_start();
+	int e = git_odb_read_header(size, type, odb, oid);
+
+	trace_perf_stop("odb_read_header", start);
+	return e;
+}
+
+static int stream_to_fd(git_odb_stream *stream, int fd)
+{
+	char *buffer = xmalloc(ODB_STREAM_CHUNK_SIZE);
+	int e = GIT_SUCCESS;
+
+	for (;;) {
+		int loaded = stream->read(stream, buffer, ODB_STREAM_CHUNK_SIZE);
+
+		if (loaded < 0) {
+			e = loaded;
+			break;
+		}
+		if (loaded == 0)
+			break;
+
+		if (write_in_full(fd, buffer, loaded) < 0) {
+			e = GIT_EOSERR;
+			break;
+		}
+	}
+
+	free(buffer);
+	return e;
+}
+
+int odb_write_object_to_fd(git_odb *odb, const git_oid *oid, int fd)
+{
+	git_odb_stream *stream;
+	git_odb_object *odb_object;
+	int e;
+
+	uint64_t start = trace_perf_start();
+
+	/* Not every backend can stream, the others inflate the whole object */
+	if (git_odb_open_rstream(&stream, odb, oid) == GIT_SUCCESS) {
+		e = stream_to_fd(stream, fd);
+		stream->free(stream);
+		trace_perf_stop("odb_stream", start);
+		return e;
+	}
+
+	e = odb_read_object(&odb_object, odb, oid);
+	if (e != GIT_SUCCESS)
+		return e;
+
+	if (write_in_full(fd, git_odb_object_data(odb_object), git_odb_object_size(odb_object)) < 0)
+		e = GIT_EOSERR;
+
+	git_odb_object_close(odb_object);
+	return e;
+}
@@ -0,0 +1,16 @@
+#ifndef ODB_STREAM_H
+#define ODB_STREAM_H
+
+#include <git2.h>
+
+int odb_read_object(git_odb_object **out, git_odb *odb, const git_oid *oid);
+int odb_read_object_header(size_t *size, git_otype *type, git_odb *odb, const git_oid *oid);
+//git_odb_read() and git_odb_read_header() with tracing
+
+int odb_write_object_to_fd(git_odb *odb, const git_oid *oid, int fd);
+//write the contents of an object to fd, by bounded chunks when the
+//backend can stream it, with a single write otherwise.
+//Returns GIT_SUCCESS, the libgit2 error of the read, or GIT_EOSERR
+//when writing to fd failed (errno is set)
+
+#endif
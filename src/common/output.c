@@ -0,0 +1,96 @@
+#include "git-compat-util.h"
+#include "output.h"
+#include "quote.h"
+#include "errors.h"
+#include "utils.h"
+#include "hex.h"
+
+static struct output stdout_output;
+static int stdout_output_loaded = 0;
+
+struct output *get_stdout_output() {
+	if (!stdout_output_loaded) {
+		stdout_output.fd = 1;
+		stdout_output.interactive = isatty(1);
+		strbuf_init(&stdout_output.buf, OUTPUT_BLOCK_SIZE);
+		stdout_output_loaded = 1;
+	}
+
+	return &stdout_output;
+}
+
+void output_init_buffer(struct output *out)
+{
+	out->fd = -1;
+	out->interactive = 0;
+	strbuf_init(&out->buf, 0);
+}
+
+void output_add(struct output *out, const void *data, size_t len)
+{
+	strbuf_add(&out->buf, data, len);
+}
+
+void output_addstr(struct output *out, const char *str)
+{
+	strbuf_addstr(&out->buf, str);
+}
+
+void output_addch(struct output *out, int c)
+{
+	strbuf_addch(&out->buf, c);
+}
+
+void output_addf(struct output *out, const char *fmt, ...)
+{
+	va_list params;
+
+	va_start(params, fmt);
+	strbuf_vaddf(&out->buf, fmt, params);
+	va_end(params);
+}
+
+void output_add_oid(struct output *out, const git_oid *oid)
+{
+	strbuf_grow(&out->buf, GIT_OID_HEXSZ);
+	oid_to_hex(out->buf.buf + out->buf.len, oid);
+	strbuf_setlen(&out->buf, out->buf.len + GIT_OID_HEXSZ);
+}
+
+void output_add_name_quoted(struct output *out, const char *name, int terminator)
+{
+	if (terminator)
+		quote_c_style(name, &out->buf, NULL, 0);
+	else
+		strbuf_addstr(&out->buf, name);
+	strbuf_addch(&out->buf, terminator);
+}
+
+void output_end_record(struct output *out)
+{
+	if (out->fd >= 0 && (out->interactive || out->buf.len >= OUTPUT_BLOCK_SIZE))
+		output_flush(out);
+}
+
+void output_flush(struct output *out)
+{
+	ssize_t written;
+
+	if (!out->buf.len || out->fd < 0)
+		return;
+
+	/* reset before dying, which flushes the output again */
+	written = write_in_full(out->fd, out->buf.buf, out->buf.len);
+	strbuf_reset(&out->buf);
+	if (written < 0)
+		die_errno("unable to write to the output");
+}
+
+void free_stdout_output() {
+	if (!stdout_output_loaded)
+		return;
+
+	output_flush(&stdout_output);
+	strbuf_release(&stdout_output.buf);
+	stdout_output_loaded = 0;
+}
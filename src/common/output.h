@@ -0,0 +1,52 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <git2.h>
+#include "strbuf.h"
+
+/*
+ * A buffered output sink : records are gathered in big blocks which are
+ * written with a single write_in_full(), without going through stdio.
+ * When the fd is a terminal every record is written right away, so that
+ * whoever reads it does not wait. Builtins writing on stdout share the
+ * sink returned by get_stdout_output(), flushed by free_global_resources.
+ */
+
+#define OUTPUT_BLOCK_SIZE (64 * 1024)
+
+struct output {
+	int fd;
+	int interactive;
+	struct strbuf buf;
+};
+
+struct output *get_stdout_output();
+//the sink of the standard output
+
+void output_init_buffer(struct output *out);
+//an output only kept in memory (its fd is -1), for instance to gather
+//records on a thread until they can be added to another output in order
+
+void output_add(struct output *out, const void *data, size_t len);
+void output_addstr(struct output *out, const char *str);
+void output_addch(struct output *out, int c);
+void output_addf(struct output *out, const char *fmt, ...) __attribute__((format (printf, 2, 3)));
+
+void output_add_oid(struct output *out, const git_oid *oid);
+//add the hexadecimal form of oid
+
+void output_add_name_quoted(struct output *out, const char *name, int terminator);
+//add name followed by terminator, quoted unless terminator is '\0'
+//(as write_name_quoted does for -z)
+
+void output_end_record(struct output *out);
+//to call after each record : writes the buffer when a block is full or
+//when the output is interactive
+
+void output_flush(struct output *out);
+//write what is buffered. Dies if it cannot be written
+
+void free_stdout_output();
+//flush and release the sink of the standard output
+
+#endif
@@ -0,0 +1,99 @@
+#include "git-compat-util.h"
+#include <pthread.h>
+#include "pack-on-write.h"
+#include "pack-writer.h"
+#include "environment.h"
+#include "utils.h"
+
+struct pack_backend {
+	git_odb_backend parent;
+	git_repository *repo; /* where the pack goes */
+};
+
+static pthread_mutex_t pack_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct pack_writer *writer; /* NULL before the first object */
+
+static int pack_backend_read(void **data, size_t *len, git_otype *type, git_odb_backend *backend, const git_oid *oid)
+{
+	int e = GIT_ENOTFOUND;
+
+	(void)backend;
+	pthread_mutex_lock(&pack_mutex);
+	if (writer)
+		e = pack_writer_read(writer, oid, data, len, type);
+	pthread_mutex_unlock(&pack_mutex);
+
+	return e;
+}
+
+static int pack_backend_read_header(size_t *len, git_otype *type, git_odb_backend *backend, const git_oid *oid)
+{
+	return pack_backend_read(NULL, len, type, backend, oid);
+}
+
+static int pack_backend_exists(git_odb_backend *backend, const git_oid *oid)
+{
+	int exists = 0;
+
+	(void)backend;
+	pthread_mutex_lock(&pack_mutex);
+	if (writer)
+		exists = pack_writer_has(writer, oid);
+	pthread_mutex_unlock(&pack_mutex);
+
+	return exists;
+}
+
+static int pack_backend_write(git_oid *oid, git_odb_backend *backend, const void *data, size_t len, git_otype type)
+{
+	struct pack_backend *pack = (struct pack_backend *)backend;
+	int e = git_odb_hash(oid, data, len, type);
+
+	/* as the loose backend, do not write what the odb already has */
+	if (e != GIT_SUCCESS || git_odb_exists(backend->odb, oid))
+		return e;
+
+	pthread_mutex_lock(&pack_mutex);
+	if (!writer)
+		writer = pack_writer_start(pack->repo);
+	pack_writer_add(writer, oid, type, data, len);
+	pthread_mutex_unlock(&pack_mutex);
+
+	return GIT_SUCCESS;
+}
+
+static void pack_backend_free(git_odb_backend *backend)
+{
+	free(backend);
+}
+
+int attach_pack_on_write(git_repository *repo)
+{
+	const char *value = getenv(GIT2_PACK_ON_WRITE_ENVIRONMENT);
+	struct pack_backend *pack;
+
+	if (!value || !*value || !strcmp(value, "0"))
+		return GIT_SUCCESS;
+
+	pack = xcalloc(1, sizeof(*pack));
+	pack->parent.read = pack_backend_read;
+	pack->parent.read_header = pack_backend_read_header;
+	pack->parent.write = pack_backend_write;
+	pack->parent.exists = pack_backend_exists;
+	pack->parent.free = pack_backend_free;
+	pack->repo = repo;
+
+	/* before the loose backend (2) for writes */
+	return git_odb_add_backend(git_repository_database(repo), &pack->parent, 3);
+}
+
+void finish_pack_on_write()
+{
+	/* held when dying while writing : the pack is unusable then */
+	if (pthread_mutex_trylock(&pack_mutex))
+		return;
+	if (writer)
+		pack_writer_finish(writer);
+	writer = NULL;
+	pthread_mutex_unlock(&pack_mutex);
+}
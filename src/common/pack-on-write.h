@@ -0,0 +1,27 @@
+#ifndef PACK_ON_WRITE_H
+#define PACK_ON_WRITE_H
+
+#include <git2.h>
+
+/*
+ * With GIT2_PACK_ON_WRITE set, the objects a command creates are not
+ * written as loose objects (a file, a zlib stream and a rename each) but
+ * appended to a single pack, through an odb backend of higher priority
+ * than the loose one. The objects of the pack in progress can be read
+ * back right away, but are not found by abbreviation. The pack and its
+ * index are moved in place at the end of the command, before falling
+ * back to git, and when the repository is closed.
+ *
+ * All the repositories of the process share the pack in progress : the
+ * backend can be used from several threads.
+ */
+
+int attach_pack_on_write(git_repository *repo);
+//add the backend to the odb of repo if GIT2_PACK_ON_WRITE is set.
+//Returns GIT_SUCCESS or the libgit2 error
+
+void finish_pack_on_write();
+//write the pack in progress, if any, so that other processes see its
+//objects. The next object starts a new pack
+
+#endif
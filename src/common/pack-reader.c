@@ -0,0 +1,888 @@
+#include "git-compat-util.h"
+#include <pthread.h>
+#include <zlib.h>
+#include "pack-reader.h"
+#include "byte-order.h"
+#include "shared-cache.h"
+#include "environment.h"
+#include "strbuf.h"
+#include "repository.h"
+#include "utils.h"
+#include "trace.h"
+#include "ctype.h"
+
+#define PACK_IDX_SIGNATURE 0xff744f63 /* "\377tOc" */
+#define PACK_IDX_FANOUT_SIZE (256 * 4)
+#define PACK_SIGNATURE 0x5041434b /* "PACK" */
+#define PACK_HEADER_SIZE 12
+
+/* Buckets of the cache, which is bounded by bytes rather than entries */
+#define DELTA_BASE_CACHE_BUCKETS 4096
+
+/* git packs no deeper chains : deeper is a loop of a corrupted pack */
+#define MAX_DELTA_DEPTH 10000
+
+/*
+ * A pack and its index, both mapped. Packs are never unmapped before
+ * free_pack_reader() : a pack git removes meanwhile stays readable, and
+ * the readers need no reference counts.
+ */
+struct pack {
+	char *name; /* of the index, in the pack directory */
+	unsigned char *idx, *data;
+	size_t idx_size, size;
+
+	uint32_t nr;
+	const unsigned char *fanout;
+	const unsigned char *oids;
+	size_t stride; /* from an oid to the next one */
+	const unsigned char *offsets; /* 32 bits each, NULL for version 1 */
+	const unsigned char *large_offsets;
+	size_t nr_large_offsets;
+};
+
+/* A resolved delta base, in the cache */
+struct delta_base {
+	const struct pack *pack;
+	uint64_t offset;
+	git_otype type;
+	void *data;
+	size_t len;
+	struct delta_base *next; /* in its bucket */
+	struct delta_base *newer, *older; /* in the lru list */
+};
+
+static struct {
+	pthread_mutex_t lock;
+
+	char *pack_path; /* of the packs opened */
+	struct stat st; /* of the pack directory, when it was last read */
+	struct pack **packs;
+	unsigned int nr, alloc;
+	const struct pack *last_found; /* the next object is likely there too */
+
+	size_t limit, used;
+	struct delta_base **buckets;
+	struct delta_base lru; /* lru.older is the most recently used */
+} reader = {PTHREAD_MUTEX_INITIALIZER, NULL, {0}, NULL, 0, 0, NULL, 0, 0, NULL, {0}};
+
+struct reader_backend {
+	git_odb_backend parent;
+	char *pack_path;
+};
+
+/* "<n>", "<n>k", "<n>m" or "<n>g". Returns -1 when it is none of them */
+static int parse_cache_size(const char *value, size_t *size)
+{
+	char *end;
+	unsigned long n;
+
+	errno = 0;
+	n = strtoul(value, &end, 10);
+	if (errno || end == value)
+		return -1;
+
+	switch (tolower(*end)) {
+	case 'g':
+		n <<= 10;
+		/* fall through */
+	case 'm':
+		n <<= 10;
+		/* fall through */
+	case 'k':
+		n <<= 10;
+		end++;
+		break;
+	}
+	if (*end)
+		return -1;
+
+	*size = n;
+	return 0;
+}
+
+static int map_file(const char *path, unsigned char **data, size_t *size)
+{
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) || !st.st_size) {
+		close(fd);
+		return -1;
+	}
+
+	*size = st.st_size;
+	*data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	return *data == MAP_FAILED ? -1 : 0;
+}
+
+static void close_pack(struct pack *pack)
+{
+	if (pack->idx)
+		munmap(pack->idx, pack->idx_size);
+	if (pack->data)
+		munmap(pack->data, pack->size);
+	free(pack->name);
+	free(pack);
+}
+
+/*
+ * Version 1 is the fanout then the offset and oid of each object ;
+ * version 2 a signature, the version and the fanout, then the oids,
+ * the crcs, the offsets and the 64 bits offsets. Both end with the
+ * checksums of the pack and of the index.
+ */
+static int parse_pack_index(struct pack *pack)
+{
+	const unsigned char *data = pack->idx;
+	size_t header = 0, per_object = 4 + GIT_OID_RAWSZ, tables;
+
+	if (pack->idx_size >= 8 && get_be32_at(data) == PACK_IDX_SIGNATURE) {
+		if (get_be32_at(data + 4) != 2)
+			return -1;
+		header = 8;
+		per_object = GIT_OID_RAWSZ + 4 + 4;
+	}
+
+	if (pack->idx_size < header + PACK_IDX_FANOUT_SIZE + 2 * GIT_OID_RAWSZ)
+		return -1;
+
+	pack->fanout = data + header;
+	pack->nr = get_be32_at(pack->fanout + 255 * 4);
+	tables = pack->idx_size - header - PACK_IDX_FANOUT_SIZE - 2 * GIT_OID_RAWSZ;
+	if (pack->nr > tables / per_object)
+		return -1;
+	for (unsigned int i = 1; i < 256; i++) {
+		if (get_be32_at(pack->fanout + (i - 1) * 4) > get_be32_at(pack->fanout + i * 4))
+			return -1;
+	}
+
+	if (header) {
+		pack->oids = pack->fanout + PACK_IDX_FANOUT_SIZE;
+		pack->stride = GIT_OID_RAWSZ;
+		pack->offsets = pack->oids + (size_t)pack->nr * (GIT_OID_RAWSZ + 4);
+		pack->large_offsets = pack->offsets + (size_t)pack->nr * 4;
+		pack->nr_large_offsets = (tables - (size_t)pack->nr * per_object) / 8;
+	} else {
+		pack->oids = pack->fanout + PACK_IDX_FANOUT_SIZE + 4;
+		pack->stride = 4 + GIT_OID_RAWSZ;
+	}
+
+	return 0;
+}
+
+/* Map the index name of path and its pack, which must be the one it indexes */
+static struct pack *open_pack(const char *path, const char *name)
+{
+	struct strbuf file = STRBUF_INIT;
+	struct pack *pack = xcalloc(1, sizeof(*pack));
+	int e;
+
+	pack->name = xstrdup(name);
+	strbuf_addf(&file, "%s%s", path, name);
+	e = map_file(file.buf, &pack->idx, &pack->idx_size);
+	if (e || parse_pack_index(pack)) {
+		pack->idx = e ? NULL : pack->idx;
+		goto fail;
+	}
+
+	strbuf_setlen(&file, file.len - strlen(".idx"));
+	strbuf_addstr(&file, ".pack");
+	if (map_file(file.buf, &pack->data, &pack->size)) {
+		pack->data = NULL;
+		goto fail;
+	}
+	if (pack->size < PACK_HEADER_SIZE + GIT_OID_RAWSZ ||
+	    get_be32_at(pack->data) != PACK_SIGNATURE ||
+	    (get_be32_at(pack->data + 4) != 2 && get_be32_at(pack->data + 4) != 3) ||
+	    get_be32_at(pack->data + 8) != pack->nr ||
+	    memcmp(pack->data + pack->size - GIT_OID_RAWSZ, pack->idx + pack->idx_size - 2 * GIT_OID_RAWSZ, GIT_OID_RAWSZ))
+		goto fail;
+
+	strbuf_release(&file);
+	return pack;
+
+fail:
+	strbuf_release(&file);
+	close_pack(pack);
+	return NULL;
+}
+
+static int is_known_pack(const char *name)
+{
+	for (unsigned int i = 0; i < reader.nr; i++) {
+		if (!strcmp(reader.packs[i]->name, name))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Open the packs of path not opened yet, when the pack directory changed.
+ * Called with the lock held
+ */
+static void load_packs(const char *path)
+{
+	struct dirent *de;
+	struct stat st;
+	DIR *dir;
+
+	if (stat(path, &st))
+		return;
+	if (reader.pack_path && !strcmp(reader.pack_path, path) &&
+	    st.st_ino == reader.st.st_ino && st.st_mtime == reader.st.st_mtime &&
+	    ST_MTIME_NSEC(st) == ST_MTIME_NSEC(reader.st))
+		return;
+
+	/* another repository : its packs would be found in this one */
+	if (reader.pack_path && strcmp(reader.pack_path, path))
+		return;
+
+	dir = opendir(path);
+	if (!dir)
+		return;
+
+	uint64_t start = trace_perf_start();
+	while ((de = readdir(dir)) != NULL) {
+		struct pack *pack;
+
+		if (suffixcmp(de->d_name, ".idx") || is_known_pack(de->d_name))
+			continue;
+		/* a pack we cannot read is left to libgit2 */
+		pack = open_pack(path, de->d_name);
+		if (!pack)
+			continue;
+		ALLOC_GROW(reader.packs, reader.nr + 1, reader.alloc);
+		reader.packs[reader.nr++] = pack;
+	}
+	closedir(dir);
+	trace_perf_stop("load_packs", start);
+
+	if (!reader.pack_path)
+		reader.pack_path = xstrdup(path);
+	reader.st = st;
+}
+
+static uint64_t pack_offset(const struct pack *pack, uint32_t pos)
+{
+	uint32_t offset;
+
+	if (!pack->offsets)
+		return get_be32_at(pack->oids + (size_t)pos * pack->stride - 4);
+
+	offset = get_be32_at(pack->offsets + (size_t)pos * 4);
+	if (!(offset & 0x80000000))
+		return offset;
+
+	offset &= 0x7fffffff;
+	if (offset >= pack->nr_large_offsets)
+		return 0;
+	return ((uint64_t)get_be32_at(pack->large_offsets + (size_t)offset * 8) << 32) |
+		get_be32_at(pack->large_offsets + (size_t)offset * 8 + 4);
+}
+
+/* The offset of oid in pack, 0 when it is not there */
+static uint64_t find_in_pack(const struct pack *pack, const git_oid *oid)
+{
+	const unsigned char *id = oid->id;
+	uint32_t lo = id[0] ? get_be32_at(pack->fanout + (id[0] - 1) * 4) : 0;
+	uint32_t hi = get_be32_at(pack->fanout + id[0] * 4);
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		int cmp = memcmp(pack->oids + (size_t)mid * pack->stride, id, GIT_OID_RAWSZ);
+
+		if (!cmp)
+			return pack_offset(pack, mid);
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return 0;
+}
+
+static const struct pack *find_object(const char *path, const git_oid *oid, uint64_t *offset)
+{
+	const struct pack *found = NULL;
+
+	pthread_mutex_lock(&reader.lock);
+	load_packs(path);
+	if (reader.pack_path && !strcmp(reader.pack_path, path)) {
+		if (reader.last_found && (*offset = find_in_pack(reader.last_found, oid)))
+			found = reader.last_found;
+		for (unsigned int i = 0; !found && i < reader.nr; i++) {
+			if ((*offset = find_in_pack(reader.packs[i], oid)))
+				found = reader.last_found = reader.packs[i];
+		}
+	}
+	pthread_mutex_unlock(&reader.lock);
+
+	return found;
+}
+
+/*
+ * The type and size of the entry at offset, and where its data starts :
+ * for deltas, after the offset or the oid of their base (in *base).
+ * Returns -1 when the entry is beyond the pack or its type unknown
+ */
+static int read_entry_header(const struct pack *pack, uint64_t offset, git_otype *type, size_t *size,
+	uint64_t *data, uint64_t *base)
+{
+	const unsigned char *p = pack->data + offset;
+	const unsigned char *end = pack->data + pack->size - GIT_OID_RAWSZ;
+	unsigned int shift = 4;
+	unsigned char c;
+
+	if (offset < PACK_HEADER_SIZE || offset >= pack->size - GIT_OID_RAWSZ)
+		return -1;
+
+	c = *p++;
+	*type = (c >> 4) & 7;
+	*size = c & 15;
+	while (c & 0x80) {
+		if (p == end || shift > 8 * sizeof(size_t) - 7)
+			return -1;
+		c = *p++;
+		*size += (size_t)(c & 0x7f) << shift;
+		shift += 7;
+	}
+
+	switch (*type) {
+	case GIT_OBJ_COMMIT:
+	case GIT_OBJ_TREE:
+	case GIT_OBJ_BLOB:
+	case GIT_OBJ_TAG:
+		break;
+	case GIT_OBJ_OFS_DELTA: {
+		/* big endian, with an offset of 1 added to each continuation */
+		uint64_t distance;
+
+		if (p == end)
+			return -1;
+		c = *p++;
+		distance = c & 0x7f;
+		while (c & 0x80) {
+			if (p == end || distance >> 56)
+				return -1;
+			c = *p++;
+			distance = ((distance + 1) << 7) | (c & 0x7f);
+		}
+		if (!distance || distance > offset)
+			return -1;
+		*base = offset - distance;
+		break;
+	}
+	case GIT_OBJ_REF_DELTA: {
+		git_oid oid;
+
+		if (end - p < GIT_OID_RAWSZ)
+			return -1;
+		memcpy(oid.id, p, GIT_OID_RAWSZ);
+		p += GIT_OID_RAWSZ;
+		/* thin packs are completed by git : the base is in the pack */
+		*base = find_in_pack(pack, &oid);
+		if (!*base)
+			return -1;
+		break;
+	}
+	default:
+		return -1;
+	}
+
+	*data = p - pack->data;
+	return 0;
+}
+
+/* Inflate the size bytes of the entry data at offset, in a new NUL terminated buffer */
+static void *inflate_entry(const struct pack *pack, uint64_t offset, size_t size)
+{
+	unsigned char *out = xmalloc(size + 1);
+	z_stream stream;
+	int ok;
+
+	memset(&stream, 0, sizeof(stream));
+	stream.next_in = (unsigned char *)pack->data + offset;
+	stream.avail_in = pack->size - GIT_OID_RAWSZ - offset;
+	stream.next_out = out;
+	stream.avail_out = size + 1;
+	ok = inflateInit(&stream) == Z_OK && inflate(&stream, Z_FINISH) == Z_STREAM_END && stream.total_out == size;
+	inflateEnd(&stream);
+
+	if (!ok) {
+		free(out);
+		return NULL;
+	}
+	trace_perf_add("pack_bytes_inflated", size);
+	out[size] = '\0';
+	return out;
+}
+
+static int read_delta_size(const unsigned char **p, const unsigned char *end, size_t *size)
+{
+	unsigned int shift = 0;
+	unsigned char c;
+
+	*size = 0;
+	do {
+		if (*p == end || shift > 8 * sizeof(size_t) - 7)
+			return -1;
+		c = *(*p)++;
+		*size |= (size_t)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+
+	return 0;
+}
+
+/* base with the delta applied, in a new NUL terminated buffer ; NULL if the delta is corrupt */
+static void *apply_delta(const unsigned char *base, size_t base_len, const unsigned char *delta, size_t delta_len, size_t *len)
+{
+	const unsigned char *p = delta, *end = delta + delta_len;
+	unsigned char *out, *o;
+	size_t source, target;
+
+	if (read_delta_size(&p, end, &source) || source != base_len || read_delta_size(&p, end, &target))
+		return NULL;
+
+	o = out = xmalloc(target + 1);
+	while (p < end) {
+		unsigned char op = *p++;
+
+		if (op & 0x80) {
+			/* copy from the base : the bits of op tell which bytes follow */
+			size_t from = 0, size = 0;
+
+			for (unsigned int i = 0; i < 4; i++) {
+				if ((op & (1 << i)) && p < end)
+					from |= (size_t)*p++ << (8 * i);
+			}
+			for (unsigned int i = 0; i < 3; i++) {
+				if ((op & (0x10 << i)) && p < end)
+					size |= (size_t)*p++ << (8 * i);
+			}
+			if (!size)
+				size = 0x10000;
+			if (from > base_len || size > base_len - from || size > target - (o - out))
+				break;
+			memcpy(o, base + from, size);
+			o += size;
+		} else if (op) {
+			/* insert the next op bytes */
+			if (op > end - p || op > target - (o - out))
+				break;
+			memcpy(o, p, op);
+			o += op;
+			p += op;
+		} else {
+			break;
+		}
+	}
+
+	if (p != end || (size_t)(o - out) != target) {
+		free(out);
+		return NULL;
+	}
+	*o = '\0';
+	*len = target;
+	return out;
+}
+
+static struct delta_base **bucket_of(const struct pack *pack, uint64_t offset)
+{
+	uintptr_t hash = (uintptr_t)pack ^ (uintptr_t)(offset * 0x9e3779b97f4a7c15ULL >> 20);
+
+	return &reader.buckets[hash % DELTA_BASE_CACHE_BUCKETS];
+}
+
+static void lru_unlink(struct delta_base *base)
+{
+	base->newer->older = base->older;
+	base->older->newer = base->newer;
+}
+
+static void lru_add(struct delta_base *base)
+{
+	base->older = reader.lru.older;
+	base->newer = &reader.lru;
+	reader.lru.older->newer = base;
+	reader.lru.older = base;
+}
+
+/* Called with the lock held */
+static void drop_base(struct delta_base *base)
+{
+	struct delta_base **b = bucket_of(base->pack, base->offset);
+
+	while (*b != base)
+		b = &(*b)->next;
+	*b = base->next;
+	lru_unlink(base);
+	reader.used -= base->len;
+	free(base->data);
+	free(base);
+}
+
+/* A copy of the cached base at offset, NULL if it is not in the cache */
+static void *get_cached_base(const struct pack *pack, uint64_t offset, git_otype *type, size_t *len)
+{
+	struct delta_base *base;
+	void *data = NULL;
+
+	pthread_mutex_lock(&reader.lock);
+	for (base = *bucket_of(pack, offset); base; base = base->next) {
+		if (base->pack == pack && base->offset == offset)
+			break;
+	}
+	if (base) {
+		lru_unlink(base);
+		lru_add(base);
+		*type = base->type;
+		*len = base->len;
+		data = xmalloc(base->len + 1);
+		memcpy(data, base->data, base->len + 1);
+	}
+	pthread_mutex_unlock(&reader.lock);
+
+	return data;
+}
+
+/* Keep data (NUL terminated, of len bytes) as the base at offset. Takes it */
+static void cache_base(const struct pack *pack, uint64_t offset, git_otype type, void *data, size_t len)
+{
+	struct delta_base *base, **bucket;
+
+	if (len > reader.limit / 4) {
+		free(data);
+		return;
+	}
+
+	pthread_mutex_lock(&reader.lock);
+	bucket = bucket_of(pack, offset);
+	for (base = *bucket; base; base = base->next) {
+		/* another thread resolved it too */
+		if (base->pack == pack && base->offset == offset) {
+			pthread_mutex_unlock(&reader.lock);
+			free(data);
+			return;
+		}
+	}
+
+	while (reader.used + len > reader.limit && reader.lru.newer != &reader.lru) {
+		drop_base(reader.lru.newer);
+		trace_perf_count("delta_base_cache_evictions");
+	}
+
+	base = xmalloc(sizeof(*base));
+	base->pack = pack;
+	base->offset = offset;
+	base->type = type;
+	base->data = data;
+	base->len = len;
+	base->next = *bucket;
+	*bucket = base;
+	lru_add(base);
+	reader.used += len;
+	pthread_mutex_unlock(&reader.lock);
+}
+
+/*
+ * Read the entry at offset : down its delta chain to a base in the cache
+ * or to a whole object, then back up applying the deltas. Each base on
+ * the way goes to the cache, the object itself does not
+ */
+static int unpack_entry(const struct pack *pack, uint64_t offset, void **out, size_t *out_len, git_otype *out_type)
+{
+	uint64_t *chain = NULL, at = offset, base_offset = 0, data;
+	unsigned int depth = 0, alloc = 0;
+	git_otype type, base_type;
+	size_t size, len;
+	void *base;
+
+	for (;;) {
+		if (at != offset) {
+			base = get_cached_base(pack, at, &base_type, &len);
+			trace_perf_count(base ? "delta_base_cache_hits" : "delta_base_cache_misses");
+			if (base)
+				break;
+		}
+		if (depth > MAX_DELTA_DEPTH || read_entry_header(pack, at, &type, &size, &data, &base_offset) < 0)
+			goto corrupted;
+		if (type != GIT_OBJ_OFS_DELTA && type != GIT_OBJ_REF_DELTA) {
+			base = inflate_entry(pack, data, size);
+			if (!base)
+				goto corrupted;
+			base_type = type;
+			len = size;
+			break;
+		}
+		ALLOC_GROW(chain, depth + 1, alloc);
+		chain[depth++] = at;
+		at = base_offset;
+	}
+
+	/* base is the object at "at", the base of the delta at chain[depth - 1] */
+	while (depth--) {
+		void *delta, *result;
+		size_t result_len;
+
+		if (read_entry_header(pack, chain[depth], &type, &size, &data, &base_offset) < 0 ||
+		    !(delta = inflate_entry(pack, data, size))) {
+			free(base);
+			goto corrupted;
+		}
+		result = apply_delta(base, len, delta, size, &result_len);
+		free(delta);
+		if (!result) {
+			free(base);
+			goto corrupted;
+		}
+
+		cache_base(pack, at, base_type, base, len);
+		base = result;
+		len = result_len;
+		at = chain[depth];
+	}
+
+	free(chain);
+	*out = base;
+	*out_len = len;
+	*out_type = base_type;
+	return GIT_SUCCESS;
+
+corrupted:
+	free(chain);
+	return GIT_EPACKCORRUPTED;
+}
+
+/* The type and size of the entry at offset, through its delta chain */
+static int entry_info(const struct pack *pack, uint64_t offset, git_otype *type, size_t *len)
+{
+	uint64_t at = offset, base_offset = 0, data;
+	unsigned int depth = 0;
+	size_t size;
+
+	for (;;) {
+		if (depth > MAX_DELTA_DEPTH || read_entry_header(pack, at, type, &size, &data, &base_offset) < 0)
+			return GIT_EPACKCORRUPTED;
+		if (*type != GIT_OBJ_OFS_DELTA && *type != GIT_OBJ_REF_DELTA)
+			break;
+
+		/* the size of the object is in the header of its delta */
+		if (at == offset) {
+			unsigned char header[32];
+			const unsigned char *p = header;
+			z_stream stream;
+
+			memset(&stream, 0, sizeof(stream));
+			stream.next_in = (unsigned char *)pack->data + data;
+			stream.avail_in = pack->size - GIT_OID_RAWSZ - data;
+			stream.next_out = header;
+			stream.avail_out = sizeof(header);
+			if (inflateInit(&stream) != Z_OK)
+				return GIT_EZLIB;
+			inflate(&stream, Z_SYNC_FLUSH);
+			inflateEnd(&stream);
+			if (read_delta_size(&p, stream.next_out, len) || read_delta_size(&p, stream.next_out, len))
+				return GIT_EPACKCORRUPTED;
+		}
+		at = base_offset;
+		depth++;
+	}
+
+	if (at == offset)
+		*len = size;
+	return GIT_SUCCESS;
+}
+
+static int reader_read(void **data, size_t *len, git_otype *type, git_odb_backend *backend, const git_oid *oid)
+{
+	struct reader_backend *r = (struct reader_backend *)backend;
+	const struct pack *pack;
+	uint64_t offset;
+	int e;
+
+	pack = find_object(r->pack_path, oid, &offset);
+	if (!pack)
+		return GIT_ENOTFOUND;
+
+	/* another process may have inflated it, now that the repository is known to have it */
+	if (shared_cache_get(oid, data, len, type))
+		return GIT_SUCCESS;
+
+	uint64_t start = trace_perf_start();
+	e = unpack_entry(pack, offset, data, len, type);
+	trace_perf_stop("pack_read", start);
+	/* the blobs are mostly read once, by a checkout */
+	if (e == GIT_SUCCESS && (*type == GIT_OBJ_TREE || *type == GIT_OBJ_COMMIT))
+		shared_cache_put(oid, *data, *len, *type);
+	return e;
+}
+
+static int reader_read_header(size_t *len, git_otype *type, git_odb_backend *backend, const git_oid *oid)
+{
+	struct reader_backend *r = (struct reader_backend *)backend;
+	const struct pack *pack;
+	uint64_t offset;
+
+	pack = find_object(r->pack_path, oid, &offset);
+	if (!pack)
+		return GIT_ENOTFOUND;
+
+	return entry_info(pack, offset, type, len);
+}
+
+static int reader_exists(git_odb_backend *backend, const git_oid *oid)
+{
+	struct reader_backend *r = (struct reader_backend *)backend;
+	uint64_t offset;
+
+	return find_object(r->pack_path, oid, &offset) != NULL;
+}
+
+static void reader_free(git_odb_backend *backend)
+{
+	struct reader_backend *r = (struct reader_backend *)backend;
+
+	free(r->pack_path);
+	free(r);
+}
+
+int pack_position_cmp(const struct pack_position *a, const struct pack_position *b)
+{
+	if (a->pack != b->pack)
+		return a->pack < b->pack ? -1 : 1;
+	if (a->offset != b->offset)
+		return a->offset < b->offset ? -1 : 1;
+	return 0;
+}
+
+void pack_positions(git_repository *repo, const git_oid *oids, unsigned int nr, struct pack_position *positions)
+{
+	char *path = get_git_pack_directory(repo);
+	unsigned int last = 0;
+
+	pthread_mutex_lock(&reader.lock);
+	load_packs(path);
+	int ours = reader.pack_path && !strcmp(reader.pack_path, path);
+	for (unsigned int n = 0; n < nr; n++) {
+		struct pack_position *pos = &positions[n];
+
+		pos->pack = PACK_POSITION_NONE;
+		pos->offset = 0;
+		if (!ours || !reader.nr)
+			continue;
+		/* objects of a tree or a commit are mostly in the same pack */
+		if ((pos->offset = find_in_pack(reader.packs[last], &oids[n]))) {
+			pos->pack = last;
+			continue;
+		}
+		for (unsigned int i = 0; i < reader.nr; i++) {
+			if (i != last && (pos->offset = find_in_pack(reader.packs[i], &oids[n]))) {
+				pos->pack = last = i;
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&reader.lock);
+
+	free(path);
+}
+
+void for_each_packed_object(git_repository *repo, each_packed_object_fn fn, void *data)
+{
+	char *path = get_git_pack_directory(repo);
+	const struct pack **packs = NULL;
+	unsigned int nr = 0;
+
+	/* the packs stay mapped : fn may read objects, which takes the lock */
+	pthread_mutex_lock(&reader.lock);
+	load_packs(path);
+	if (reader.pack_path && !strcmp(reader.pack_path, path) && reader.nr) {
+		nr = reader.nr;
+		packs = xmalloc(nr * sizeof(*packs));
+		memcpy(packs, reader.packs, nr * sizeof(*packs));
+	}
+	pthread_mutex_unlock(&reader.lock);
+
+	for (unsigned int i = 0; i < nr; i++) {
+		for (uint32_t n = 0; n < packs[i]->nr; n++) {
+			struct pack_position pos = {i, pack_offset(packs[i], n)};
+			git_oid oid;
+
+			memcpy(oid.id, packs[i]->oids + (size_t)n * packs[i]->stride, GIT_OID_RAWSZ);
+			fn(&oid, &pos, data);
+		}
+	}
+
+	free(packs);
+	free(path);
+}
+
+/* the size set by the variable name, 0 if it is not set (or not a size) */
+static size_t cache_size(const char *name)
+{
+	const char *value = getenv(name);
+	size_t size;
+
+	if (!value || !*value || parse_cache_size(value, &size) < 0)
+		return 0;
+	return size;
+}
+
+int attach_pack_reader(git_repository *repo)
+{
+	size_t limit = cache_size(GIT2_DELTA_BASE_CACHE_ENVIRONMENT);
+	size_t shared = cache_size(GIT2_SHARED_OBJECT_CACHE_ENVIRONMENT);
+	struct reader_backend *r;
+
+	if (!limit && !shared)
+		return GIT_SUCCESS;
+
+	pthread_mutex_lock(&reader.lock);
+	/* without a delta base cache, only the shared objects are kept */
+	reader.limit = limit;
+	if (shared && !shared_cache_open(shared) && !limit) {
+		pthread_mutex_unlock(&reader.lock);
+		return GIT_SUCCESS;
+	}
+	if (!reader.buckets) {
+		reader.buckets = xcalloc(DELTA_BASE_CACHE_BUCKETS, sizeof(*reader.buckets));
+		reader.lru.newer = reader.lru.older = &reader.lru;
+	}
+	pthread_mutex_unlock(&reader.lock);
+
+	r = xcalloc(1, sizeof(*r));
+	r->parent.read = reader_read;
+	r->parent.read_header = reader_read_header;
+	r->parent.exists = reader_exists;
+	r->parent.free = reader_free;
+	r->pack_path = get_git_pack_directory(repo);
+
+	/* before the loose (2) and pack (1) backends of libgit2 */
+	return git_odb_add_backend(git_repository_database(repo), &r->parent, 3);
+}
+
+void free_pack_reader()
+{
+	pthread_mutex_lock(&reader.lock);
+	while (reader.buckets && reader.lru.newer != &reader.lru)
+		drop_base(reader.lru.newer);
+	free(reader.buckets);
+	reader.buckets = NULL;
+	reader.used = 0;
+
+	for (unsigned int i = 0; i < reader.nr; i++)
+		close_pack(reader.packs[i]);
+	free(reader.packs);
+	reader.packs = NULL;
+	reader.nr = reader.alloc = 0;
+	reader.last_found = NULL;
+	free(reader.pack_path);
+	reader.pack_path = NULL;
+	pthread_mutex_unlock(&reader.lock);
+}
@@ -0,0 +1,58 @@
+#ifndef PACK_READER_H
+#define PACK_READER_H
+
+#include <stdint.h>
+#include <git2.h>
+
+/*
+ * With GIT2_DELTA_BASE_CACHE set to a size ("96m", "512k", in bytes
+ * without a suffix), objects are read from the packs by an odb backend
+ * of higher priority than the ones of libgit2, which keeps the bases of
+ * the deltas it resolves : reading many objects of the same delta chains
+ * (checkout-index -a, cat-file --batch) inflates each base once instead
+ * of once per object. The least recently used bases are dropped beyond
+ * that size.
+ *
+ * Objects it cannot read (loose, in a pack written meanwhile, a delta
+ * on a base of another pack) are left to the other backends. The packs
+ * and the cache are shared by all the repositories of the process, and
+ * can be used from several threads. With GIT2_TRACE_PERF the report
+ * counts the hits and misses of the cache, its evictions and the bytes
+ * inflated.
+ *
+ * With GIT2_SHARED_OBJECT_CACHE, the trees and commits it reads are
+ * also shared with the other git2 processes (see shared-cache.h).
+ */
+
+int attach_pack_reader(git_repository *repo);
+//add the backend to the odb of repo if GIT2_DELTA_BASE_CACHE or
+//GIT2_SHARED_OBJECT_CACHE is set. Returns GIT_SUCCESS or the libgit2 error
+
+/*
+ * Where objects are in the packs, whether the backend is attached or not :
+ * commands reading many objects sort them by position so that the packs
+ * are read forward, instead of seeking back and forth through them.
+ */
+struct pack_position {
+	uint32_t pack; /* PACK_POSITION_NONE if no pack has it */
+	uint64_t offset;
+};
+
+#define PACK_POSITION_NONE UINT32_MAX
+
+int pack_position_cmp(const struct pack_position *a, const struct pack_position *b);
+//for sorting by pack, then by offset. Objects in no pack come last
+
+void pack_positions(git_repository *repo, const git_oid *oids, unsigned int nr, struct pack_position *positions);
+//the position of each of the nr oids in the packs of repo
+
+typedef void (*each_packed_object_fn)(const git_oid *oid, const struct pack_position *pos, void *data);
+
+void for_each_packed_object(git_repository *repo, each_packed_object_fn fn, void *data);
+//call fn on every object of every pack of repo, in the order of the
+//indexes. An object in several packs is seen once per pack
+
+void free_pack_reader();
+//drop the cache and unmap the packs
+
+#endif
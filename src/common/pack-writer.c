@@ -0,0 +1,403 @@
+#include "git-compat-util.h"
+#include <zlib.h>
+#include "pack-writer.h"
+#include "byte-order.h"
+#include "strbuf.h"
+#include "utils.h"
+#include "errors.h"
+#include "trace.h"
+#include "sha1.h"
+#include "hex.h"
+#include "fsync.h"
+#include "oid-hash.h"
+#include "repository.h"
+
+#define PACK_SIGNATURE 0x5041434b /* "PACK" */
+#define PACK_VERSION 2
+#define PACK_HEADER_SIZE 12
+#define PACK_IDX_SIGNATURE 0xff744f63 /* "\377tOc" */
+#define PACK_IDX_VERSION 2
+#define PACK_IDX_LARGE_OFFSET 0x80000000
+
+/* output is written by chunks of this size */
+#define PACK_WRITE_CHUNK (1024 * 1024)
+
+#define NO_ENTRY UINT_MAX
+
+struct pack_entry {
+	git_oid oid;
+	uint32_t crc;
+	off_t offset;
+	git_otype type;
+	size_t size;
+	unsigned int header_len; /* the deflated data follows */
+	size_t deflated_len;
+};
+
+struct pack_writer {
+	char *pack_dir; /* with its trailing '/' */
+	struct strbuf tmp_path;
+	int fd;
+	struct strbuf out; /* not written yet */
+	off_t offset; /* in the pack of the end of out */
+	z_stream stream;
+
+	struct pack_entry *entries;
+	unsigned int nr, alloc;
+	unsigned int *buckets; /* of the entries by oid, NO_ENTRY if free */
+	unsigned int nr_buckets; /* a power of 2 */
+};
+
+static void flush_output(struct pack_writer *writer)
+{
+	if (write_in_full(writer->fd, writer->out.buf, writer->out.len) < 0)
+		die_errno("unable to write %s", writer->tmp_path.buf);
+	strbuf_reset(&writer->out);
+}
+
+struct pack_writer *pack_writer_start(git_repository *repo)
+{
+	struct pack_writer *writer = xcalloc(1, sizeof(*writer));
+
+	writer->pack_dir = get_git_pack_directory(repo);
+
+	strbuf_init(&writer->tmp_path, 0);
+	strbuf_addf(&writer->tmp_path, "%stmp_pack_XXXXXX", writer->pack_dir);
+	writer->fd = mkstemp(writer->tmp_path.buf);
+	if (writer->fd < 0)
+		die_errno("unable to create temporary pack file %s", writer->tmp_path.buf);
+
+	/* the number of objects is only known at the end */
+	strbuf_init(&writer->out, PACK_WRITE_CHUNK);
+	add_be32(&writer->out, PACK_SIGNATURE);
+	add_be32(&writer->out, PACK_VERSION);
+	add_be32(&writer->out, 0);
+	writer->offset = PACK_HEADER_SIZE;
+
+	if (deflateInit(&writer->stream, Z_DEFAULT_COMPRESSION) != Z_OK)
+		die("unable to initialize compression");
+
+	return writer;
+}
+
+static unsigned int bucket_of(const git_oid *oid, unsigned int nr_buckets)
+{
+	return oid_hash(oid) & (nr_buckets - 1);
+}
+
+static unsigned int *find_bucket(struct pack_writer *writer, const git_oid *oid)
+{
+	unsigned int i = bucket_of(oid, writer->nr_buckets);
+
+	while (writer->buckets[i] != NO_ENTRY && git_oid_cmp(&writer->entries[writer->buckets[i]].oid, oid))
+		i = (i + 1) & (writer->nr_buckets - 1);
+	return &writer->buckets[i];
+}
+
+/* Keep the buckets at most half full */
+static void grow_buckets(struct pack_writer *writer)
+{
+	unsigned int *old = writer->buckets;
+	unsigned int old_nr = writer->nr_buckets;
+
+	if (2 * (writer->nr + 1) <= writer->nr_buckets)
+		return;
+
+	writer->nr_buckets = old_nr ? 2 * old_nr : 1024;
+	writer->buckets = xmalloc(writer->nr_buckets * sizeof(*writer->buckets));
+	memset(writer->buckets, 0xff, writer->nr_buckets * sizeof(*writer->buckets));
+
+	for (unsigned int i = 0; i < old_nr; i++)
+		if (old[i] != NO_ENTRY)
+			*find_bucket(writer, &writer->entries[old[i]].oid) = old[i];
+	free(old);
+}
+
+int pack_writer_has(struct pack_writer *writer, const git_oid *oid)
+{
+	return writer->nr_buckets && *find_bucket(writer, oid) != NO_ENTRY;
+}
+
+/* type and size, 4 bits of size then 7 bits per byte */
+static size_t encode_object_header(unsigned char *header, git_otype type, size_t size)
+{
+	size_t n = 1;
+
+	*header = (type << 4) | (size & 0xf);
+	size >>= 4;
+	while (size) {
+		header[n - 1] |= 0x80;
+		header[n++] = size & 0x7f;
+		size >>= 7;
+	}
+
+	return n;
+}
+
+int pack_writer_add(struct pack_writer *writer, const git_oid *oid, git_otype type, const void *data, size_t len)
+{
+	unsigned char header[16];
+	size_t header_len, start, bound;
+	unsigned int *bucket;
+	struct pack_entry *entry;
+
+	grow_buckets(writer);
+	bucket = find_bucket(writer, oid);
+	if (*bucket != NO_ENTRY)
+		return 0;
+
+	ALLOC_GROW(writer->entries, writer->nr + 1, writer->alloc);
+	*bucket = writer->nr;
+	entry = &writer->entries[writer->nr++];
+	git_oid_cpy(&entry->oid, oid);
+	entry->offset = writer->offset;
+
+	entry->type = type;
+	entry->size = len;
+
+	start = writer->out.len;
+	header_len = encode_object_header(header, type, len);
+	strbuf_add(&writer->out, header, header_len);
+	entry->header_len = header_len;
+
+	bound = deflateBound(&writer->stream, len);
+	strbuf_grow(&writer->out, bound);
+	deflateReset(&writer->stream);
+	writer->stream.next_in = (unsigned char *)data;
+	writer->stream.avail_in = len;
+	writer->stream.next_out = (unsigned char *)writer->out.buf + writer->out.len;
+	writer->stream.avail_out = bound;
+	if (deflate(&writer->stream, Z_FINISH) != Z_STREAM_END)
+		die("unable to compress an object");
+	strbuf_setlen(&writer->out, writer->out.len + (bound - writer->stream.avail_out));
+	entry->deflated_len = bound - writer->stream.avail_out;
+
+	entry->crc = crc32(0, (unsigned char *)writer->out.buf + start, writer->out.len - start);
+	writer->offset += writer->out.len - start;
+
+	if (writer->out.len >= PACK_WRITE_CHUNK)
+		flush_output(writer);
+
+	return 1;
+}
+
+/* The deflated data of entry, from what is not written yet or from the file */
+static int read_deflated(struct pack_writer *writer, const struct pack_entry *entry, unsigned char *buf)
+{
+	off_t data_offset = entry->offset + entry->header_len;
+	off_t written = writer->offset - writer->out.len;
+
+	if (data_offset >= written) {
+		memcpy(buf, writer->out.buf + (data_offset - written), entry->deflated_len);
+		return 0;
+	}
+
+	for (size_t done = 0; done < entry->deflated_len;) {
+		ssize_t n = pread(writer->fd, buf + done, entry->deflated_len - done, data_offset + done);
+
+		if (n < 0 && (errno == EINTR || errno == EAGAIN))
+			continue;
+		if (n <= 0)
+			return -1;
+		done += n;
+	}
+	return 0;
+}
+
+int pack_writer_read(struct pack_writer *writer, const git_oid *oid, void **data, size_t *len, git_otype *type)
+{
+	const struct pack_entry *entry;
+	unsigned int *bucket;
+	unsigned char *deflated;
+	z_stream stream;
+	int e;
+
+	if (!writer->nr_buckets)
+		return GIT_ENOTFOUND;
+	bucket = find_bucket(writer, oid);
+	if (*bucket == NO_ENTRY)
+		return GIT_ENOTFOUND;
+
+	entry = &writer->entries[*bucket];
+	*len = entry->size;
+	*type = entry->type;
+	if (!data)
+		return GIT_SUCCESS;
+
+	deflated = xmalloc(entry->deflated_len ? entry->deflated_len : 1);
+	if (read_deflated(writer, entry, deflated) < 0) {
+		free(deflated);
+		return GIT_EOSERR;
+	}
+
+	/* one more byte, as libgit2 NUL terminates the data of objects */
+	*data = xmalloc(entry->size + 1);
+	memset(&stream, 0, sizeof(stream));
+	stream.next_in = deflated;
+	stream.avail_in = entry->deflated_len;
+	stream.next_out = *data;
+	stream.avail_out = entry->size + 1;
+	e = inflateInit(&stream) == Z_OK && inflate(&stream, Z_FINISH) == Z_STREAM_END &&
+		stream.total_out == entry->size ? GIT_SUCCESS : GIT_EOBJCORRUPTED;
+	inflateEnd(&stream);
+	free(deflated);
+
+	if (e != GIT_SUCCESS) {
+		free(*data);
+		*data = NULL;
+		return e;
+	}
+	((char *)*data)[entry->size] = '\0';
+	return GIT_SUCCESS;
+}
+
+/*
+ * The object count goes in the header written first : write it over,
+ * then hash the whole file and append the checksum
+ */
+static void write_pack_trailer(struct pack_writer *writer, unsigned char checksum[SHA1_RAWSZ])
+{
+	unsigned char header[PACK_HEADER_SIZE];
+	struct sha1_ctx sha1;
+	char *buf = xmalloc(PACK_WRITE_CHUNK);
+	ssize_t n;
+
+	put_be32_at(header, PACK_SIGNATURE);
+	put_be32_at(header + 4, PACK_VERSION);
+	put_be32_at(header + 8, writer->nr);
+	if (lseek(writer->fd, 0, SEEK_SET) < 0 || write_in_full(writer->fd, header, sizeof(header)) < 0)
+		die_errno("unable to write %s", writer->tmp_path.buf);
+
+	sha1_init(&sha1);
+	if (lseek(writer->fd, 0, SEEK_SET) < 0)
+		die_errno("unable to read %s", writer->tmp_path.buf);
+	while ((n = xread(writer->fd, buf, PACK_WRITE_CHUNK)) > 0)
+		sha1_update(&sha1, buf, n);
+	if (n < 0)
+		die_errno("unable to read %s", writer->tmp_path.buf);
+	sha1_final(checksum, &sha1);
+	free(buf);
+
+	if (write_in_full(writer->fd, checksum, SHA1_RAWSZ) < 0)
+		die_errno("unable to write %s", writer->tmp_path.buf);
+	fsync_written_file(writer->fd, writer->tmp_path.buf);
+	if (close(writer->fd))
+		die_errno("unable to write %s", writer->tmp_path.buf);
+	writer->fd = -1;
+}
+
+static int entry_cmp(const void *a, const void *b)
+{
+	return git_oid_cmp(&((const struct pack_entry *)a)->oid, &((const struct pack_entry *)b)->oid);
+}
+
+/*
+ * Version 2 : signature, version, fanout, sorted oids, crcs, offsets
+ * (those from 2GB on in a table of 64 bits offsets), then the checksums
+ * of the pack and of the index
+ */
+static void build_index(struct strbuf *idx, struct pack_writer *writer, const unsigned char pack_checksum[SHA1_RAWSZ])
+{
+	unsigned char checksum[SHA1_RAWSZ];
+	struct sha1_ctx sha1;
+	uint32_t large = 0;
+	unsigned int i, j;
+
+	qsort(writer->entries, writer->nr, sizeof(*writer->entries), entry_cmp);
+
+	add_be32(idx, PACK_IDX_SIGNATURE);
+	add_be32(idx, PACK_IDX_VERSION);
+	for (i = 0, j = 0; i < 256; i++) {
+		while (j < writer->nr && writer->entries[j].oid.id[0] == i)
+			j++;
+		add_be32(idx, j);
+	}
+	for (i = 0; i < writer->nr; i++)
+		strbuf_add(idx, writer->entries[i].oid.id, GIT_OID_RAWSZ);
+	for (i = 0; i < writer->nr; i++)
+		add_be32(idx, writer->entries[i].crc);
+	for (i = 0; i < writer->nr; i++) {
+		off_t offset = writer->entries[i].offset;
+
+		if (offset < PACK_IDX_LARGE_OFFSET)
+			add_be32(idx, offset);
+		else
+			add_be32(idx, PACK_IDX_LARGE_OFFSET | large++);
+	}
+	for (i = 0; i < writer->nr; i++) {
+		uint64_t offset = writer->entries[i].offset;
+
+		if (offset >= PACK_IDX_LARGE_OFFSET) {
+			add_be32(idx, offset >> 32);
+			add_be32(idx, offset & 0xffffffff);
+		}
+	}
+
+	strbuf_add(idx, pack_checksum, SHA1_RAWSZ);
+	sha1_init(&sha1);
+	sha1_update(&sha1, idx->buf, idx->len);
+	sha1_final(checksum, &sha1);
+	strbuf_add(idx, checksum, SHA1_RAWSZ);
+}
+
+static void write_file(const char *path, const struct strbuf *contents)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0444);
+
+	if (fd < 0 || write_in_full(fd, contents->buf, contents->len) < 0)
+		die_errno("unable to write %s", path);
+	fsync_written_file(fd, path);
+	if (close(fd))
+		die_errno("unable to write %s", path);
+}
+
+static void release_writer(struct pack_writer *writer)
+{
+	deflateEnd(&writer->stream);
+	strbuf_release(&writer->out);
+	strbuf_release(&writer->tmp_path);
+	free(writer->pack_dir);
+	free(writer->entries);
+	free(writer->buckets);
+	free(writer);
+}
+
+void pack_writer_finish(struct pack_writer *writer)
+{
+	uint64_t start = trace_perf_start();
+	unsigned char checksum[SHA1_RAWSZ];
+	char hex[2 * SHA1_RAWSZ + 1];
+	struct strbuf path = STRBUF_INIT;
+	struct strbuf idx = STRBUF_INIT;
+
+	if (!writer->nr) {
+		close(writer->fd);
+		unlink(writer->tmp_path.buf);
+		release_writer(writer);
+		return;
+	}
+
+	flush_output(writer);
+	write_pack_trailer(writer, checksum);
+	*hex_encode(hex, checksum, SHA1_RAWSZ) = '\0';
+
+	/* the pack first : readers only look at packs which have an index */
+	strbuf_addf(&path, "%spack-%s.pack", writer->pack_dir, hex);
+	if (chmod(writer->tmp_path.buf, 0444) || rename(writer->tmp_path.buf, path.buf))
+		die_errno("unable to move %s to %s", writer->tmp_path.buf, path.buf);
+
+	build_index(&idx, writer, checksum);
+	strbuf_reset(&writer->tmp_path);
+	strbuf_addf(&writer->tmp_path, "%stmp_idx_%s", writer->pack_dir, hex);
+	write_file(writer->tmp_path.buf, &idx);
+
+	strbuf_reset(&path);
+	strbuf_addf(&path, "%spack-%s.idx", writer->pack_dir, hex);
+	if (rename(writer->tmp_path.buf, path.buf))
+		die_errno("unable to move %s to %s", writer->tmp_path.buf, path.buf);
+
+	strbuf_release(&idx);
+	strbuf_release(&path);
+	release_writer(writer);
+	trace_perf_stop("pack_writer_finish", start);
+}
@@ -0,0 +1,35 @@
+#ifndef PACK_WRITER_H
+#define PACK_WRITER_H
+
+#include <git2.h>
+
+/*
+ * Write new objects straight into a pack (version 2, no deltas) and its
+ * index, instead of one loose object each : for imports that create many
+ * objects at once. The pack is written in a temporary file of
+ * objects/pack, and only shows up in the odb with pack_writer_finish().
+ * I/O errors die : the temporary file is then left for git gc.
+ */
+
+struct pack_writer;
+
+struct pack_writer *pack_writer_start(git_repository *repo);
+
+int pack_writer_add(struct pack_writer *writer, const git_oid *oid, git_otype type, const void *data, size_t len);
+//add the object oid (of type, whose contents are data). Returns 0 if
+//the pack already has it, 1 otherwise
+
+int pack_writer_has(struct pack_writer *writer, const git_oid *oid);
+//whether oid was added to the pack
+
+int pack_writer_read(struct pack_writer *writer, const git_oid *oid, void **data, size_t *len, git_otype *type);
+//read back an object added to the pack : its type and size, and its
+//contents in a new buffer (NUL terminated) unless data is NULL.
+//Returns GIT_SUCCESS, GIT_ENOTFOUND if the pack does not have it, or
+//another libgit2 error
+
+void pack_writer_finish(struct pack_writer *writer);
+//write the header and the checksum of the pack, then its index, and
+//move both in place. Frees writer
+
+#endif
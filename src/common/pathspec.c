@@ -0,0 +1,125 @@
+#include "git-compat-util.h"
+#include "pathspec.h"
+#include "strbuf.h"
+#include "utils.h"
+#include "ctype.h"
+#include "wildmatch.h"
+
+/* Plain paths and globs : leave magic and relative components to git */
+static int is_supported_pathspec(const char *spec)
+{
+	const char *component = spec;
+
+	if (!*spec || *spec == '/' || *spec == ':')
+		return 0;
+
+	for (;;) {
+		const char *slash = strchrnul(component, '/');
+		size_t len = slash - component;
+
+		if ((len == 1 && component[0] == '.') || (len == 2 && !strncmp(component, "..", 2)))
+			return 0;
+		/* "a//b", but "dir/" is fine */
+		if (!len && *slash)
+			return 0;
+		if (!*slash)
+			return 1;
+		component = slash + 1;
+	}
+}
+
+static size_t literal_length(const char *match)
+{
+	size_t len = 0;
+
+	while (match[len] && !is_glob_special(match[len]))
+		len++;
+	return len;
+}
+
+int pathspec_parse(struct pathspec *pathspec, const char *prefix, const char **specs, unsigned int nr)
+{
+	struct strbuf match = STRBUF_INIT;
+	size_t common_len = 0;
+
+	pathspec->items = nr ? xmalloc(nr * sizeof(*pathspec->items)) : NULL;
+	pathspec->nr = 0;
+	for (unsigned int i = 0; i < nr; i++) {
+		struct pathspec_item *item = &pathspec->items[i];
+
+		if (!is_supported_pathspec(specs[i])) {
+			strbuf_release(&match);
+			return -1;
+		}
+
+		strbuf_reset(&match);
+		strbuf_addstr(&match, prefix);
+		strbuf_addstr(&match, specs[i]);
+		item->match = arena_memdupz(&pathspec->arena, match.buf, match.len);
+		item->len = match.len;
+		item->literal_len = literal_length(item->match);
+		pathspec->nr++;
+
+		/* what the literal starts share */
+		if (!i) {
+			common_len = item->literal_len;
+		} else {
+			size_t len = 0;
+
+			while (len < common_len && len < item->literal_len &&
+			       item->match[len] == pathspec->items[0].match[len])
+				len++;
+			common_len = len;
+		}
+	}
+	strbuf_release(&match);
+
+	if (!nr) {
+		pathspec->common = prefix;
+		pathspec->common_len = strlen(prefix);
+		return 0;
+	}
+
+	/* down to a whole directory : "src/co" is "src/" */
+	while (common_len && pathspec->items[0].match[common_len - 1] != '/')
+		common_len--;
+	pathspec->common = arena_memdupz(&pathspec->arena, pathspec->items[0].match, common_len);
+	pathspec->common_len = common_len;
+	return 0;
+}
+
+static int item_match(const struct pathspec_item *item, const char *path, size_t len)
+{
+	if (len < item->literal_len || memcmp(path, item->match, item->literal_len))
+		return 0;
+
+	if (item->literal_len == item->len) {
+		/* "dir" matches dir itself and what is below it, "dir/" only what is below */
+		return item->match[item->len - 1] == '/' || len == item->len || path[item->len] == '/';
+	}
+	/* as git, a file may also be named by a glob as it is */
+	if (len == item->len && !memcmp(path, item->match, len))
+		return 1;
+	return wildmatch(item->match + item->literal_len, path + item->literal_len, 0);
+}
+
+int pathspec_match(const struct pathspec *pathspec, const char *path, size_t len)
+{
+	if (!pathspec->nr)
+		return 1;
+
+	for (unsigned int i = 0; i < pathspec->nr; i++)
+		if (item_match(&pathspec->items[i], path, len))
+			return 1;
+	return 0;
+}
+
+void pathspec_clear(struct pathspec *pathspec)
+{
+	free(pathspec->items);
+	arena_release(&pathspec->arena);
+	pathspec->items = NULL;
+	pathspec->nr = 0;
+	pathspec->common = "";
+	pathspec->common_len = 0;
+}
@@ -0,0 +1,46 @@
+#ifndef PATHSPEC_H
+#define PATHSPEC_H
+
+#include <stddef.h>
+#include "arena.h"
+
+/*
+ * The pathspecs of a command, as git matches them without magic : "dir"
+ * matches dir and what is below it, "dir/" only what is below it, and a
+ * pathspec with wildcards is a glob whose '*' also matches slashes
+ * ("*.c" matches "src/a.c").
+ *
+ * Each item is compiled once with the length of its literal start : it
+ * gives the slice of the sorted index the item can match, and rejects
+ * most paths with a memcmp() before any wildmatch().
+ */
+
+struct pathspec_item {
+	const char *match; /* from the top of the work tree */
+	size_t len;
+	size_t literal_len; /* before the first wildcard */
+};
+
+struct pathspec {
+	struct pathspec_item *items;
+	unsigned int nr;
+	/* the leading directories of all the items, with their trailing '/' : "" or "dir/" */
+	const char *common;
+	size_t common_len;
+	struct arena arena;
+};
+
+#define PATHSPEC_INIT { NULL, 0, "", 0, ARENA_INIT }
+
+int pathspec_parse(struct pathspec *pathspec, const char *prefix, const char **specs, unsigned int nr);
+//compile specs, which are relative to prefix ("" or "dir/"). Returns -1
+//if one of them needs what is left to git : magic (":"), "." and ".."
+//components, absolute paths
+
+int pathspec_match(const struct pathspec *pathspec, const char *path, size_t len);
+//returns 1 if path (from the top of the work tree, NUL terminated)
+//matches one of the items, or if there is none, 0 otherwise
+
+void pathspec_clear(struct pathspec *pathspec);
+
+#endif
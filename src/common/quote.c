@@ -163,16 +163,94 @@ static inline int sq_must_quote(char c)
 	return sq_lookup[(unsigned char)c] + quote_path_fully > 0;
 }
 
+/*
+ * Paths rarely need quoting : scan them by blocks of 16 bytes when the
+ * processor can (SSE2 on x86-64, NEON on arm64), the scalar loops below
+ * only handle what is left.
+ */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define QUOTE_SCAN_BLOCK 16
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define QUOTE_SCAN_BLOCK 16
+#endif
+
+#ifdef QUOTE_SCAN_BLOCK
+/* blocks may go past the \0, which address sanitizers cannot know is harmless */
+#define QUOTE_SCAN_NO_SANITIZE __attribute__((no_sanitize_address))
+#else
+#define QUOTE_SCAN_NO_SANITIZE
+#endif
+
+#ifdef QUOTE_SCAN_BLOCK
+/* bit i is set if byte i of the block must be quoted, as sq_must_quote() says */
+static inline QUOTE_SCAN_NO_SANITIZE unsigned int quote_scan_block(const unsigned char *p)
+{
+#if defined(__SSE2__)
+	__m128i v = _mm_loadu_si128((const __m128i *)p);
+	/* signed : the bytes >= 0x80 are below 0x20 too */
+	__m128i m = _mm_cmplt_epi8(v, _mm_set1_epi8(0x20));
+
+	if (!quote_path_fully)
+		m = _mm_and_si128(m, _mm_cmpgt_epi8(v, _mm_set1_epi8(-1)));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7f)));
+
+	return _mm_movemask_epi8(m);
+#else
+	static const uint8_t bits[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+	uint8x16_t v = vld1q_u8(p);
+	uint8x16_t m = vcltq_u8(v, vdupq_n_u8(0x20));
+
+	if (quote_path_fully)
+		m = vorrq_u8(m, vcgeq_u8(v, vdupq_n_u8(0x80)));
+	m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('"')));
+	m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('\\')));
+	m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8(0x7f)));
+
+	if (!vmaxvq_u8(m))
+		return 0;
+
+	m = vandq_u8(m, vld1q_u8(bits));
+	return vaddv_u8(vget_low_u8(m)) | (vaddv_u8(vget_high_u8(m)) << 8);
+#endif
+}
+#endif
+
 /* returns the longest prefix not needing a quote up to maxlen if positive.
    This stops at the first \0 because it's marked as a character needing an
    escape */
-static size_t next_quote_pos(const char *s, ssize_t maxlen)
+static QUOTE_SCAN_NO_SANITIZE size_t next_quote_pos(const char *s, ssize_t maxlen)
 {
-	size_t len;
+	size_t len = 0;
+#ifdef QUOTE_SCAN_BLOCK
+	const unsigned char *p = (const unsigned char *)s;
+	unsigned int mask;
+
+	if (maxlen < 0) {
+		/*
+		 * The end is only known once the \0 is found : read aligned
+		 * blocks, which never cross a page, so that reading past the
+		 * \0 cannot fault.
+		 */
+		for (; (uintptr_t)(p + len) % QUOTE_SCAN_BLOCK; len++)
+			if (sq_must_quote(s[len]))
+				return len;
+		for (;; len += QUOTE_SCAN_BLOCK)
+			if ((mask = quote_scan_block(p + len)))
+				return len + __builtin_ctz(mask);
+	}
+
+	for (; len + QUOTE_SCAN_BLOCK <= (size_t)maxlen; len += QUOTE_SCAN_BLOCK)
+		if ((mask = quote_scan_block(p + len)))
+			return len + __builtin_ctz(mask);
+#endif
 	if (maxlen < 0) {
-		for (len = 0; !sq_must_quote(s[len]); len++);
+		for (; !sq_must_quote(s[len]); len++);
 	} else {
-		for (len = 0; len < (size_t)maxlen && !sq_must_quote(s[len]); len++);
+		for (; len < (size_t)maxlen && !sq_must_quote(s[len]); len++);
 	}
 	return len;
 }
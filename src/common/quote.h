@@ -28,6 +28,9 @@
 #include <stdio.h>
 #include "strbuf.h"
 
+/* core.quotepath : 0 leaves the bytes above 0x7f of the paths as they are */
+extern int quote_path_fully;
+
 void sq_quote_print(FILE *stream, const char *src);
 
 void sq_quote_buf(struct strbuf *, const char *src);
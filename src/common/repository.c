@@ -1,27 +1,95 @@
 #include <stdlib.h>
 #include "repository.h"
 #include "errors.h"
-#include "git-support.h"
 #include "environment.h"
+#include "fileops.h"
+#include "abspath.h"
+#include "trace.h"
+#include "git-support.h"
+#include "tree-cache.h"
+#include "revision.h"
+#include "pack-on-write.h"
+#include "pack-reader.h"
+#include "discovery-cache.h"
+#include "strbuf.h"
+
+#define SYSTEM_CONFIG_FILE "/etc/gitconfig"
 
 static git_repository *repository = NULL;
+static char repository_real_path[PATH_MAX];
 static char prefix[PATH_MAX];
+static char global_config_file[GIT_PATH_MAX];
 static int prefix_loaded = 0;
 
+static struct index_map index_map = INDEX_MAP_INIT;
+static struct stat index_map_stat; /* of the mapped file, zeroed if there was none */
+static int index_map_loaded = 0;
+
+static struct stat repository_index_stat; /* when libgit2 read the index */
+static int repository_index_loaded = 0;
+
+/* The repository around the current directory, from the cache if it has it */
+static int discover_repository(char *discovered_path, size_t size) {
+	const char *ceiling = getenv(GIT_CEILING_DIRECTORIES_ENVIRONMENT);
+	int cached = getenv(GIT2_DISCOVERY_CACHE_ENVIRONMENT) != NULL;
+	struct stat cwd;
+	int e;
+
+	if (!ceiling)
+		ceiling = "";
+	if (cached && stat(".", &cwd))
+		cached = 0;
+	uint64_t start = trace_perf_start();
+	if (cached && !discovery_cache_lookup(discovered_path, size, &cwd, ceiling)) {
+		trace_perf_stop("repository_discover_cached", start);
+		return GIT_SUCCESS;
+	}
+
+	e = git_repository_discover(discovered_path, size, ".", 0, *ceiling ? ceiling : NULL);
+	trace_perf_stop("repository_discover", start);
+
+	if (e == GIT_SUCCESS && cached)
+		discovery_cache_store(discovered_path, &cwd, ceiling);
+	return e;
+}
+
+/* GIT_DIR (set by --git-dir too) without any lookup, or the repository around the current directory */
+static const char *find_repository(char *discovered_path, size_t size) {
+	const char *repository_path = getenv(GIT_DIR_ENVIRONMENT);
+
+	if (repository_path == NULL) {
+		if (discover_repository(discovered_path, size) < GIT_SUCCESS)
+			return NULL;
+		repository_path = discovered_path;
+	}
+
+	return repository_path;
+}
+
+static int open_repository(const char *path) {
+	uint64_t start = trace_perf_start();
+	int e = git_repository_open(&repository, path);
+	trace_perf_stop("repository_open", start);
+
+	if (e < GIT_SUCCESS) {
+		repository = NULL;
+		return e;
+	}
+
+	if (!realpath(path, repository_real_path))
+		repository_real_path[0] = '\0';
+	e = attach_pack_on_write(repository);
+	if (e == GIT_SUCCESS)
+		e = attach_pack_reader(repository);
+	return e;
+}
+
 git_repository* get_git_repository() {
 	if (repository == NULL) {
 		char discovered_path[PATH_MAX];
-		char *repository_path = getenv(GIT_DIR_ENVIRONMENT);
-
-		if (repository_path == NULL) {
-			if (git_repository_discover(discovered_path, sizeof(discovered_path), ".", 0, getenv(GIT_CEILING_DIRECTORIES_ENVIRONMENT)) < GIT_SUCCESS) {
-				libgit_error();
-			}
+		const char *repository_path = find_repository(discovered_path, sizeof(discovered_path));
 
-			repository_path = discovered_path;
-		}
-
-		if (git_repository_open(&repository, repository_path) < GIT_SUCCESS) {
+		if (repository_path == NULL || open_repository(repository_path) < GIT_SUCCESS) {
 			libgit_error();
 		}
 	}
@@ -29,26 +97,215 @@ git_repository* get_git_repository() {
 	return repository;
 }
 
+static void stat_index_file(struct stat *st) {
+	if (stat(git_repository_path(get_git_repository(), GIT_REPO_PATH_INDEX), st))
+		memset(st, 0, sizeof(*st));
+}
+
+static int load_index_map();
+
+int get_git_repository_index(git_index **index, git_repository *repo) {
+	/* libgit2 reads neither the compressed paths nor the split indexes : git does */
+	if (repo == repository && load_index_map() == GIT_SUCCESS &&
+	    (index_map.version == 4 || index_map.shared))
+		please_git_do_it_for_me(FALLBACK_INDEX);
+
+	uint64_t start = trace_perf_start();
+	if (!repository_index_loaded && repo == repository) {
+		stat_index_file(&repository_index_stat);
+		repository_index_loaded = 1;
+	}
+	int e = git_repository_index(index, repo);
+
+	trace_perf_stop("index_load", start);
+	return e;
+}
+
+static int same_index_file(const struct stat *a, const struct stat *b) {
+	return a->st_ino == b->st_ino && a->st_dev == b->st_dev && a->st_size == b->st_size &&
+		a->st_mtime == b->st_mtime && ST_MTIME_NSEC(*a) == ST_MTIME_NSEC(*b) &&
+		a->st_ctime == b->st_ctime && ST_CTIME_NSEC(*a) == ST_CTIME_NSEC(*b);
+}
+
+static int load_index_map() {
+	struct stat st;
+	int e;
+
+	/* the commands run before may have written it */
+	stat_index_file(&st);
+
+	if (index_map_loaded) {
+		if (same_index_file(&st, &index_map_stat))
+			return GIT_SUCCESS;
+		index_map_release(&index_map);
+		index_map_loaded = 0;
+	}
+
+	e = index_map_load(&index_map, get_git_repository());
+	if (e != GIT_SUCCESS)
+		return e;
+
+	index_map_stat = st;
+	index_map_loaded = 1;
+	return GIT_SUCCESS;
+}
+
+const struct index_map *get_git_sparse_index_map() {
+	int e = load_index_map();
+
+	if (e == GIT_ENOTIMPLEMENTED)
+		please_git_do_it_for_me(FALLBACK_INDEX);
+	if (e != GIT_SUCCESS)
+		die_errno("cannot read the index file");
+
+	return &index_map;
+}
+
+const struct index_map *get_git_index_map() {
+	const struct index_map *map = get_git_sparse_index_map();
+
+	/* git expands the sparse directories for the commands which list paths */
+	if (index_map_sparse(map))
+		please_git_do_it_for_me(FALLBACK_SPARSE);
+
+	return map;
+}
+
 const char *get_git_prefix() {
 	if (!prefix_loaded) {
-		const char *argv[]= {"git", "rev-parse", "--show-prefix", NULL};
-		char *new_prefix = please_git_help_me(argv);
+		char cwd[PATH_MAX];
+		char work_tree[PATH_MAX];
+		const char *work_tree_path = getenv(GIT_WORK_TREE_ENVIRONMENT);
+		size_t work_tree_len;
 
-		if (sizeof(new_prefix) > sizeof(prefix)) {
-			die("The given prefix is too long.\n");
+		prefix[0] = '\0';
+		prefix_loaded = 1;
+
+		if (work_tree_path == NULL)
+			work_tree_path = git_repository_path(get_git_repository(), GIT_REPO_PATH_WORKDIR);
+
+		if (work_tree_path == NULL) {
+			/* Bare repository : no prefix */
+			return prefix;
 		}
 
+		if (git2_getcwd(cwd, sizeof(cwd)) < GIT_SUCCESS)
+			die_errno("Could not get current working directory");
+
+		/* getcwd() resolves links, so must the work tree */
+		if (git2_prettify_dir_path(work_tree, sizeof(work_tree), real_path(work_tree_path)) < GIT_SUCCESS)
+			die("Invalid work tree '%s'", work_tree_path);
 
-		strcpy(prefix, new_prefix);
-		free(new_prefix);
+		/* Outside of the work tree (ie in the .git directory) the prefix is empty */
+		work_tree_len = strlen(work_tree);
+		if (!strncmp(cwd, work_tree, work_tree_len)) {
+			if (strlen(cwd + work_tree_len) >= sizeof(prefix))
+				die("The given prefix is too long.\n");
+
+			strcpy(prefix, cwd + work_tree_len);
+		}
 	}
 
 	return prefix;
 }
 
-void free_repository() {
+const char *get_git_global_config_file() {
+	if (git_config_find_global(global_config_file) != GIT_SUCCESS)
+		return NULL;
+	return global_config_file;
+}
+
+const char *get_git_system_config_file() {
+	if (getenv("GIT_CONFIG_NOSYSTEM") || access(SYSTEM_CONFIG_FILE, F_OK))
+		return NULL;
+	return SYSTEM_CONFIG_FILE;
+}
+
+git_config *get_git_config(git_repository *repo) {
+	git_config *cfg;
+
+	if (git_repository_config(&cfg, repo, get_git_global_config_file(), get_git_system_config_file()) != GIT_SUCCESS)
+		libgit_error();
+	return cfg;
+}
+
+int get_git_config_bool(git_repository *repo, const char *name, int value) {
+	git_config *cfg = get_git_config(repo);
+
+	git_config_get_bool(cfg, name, &value);
+	git_config_free(cfg);
+	return value;
+}
+
+char *get_git_pack_directory(git_repository *repo) {
+	struct strbuf path = STRBUF_INIT;
+
+	strbuf_addstr(&path, git_repository_path(repo, GIT_REPO_PATH_ODB));
+	if (path.len && path.buf[path.len - 1] != '/')
+		strbuf_addch(&path, '/');
+	strbuf_addstr(&path, "pack/");
+	return strbuf_detach(&path, NULL);
+}
+
+static void close_repository() {
 	if (repository == NULL)
 		return;
 
+	free_tree_cache();
+	free_revision_cache();
+	finish_pack_on_write();
 	git_repository_free(repository);
+	repository = NULL;
+	repository_index_loaded = 0;
+}
+
+void release_stale_repository(int changed_behind) {
+	struct stat st;
+
+	if (!repository)
+		return;
+
+	/*
+	 * libgit2 only notices a new index when its mtime changed, to the
+	 * second : the index it holds is dropped as soon as the file changed.
+	 */
+	if (!changed_behind && repository_index_loaded) {
+		stat_index_file(&st);
+		changed_behind = !same_index_file(&st, &repository_index_stat);
+	}
+
+	if (changed_behind)
+		close_repository();
+}
+
+int prepare_git_repository() {
+	char discovered_path[PATH_MAX], resolved_path[PATH_MAX];
+	const char *repository_path = find_repository(discovered_path, sizeof(discovered_path));
+
+	/* the current directory may not be the one of the previous request */
+	prefix_loaded = 0;
+
+	if (repository_path && !realpath(repository_path, resolved_path))
+		repository_path = NULL;
+
+	if (!repository || !repository_path || strcmp(resolved_path, repository_real_path)) {
+		free_repository();
+		if (!repository_path)
+			return GIT_ENOTAREPO;
+		int e = open_repository(repository_path);
+		if (e < GIT_SUCCESS)
+			return e;
+	}
+
+	/* what cannot be mapped is left to the command */
+	load_index_map();
+	return GIT_SUCCESS;
+}
+
+void free_repository() {
+	if (index_map_loaded)
+		index_map_release(&index_map);
+	index_map_loaded = 0;
+
+	close_repository();
 }
@@ -2,12 +2,56 @@
 #define REPOSITORY_H
 
 #include <git2.h>
+#include "index-map.h"
 
 git_repository* get_git_repository();
 
+int get_git_repository_index(git_index **index, git_repository *repo);
+//git_repository_index() with tracing
+
+const struct index_map *get_git_index_map();
+//the index file of the repository, mapped once for the whole run (for
+//all the commands of a run, see run_builtin()) and mapped again when the
+//file changed since. The map is valid until the next call. Falls back to
+//git when the index has a format we do not know, or is a sparse index
+
+const struct index_map *get_git_sparse_index_map();
+//get_git_index_map() for the commands which know what to do with sparse
+//directory entries (see index_map_sparse())
+
+void release_stale_repository(int changed_behind);
+//between two commands of a run : close the repository (it is opened
+//again when needed) if git may have changed it behind our back
+//(changed_behind), or if the index file is not the one libgit2 loaded
+
+int prepare_git_repository();
+//for a long-lived process : make get_git_repository() the repository of
+//the current directory and environment, keeping the open one if it is
+//the same, and map its index ahead. Never dies nor falls back : returns
+//a libgit2 error code, and the command then reports it itself
+
 const char *get_git_prefix();
 //returns the prefix for the current working directory
 
+const char *get_git_global_config_file();
+//the global configuration file (~/.gitconfig), NULL if there is none.
+//The path is valid until the next call
+
+const char *get_git_system_config_file();
+//the system configuration file, NULL if there is none or
+//GIT_CONFIG_NOSYSTEM is set
+
+git_config *get_git_config(git_repository *repo);
+//the configuration of repo, from its own, the global and the system
+//configuration files, to be freed with git_config_free()
+
+int get_git_config_bool(git_repository *repo, const char *name, int value);
+//the boolean setting name ("core.filemode") of repo, from its own, the
+//global and the system configuration files : value if it is not set
+
+char *get_git_pack_directory(git_repository *repo);
+//the "objects/pack/" directory of repo, with a trailing '/', to be freed
+
 void free_repository();
 
 #endif
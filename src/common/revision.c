@@ -0,0 +1,660 @@
+#include "git-compat-util.h"
+#include "revision.h"
+#include "odb-batch.h"
+#include "odb-stream.h"
+#include "tree-cache.h"
+#include "strbuf.h"
+#include "utils.h"
+#include "trace.h"
+#include "hex.h"
+#include "ctype.h"
+
+/* git gives up on deeper chains of symbolic refs */
+#define MAX_SYMREF_DEPTH 5
+
+struct packed_ref {
+	const char *name; /* in the contents of the file */
+	git_oid oid;
+};
+
+/* packed-refs of the repository at path, as it was at st */
+static struct {
+	char *path;
+	struct stat st;
+	struct strbuf contents;
+	struct packed_ref *refs;
+	unsigned int nr, alloc;
+} packed = {NULL, {0}, STRBUF_INIT, NULL, 0, 0};
+
+/* The rules of git to complete a ref name, in order */
+static const char *ref_rules[] = {
+	"%.*s",
+	"refs/%.*s",
+	"refs/tags/%.*s",
+	"refs/heads/%.*s",
+	"refs/remotes/%.*s",
+	"refs/remotes/%.*s/HEAD",
+	NULL
+};
+
+static void git_dir_path(struct strbuf *path, git_repository *repo, const char *name)
+{
+	strbuf_addstr(path, git_repository_path(repo, GIT_REPO_PATH));
+	if (path->len && path->buf[path->len - 1] != '/')
+		strbuf_addch(path, '/');
+	strbuf_addstr(path, name);
+}
+
+void free_revision_cache()
+{
+	free(packed.path);
+	packed.path = NULL;
+	strbuf_release(&packed.contents);
+	free(packed.refs);
+	packed.refs = NULL;
+	packed.nr = packed.alloc = 0;
+}
+
+static int packed_ref_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct packed_ref *)a)->name, ((const struct packed_ref *)b)->name);
+}
+
+/*
+ * "<40 hex> <name>" lines, each maybe followed by a "^<40 hex>" line with
+ * the object of a tag (which we peel ourselves), after "#" comments
+ */
+static void parse_packed_refs()
+{
+	char *line = packed.contents.buf;
+	char *end = line + packed.contents.len;
+
+	while (line < end) {
+		char *eol = memchr(line, '\n', end - line);
+
+		if (!eol)
+			eol = end;
+		*eol = '\0';
+
+		if (eol - line > GIT_OID_HEXSZ + 1 && line[GIT_OID_HEXSZ] == ' ') {
+			git_oid oid;
+
+			if (git_oid_fromstrn(&oid, line, GIT_OID_HEXSZ) == GIT_SUCCESS) {
+				ALLOC_GROW(packed.refs, packed.nr + 1, packed.alloc);
+				packed.refs[packed.nr].name = line + GIT_OID_HEXSZ + 1;
+				git_oid_cpy(&packed.refs[packed.nr].oid, &oid);
+				packed.nr++;
+			}
+		}
+
+		line = eol + 1;
+	}
+
+	/* git writes it sorted, but does not need it to be */
+	qsort(packed.refs, packed.nr, sizeof(*packed.refs), packed_ref_cmp);
+}
+
+static int same_file(const struct stat *a, const struct stat *b)
+{
+	return a->st_ino == b->st_ino && a->st_size == b->st_size &&
+		a->st_mtime == b->st_mtime && ST_MTIME_NSEC(*a) == ST_MTIME_NSEC(*b);
+}
+
+/* The packed refs of repo, read again if the file changed since */
+static void load_packed_refs(git_repository *repo)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct stat st;
+	int fd;
+
+	git_dir_path(&path, repo, "packed-refs");
+	if (stat(path.buf, &st))
+		memset(&st, 0, sizeof(st));
+
+	if (packed.path && !strcmp(packed.path, path.buf) && same_file(&st, &packed.st)) {
+		strbuf_release(&path);
+		return;
+	}
+
+	uint64_t start = trace_perf_start();
+	free_revision_cache();
+	packed.path = strbuf_detach(&path, NULL);
+	packed.st = st;
+
+	fd = open(packed.path, O_RDONLY);
+	if (fd >= 0) {
+		if (strbuf_read(&packed.contents, fd, st.st_size) < 0)
+			strbuf_reset(&packed.contents);
+		close(fd);
+	}
+
+	parse_packed_refs();
+	trace_perf_stop("load_packed_refs", start);
+}
+
+static int read_packed_ref(git_oid *oid, git_repository *repo, const char *name)
+{
+	struct packed_ref key, *ref;
+
+	load_packed_refs(repo);
+
+	key.name = name;
+	ref = bsearch(&key, packed.refs, packed.nr, sizeof(*packed.refs), packed_ref_cmp);
+	if (!ref)
+		return GIT_ENOTFOUND;
+
+	git_oid_cpy(oid, &ref->oid);
+	return GIT_SUCCESS;
+}
+
+/*
+ * The object the ref name points to, following symbolic refs. The loose
+ * ref, when there is one, is the current value : the packed one is the
+ * value when the refs were last packed.
+ */
+static int read_ref(git_oid *oid, git_repository *repo, const char *name, int depth)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct strbuf contents = STRBUF_INIT;
+	int fd, e = GIT_ENOTFOUND;
+
+	if (depth > MAX_SYMREF_DEPTH)
+		return GIT_ENOTIMPLEMENTED;
+
+	git_dir_path(&path, repo, name);
+	fd = open(path.buf, O_RDONLY);
+	strbuf_release(&path);
+
+	if (fd < 0) {
+		if (errno != ENOENT && errno != ENOTDIR)
+			return GIT_ENOTIMPLEMENTED;
+		return prefixcmp(name, "refs/") ? GIT_ENOTFOUND : read_packed_ref(oid, repo, name);
+	}
+
+	/* a directory cannot be read, and is not a ref */
+	if (strbuf_read(&contents, fd, 64) < 0) {
+		close(fd);
+		strbuf_release(&contents);
+		return errno == EISDIR ? GIT_ENOTFOUND : GIT_ENOTIMPLEMENTED;
+	}
+	close(fd);
+	strbuf_rtrim(&contents);
+
+	if (!prefixcmp(contents.buf, "ref:")) {
+		const char *target = contents.buf + strlen("ref:");
+
+		while (isspace(*target))
+			target++;
+		e = read_ref(oid, repo, target, depth + 1);
+	} else if (contents.len >= GIT_OID_HEXSZ &&
+		   (contents.len == GIT_OID_HEXSZ || isspace(contents.buf[GIT_OID_HEXSZ])) &&
+		   git_oid_fromstrn(oid, contents.buf, GIT_OID_HEXSZ) == GIT_SUCCESS) {
+		/* FETCH_HEAD and the like have more after the oid */
+		e = GIT_SUCCESS;
+	}
+
+	strbuf_release(&contents);
+	return e;
+}
+
+/* What git check_ref_format() would not take, or what git reads differently */
+static int bad_ref_name(const char *name, size_t len)
+{
+	if (!len || name[0] == '-' || name[0] == '/' || name[len - 1] == '/' || name[len - 1] == '.')
+		return 1;
+	if (len >= 5 && !memcmp(name + len - 5, ".lock", 5))
+		return 1;
+
+	for (size_t i = 0; i < len; i++) {
+		unsigned char c = name[i];
+
+		if (c <= ' ' || c == 0x7f || strchr("~^:?*[\\", c))
+			return 1;
+		if (c == '.' && (i + 1 < len && name[i + 1] == '.'))
+			return 1;
+		if (c == '.' && (!i || name[i - 1] == '/'))
+			return 1;
+		if (c == '/' && i + 1 < len && name[i + 1] == '/')
+			return 1;
+		if (c == '@' && i + 1 < len && name[i + 1] == '{')
+			return 1;
+	}
+
+	return 0;
+}
+
+static int has_alternates(git_repository *repo)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct stat st;
+	int exists;
+
+	strbuf_addstr(&path, git_repository_path(repo, GIT_REPO_PATH_ODB));
+	if (path.len && path.buf[path.len - 1] != '/')
+		strbuf_addch(&path, '/');
+	strbuf_addstr(&path, "info/alternates");
+	exists = !stat(path.buf, &st);
+
+	strbuf_release(&path);
+	return exists;
+}
+
+static int is_hex(const char *name, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+		if (hex_value(name[i]) < 0)
+			return 0;
+	return 1;
+}
+
+/* A full oid, a ref name, or an abbreviated oid, as git get_sha1_basic() */
+static int resolve_basic(git_oid *oid, git_repository *repo, const char *name, size_t len)
+{
+	struct strbuf ref = STRBUF_INIT;
+	int found = 0;
+
+	if (len == GIT_OID_HEXSZ && git_oid_fromstrn(oid, name, len) == GIT_SUCCESS)
+		return GIT_SUCCESS;
+
+	if (bad_ref_name(name, len))
+		return GIT_ENOTIMPLEMENTED;
+
+	for (int i = 0; ref_rules[i]; i++) {
+		git_oid ref_oid;
+		int e;
+
+		strbuf_reset(&ref);
+		strbuf_addf(&ref, ref_rules[i], (int)len, name);
+		e = read_ref(&ref_oid, repo, ref.buf, 0);
+		if (e == GIT_SUCCESS) {
+			if (!found)
+				git_oid_cpy(oid, &ref_oid);
+			found++;
+		} else if (e != GIT_ENOTFOUND) {
+			strbuf_release(&ref);
+			return e;
+		}
+	}
+	strbuf_release(&ref);
+
+	/* git warns about the ambiguity, and has settings for it */
+	if (found > 1)
+		return GIT_ENOTIMPLEMENTED;
+	if (found)
+		return GIT_SUCCESS;
+
+	if (len < ODB_MIN_PREFIX_LEN || len > GIT_OID_HEXSZ || !is_hex(name, len))
+		return GIT_ENOTFOUND;
+	if (has_alternates(repo))
+		return GIT_ENOTIMPLEMENTED;
+
+	return odb_find_prefix(repo, name, len, oid);
+}
+
+static int object_type(git_otype *type, git_repository *repo, const git_oid *oid)
+{
+	size_t size;
+
+	return odb_read_object_header(&size, type, git_repository_database(repo), oid);
+}
+
+/*
+ * Peel oid (of the given type) to an object of type target : through tags,
+ * and from a commit to its tree. GIT_OBJ_ANY peels the tags only.
+ */
+static int peel(git_oid *oid, git_repository *repo, git_otype type, git_otype target)
+{
+	int e;
+
+	while (type != target) {
+		if (type == GIT_OBJ_TAG) {
+			git_tag *tag;
+
+			e = git_tag_lookup(&tag, repo, oid);
+			if (e != GIT_SUCCESS)
+				return e;
+			git_oid_cpy(oid, git_tag_target_oid(tag));
+			type = git_tag_type(tag);
+			git_tag_close(tag);
+		} else if (target == GIT_OBJ_ANY) {
+			return GIT_SUCCESS;
+		} else if (type == GIT_OBJ_COMMIT && target == GIT_OBJ_TREE) {
+			git_commit *commit;
+
+			e = git_commit_lookup(&commit, repo, oid);
+			if (e != GIT_SUCCESS)
+				return e;
+			git_oid_cpy(oid, git_commit_tree_oid(commit));
+			git_commit_close(commit);
+			type = GIT_OBJ_TREE;
+		} else {
+			return GIT_EINVALIDTYPE;
+		}
+	}
+
+	return GIT_SUCCESS;
+}
+
+static int peel_oid(git_oid *oid, git_repository *repo, git_otype target)
+{
+	git_otype type;
+	int e = object_type(&type, repo, oid);
+
+	if (e != GIT_SUCCESS)
+		return e;
+	return peel(oid, repo, type, target);
+}
+
+/* The nth parent of the commit at oid (n = 0 is the commit itself) */
+static int get_parent(git_oid *oid, git_repository *repo, unsigned long n)
+{
+	git_commit *commit;
+	int e = peel_oid(oid, repo, GIT_OBJ_COMMIT);
+
+	if (e != GIT_SUCCESS || !n)
+		return e;
+
+	e = git_commit_lookup(&commit, repo, oid);
+	if (e != GIT_SUCCESS)
+		return e;
+
+	if (n > git_commit_parentcount(commit))
+		e = GIT_ENOTFOUND;
+	else
+		git_oid_cpy(oid, git_commit_parent_oid(commit, n - 1));
+
+	git_commit_close(commit);
+	return e;
+}
+
+/* The nth first-parent ancestor of the commit at oid */
+static int get_ancestor(git_oid *oid, git_repository *repo, unsigned long n)
+{
+	int e = peel_oid(oid, repo, GIT_OBJ_COMMIT);
+
+	while (e == GIT_SUCCESS && n--)
+		e = get_parent(oid, repo, 1);
+
+	return e;
+}
+
+static int resolve(git_oid *oid, git_repository *repo, const char *name, size_t len);
+
+/* name^{type} : len is that of name */
+static int peel_onion(git_oid *oid, git_repository *repo, const char *name, size_t len, const char *type, size_t type_len)
+{
+	static const struct {
+		const char *name;
+		git_otype type;
+	} types[] = {
+		{"commit", GIT_OBJ_COMMIT},
+		{"tree", GIT_OBJ_TREE},
+		{"blob", GIT_OBJ_BLOB},
+		{"tag", GIT_OBJ_TAG},
+		{"object", GIT_OBJ_ANY},
+		{"", GIT_OBJ_ANY},
+	};
+	int e;
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(types); i++) {
+		if (strlen(types[i].name) != type_len || memcmp(types[i].name, type, type_len))
+			continue;
+
+		e = resolve(oid, repo, name, len);
+		if (e != GIT_SUCCESS)
+			return e;
+
+		if (i == ARRAY_SIZE(types) - 1)
+			return peel_oid(oid, repo, GIT_OBJ_ANY);
+		if (types[i].type == GIT_OBJ_ANY) {
+			git_otype existing;
+			return object_type(&existing, repo, oid);
+		}
+		return peel_oid(oid, repo, types[i].type);
+	}
+
+	/* "^{/text}" searches the commit messages */
+	return GIT_ENOTIMPLEMENTED;
+}
+
+static int resolve(git_oid *oid, git_repository *repo, const char *name, size_t len)
+{
+	size_t i;
+
+	if (len && name[len - 1] == '}') {
+		for (i = len - 1; i > 0; i--) {
+			if (name[i - 1] == '^' && name[i] == '{')
+				return peel_onion(oid, repo, name, i - 1, name + i + 1, len - i - 2);
+		}
+		return GIT_ENOTIMPLEMENTED;
+	}
+
+	/* the last "~N" or "^N" suffix, N defaulting to 1 */
+	for (i = len; i > 0 && isdigit(name[i - 1]); i--)
+		;
+	if (i > 0 && (name[i - 1] == '~' || name[i - 1] == '^')) {
+		unsigned long n = 1;
+		int e;
+
+		if (i < len) {
+			if (len - i > 9)
+				return GIT_ENOTIMPLEMENTED;
+			n = strtoul(name + i, NULL, 10);
+		}
+
+		e = resolve(oid, repo, name, i - 1);
+		if (e != GIT_SUCCESS)
+			return e;
+		return name[i - 1] == '^' ? get_parent(oid, repo, n) : get_ancestor(oid, repo, n);
+	}
+
+	return resolve_basic(oid, repo, name, len);
+}
+
+/* The colon of "rev:path" : the first one out of braces, as "HEAD@{10:00}" has one */
+static const char *path_colon(const char *name)
+{
+	int depth = 0;
+
+	for (; *name; name++) {
+		if (*name == '{')
+			depth++;
+		else if (depth && *name == '}')
+			depth--;
+		else if (!depth && *name == ':')
+			return name;
+	}
+	return NULL;
+}
+
+/*
+ * The entry at path in the tree at oid, as git get_tree_entry() : each
+ * component is looked up in the tree of the previous one, and "dir/" is
+ * the tree of dir
+ */
+static int get_tree_entry(git_oid *oid, git_repository *repo, const char *path)
+{
+	while (*path) {
+		const char *slash = strchrnul(path, '/');
+		size_t len = slash - path;
+		unsigned int mode = 0;
+		int found = 0;
+		git_tree *tree;
+		int e = tree_cache_lookup(&tree, repo, oid);
+
+		if (e != GIT_SUCCESS)
+			return e;
+		for (unsigned int i = 0; i < git_tree_entrycount(tree); i++) {
+			const git_tree_entry *entry = git_tree_entry_byindex(tree, i);
+			const char *entry_name = git_tree_entry_name(entry);
+
+			if (strlen(entry_name) == len && !memcmp(entry_name, path, len)) {
+				git_oid_cpy(oid, git_tree_entry_id(entry));
+				mode = git_tree_entry_attributes(entry);
+				found = 1;
+				break;
+			}
+		}
+		tree_cache_close(tree);
+
+		if (!found || (*slash && !S_ISDIR(mode)))
+			return GIT_ENOTFOUND;
+		path = *slash ? slash + 1 : slash;
+	}
+
+	return GIT_SUCCESS;
+}
+
+/* "rev:path" : rev is peeled to its tree, path is relative to its top */
+static int resolve_path(git_oid *oid, git_repository *repo, const char *name, size_t len, const char *path)
+{
+	int e;
+
+	/* "./" and "../" are relative to the current directory, git knows it */
+	if (!strcmp(path, ".") || !strcmp(path, "..") || !prefixcmp(path, "./") || !prefixcmp(path, "../"))
+		return GIT_ENOTIMPLEMENTED;
+
+	e = resolve(oid, repo, name, len);
+	if (e == GIT_SUCCESS)
+		e = peel_oid(oid, repo, GIT_OBJ_TREE);
+	/* git tells which of the path or the tree-ish is wrong */
+	if (e == GIT_EINVALIDTYPE)
+		return GIT_ENOTIMPLEMENTED;
+	if (e != GIT_SUCCESS)
+		return e;
+
+	e = get_tree_entry(oid, repo, path);
+	return e == GIT_ENOTFOUND ? GIT_ENOTIMPLEMENTED : e;
+}
+
+int resolve_revision(git_oid *oid, git_repository *repo, const char *name)
+{
+	uint64_t start = trace_perf_start();
+	const char *colon = strchr(name, ':') ? path_colon(name) : NULL;
+	int e;
+
+	/* ":path" and ":n:path" name index entries, ":/text" a commit message */
+	if (colon == name)
+		e = GIT_ENOTIMPLEMENTED;
+	else if (colon)
+		e = resolve_path(oid, repo, name, colon - name, colon + 1);
+	else
+		e = resolve(oid, repo, name, strlen(name));
+
+	trace_perf_stop("resolve_revision", start);
+	return e;
+}
+
+int resolve_revision_type(git_oid *oid, git_repository *repo, const char *name, git_otype type)
+{
+	int e = resolve_revision(oid, repo, name);
+
+	if (e != GIT_SUCCESS)
+		return e;
+	return peel_oid(oid, repo, type);
+}
+
+struct ref_entry {
+	char *name;
+	git_oid oid;
+};
+
+struct ref_list {
+	struct ref_entry *refs;
+	unsigned int nr, alloc;
+};
+
+static int ref_entry_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct ref_entry *)a)->name, ((const struct ref_entry *)b)->name);
+}
+
+/* The names of the loose refs under path (a directory of the git dir, ending with '/') */
+static int list_loose_refs(struct ref_list *list, struct strbuf *path, size_t git_dir_len)
+{
+	DIR *dir = opendir(path->buf);
+	struct dirent *de;
+	size_t len = path->len;
+	int e = GIT_SUCCESS;
+
+	if (!dir)
+		return errno == ENOENT ? GIT_SUCCESS : GIT_ENOTIMPLEMENTED;
+
+	while (e == GIT_SUCCESS && (de = readdir(dir)) != NULL) {
+		struct stat st;
+
+		/* as git : hidden files, and the locks of refs being written */
+		if (de->d_name[0] == '.' || !suffixcmp(de->d_name, ".lock"))
+			continue;
+
+		strbuf_setlen(path, len);
+		strbuf_addstr(path, de->d_name);
+		if (lstat(path->buf, &st)) {
+			e = GIT_ENOTIMPLEMENTED;
+		} else if (S_ISDIR(st.st_mode)) {
+			strbuf_addch(path, '/');
+			e = list_loose_refs(list, path, git_dir_len);
+		} else if (!S_ISREG(st.st_mode) || bad_ref_name(path->buf + git_dir_len, path->len - git_dir_len)) {
+			/* links to refs and names git warns about */
+			e = GIT_ENOTIMPLEMENTED;
+		} else {
+			ALLOC_GROW(list->refs, list->nr + 1, list->alloc);
+			list->refs[list->nr++].name = xstrdup(path->buf + git_dir_len);
+		}
+	}
+
+	closedir(dir);
+	strbuf_setlen(path, len);
+	return e;
+}
+
+int for_each_ref(git_repository *repo, each_ref_fn fn, void *data)
+{
+	uint64_t start = trace_perf_start();
+	struct ref_list loose = {NULL, 0, 0}, all = {NULL, 0, 0};
+	struct strbuf path = STRBUF_INIT;
+	size_t git_dir_len;
+	unsigned int i = 0, j = 0;
+	int e;
+
+	git_dir_path(&path, repo, "");
+	git_dir_len = path.len;
+	strbuf_addstr(&path, "refs/");
+	e = list_loose_refs(&loose, &path, git_dir_len);
+	strbuf_release(&path);
+	qsort(loose.refs, loose.nr, sizeof(*loose.refs), ref_entry_cmp);
+
+	/* both sorted : a loose ref hides the packed one of the same name */
+	load_packed_refs(repo);
+	while (e == GIT_SUCCESS && (i < loose.nr || j < packed.nr)) {
+		int cmp = i == loose.nr ? 1 : j == packed.nr ? -1 : strcmp(loose.refs[i].name, packed.refs[j].name);
+
+		ALLOC_GROW(all.refs, all.nr + 1, all.alloc);
+		if (cmp <= 0) {
+			all.refs[all.nr].name = loose.refs[i].name;
+			loose.refs[i++].name = NULL;
+			/* a broken ref, or a symbolic one to nothing */
+			if (read_ref(&all.refs[all.nr].oid, repo, all.refs[all.nr].name, 0) != GIT_SUCCESS)
+				e = GIT_ENOTIMPLEMENTED;
+			if (!cmp)
+				j++;
+		} else {
+			all.refs[all.nr].name = xstrdup(packed.refs[j].name);
+			git_oid_cpy(&all.refs[all.nr].oid, &packed.refs[j++].oid);
+		}
+		all.nr++;
+	}
+	trace_perf_stop("for_each_ref", start);
+
+	/* fn may read refs : the packed ones may be read again meanwhile */
+	for (i = 0; e == GIT_SUCCESS && i < all.nr; i++)
+		e = fn(all.refs[i].name, &all.refs[i].oid, data);
+
+	for (i = 0; i < loose.nr; i++)
+		free(loose.refs[i].name);
+	for (i = 0; i < all.nr; i++)
+		free(all.refs[i].name);
+	free(loose.refs);
+	free(all.refs);
+	return e;
+}
@@ -0,0 +1,44 @@
+#ifndef REVISION_H
+#define REVISION_H
+
+#include <git2.h>
+
+/*
+ * Resolution of the revision names git commands take (git help
+ * revisions), without asking git rev-parse : full and abbreviated oids,
+ * ref names with the dwim rules of git ("master" is refs/heads/master),
+ * symbolic refs (HEAD), the "~N", "^N" and "^{type}" suffixes, and
+ * "<rev>:<path>" (the entry at path in the tree of rev).
+ *
+ * Loose refs are read from their file ; packed-refs is parsed once into
+ * a sorted table, read again when the file changes. Names of other
+ * forms (":path", "@{...}", "^{/text}", paths from the current
+ * directory as "HEAD:./file"), names matching several refs, and
+ * repositories with alternates for abbreviations are left to git :
+ * GIT_ENOTIMPLEMENTED tells the caller to fall back. So is a path which
+ * is not in its tree, for git to word the error.
+ */
+
+int resolve_revision(git_oid *oid, git_repository *repo, const char *name);
+//the object named by name. Returns GIT_SUCCESS, GIT_ENOTFOUND,
+//GIT_EAMBIGUOUSOIDPREFIX, GIT_ENOTIMPLEMENTED (ask git), or the libgit2
+//error of reading an object
+
+int resolve_revision_type(git_oid *oid, git_repository *repo, const char *name, git_otype type);
+//resolve_revision(), then peeled to an object of type as name^{type}
+//does (tags to their target, commits to their tree). Returns
+//GIT_EINVALIDTYPE if it does not peel to type
+
+typedef int (*each_ref_fn)(const char *name, const git_oid *oid, void *data);
+
+int for_each_ref(git_repository *repo, each_ref_fn fn, void *data);
+//call fn for each ref under refs/, loose or packed, in the order of
+//their names, with the object it points to (through symbolic refs).
+//Stops at the first call which does not return GIT_SUCCESS and returns
+//what it returned. GIT_ENOTIMPLEMENTED when a ref is one git warns
+//about (broken, dangling, badly named) : ask git
+
+void free_revision_cache();
+//forget the packed refs
+
+#endif
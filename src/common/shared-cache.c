@@ -0,0 +1,294 @@
+#include "git-compat-util.h"
+#include <sys/mman.h>
+#include "shared-cache.h"
+#include "strbuf.h"
+#include "utils.h"
+#include "trace.h"
+#include "oid-hash.h"
+
+#define SHARED_CACHE_SIGNATURE 0x47324f43 /* "G2OC" */
+#define SHARED_CACHE_VERSION 1
+#define SHARED_CACHE_DIRECTORY "/dev/shm"
+
+/* a slot for this many bytes of data, about the size of a tree */
+#define SHARED_CACHE_BYTES_PER_SLOT 2048
+/* the slots an oid may be in, from the one of its first bytes on */
+#define SHARED_CACHE_PROBES 8
+/* bigger objects would wipe out too much of the ring at once */
+#define SHARED_CACHE_MAX_SHARE 16
+
+struct segment_header {
+	uint32_t signature; /* written last by the creator : the segment is ready */
+	uint32_t version;
+	uint64_t size; /* of the whole segment */
+	uint64_t nr_slots;
+	uint64_t data_offset, data_size;
+	uint64_t cursor; /* bytes ever written to the ring, the next ones at cursor % data_size */
+};
+
+struct slot {
+	uint32_t sequence; /* odd while the slot is written, 0 if it never was */
+	uint32_t type;
+	uint64_t position; /* of the data, counted as the cursor */
+	uint64_t len;
+	unsigned char oid[GIT_OID_RAWSZ];
+	uint32_t padding;
+};
+
+static struct {
+	unsigned char *base;
+	size_t size;
+	struct segment_header *header;
+	struct slot *slots;
+	unsigned char *data;
+	uint64_t nr_slots, data_size;
+} segment;
+
+/* Where the slots and the ring of a segment of size bytes are */
+static int layout(uint64_t size, uint64_t *nr_slots, uint64_t *data_offset)
+{
+	uint64_t slots = size / SHARED_CACHE_BYTES_PER_SLOT;
+	uint64_t offset = sizeof(struct segment_header) + slots * sizeof(struct slot);
+
+	/* the ring starts on a cache line */
+	offset = (offset + 63) & ~(uint64_t)63;
+	if (slots < SHARED_CACHE_PROBES || offset + SHARED_CACHE_MAX_SHARE * 1024 > size)
+		return -1;
+
+	*nr_slots = slots;
+	*data_offset = offset;
+	return 0;
+}
+
+static int map_segment(int fd, size_t size)
+{
+	void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	if (base == MAP_FAILED)
+		return -1;
+	segment.base = base;
+	segment.size = size;
+	segment.header = base;
+	return 0;
+}
+
+static void unmap_segment(void)
+{
+	if (segment.base)
+		munmap(segment.base, segment.size);
+	memset(&segment, 0, sizeof(segment));
+}
+
+/* The newly created segment of fd : its layout, then the signature telling it is ready */
+static int create_segment(int fd, size_t size)
+{
+	uint64_t nr_slots, data_offset;
+
+	if (layout(size, &nr_slots, &data_offset) < 0 || ftruncate(fd, size) < 0 ||
+	    map_segment(fd, size) < 0)
+		return -1;
+
+	segment.header->version = SHARED_CACHE_VERSION;
+	segment.header->size = size;
+	segment.header->nr_slots = nr_slots;
+	segment.header->data_offset = data_offset;
+	segment.header->data_size = size - data_offset;
+	__atomic_store_n(&segment.header->signature, SHARED_CACHE_SIGNATURE, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/* The segment another process created, if it is ours and ready */
+static int attach_segment(int fd)
+{
+	struct segment_header *header;
+	uint64_t nr_slots, data_offset;
+	struct stat st;
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid() ||
+	    (st.st_mode & 077) || (uint64_t)st.st_size < sizeof(*header) ||
+	    (uint64_t)st.st_size != (size_t)st.st_size || map_segment(fd, st.st_size) < 0)
+		return -1;
+
+	header = segment.header;
+	if (__atomic_load_n(&header->signature, __ATOMIC_ACQUIRE) != SHARED_CACHE_SIGNATURE ||
+	    header->version != SHARED_CACHE_VERSION || header->size != (uint64_t)st.st_size ||
+	    layout(header->size, &nr_slots, &data_offset) < 0 ||
+	    header->nr_slots != nr_slots || header->data_offset != data_offset ||
+	    header->data_size != header->size - data_offset) {
+		unmap_segment();
+		return -1;
+	}
+	return 0;
+}
+
+int shared_cache_open(size_t size)
+{
+	struct strbuf path = STRBUF_INIT;
+	int fd, e;
+
+	if (segment.base)
+		return 1;
+
+	/* one segment per user : the oids name the same objects in every repository */
+	strbuf_addf(&path, "%s/git2-objects-%lu", SHARED_CACHE_DIRECTORY, (unsigned long)geteuid());
+	fd = open(path.buf, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+	if (fd >= 0) {
+		e = create_segment(fd, size);
+		if (e < 0) {
+			unmap_segment();
+			unlink(path.buf);
+		}
+	} else {
+		fd = open(path.buf, O_RDWR | O_NOFOLLOW | O_CLOEXEC);
+		e = fd < 0 ? -1 : attach_segment(fd);
+	}
+	if (fd >= 0)
+		close(fd);
+	strbuf_release(&path);
+	if (e < 0)
+		return 0;
+
+	segment.nr_slots = segment.header->nr_slots;
+	segment.data_size = segment.header->data_size;
+	segment.slots = (struct slot *)(segment.base + sizeof(struct segment_header));
+	segment.data = segment.base + segment.header->data_offset;
+	return 1;
+}
+
+static uint64_t first_slot(const git_oid *oid)
+{
+	return oid_hash(oid) % segment.nr_slots;
+}
+
+/* the ring did not come round over the len bytes at position since they were written */
+static int still_there(uint64_t position)
+{
+	uint64_t cursor = __atomic_load_n(&segment.header->cursor, __ATOMIC_RELAXED);
+
+	return cursor <= position + segment.data_size;
+}
+
+static void copy_out(unsigned char *out, uint64_t position, uint64_t len)
+{
+	uint64_t at = position % segment.data_size;
+	uint64_t first = len < segment.data_size - at ? len : segment.data_size - at;
+
+	memcpy(out, segment.data + at, first);
+	memcpy(out + first, segment.data, len - first);
+}
+
+static void copy_in(uint64_t position, const void *data, uint64_t len)
+{
+	uint64_t at = position % segment.data_size;
+	uint64_t first = len < segment.data_size - at ? len : segment.data_size - at;
+
+	memcpy(segment.data + at, data, first);
+	memcpy(segment.data, (const unsigned char *)data + first, len - first);
+}
+
+int shared_cache_get(const git_oid *oid, void **data, size_t *len, git_otype *type)
+{
+	uint64_t first;
+
+	if (!segment.base)
+		return 0;
+
+	first = first_slot(oid);
+	for (unsigned int i = 0; i < SHARED_CACHE_PROBES; i++) {
+		struct slot *slot = &segment.slots[(first + i) % segment.nr_slots];
+		uint32_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+		uint64_t position, length;
+		uint32_t slot_type;
+		unsigned char *out;
+
+		if (!sequence || (sequence & 1) || memcmp(slot->oid, oid->id, GIT_OID_RAWSZ))
+			continue;
+		position = slot->position;
+		length = slot->len;
+		slot_type = slot->type;
+		/* what was read is only that of a single write if the sequence is the same */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) != sequence ||
+		    length > segment.data_size / SHARED_CACHE_MAX_SHARE || !still_there(position))
+			continue;
+
+		out = xmalloc(length + 1);
+		copy_out(out, position, length);
+		/* a writer may have reserved the data, and written over it, while it was copied */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (!still_there(position)) {
+			free(out);
+			continue;
+		}
+
+		out[length] = '\0';
+		*data = out;
+		*len = length;
+		*type = slot_type;
+		trace_perf_count("shared_cache_hits");
+		return 1;
+	}
+
+	trace_perf_count("shared_cache_misses");
+	return 0;
+}
+
+void shared_cache_put(const git_oid *oid, const void *data, size_t len, git_otype type)
+{
+	struct slot *victim = NULL;
+	uint32_t sequence;
+	uint64_t first, position;
+
+	if (!segment.base || len > segment.data_size / SHARED_CACHE_MAX_SHARE)
+		return;
+
+	/* a free slot, the object itself if it was overwritten, or the oldest one */
+	first = first_slot(oid);
+	for (unsigned int i = 0; i < SHARED_CACHE_PROBES; i++) {
+		struct slot *slot = &segment.slots[(first + i) % segment.nr_slots];
+
+		sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+		if (sequence & 1)
+			continue;
+		if (!sequence) {
+			victim = slot;
+			break;
+		}
+		if (!memcmp(slot->oid, oid->id, GIT_OID_RAWSZ)) {
+			/* another process put it meanwhile */
+			if (still_there(slot->position))
+				return;
+			victim = slot;
+			break;
+		}
+		if (!victim || slot->position < victim->position)
+			victim = slot;
+	}
+	if (!victim)
+		return;
+
+	/* the slot is ours while its sequence is odd : a writer which loses the race gives up */
+	sequence = __atomic_load_n(&victim->sequence, __ATOMIC_RELAXED);
+	if ((sequence & 1) ||
+	    !__atomic_compare_exchange_n(&victim->sequence, &sequence, sequence + 1, 0,
+		__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return;
+
+	/* reserved before it is written, so that readers of what was there can tell */
+	position = __atomic_fetch_add(&segment.header->cursor, len, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	copy_in(position, data, len);
+
+	victim->type = type;
+	victim->position = position;
+	victim->len = len;
+	memcpy(victim->oid, oid->id, GIT_OID_RAWSZ);
+	sequence += 2;
+	__atomic_store_n(&victim->sequence, sequence ? sequence : 2, __ATOMIC_RELEASE);
+	trace_perf_count("shared_cache_stores");
+}
+
+void free_shared_cache()
+{
+	unmap_segment();
+}
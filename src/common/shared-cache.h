@@ -0,0 +1,44 @@
+#ifndef SHARED_CACHE_H
+#define SHARED_CACHE_H
+
+#include <stddef.h>
+#include <git2.h>
+
+/*
+ * With GIT2_SHARED_OBJECT_CACHE set to a size ("256m", as
+ * GIT2_DELTA_BASE_CACHE), the trees and commits the pack reader inflates
+ * are kept in a segment of /dev/shm shared by all the git2 processes of
+ * the user : concurrent commands on the same repositories (CI jobs, a
+ * build running ls-tree, read-tree and rev-list side by side) inflate
+ * each of them once. Objects are named by their oid, so one segment
+ * serves every repository ; an object is only taken from it once the
+ * packs of the repository are known to have it.
+ *
+ * The segment is a table of slots, found by the first bytes of the oids,
+ * and a ring of object data written in turn : the oldest objects are
+ * overwritten first. A hit writes nothing, so readers take no lock :
+ * each slot has a sequence number, odd while it is written, and a reader
+ * keeps what it copied only if the number did not change and the ring
+ * did not come round over the data meanwhile. A writer skips a slot
+ * another one is writing. All of it is an optimization : a segment which
+ * cannot be created, or of another user, leaves the cache off.
+ */
+
+int shared_cache_open(size_t size);
+//map the segment, creating it of about size bytes if there is none
+//(an existing one keeps its size). Returns 1 once it is mapped, 0 if
+//the cache cannot be used. Not thread-safe : the pack reader calls it
+//under its lock
+
+int shared_cache_get(const git_oid *oid, void **data, size_t *len, git_otype *type);
+//a copy (NUL terminated, to free) of the object oid, if it is in the
+//segment : returns 1, 0 otherwise. Thread-safe
+
+void shared_cache_put(const git_oid *oid, const void *data, size_t len, git_otype type);
+//add the len bytes of the object oid to the segment, unless it is too
+//big for it or its slots are being written. Thread-safe
+
+void free_shared_cache();
+//unmap the segment, which stays for the other processes
+
+#endif
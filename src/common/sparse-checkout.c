@@ -0,0 +1,180 @@
+#include "git-compat-util.h"
+#include "sparse-checkout.h"
+#include "git-support.h"
+#include "errors.h"
+#include "strbuf.h"
+#include "utils.h"
+#include "ctype.h"
+#include "trace.h"
+#include "repository.h"
+
+/* Whether the checkout of repo is sparse, in cone mode */
+static int read_sparse_config(git_repository *repo, int *sparse_index)
+{
+	git_config *cfg = get_git_config(repo);
+	int sparse = 0, cone = 0;
+
+	*sparse_index = 0;
+
+	git_config_get_bool(cfg, "core.sparsecheckout", &sparse);
+	git_config_get_bool(cfg, "core.sparsecheckoutcone", &cone);
+	git_config_get_bool(cfg, "index.sparse", sparse_index);
+	git_config_free(cfg);
+
+	/* the other patterns are matched as a .gitignore, by git */
+	if (sparse && !cone)
+		please_git_do_it_for_me(FALLBACK_SPARSE);
+	return sparse;
+}
+
+/* A directory of a pattern, "dir/" : no wildcard, nothing escaped */
+static int cone_directory(const char *dir, size_t len)
+{
+	if (!len || dir[len - 1] != '/' || dir[0] == '/')
+		return 0;
+	for (size_t i = 0; i < len; i++) {
+		if (strchr("*?[\\", dir[i]) || (dir[i] == '/' && i && dir[i - 1] == '/'))
+			return 0;
+	}
+	return 1;
+}
+
+static void add_recursive(struct sparse_checkout *sparse, struct strbuf *dir)
+{
+	string_set_add(&sparse->recursive, dir->buf);
+
+	/* its leading directories have their files in the cone */
+	for (size_t i = 0; i + 1 < dir->len; i++) {
+		if (dir->buf[i] != '/')
+			continue;
+		char c = dir->buf[i + 1];
+
+		dir->buf[i + 1] = '\0';
+		string_set_add(&sparse->parents, dir->buf);
+		dir->buf[i + 1] = c;
+	}
+}
+
+/* The patterns of the file, one per line : -1 if they are not a cone */
+static int parse_cone(struct sparse_checkout *sparse, const struct strbuf *patterns)
+{
+	struct strbuf dir = STRBUF_INIT;
+	const char *line = patterns->buf, *end = patterns->buf + patterns->len;
+	int nr = 0, e = 0;
+
+	while (!e && line < end) {
+		const char *eol = memchr(line, '\n', end - line);
+		size_t len = (eol ? eol : end) - line;
+		const char *next = eol ? eol + 1 : end;
+
+		while (len && isspace((unsigned char)line[len - 1]))
+			len--;
+		if (!len || line[0] == '#') {
+			line = next;
+			continue;
+		}
+
+		/* the two patterns of the top come first */
+		if (nr++ < 2) {
+			e = len != (size_t)(nr == 1 ? 2 : 4) || memcmp(line, nr == 1 ? "/*" : "!/*/", len);
+		} else if (line[0] == '!') {
+			/* "!/dir/<star>/", right after "/dir/" : dir is only a parent */
+			e = len < 6 || line[1] != '/' || memcmp(line + len - 3, "/*/", 3) ||
+				!cone_directory(line + 2, len - 4);
+			if (!e) {
+				strbuf_reset(&dir);
+				strbuf_add(&dir, line + 2, len - 4);
+				e = !string_set_remove(&sparse->recursive, dir.buf);
+				string_set_add(&sparse->parents, dir.buf);
+			}
+		} else {
+			e = line[0] != '/' || !cone_directory(line + 1, len - 1);
+			if (!e) {
+				strbuf_reset(&dir);
+				strbuf_add(&dir, line + 1, len - 1);
+				add_recursive(sparse, &dir);
+			}
+		}
+		line = next;
+	}
+
+	strbuf_release(&dir);
+	return e || !nr ? -1 : 0;
+}
+
+int sparse_checkout_load(struct sparse_checkout *sparse, git_repository *repo, int *sparse_index)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct strbuf patterns = STRBUF_INIT;
+	struct sparse_checkout empty = SPARSE_CHECKOUT_INIT;
+	int loaded;
+
+	*sparse = empty;
+	if (!read_sparse_config(repo, sparse_index))
+		return 0;
+
+	uint64_t start = trace_perf_start();
+	strbuf_addstr(&path, git_repository_path(repo, GIT_REPO_PATH));
+	if (path.len && path.buf[path.len - 1] != '/')
+		strbuf_addch(&path, '/');
+	strbuf_addstr(&path, "info/sparse-checkout");
+
+	/* as in git, no patterns leave the checkout complete */
+	loaded = strbuf_read_file(&patterns, path.buf, 0) >= 0;
+	if (loaded && parse_cone(sparse, &patterns) < 0)
+		please_git_do_it_for_me(FALLBACK_SPARSE);
+	trace_perf_stop("sparse_checkout_load", start);
+
+	strbuf_release(&patterns);
+	strbuf_release(&path);
+	return loaded;
+}
+
+enum sparse_dir sparse_checkout_dir(const struct sparse_checkout *sparse, const char *dir, size_t len)
+{
+	struct strbuf key = STRBUF_INIT;
+	enum sparse_dir where = SPARSE_DIR_PARTIAL;
+
+	if (len) {
+		strbuf_add(&key, dir, len);
+		if (string_set_contains(&sparse->recursive, key.buf))
+			where = SPARSE_DIR_IN;
+		else if (!string_set_contains(&sparse->parents, key.buf))
+			where = SPARSE_DIR_OUT;
+		strbuf_release(&key);
+	}
+	return where;
+}
+
+int sparse_checkout_contains(const struct sparse_checkout *sparse, const char *path, size_t len)
+{
+	struct strbuf key = STRBUF_INIT;
+	const char *slash = memrchr(path, '/', len);
+	int in;
+
+	if (!slash)
+		return 1;
+
+	strbuf_add(&key, path, slash + 1 - path);
+	in = string_set_contains(&sparse->parents, key.buf);
+
+	/* or below a recursive directory, at any depth */
+	for (size_t i = 0; !in && i < key.len; i++) {
+		if (key.buf[i] != '/')
+			continue;
+		char c = key.buf[i + 1];
+
+		key.buf[i + 1] = '\0';
+		in = string_set_contains(&sparse->recursive, key.buf);
+		key.buf[i + 1] = c;
+	}
+
+	strbuf_release(&key);
+	return in;
+}
+
+void sparse_checkout_clear(struct sparse_checkout *sparse)
+{
+	string_set_clear(&sparse->recursive);
+	string_set_clear(&sparse->parents);
+}
@@ -0,0 +1,50 @@
+#ifndef SPARSE_CHECKOUT_H
+#define SPARSE_CHECKOUT_H
+
+#include <stddef.h>
+#include <git2.h>
+#include "string-set.h"
+
+/*
+ * The cone of a sparse checkout (core.sparseCheckout with
+ * core.sparseCheckoutCone). info/sparse-checkout, as "git sparse-checkout
+ * set" writes it, holds a "/dir/" pattern for each directory of the cone,
+ * and leaves the subdirectories of its parents out with negated
+ * "/dir/<star>/" patterns, the top of the work tree coming first.
+ *
+ * The files at the top are always in the cone, the "recursive"
+ * directories (dir/sub/) with all their contents, and the "parent"
+ * directories (dir/, and the leading directories of the others) with
+ * their files only. A path is matched by looking its directories up in
+ * two hash sets, instead of going through the patterns.
+ */
+
+struct sparse_checkout {
+	struct string_set recursive; /* "dir/" : all of it is in the cone */
+	struct string_set parents; /* "dir/" : its files are, its subdirectories maybe */
+};
+
+#define SPARSE_CHECKOUT_INIT { STRING_SET_INIT, STRING_SET_INIT }
+
+enum sparse_dir {
+	SPARSE_DIR_OUT, /* none of it is in the cone */
+	SPARSE_DIR_PARTIAL, /* its files are, its subdirectories must be matched */
+	SPARSE_DIR_IN /* all of it is */
+};
+
+int sparse_checkout_load(struct sparse_checkout *sparse, git_repository *repo, int *sparse_index);
+//read the cone of repo : returns 1 if it has one, 0 if the checkout is
+//not sparse (or has no patterns). *sparse_index tells whether index.sparse
+//asks for sparse directory entries. Falls back to git for the patterns
+//which are not a cone
+
+enum sparse_dir sparse_checkout_dir(const struct sparse_checkout *sparse, const char *dir, size_t len);
+//where dir ("dir/", from the top of the work tree) is, its parent
+//being SPARSE_DIR_PARTIAL. The top of the work tree is SPARSE_DIR_PARTIAL
+
+int sparse_checkout_contains(const struct sparse_checkout *sparse, const char *path, size_t len);
+//whether the file path is in the cone
+
+void sparse_checkout_clear(struct sparse_checkout *sparse);
+
+#endif
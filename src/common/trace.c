@@ -0,0 +1,307 @@
+#include <time.h>
+#include "git-compat-util.h"
+#include "trace.h"
+#include "environment.h"
+#include "strbuf.h"
+#include "utils.h"
+#include "abspath.h"
+
+#ifndef NO_PTHREADS
+#include <pthread.h>
+#endif
+
+/* beyond this many events only the summary is kept up to date */
+#define TRACE_PERF_MAX_EVENTS 100000
+
+struct trace_event {
+	const char *name;
+	uint64_t start; /* ns since the first traced event */
+	uint64_t duration; /* ns, 0 for instant events */
+	unsigned int thread;
+	int instant;
+};
+
+struct trace_total {
+	const char *name;
+	unsigned long count;
+	uint64_t duration;
+};
+
+struct trace_counter {
+	const char *name;
+	uint64_t value;
+};
+
+static int trace_state = -1; /* -1 not initialised, 0 off, 1 on */
+static const char *trace_destination;
+static uint64_t trace_origin;
+static int trace_flushed;
+
+static struct trace_event *events;
+static int events_nr, events_alloc;
+static unsigned long events_dropped;
+
+static struct trace_total *totals;
+static int totals_nr, totals_alloc;
+
+static struct trace_counter *counters;
+static int counters_nr, counters_alloc;
+
+static unsigned int threads_nr;
+static __thread unsigned int thread_id;
+static __thread int thread_registered;
+
+#ifndef NO_PTHREADS
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void lock_trace(void)
+{
+#ifndef NO_PTHREADS
+	pthread_mutex_lock(&trace_lock);
+#endif
+}
+
+static void unlock_trace(void)
+{
+#ifndef NO_PTHREADS
+	pthread_mutex_unlock(&trace_lock);
+#endif
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int trace_perf_enabled(void)
+{
+	if (trace_state < 0) {
+		const char *value = getenv(GIT2_TRACE_PERF_ENVIRONMENT);
+
+		trace_state = 0;
+		if (!value || !*value || !strcmp(value, "0") || !strcasecmp(value, "false"))
+			return 0;
+
+		if (!strcmp(value, "1") || !strcmp(value, "2") || !strcasecmp(value, "true"))
+			trace_destination = NULL;
+		else if (is_absolute_path(value))
+			trace_destination = value;
+		else
+			return 0;
+
+		trace_origin = now_ns();
+		trace_state = 1;
+	}
+
+	return trace_state;
+}
+
+uint64_t trace_perf_start(void)
+{
+	if (!trace_perf_enabled())
+		return 0;
+
+	return now_ns();
+}
+
+/* Called with the lock held */
+static void add_event(const char *name, uint64_t start, uint64_t duration, int instant)
+{
+	struct trace_total *total = NULL;
+	int i;
+
+	if (!thread_registered) {
+		thread_id = threads_nr++;
+		thread_registered = 1;
+	}
+
+	for (i = 0; i < totals_nr; i++) {
+		if (!strcmp(totals[i].name, name)) {
+			total = &totals[i];
+			break;
+		}
+	}
+	if (!total) {
+		ALLOC_GROW(totals, totals_nr + 1, totals_alloc);
+		total = &totals[totals_nr++];
+		total->name = name;
+		total->count = 0;
+		total->duration = 0;
+	}
+	total->count++;
+	total->duration += duration;
+
+	if (events_nr >= TRACE_PERF_MAX_EVENTS) {
+		events_dropped++;
+		return;
+	}
+
+	ALLOC_GROW(events, events_nr + 1, events_alloc);
+	events[events_nr].name = name;
+	events[events_nr].start = start - trace_origin;
+	events[events_nr].duration = duration;
+	events[events_nr].thread = thread_id;
+	events[events_nr].instant = instant;
+	events_nr++;
+}
+
+void trace_perf_stop(const char *name, uint64_t start)
+{
+	uint64_t end;
+
+	if (!start)
+		return;
+
+	end = now_ns();
+
+	lock_trace();
+	add_event(name, start, end - start, 0);
+	unlock_trace();
+}
+
+void trace_perf_mark(const char *name)
+{
+	uint64_t now;
+
+	if (!trace_perf_enabled())
+		return;
+
+	now = now_ns();
+
+	lock_trace();
+	add_event(name, now, 0, 1);
+	unlock_trace();
+}
+
+void trace_perf_add(const char *name, uint64_t value)
+{
+	int i;
+
+	if (!trace_perf_enabled())
+		return;
+
+	lock_trace();
+	for (i = 0; i < counters_nr; i++) {
+		if (!strcmp(counters[i].name, name))
+			break;
+	}
+	if (i == counters_nr) {
+		ALLOC_GROW(counters, counters_nr + 1, counters_alloc);
+		counters[counters_nr].name = name;
+		counters[counters_nr++].value = 0;
+	}
+	counters[i].value += value;
+	unlock_trace();
+}
+
+void trace_perf_count(const char *name)
+{
+	trace_perf_add(name, 1);
+}
+
+static void add_json_string(struct strbuf *out, const char *str)
+{
+	strbuf_addch(out, '"');
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			strbuf_addf(out, "\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			strbuf_addf(out, "\\u%04x", *str);
+		else
+			strbuf_addch(out, *str);
+	}
+	strbuf_addch(out, '"');
+}
+
+void trace_perf_reset(void)
+{
+	lock_trace();
+	free(events);
+	free(totals);
+	free(counters);
+	events = NULL;
+	totals = NULL;
+	counters = NULL;
+	events_nr = events_alloc = totals_nr = totals_alloc = 0;
+	counters_nr = counters_alloc = 0;
+	events_dropped = 0;
+	trace_flushed = 0;
+	trace_state = -1;
+	unlock_trace();
+}
+
+void trace_perf_flush(void)
+{
+	struct strbuf out = STRBUF_INIT;
+	int pid = (int)getpid();
+	int fd = 2;
+	int i;
+
+	if (trace_state != 1)
+		return;
+
+	lock_trace();
+	if (trace_flushed) {
+		unlock_trace();
+		return;
+	}
+	trace_flushed = 1;
+
+	/* timestamps of the trace-event format are in microseconds */
+	strbuf_addstr(&out, "{\"traceEvents\":[");
+	for (i = 0; i < events_nr; i++) {
+		struct trace_event *event = &events[i];
+
+		strbuf_addstr(&out, i ? ",\n" : "\n");
+		strbuf_addstr(&out, "{\"name\":");
+		add_json_string(&out, event->name);
+		strbuf_addf(&out, ",\"ph\":\"%s\",\"ts\":%.3f,", event->instant ? "i" : "X", event->start / 1000.0);
+		if (!event->instant)
+			strbuf_addf(&out, "\"dur\":%.3f,", event->duration / 1000.0);
+		strbuf_addf(&out, "\"pid\":%d,\"tid\":%u}", pid, event->thread);
+	}
+
+	strbuf_addstr(&out, "\n],\"git2Summary\":{");
+	for (i = 0; i < totals_nr; i++) {
+		strbuf_addstr(&out, i ? ",\n" : "\n");
+		add_json_string(&out, totals[i].name);
+		strbuf_addf(&out, ":{\"count\":%lu,\"total_ns\":%llu}",
+			totals[i].count, (unsigned long long)totals[i].duration);
+	}
+	strbuf_addstr(&out, "\n},\"git2Counters\":{");
+	for (i = 0; i < counters_nr; i++) {
+		strbuf_addstr(&out, i ? ",\n" : "\n");
+		add_json_string(&out, counters[i].name);
+		strbuf_addf(&out, ":%llu", (unsigned long long)counters[i].value);
+	}
+	strbuf_addf(&out, "\n},\"git2DroppedEvents\":%lu}\n", events_dropped);
+
+	free(events);
+	free(totals);
+	free(counters);
+	events = NULL;
+	totals = NULL;
+	counters = NULL;
+	events_nr = events_alloc = totals_nr = totals_alloc = 0;
+	counters_nr = counters_alloc = 0;
+	unlock_trace();
+
+	if (trace_destination) {
+		fd = open(trace_destination, O_WRONLY | O_APPEND | O_CREAT, 0666);
+		if (fd < 0) {
+			fprintf(stderr, "cannot open trace file '%s': %s\n", trace_destination, strerror(errno));
+			strbuf_release(&out);
+			return;
+		}
+	}
+
+	write_in_full(fd, out.buf, out.len);
+	if (fd != 2)
+		close(fd);
+
+	strbuf_release(&out);
+}
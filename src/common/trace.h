@@ -0,0 +1,45 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/*
+ * Performance tracing, enabled by GIT2_TRACE_PERF :
+ *  - "1", "2" or "true" writes the report on stderr,
+ *  - an absolute path appends it to that file,
+ *  - unset, empty, "0" or "false" disables it.
+ *
+ * The report is a trace-event JSON object (chrome://tracing, Perfetto)
+ * with one complete event per timed region, plus a per-name summary of
+ * counts and total time in "git2Summary", and the counters of
+ * trace_perf_add() in "git2Counters". Names are not copied : they
+ * must stay valid until the report is written.
+ */
+
+int trace_perf_enabled(void);
+//returns 1 if GIT2_TRACE_PERF asks for a report
+
+uint64_t trace_perf_start(void);
+//returns the start time of a region (0 when tracing is off)
+
+void trace_perf_stop(const char *name, uint64_t start);
+//record the region started at start (ignored when start is 0)
+
+void trace_perf_mark(const char *name);
+//record an instant event
+
+void trace_perf_add(const char *name, uint64_t value);
+//add value to the counter name, reported in "git2Counters"
+
+void trace_perf_count(const char *name);
+//add one to the counter name
+
+void trace_perf_reset(void);
+//drop what was recorded and look at GIT2_TRACE_PERF again, for a
+//long-lived process starting another command
+
+void trace_perf_flush(void);
+//write the report, once (called by free_global_resources and
+//before execing git)
+
+#endif
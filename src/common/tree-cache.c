@@ -0,0 +1,164 @@
+#include "git-compat-util.h"
+#include "tree-cache.h"
+#include "utils.h"
+#include "trace.h"
+#include "repository.h"
+#include "oid-hash.h"
+
+#define TREE_CACHE_BUCKETS (2 * TREE_CACHE_SIZE)
+#define NO_SLOT UINT_MAX
+
+struct cached_tree {
+	git_tree *tree; /* NULL for a free slot */
+	unsigned int users;
+	unsigned int next_in_bucket;
+	unsigned int newer, older; /* least recently used list */
+};
+
+static struct cached_tree *slots;
+static unsigned int *buckets;
+static unsigned int nr_slots;
+static unsigned int newest = NO_SLOT, oldest = NO_SLOT;
+
+static unsigned int bucket_of(const git_oid *oid)
+{
+	return oid_hash(oid) % TREE_CACHE_BUCKETS;
+}
+
+static void unlink_lru(unsigned int slot)
+{
+	struct cached_tree *cached = &slots[slot];
+
+	if (cached->newer != NO_SLOT)
+		slots[cached->newer].older = cached->older;
+	else
+		newest = cached->older;
+	if (cached->older != NO_SLOT)
+		slots[cached->older].newer = cached->newer;
+	else
+		oldest = cached->newer;
+}
+
+static void push_lru(unsigned int slot)
+{
+	slots[slot].older = newest;
+	slots[slot].newer = NO_SLOT;
+	if (newest != NO_SLOT)
+		slots[newest].newer = slot;
+	else
+		oldest = slot;
+	newest = slot;
+}
+
+static unsigned int find_slot(const git_oid *oid)
+{
+	unsigned int slot = buckets[bucket_of(oid)];
+
+	while (slot != NO_SLOT && git_oid_cmp(git_tree_id(slots[slot].tree), oid))
+		slot = slots[slot].next_in_bucket;
+	return slot;
+}
+
+static void remove_from_bucket(unsigned int slot)
+{
+	unsigned int *link = &buckets[bucket_of(git_tree_id(slots[slot].tree))];
+
+	while (*link != slot)
+		link = &slots[*link].next_in_bucket;
+	*link = slots[slot].next_in_bucket;
+}
+
+/* A slot for a new tree : a free one, or the least recently used tree nobody uses */
+static unsigned int get_free_slot(void)
+{
+	unsigned int slot;
+
+	if (nr_slots < TREE_CACHE_SIZE)
+		return nr_slots++;
+
+	for (slot = oldest; slot != NO_SLOT; slot = slots[slot].newer)
+		if (!slots[slot].users)
+			break;
+	if (slot == NO_SLOT)
+		return NO_SLOT;
+
+	unlink_lru(slot);
+	remove_from_bucket(slot);
+	git_tree_close(slots[slot].tree);
+	slots[slot].tree = NULL;
+	return slot;
+}
+
+int tree_cache_lookup(git_tree **tree, git_repository *repo, const git_oid *oid)
+{
+	uint64_t start;
+	unsigned int slot;
+	int e;
+
+	if (!slots) {
+		slots = xcalloc(TREE_CACHE_SIZE, sizeof(*slots));
+		buckets = xmalloc(TREE_CACHE_BUCKETS * sizeof(*buckets));
+		memset(buckets, 0xff, TREE_CACHE_BUCKETS * sizeof(*buckets));
+	}
+
+	if (repo != get_git_repository())
+		return git_tree_lookup(tree, repo, oid);
+
+	slot = find_slot(oid);
+	if (slot != NO_SLOT) {
+		slots[slot].users++;
+		unlink_lru(slot);
+		push_lru(slot);
+		*tree = slots[slot].tree;
+		return GIT_SUCCESS;
+	}
+
+	start = trace_perf_start();
+	e = git_tree_lookup(tree, repo, oid);
+	trace_perf_stop("tree_lookup", start);
+	if (e != GIT_SUCCESS)
+		return e;
+
+	/* every tree is in use : do without the cache */
+	slot = get_free_slot();
+	if (slot == NO_SLOT)
+		return GIT_SUCCESS;
+
+	slots[slot].tree = *tree;
+	slots[slot].users = 1;
+	slots[slot].next_in_bucket = buckets[bucket_of(oid)];
+	buckets[bucket_of(oid)] = slot;
+	push_lru(slot);
+
+	return GIT_SUCCESS;
+}
+
+void tree_cache_close(git_tree *tree)
+{
+	unsigned int slot = NO_SLOT;
+
+	if (slots && git_object_owner((git_object *)tree) == get_git_repository())
+		slot = find_slot(git_tree_id(tree));
+
+	if (slot != NO_SLOT && slots[slot].tree == tree)
+		slots[slot].users--;
+	else
+		git_tree_close(tree);
+}
+
+void free_tree_cache()
+{
+	if (!slots)
+		return;
+
+	for (unsigned int slot = 0; slot < nr_slots; slot++)
+		if (slots[slot].tree)
+			git_tree_close(slots[slot].tree);
+
+	free(slots);
+	free(buckets);
+	slots = NULL;
+	buckets = NULL;
+	nr_slots = 0;
+	newest = oldest = NO_SLOT;
+}
@@ -0,0 +1,30 @@
+#ifndef TREE_CACHE_H
+#define TREE_CACHE_H
+
+#include <git2.h>
+
+/*
+ * A cache of the parsed trees of the repository of the command, so that
+ * a tree reached several times (identical subtrees, vendored copies) is
+ * only read and parsed once. It keeps at most TREE_CACHE_SIZE trees: the
+ * least recently used ones are closed first, never those in use.
+ *
+ * It is not thread-safe : only the thread of the command uses it. Trees
+ * of other repositories (those opened by worker threads) are looked up
+ * and closed directly.
+ */
+
+#define TREE_CACHE_SIZE 4096
+
+int tree_cache_lookup(git_tree **tree, git_repository *repo, const git_oid *oid);
+//git_tree_lookup() through the cache. The tree is in use until given
+//back with tree_cache_close()
+
+void tree_cache_close(git_tree *tree);
+//give back a tree of tree_cache_lookup() (it is closed if it could not
+//be cached)
+
+void free_tree_cache();
+//close all the cached trees
+
+#endif
@@ -0,0 +1,562 @@
+#include "git-compat-util.h"
+#include "tree-merge.h"
+#include "tree-cache.h"
+#include "errors.h"
+#include "utils.h"
+#include "trace.h"
+#include "repository.h"
+
+/* What a tree or the index has at a path : NULL where it has nothing */
+struct merge_entry {
+	unsigned int mode;
+	git_oid oid;
+};
+
+struct merge_state {
+	const struct tree_merge *merge;
+	struct index_builder *result;
+	struct strbuf path; /* the work tree, then the path being merged */
+	size_t work_tree_len;
+	int trust_filemode; /* core.filemode */
+	unsigned int emitted; /* entries added to result */
+	unsigned int expected; /* the tree the result is most likely to be */
+
+	/* what was added at the path being merged */
+	const struct merge_entry *added;
+	unsigned int nr_added;
+	int added_stage;
+};
+
+static int same(const struct merge_entry *a, const struct merge_entry *b)
+{
+	if (!a || !b)
+		return !a && !b;
+	return a->mode == b->mode && !git_oid_cmp(&a->oid, &b->oid);
+}
+
+static int same_oid(const git_oid *a, const git_oid *b)
+{
+	if (!a || !b)
+		return !a && !b;
+	return !git_oid_cmp(a, b);
+}
+
+static const char *relative_path(const struct merge_state *state)
+{
+	return state->path.buf + state->work_tree_len;
+}
+
+static size_t relative_len(const struct merge_state *state)
+{
+	return state->path.len - state->work_tree_len;
+}
+
+/* In the order of trees : directories compare as if their name ended with a slash */
+static int name_compare(const char *a, size_t a_len, int a_dir, const char *b, size_t b_len, int b_dir)
+{
+	size_t len = a_len < b_len ? a_len : b_len;
+	int cmp = memcmp(a, b, len);
+	unsigned char ca, cb;
+
+	if (cmp)
+		return cmp;
+	ca = a_len > len ? a[len] : a_dir ? '/' : '\0';
+	cb = b_len > len ? b[len] : b_dir ? '/' : '\0';
+	return ca < cb ? -1 : ca > cb;
+}
+
+/* Whether tree has a file (or submodule) of this name */
+static int tree_has_file(git_tree *tree, const char *name, size_t len)
+{
+	unsigned int lo = 0, hi = git_tree_entrycount(tree);
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+		const git_tree_entry *entry = git_tree_entry_byindex(tree, mid);
+		const char *entry_name = git_tree_entry_name(entry);
+		int cmp = name_compare(entry_name, strlen(entry_name), S_ISDIR(git_tree_entry_attributes(entry)),
+			name, len, 0);
+
+		if (!cmp)
+			return 1;
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return 0;
+}
+
+/* Whether the index has a file at path, from the top of the work tree */
+static int index_has_file(const struct index_map *index, const char *path, size_t len)
+{
+	unsigned int pos = index_map_lower_bound(index, path, len);
+	const char *found;
+
+	if (pos >= index->nr)
+		return 0;
+	found = index_map_path(index, pos);
+	return !strncmp(found, path, len) && !found[len];
+}
+
+/*
+ * As git's verify_uptodate() : the file of an index entry the merge
+ * changes or removes must not have been modified (it may be missing).
+ */
+static int entry_uptodate(struct merge_state *state, const git_index_entry *entry)
+{
+	struct stat st;
+
+	if (lstat(state->path.buf, &st))
+		return errno == ENOENT;
+	if ((entry->mode & S_IFMT) == S_IFGITLINK)
+		return 1;
+	if (!index_entry_matches_stat(entry, state->path.buf, &st, state->trust_filemode))
+		return 0;
+	/* modified in the second the index was written : only the contents tell */
+	if (entry->mtime.seconds >= (git_time_t)state->merge->index->mtime)
+		return index_entry_matches_file(entry, state->path.buf, &st);
+	return 1;
+}
+
+static void keep_index_entry(struct merge_state *state, unsigned int n, const struct merge_entry *entry)
+{
+	index_builder_copy(state->result, state->merge->index, n, n + 1);
+	state->emitted++;
+	state->added = entry;
+	state->nr_added++;
+}
+
+static void add_entry(struct merge_state *state, const struct merge_entry *entry, int stage)
+{
+	git_index_entry source_entry;
+
+	memset(&source_entry, 0, sizeof(source_entry));
+	source_entry.mode = entry->mode;
+	git_oid_cpy(&source_entry.oid, &entry->oid);
+	source_entry.path = (char *)relative_path(state);
+	index_builder_add(state->result, &source_entry, stage);
+
+	state->emitted++;
+	state->added = entry;
+	state->nr_added++;
+	state->added_stage |= stage;
+}
+
+/* git's merged_entry() : entry takes the place of the index entry old */
+static int merged_entry(struct merge_state *state, const struct merge_entry *entry,
+	const struct merge_entry *old, const git_index_entry *old_entry, unsigned int n)
+{
+	/* the stat data of the index stays */
+	if (old && same(old, entry)) {
+		keep_index_entry(state, n, entry);
+		return 0;
+	}
+	if (old && !entry_uptodate(state, old_entry))
+		return -1;
+	add_entry(state, entry, 0);
+	return 0;
+}
+
+static int deleted_entry(struct merge_state *state, const struct merge_entry *old, const git_index_entry *old_entry)
+{
+	if (old && !entry_uptodate(state, old_entry))
+		return -1;
+	return 0;
+}
+
+static int oneway_merge(struct merge_state *state, const struct merge_entry *const *stages,
+	const git_index_entry *old_entry, unsigned int n)
+{
+	const struct merge_entry *old = stages[0], *a = stages[1];
+
+	if (!a)
+		return deleted_entry(state, old, old_entry);
+	return merged_entry(state, a, old, old_entry, n);
+}
+
+static int twoway_merge(struct merge_state *state, const struct merge_entry *const *stages,
+	const git_index_entry *current_entry, unsigned int n)
+{
+	const struct merge_entry *current = stages[0], *oldtree = stages[1], *newtree = stages[2];
+
+	if (current) {
+		if ((!oldtree && !newtree) ||
+		    (!oldtree && newtree && same(current, newtree)) ||
+		    (oldtree && newtree && same(oldtree, newtree)) ||
+		    (oldtree && newtree && same(current, newtree))) {
+			keep_index_entry(state, n, current);
+			return 0;
+		}
+		if (oldtree && !newtree && same(current, oldtree))
+			return deleted_entry(state, current, current_entry);
+		if (oldtree && newtree && same(current, oldtree))
+			return merged_entry(state, newtree, current, current_entry, n);
+		return -1;
+	}
+
+	if (!newtree)
+		return 0;
+	/* the removal of the path was staged */
+	if (oldtree && !state->merge->initial_checkout)
+		return same(oldtree, newtree) ? 0 : -1;
+	return merged_entry(state, newtree, NULL, NULL, n);
+}
+
+static int threeway_merge(struct merge_state *state, const struct merge_entry *const *stages,
+	const git_index_entry *index_entry, unsigned int n)
+{
+	const struct merge_entry *index = stages[0], *base = stages[1], *head = stages[2], *remote = stages[3];
+	int head_match = 0, remote_match = 0;
+
+	if (!same(remote, head)) {
+		head_match = same(base, head);
+		remote_match = same(base, remote);
+	}
+
+	/* the index may match the result instead of the head */
+	if (remote && head_match && !remote_match) {
+		if (index && !same(index, remote) && !same(index, head))
+			return -1;
+		return merged_entry(state, remote, index, index_entry, n);
+	}
+	if (index && !same(index, head))
+		return -1;
+
+	if (head) {
+		if (same(head, remote))
+			return merged_entry(state, head, index, index_entry, n);
+		if (remote_match && !head_match)
+			return merged_entry(state, head, index, index_entry, n);
+	}
+	if (!head && !remote && !base)
+		return 0;
+
+	/* no merge : the stages are left for the user, who may have changed the file */
+	if (index && !entry_uptodate(state, index_entry))
+		return -1;
+	if (base && (!head_match || !remote_match))
+		add_entry(state, base, 1);
+	if (head)
+		add_entry(state, head, 2);
+	if (remote)
+		add_entry(state, remote, 3);
+	return 0;
+}
+
+static int merge_path(struct merge_state *state, const struct merge_entry *const *stages,
+	const git_index_entry *index_entry, unsigned int n)
+{
+	state->added = NULL;
+	state->nr_added = 0;
+	state->added_stage = 0;
+
+	switch (state->merge->nr_trees) {
+		case 1:
+			return oneway_merge(state, stages, index_entry, n);
+		case 2:
+			return twoway_merge(state, stages, index_entry, n);
+		default:
+			return threeway_merge(state, stages, index_entry, n);
+	}
+}
+
+/* Add all the entries of tree, as a new index would have them */
+static void add_tree(struct merge_state *state, git_tree *tree, struct cache_tree *directory)
+{
+	size_t len = state->path.len;
+	unsigned int before = state->emitted;
+
+	for (unsigned int i = 0; i < git_tree_entrycount(tree); i++) {
+		const git_tree_entry *tree_entry = git_tree_entry_byindex(tree, i);
+		const char *name = git_tree_entry_name(tree_entry);
+		struct merge_entry entry;
+
+		entry.mode = git_tree_entry_attributes(tree_entry);
+		git_oid_cpy(&entry.oid, git_tree_entry_id(tree_entry));
+		strbuf_addstr(&state->path, name);
+
+		if (S_ISDIR(entry.mode)) {
+			struct cache_tree *subdirectory = cache_tree_new(name, strlen(name));
+			git_tree *subtree;
+
+			if (tree_cache_lookup(&subtree, state->merge->repo, &entry.oid) != GIT_SUCCESS)
+				libgit_error();
+			strbuf_addch(&state->path, '/');
+			add_tree(state, subtree, subdirectory);
+			tree_cache_close(subtree);
+
+			ALLOC_GROW(directory->subtrees, directory->nr + 1, directory->alloc);
+			directory->subtrees[directory->nr++] = subdirectory;
+		} else {
+			add_entry(state, &entry, 0);
+		}
+		strbuf_setlen(&state->path, len);
+	}
+
+	git_oid_cpy(&directory->oid, git_tree_id(tree));
+	directory->entry_count = state->emitted - before;
+}
+
+static int merge_directory(struct merge_state *state, git_tree *const *trees,
+	unsigned int begin, unsigned int end, const struct cache_tree *index_dir, struct cache_tree *result_dir);
+
+/*
+ * Merge the directory at state->path, of which the trees have the given
+ * oids (NULL where they have none) and the index the entries begin to
+ * end, whose cache-tree is index_dir (NULL if there is none).
+ */
+static int merge_subdirectory(struct merge_state *state, const git_oid *const *oids,
+	unsigned int begin, unsigned int end, const struct cache_tree *index_dir, struct cache_tree *result_dir)
+{
+	const struct tree_merge *merge = state->merge;
+	const git_oid *index_oid = NULL;
+	int keep_index = 0;
+	int add_only = -1; /* the tree whose entries are all the result */
+	git_tree *trees[MAX_MERGE_TREES] = {NULL};
+	int e = 0;
+
+	/* the entries of the index are exactly those of its valid cache-tree */
+	if (begin < end && index_dir && index_dir->entry_count >= 0 &&
+	    (unsigned int)index_dir->entry_count == end - begin)
+		index_oid = &index_dir->oid;
+
+	switch (merge->nr_trees) {
+		case 1:
+			keep_index = index_oid && same_oid(index_oid, oids[0]);
+			if (begin == end && oids[0])
+				add_only = 0;
+			break;
+		case 2:
+			keep_index = (same_oid(oids[0], oids[1]) && (!merge->initial_checkout || !oids[1])) ||
+				(index_oid && same_oid(index_oid, oids[1]));
+			if (begin == end && oids[1] && (!oids[0] || (same_oid(oids[0], oids[1]) && merge->initial_checkout)))
+				add_only = 1;
+			break;
+		default:
+			if (same_oid(oids[0], oids[1]) && same_oid(oids[1], oids[2]) && oids[1]) {
+				keep_index = index_oid && same_oid(index_oid, oids[1]);
+				if (begin == end)
+					add_only = 1;
+			} else if (!oids[0] && !oids[1] && !oids[2]) {
+				/* the index has entries which are not in the head */
+				return begin == end ? 0 : -1;
+			}
+			break;
+	}
+
+	if (keep_index) {
+		index_builder_copy(state->result, merge->index, begin, end);
+		state->emitted += end - begin;
+		if (index_dir) {
+			struct cache_tree *copy = cache_tree_copy(index_dir);
+
+			/* the copy takes the place of result_dir, keeping its name */
+			result_dir->entry_count = copy->entry_count;
+			git_oid_cpy(&result_dir->oid, &copy->oid);
+			result_dir->subtrees = copy->subtrees;
+			result_dir->nr = copy->nr;
+			result_dir->alloc = copy->alloc;
+			free(copy);
+		}
+		return 0;
+	}
+
+	if (add_only >= 0) {
+		git_tree *tree;
+
+		if (tree_cache_lookup(&tree, merge->repo, oids[add_only]) != GIT_SUCCESS)
+			libgit_error();
+		add_tree(state, tree, result_dir);
+		tree_cache_close(tree);
+		return 0;
+	}
+
+	for (unsigned int k = 0; k < merge->nr_trees; k++) {
+		if (oids[k] && tree_cache_lookup(&trees[k], merge->repo, oids[k]) != GIT_SUCCESS)
+			libgit_error();
+	}
+	e = merge_directory(state, trees, begin, end, index_dir, result_dir);
+	for (unsigned int k = 0; k < merge->nr_trees; k++) {
+		if (trees[k])
+			tree_cache_close(trees[k]);
+	}
+	return e;
+}
+
+/*
+ * Walk the entries of the trees (NULL where there is none) and of the
+ * index from begin to end in step, in the order of the index. result_dir
+ * is valid when the result is the expected tree, as it most often is.
+ */
+static int merge_directory(struct merge_state *state, git_tree *const *trees,
+	unsigned int begin, unsigned int end, const struct cache_tree *index_dir, struct cache_tree *result_dir)
+{
+	const struct tree_merge *merge = state->merge;
+	unsigned int cursors[MAX_MERGE_TREES] = {0};
+	unsigned int before = state->emitted, i = begin;
+	size_t len = state->path.len, relative = relative_len(state);
+	int matches = 1;
+
+	for (;;) {
+		const git_tree_entry *found[MAX_MERGE_TREES] = {NULL};
+		const char *name = NULL, *index_path = NULL;
+		size_t name_len = 0, index_name_len = 0;
+		int is_dir = 0, index_is_dir = 0, in_index;
+
+		/* the first name of the trees and of the index */
+		for (unsigned int k = 0; k < merge->nr_trees; k++) {
+			const git_tree_entry *entry;
+			const char *entry_name;
+			size_t entry_len;
+			int entry_is_dir;
+
+			if (!trees[k] || cursors[k] >= git_tree_entrycount(trees[k]))
+				continue;
+			entry = git_tree_entry_byindex(trees[k], cursors[k]);
+			entry_name = git_tree_entry_name(entry);
+			entry_len = strlen(entry_name);
+			entry_is_dir = S_ISDIR(git_tree_entry_attributes(entry));
+			if (!name || name_compare(entry_name, entry_len, entry_is_dir, name, name_len, is_dir) < 0) {
+				name = entry_name;
+				name_len = entry_len;
+				is_dir = entry_is_dir;
+			}
+		}
+		if (i < end) {
+			const char *slash;
+
+			index_path = index_map_path(merge->index, i) + relative;
+			slash = strchr(index_path, '/');
+			index_name_len = slash ? (size_t)(slash - index_path) : strlen(index_path);
+			index_is_dir = slash != NULL;
+			if (!name || name_compare(index_path, index_name_len, index_is_dir, name, name_len, is_dir) < 0) {
+				name = index_path;
+				name_len = index_name_len;
+				is_dir = index_is_dir;
+			}
+		}
+		if (!name)
+			break;
+
+		in_index = index_path && !name_compare(index_path, index_name_len, index_is_dir, name, name_len, is_dir);
+		for (unsigned int k = 0; k < merge->nr_trees; k++) {
+			const git_tree_entry *entry;
+			const char *entry_name;
+
+			if (!trees[k] || cursors[k] >= git_tree_entrycount(trees[k]))
+				continue;
+			entry = git_tree_entry_byindex(trees[k], cursors[k]);
+			entry_name = git_tree_entry_name(entry);
+			if (!name_compare(entry_name, strlen(entry_name), S_ISDIR(git_tree_entry_attributes(entry)),
+					name, name_len, is_dir)) {
+				found[k] = entry;
+				cursors[k]++;
+			}
+		}
+		strbuf_add(&state->path, name, name_len);
+
+		if (is_dir) {
+			const git_oid *oids[MAX_MERGE_TREES] = {NULL};
+			const struct cache_tree *index_subdir = NULL;
+			struct cache_tree *subdirectory;
+			unsigned int subend = i;
+			unsigned int subbefore = state->emitted;
+
+			/* a file and a directory of the same name : git knows what to do */
+			if (index_has_file(merge->index, relative_path(state), relative_len(state)))
+				goto fail;
+			for (unsigned int k = 0; k < merge->nr_trees; k++) {
+				if (trees[k] && tree_has_file(trees[k], state->path.buf + len, name_len))
+					goto fail;
+				if (found[k])
+					oids[k] = git_tree_entry_id(found[k]);
+			}
+
+			strbuf_addch(&state->path, '/');
+			if (in_index)
+				subend = index_map_prefix_end(merge->index, i, relative_path(state), relative_len(state));
+			if (index_dir)
+				index_subdir = cache_tree_subtree(index_dir, state->path.buf + len, name_len);
+
+			subdirectory = cache_tree_new(state->path.buf + len, name_len);
+			if (merge_subdirectory(state, oids, i, subend, index_subdir, subdirectory) < 0) {
+				cache_tree_free(subdirectory);
+				goto fail;
+			}
+			i = subend;
+
+			if (state->emitted == subbefore) {
+				cache_tree_free(subdirectory);
+				if (oids[state->expected])
+					matches = 0;
+			} else {
+				if (subdirectory->entry_count < 0 || !same_oid(&subdirectory->oid, oids[state->expected]))
+					matches = 0;
+				ALLOC_GROW(result_dir->subtrees, result_dir->nr + 1, result_dir->alloc);
+				result_dir->subtrees[result_dir->nr++] = subdirectory;
+			}
+		} else {
+			struct merge_entry entries[MAX_MERGE_TREES + 1];
+			const struct merge_entry *stages[MAX_MERGE_TREES + 1] = {NULL};
+			git_index_entry index_entry;
+			unsigned int n = i;
+
+			if (in_index) {
+				index_map_entry(merge->index, i++, &index_entry);
+				entries[0].mode = index_entry.mode;
+				git_oid_cpy(&entries[0].oid, &index_entry.oid);
+				stages[0] = &entries[0];
+			}
+			for (unsigned int k = 0; k < merge->nr_trees; k++) {
+				if (!found[k])
+					continue;
+				entries[k + 1].mode = git_tree_entry_attributes(found[k]);
+				git_oid_cpy(&entries[k + 1].oid, git_tree_entry_id(found[k]));
+				stages[k + 1] = &entries[k + 1];
+			}
+
+			if (merge_path(state, stages, in_index ? &index_entry : NULL, n) < 0)
+				goto fail;
+			if (state->added_stage || state->nr_added > 1 ||
+			    !same(state->nr_added ? state->added : NULL, stages[state->expected + 1]))
+				matches = 0;
+		}
+		strbuf_setlen(&state->path, len);
+	}
+
+	if (matches && trees[state->expected]) {
+		git_oid_cpy(&result_dir->oid, git_tree_id(trees[state->expected]));
+		result_dir->entry_count = state->emitted - before;
+	} else {
+		result_dir->entry_count = -1;
+	}
+	return 0;
+
+fail:
+	strbuf_setlen(&state->path, len);
+	return -1;
+}
+
+int merge_trees(struct index_builder *result, struct cache_tree *root, const struct tree_merge *merge)
+{
+	struct merge_state state;
+	int e;
+
+	memset(&state, 0, sizeof(state));
+	state.merge = merge;
+	state.result = result;
+	strbuf_init(&state.path, 0);
+	strbuf_addstr(&state.path, merge->work_tree);
+	state.work_tree_len = state.path.len;
+	state.trust_filemode = get_git_config_bool(merge->repo, "core.filemode", 1);
+	/* with three trees, the head (ours) */
+	state.expected = merge->nr_trees == 3 ? 1 : merge->nr_trees - 1;
+
+	uint64_t start = trace_perf_start();
+	e = merge_subdirectory(&state, merge->trees, 0, merge->index->nr, merge->index_tree, root);
+	trace_perf_stop("merge_trees", start);
+
+	strbuf_release(&state.path);
+	return e;
+}
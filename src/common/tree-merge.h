@@ -0,0 +1,43 @@
+#ifndef TREE_MERGE_H
+#define TREE_MERGE_H
+
+#include <git2.h>
+#include "index-map.h"
+#include "cache-tree.h"
+
+/*
+ * The merges of "read-tree -m" with one, two or three trees (git's
+ * oneway_merge(), twoway_merge() and threeway_merge(), without
+ * --aggressive), into a new index.
+ *
+ * The trees and the index are walked in step, one directory at a time.
+ * A directory whose result is known from the oids alone is not walked :
+ * its entries are copied as a whole from the index when the trees and
+ * the cache-tree of the index tell they stay (a one-way merge into the
+ * same tree, the same subtree in H and M...), or added from a single
+ * tree when the index has none there. The result is written in order,
+ * so that the index is built in one pass.
+ *
+ * Whatever git would refuse or get wrong without a work tree check of
+ * its own (an entry not up to date, a file turned into a directory, an
+ * index entry git would not overwrite) makes the merge give up, so that
+ * git does it and reports the error itself.
+ */
+
+#define MAX_MERGE_TREES 3
+
+struct tree_merge {
+	git_repository *repo;
+	const struct index_map *index; /* without unmerged nor extended entries */
+	const struct cache_tree *index_tree; /* the cache-tree of index */
+	const char *work_tree; /* the top of it, with a trailing '/' */
+	const git_oid *trees[MAX_MERGE_TREES];
+	unsigned int nr_trees;
+	int initial_checkout; /* the index file does not exist yet */
+};
+
+int merge_trees(struct index_builder *result, struct cache_tree *root, const struct tree_merge *merge);
+//append the entries of the merged index to result, and give root their
+//cache-tree. Returns 0, or -1 if git must do the merge
+
+#endif
@@ -0,0 +1,265 @@
+#include "git-compat-util.h"
+#include "untracked-cache.h"
+#include "byte-order.h"
+#include "utils.h"
+#include "run-command.h"
+#include "trace.h"
+#include "cache-file.h"
+
+#define UNTRACKED_CACHE_SIGNATURE 0xff673275 /* "\377g2u" */
+#define UNTRACKED_CACHE_VERSION 1
+#define UNTRACKED_CACHE_HEADER_SIZE 20
+
+static int dir_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct untracked_cache_dir *)a)->path, ((const struct untracked_cache_dir *)b)->path);
+}
+
+/* A NUL terminated string of len bytes at *pos, which is moved past it */
+static const char *parse_string(const char *buf, size_t size, size_t *pos, size_t len)
+{
+	const char *str = buf + *pos;
+
+	if (size - *pos < len + 1 || str[len])
+		return NULL;
+	*pos += len + 1;
+	return str;
+}
+
+static int parse_be32(const char *buf, size_t size, size_t *pos, uint32_t *value)
+{
+	if (size - *pos < 4)
+		return -1;
+	*value = get_be32_at((const unsigned char *)buf + *pos);
+	*pos += 4;
+	return 0;
+}
+
+static int parse_cache(struct untracked_cache *cache, size_t size)
+{
+	const char *buf = cache->buf;
+	size_t pos = UNTRACKED_CACHE_HEADER_SIZE;
+	uint32_t nr, token_len;
+
+	if (size < UNTRACKED_CACHE_HEADER_SIZE ||
+	    get_be32_at((const unsigned char *)buf) != UNTRACKED_CACHE_SIGNATURE ||
+	    get_be32_at((const unsigned char *)buf + 4) != UNTRACKED_CACHE_VERSION)
+		return -1;
+	cache->written = get_be32_at((const unsigned char *)buf + 8);
+	nr = get_be32_at((const unsigned char *)buf + 12);
+	token_len = get_be32_at((const unsigned char *)buf + 16);
+	if (token_len) {
+		const char *token = parse_string(buf, size, &pos, token_len);
+
+		if (!token)
+			return -1;
+		cache->token = xstrdup(token);
+	}
+
+	/* each record is at least 32 bytes */
+	if (nr > (size - pos) / 32)
+		return -1;
+	cache->dirs = xcalloc(nr ? nr : 1, sizeof(*cache->dirs));
+	for (cache->nr = 0; cache->nr < nr; cache->nr++) {
+		struct untracked_cache_dir *dir = &cache->dirs[cache->nr];
+		uint32_t path_len, names_len;
+		size_t start = pos;
+
+		if (parse_be32(buf, size, &pos, &path_len) ||
+		    !(dir->path = parse_string(buf, size, &pos, path_len)))
+			return -1;
+		for (int i = 0; i < 5; i++)
+			if (parse_be32(buf, size, &pos, &dir->stat[i]))
+				return -1;
+		if (parse_be32(buf, size, &pos, &dir->nr) || parse_be32(buf, size, &pos, &names_len) ||
+		    size - pos < names_len || (names_len && buf[pos + names_len - 1]))
+			return -1;
+		dir->names = buf + pos;
+		pos += names_len;
+		dir->record = buf + start;
+		dir->record_len = pos - start;
+	}
+	if (pos != size)
+		return -1;
+
+	qsort(cache->dirs, cache->nr, sizeof(*cache->dirs), dir_cmp);
+	return 0;
+}
+
+void untracked_cache_load(struct untracked_cache *cache, const char *file)
+{
+	struct strbuf contents = STRBUF_INIT;
+
+	memset(cache, 0, sizeof(*cache));
+	cache->start = (uint32_t)time(NULL);
+
+	uint64_t start = trace_perf_start();
+	if (strbuf_read_file(&contents, file, 0) < 0) {
+		strbuf_release(&contents);
+		trace_perf_stop("untracked_cache_load", start);
+		return;
+	}
+
+	size_t size = contents.len;
+	cache->buf = strbuf_detach(&contents, NULL);
+	if (parse_cache(cache, size) < 0) {
+		untracked_cache_release(cache);
+		cache->start = (uint32_t)time(NULL);
+	}
+	trace_perf_stop("untracked_cache_load", start);
+}
+
+static struct untracked_cache_dir *find_dir(const struct untracked_cache *cache, const char *path)
+{
+	struct untracked_cache_dir key;
+
+	if (!cache->nr)
+		return NULL;
+	key.path = path;
+	return bsearch(&key, cache->dirs, cache->nr, sizeof(*cache->dirs), dir_cmp);
+}
+
+const struct untracked_cache_dir *untracked_cache_find(const struct untracked_cache *cache, const char *path)
+{
+	return find_dir(cache, path);
+}
+
+/* A path the fsmonitor reports : its directory changed, and it may be one itself */
+static void mark_dirty(struct untracked_cache *cache, struct strbuf *dir, const char *path)
+{
+	struct untracked_cache_dir *cached;
+	size_t len = strlen(path);
+	const char *slash;
+
+	if (len && path[len - 1] == '/')
+		len--;
+
+	strbuf_reset(dir);
+	strbuf_add(dir, path, len);
+	strbuf_addch(dir, '/');
+	if ((cached = find_dir(cache, dir->buf)) != NULL)
+		cached->dirty = 1;
+
+	slash = memrchr(path, '/', len);
+	strbuf_reset(dir);
+	if (slash)
+		strbuf_add(dir, path, slash + 1 - path);
+	if ((cached = find_dir(cache, dir->buf)) != NULL)
+		cached->dirty = 1;
+}
+
+void untracked_cache_query_fsmonitor(struct untracked_cache *cache, const char *hook, const char *work_tree)
+{
+	const char *argv[] = {hook, "2", cache->token ? cache->token : "", NULL};
+	struct strbuf output = STRBUF_INIT;
+	struct strbuf dir = STRBUF_INIT;
+	struct child_process process;
+	const char *path, *end;
+	int everything = !cache->token;
+
+	memset(&process, 0, sizeof(process));
+	process.argv = argv;
+	process.dir = work_tree;
+	process.use_shell = 1;
+	process.no_stdin = 1;
+
+	uint64_t start = trace_perf_start();
+	if (capture_command(&process, &output, 0) || !memchr(output.buf, '\0', output.len)) {
+		/* no token : the next walk asks again from scratch */
+		trace_perf_stop("fsmonitor_query", start);
+		strbuf_release(&output);
+		return;
+	}
+
+	cache->new_token = xstrdup(output.buf);
+	end = output.buf + output.len;
+	for (path = output.buf + strlen(output.buf) + 1; path < end; path += strlen(path) + 1) {
+		/* "/" : the hook does not know what changed */
+		if (!strcmp(path, "/")) {
+			everything = 1;
+			break;
+		}
+		mark_dirty(cache, &dir, path);
+	}
+	cache->fsmonitor = !everything;
+	trace_perf_stop("fsmonitor_query", start);
+
+	strbuf_release(&dir);
+	strbuf_release(&output);
+}
+
+void untracked_cache_stat(uint32_t stat[5], const struct stat *st)
+{
+	stat[0] = (uint32_t)st->st_mtime;
+	stat[1] = ST_MTIME_NSEC(*st);
+	stat[2] = (uint32_t)st->st_ctime;
+	stat[3] = ST_CTIME_NSEC(*st);
+	stat[4] = (uint32_t)st->st_ino;
+}
+
+int untracked_cache_valid(const struct untracked_cache *cache, const struct untracked_cache_dir *dir,
+	const uint32_t stat[5])
+{
+	/* changed in the second the cache was written : maybe after it was read */
+	return !memcmp(dir->stat, stat, sizeof(dir->stat)) && dir->stat[0] < cache->written;
+}
+
+void untracked_cache_add(struct strbuf *records, const char *path, size_t len, const uint32_t stat[5],
+	unsigned int nr, const char *names, size_t names_len)
+{
+	add_be32(records, (uint32_t)len);
+	strbuf_add(records, path, len);
+	strbuf_addch(records, '\0');
+	for (int i = 0; i < 5; i++)
+		add_be32(records, stat[i]);
+	add_be32(records, nr);
+	add_be32(records, (uint32_t)names_len);
+	strbuf_add(records, names, names_len);
+}
+
+void untracked_cache_write(const struct untracked_cache *cache, const char *file, const char *prefix,
+	const struct strbuf *records, unsigned int nr)
+{
+	struct strbuf contents = STRBUF_INIT;
+	size_t prefix_len = strlen(prefix);
+	size_t token_len = cache->new_token ? strlen(cache->new_token) : 0;
+
+	uint64_t start = trace_perf_start();
+	add_be32(&contents, UNTRACKED_CACHE_SIGNATURE);
+	add_be32(&contents, UNTRACKED_CACHE_VERSION);
+	add_be32(&contents, cache->start);
+	add_be32(&contents, 0);
+	add_be32(&contents, (uint32_t)token_len);
+	if (token_len)
+		strbuf_add(&contents, cache->new_token, token_len + 1);
+
+	/*
+	 * The directories the walk did not look at stay as they were, unless
+	 * they changed. Under a new token, they must be unchanged since the
+	 * old one, which only the fsmonitor can tell
+	 */
+	for (unsigned int i = 0; (cache->fsmonitor || !cache->new_token) && i < cache->nr; i++) {
+		const struct untracked_cache_dir *dir = &cache->dirs[i];
+
+		if (!strncmp(dir->path, prefix, prefix_len) || dir->dirty)
+			continue;
+		strbuf_add(&contents, dir->record, dir->record_len);
+		nr++;
+	}
+	strbuf_add(&contents, records->buf, records->len);
+	put_be32_at(contents.buf + 12, nr);
+
+	write_cache_file(file, contents.buf, contents.len);
+	trace_perf_stop("untracked_cache_write", start);
+
+	strbuf_release(&contents);
+}
+
+void untracked_cache_release(struct untracked_cache *cache)
+{
+	free(cache->dirs);
+	free(cache->buf);
+	free(cache->token);
+	free(cache->new_token);
+	memset(cache, 0, sizeof(*cache));
+}
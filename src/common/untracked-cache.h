@@ -0,0 +1,75 @@
+#ifndef UNTRACKED_CACHE_H
+#define UNTRACKED_CACHE_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include "strbuf.h"
+
+/*
+ * What the directories of the work tree held when list_untracked() last
+ * read them, kept in .git/git2-untracked-cache : a walk only reads again
+ * the directories whose stat data changed since. With an fsmonitor hook
+ * (core.fsmonitor), the directories it does not report are not even
+ * stat()ed.
+ *
+ * Only the names of the entries are kept, not whether they are ignored
+ * or tracked : that is worked out again on each walk, so the .gitignore
+ * files and the index may change freely. A directory modified in the
+ * second the walk which cached it started is read again, as git does
+ * for racily clean entries.
+ */
+
+struct untracked_cache_dir {
+	const char *path; /* from the top of the work tree, with a trailing '/' : "" for the top */
+	uint32_t stat[5]; /* mtime, ctime (seconds and nanoseconds) and inode */
+	unsigned int nr; /* of entries */
+	const char *names; /* of the entries : 'd' (directory) or 'f', the name, a NUL */
+	const char *record; /* in the file, to copy it to the next one as it is */
+	size_t record_len;
+	int dirty; /* reported by the fsmonitor */
+};
+
+struct untracked_cache {
+	char *buf; /* the file, which the directories point into */
+	struct untracked_cache_dir *dirs; /* sorted by path */
+	unsigned int nr;
+	uint32_t written; /* when the walk which wrote it started */
+	char *token; /* of the fsmonitor, NULL if there is none */
+
+	int fsmonitor; /* the fsmonitor answered : the dirs it did not report are clean */
+	char *new_token; /* what it answered with, for the next file */
+	uint32_t start; /* of this walk */
+};
+
+void untracked_cache_load(struct untracked_cache *cache, const char *file);
+//read file, an empty cache if it cannot be read or is not valid
+
+void untracked_cache_query_fsmonitor(struct untracked_cache *cache, const char *hook, const char *work_tree);
+//run the fsmonitor hook (version 2 of its protocol) with the token of
+//the file, and mark the directories it reports as dirty. Without a
+//token, or when the hook fails or reports everything, the directories
+//are checked through their stat data
+
+const struct untracked_cache_dir *untracked_cache_find(const struct untracked_cache *cache, const char *path);
+//the directory path ("" or "dir/"), NULL if it is not in the cache
+
+void untracked_cache_stat(uint32_t stat[5], const struct stat *st);
+//the stat data a directory is cached with
+
+int untracked_cache_valid(const struct untracked_cache *cache, const struct untracked_cache_dir *dir,
+	const uint32_t stat[5]);
+//whether the cached entries of dir are still those of the directory,
+//whose stat data is now stat
+
+void untracked_cache_add(struct strbuf *records, const char *path, size_t len, const uint32_t stat[5],
+	unsigned int nr, const char *names, size_t names_len);
+//append the record of a directory read again to records
+
+void untracked_cache_write(const struct untracked_cache *cache, const char *file, const char *prefix,
+	const struct strbuf *records, unsigned int nr);
+//write the cache again, with the nr records of the walk below prefix and
+//the directories of the old one out of it, through write_cache_file()
+
+void untracked_cache_release(struct untracked_cache *cache);
+
+#endif
@@ -0,0 +1,650 @@
+#include "git-compat-util.h"
+#include <dirent.h>
+#include "untracked.h"
+#include "ignore.h"
+#include "strbuf.h"
+#include "utils.h"
+#include "thread-pool.h"
+#include "trace.h"
+#include "untracked-cache.h"
+
+/* Work items per worker, for the big directories not to keep a worker alone at the end */
+#define DIRECTORIES_PER_WORKER 8
+/* How deep the top of the work tree is read before the workers start */
+#define MAX_PLAN_DEPTH 3
+
+/*
+ * The .gitignore of a directory, chained to those of its parents : the
+ * deepest one which has a matching pattern decides. The chains are only
+ * read once built, by any thread, and the lists belong to the cache of
+ * ignore_list_load().
+ */
+struct ignore_frame {
+	const struct ignore_frame *parent;
+	const struct ignore_list *list; /* in the cache of ignore_list_load() */
+};
+
+/* A directory left to the workers */
+struct pending_dir {
+	const char *path; /* from the top of the work tree, with a trailing '/' */
+	unsigned int begin, end; /* its index entries */
+	const struct ignore_frame *ignores;
+};
+
+struct walker {
+	const struct untracked_options *options;
+	const struct index_map *index;
+	const struct ignore_list *global[2]; /* info/exclude, then core.excludesFile, or NULL */
+
+	/* the top of the work tree, read before the workers start */
+	struct pending_dir *pending;
+	unsigned int nr_pending, pending_alloc;
+	struct arena pending_paths;
+	struct ignore_frame **frames; /* of the directories planned, freed at the end */
+	unsigned int nr_frames, frames_alloc;
+
+	struct untracked_list {
+		const char **paths;
+		unsigned int nr, alloc;
+	} *found; /* one per worker, in the arenas of the result */
+	struct arena *arenas;
+
+	struct untracked_cache *cache; /* NULL without one */
+	struct cache_records {
+		struct strbuf buf; /* of the directories walked, for the next cache */
+		unsigned int nr;
+		unsigned int read; /* of them not from the cache */
+	} *records; /* one per worker */
+};
+
+/* A thread reading directories : path is the work tree then the directory */
+struct walk_state {
+	struct walker *walker;
+	struct untracked_list *found;
+	struct arena *arena;
+	struct cache_records *records;
+	struct strbuf path;
+	size_t root_len;
+};
+
+struct dir_entry {
+	const char *name;
+	size_t len;
+	int is_dir;
+};
+
+static int is_ignored(const struct walker *walker, const struct ignore_frame *frames,
+	const char *path, size_t len, int is_dir)
+{
+	int ignored;
+
+	if (!walker->options->exclude_standard)
+		return 0;
+
+	for (; frames; frames = frames->parent) {
+		if ((ignored = ignore_list_match(frames->list, path, len, is_dir)) >= 0)
+			return ignored;
+	}
+	for (int i = 0; i < 2; i++) {
+		if (walker->global[i] && (ignored = ignore_list_match(walker->global[i], path, len, is_dir)) >= 0)
+			return ignored;
+	}
+	return 0;
+}
+
+/* The .gitignore of the directory in state->path, chained to parent */
+static struct ignore_frame *read_ignore_frame(struct walk_state *state, const struct ignore_frame *parent)
+{
+	struct ignore_frame *frame = NULL;
+	const struct ignore_list *list;
+	size_t len = state->path.len;
+
+	strbuf_addstr(&state->path, ".gitignore");
+	list = ignore_list_load(state->path.buf, state->path.buf + state->root_len, len - state->root_len);
+	strbuf_setlen(&state->path, len);
+	if (list) {
+		frame = xmalloc(sizeof(*frame));
+		frame->parent = parent;
+		frame->list = list;
+	}
+	return frame;
+}
+
+/*
+ * Names in the order of the index : a directory sorts as if its name
+ * ended with a '/', as the paths of its index entries do
+ */
+static int key_cmp(const char *a, size_t a_len, int a_dir, const char *b, size_t b_len, int b_dir)
+{
+	size_t len = a_len < b_len ? a_len : b_len;
+	int cmp = memcmp(a, b, len);
+
+	if (cmp)
+		return cmp;
+	return (len < a_len ? (unsigned char)a[len] : a_dir ? '/' : 0) -
+		(len < b_len ? (unsigned char)b[len] : b_dir ? '/' : 0);
+}
+
+static int dir_entry_cmp(const void *a, const void *b)
+{
+	const struct dir_entry *ea = a, *eb = b;
+
+	return key_cmp(ea->name, ea->len, ea->is_dir, eb->name, eb->len, eb->is_dir);
+}
+
+/* The name of the nth index entry in the directory of dir_len, and whether it is below a subdirectory */
+static const char *index_key(const struct index_map *index, unsigned int n, size_t dir_len, size_t *len, int *is_dir)
+{
+	const char *name = index_map_path(index, n) + dir_len;
+	const char *slash = strchrnul(name, '/');
+
+	*len = slash - name;
+	*is_dir = *slash == '/';
+	return name;
+}
+
+static void add_found(struct walk_state *state, const char *path, size_t len)
+{
+	struct untracked_list *found = state->found;
+
+	ALLOC_GROW(found->paths, found->nr + 1, found->alloc);
+	found->paths[found->nr++] = arena_memdupz(state->arena, path, len);
+}
+
+/*
+ * The entries of the directory in state->path, sorted, with their names
+ * in names. Returns -1 if it cannot be read
+ */
+static int read_entries(struct walk_state *state, struct strbuf *names, struct dir_entry **entries, unsigned int *nr)
+{
+	unsigned int alloc = 0, offsets_alloc = 0;
+	size_t *offsets = NULL, len = state->path.len;
+	struct dirent *de;
+	DIR *dir;
+
+	dir = opendir(state->path.buf);
+	if (!dir)
+		return -1;
+
+	*entries = NULL;
+	*nr = 0;
+	/* readdir() reads the entries by batches, with getdents64() on Linux */
+	while ((de = readdir(dir)) != NULL) {
+		const char *name = de->d_name;
+		struct stat st;
+		int is_dir;
+
+		if (name[0] == '.' && (!name[1] || !strcmp(name + 1, ".") || !strcmp(name + 1, "git")))
+			continue;
+
+		switch (de->d_type) {
+		case DT_REG:
+		case DT_LNK:
+			is_dir = 0;
+			break;
+		case DT_DIR:
+			is_dir = 1;
+			break;
+		case DT_UNKNOWN:
+			strbuf_addstr(&state->path, name);
+			if (lstat(state->path.buf, &st))
+				st.st_mode = 0;
+			strbuf_setlen(&state->path, len);
+			if (!S_ISREG(st.st_mode) && !S_ISLNK(st.st_mode) && !S_ISDIR(st.st_mode))
+				continue;
+			is_dir = S_ISDIR(st.st_mode);
+			break;
+		default:
+			/* sockets and fifos are not files git can track */
+			continue;
+		}
+
+		ALLOC_GROW(*entries, *nr + 1, alloc);
+		ALLOC_GROW(offsets, *nr + 1, offsets_alloc);
+		offsets[*nr] = names->len;
+		(*entries)[*nr].len = strlen(name);
+		(*entries)[*nr].is_dir = is_dir;
+		strbuf_add(names, name, (*entries)[*nr].len + 1);
+		(*nr)++;
+	}
+	closedir(dir);
+
+	/* the names only stop moving once all are read */
+	for (unsigned int i = 0; i < *nr; i++)
+		(*entries)[i].name = names->buf + offsets[i];
+	free(offsets);
+
+	qsort(*entries, *nr, sizeof(**entries), dir_entry_cmp);
+	return 0;
+}
+
+/* The entries of a directory the cache still knows, which point into it */
+static void cached_entries(const struct untracked_cache_dir *cached, struct dir_entry **entries, unsigned int *nr)
+{
+	const char *name = cached->names;
+
+	*entries = xmalloc((cached->nr ? cached->nr : 1) * sizeof(**entries));
+	for (*nr = 0; *nr < cached->nr; (*nr)++) {
+		struct dir_entry *entry = &(*entries)[*nr];
+
+		entry->is_dir = *name++ == 'd';
+		entry->name = name;
+		entry->len = strlen(name);
+		name += entry->len + 1;
+	}
+}
+
+/*
+ * read_entries(), or the entries the cache has for the directory when
+ * the fsmonitor did not report it, or when its stat data did not change.
+ * The directory is recorded for the next cache either way
+ */
+static int directory_entries(struct walk_state *state, struct strbuf *names, struct dir_entry **entries, unsigned int *nr)
+{
+	const struct untracked_cache *cache = state->walker->cache;
+	const char *path = state->path.buf + state->root_len;
+	size_t len = state->path.len - state->root_len;
+	const struct untracked_cache_dir *cached;
+	struct strbuf record_names = STRBUF_INIT;
+	uint32_t stat_data[5];
+	struct stat st;
+
+	if (!cache)
+		return read_entries(state, names, entries, nr);
+
+	cached = untracked_cache_find(cache, path);
+	if (cached && cache->fsmonitor && !cached->dirty)
+		goto from_cache;
+
+	/* before reading it : a change while it is read shows next time */
+	if (lstat(state->path.buf, &st))
+		return -1;
+	untracked_cache_stat(stat_data, &st);
+	if (cached && untracked_cache_valid(cache, cached, stat_data))
+		goto from_cache;
+
+	if (read_entries(state, names, entries, nr) < 0)
+		return -1;
+	for (unsigned int i = 0; i < *nr; i++) {
+		strbuf_addch(&record_names, (*entries)[i].is_dir ? 'd' : 'f');
+		strbuf_add(&record_names, (*entries)[i].name, (*entries)[i].len + 1);
+	}
+	untracked_cache_add(&state->records->buf, path, len, stat_data, *nr, record_names.buf, record_names.len);
+	state->records->nr++;
+	state->records->read++;
+	strbuf_release(&record_names);
+	return 0;
+
+from_cache:
+	strbuf_add(&state->records->buf, cached->record, cached->record_len);
+	state->records->nr++;
+	cached_entries(cached, entries, nr);
+	return 0;
+}
+
+static void walk_directory(struct walk_state *state, unsigned int begin, unsigned int end,
+	const struct ignore_frame *ignores, int plan);
+
+static void queue_directory(struct walker *walker, const char *path, size_t len, unsigned int begin, unsigned int end,
+	const struct ignore_frame *ignores)
+{
+	struct pending_dir *pending;
+
+	ALLOC_GROW(walker->pending, walker->nr_pending + 1, walker->pending_alloc);
+	pending = &walker->pending[walker->nr_pending++];
+	pending->path = arena_memdupz(&walker->pending_paths, path, len);
+	pending->begin = begin;
+	pending->end = end;
+	pending->ignores = ignores;
+}
+
+/* Read the subdirectory in state->path now, or leave it to the workers when planning */
+static void descend(struct walk_state *state, unsigned int begin, unsigned int end,
+	const struct ignore_frame *ignores, int plan)
+{
+	if (plan)
+		queue_directory(state->walker, state->path.buf + state->root_len, state->path.len - state->root_len,
+				begin, end, ignores);
+	else
+		walk_directory(state, begin, end, ignores, 0);
+}
+
+/*
+ * A directory with no entry below it in the index is untracked as a
+ * whole, unless the index has it as a submodule (the entry just before
+ * "name/" is then "name"). Other repositories are listed as "name/"
+ */
+static void untracked_directory(struct walk_state *state, unsigned int at, unsigned int begin,
+	const struct dir_entry *entry, size_t dir_len, const struct ignore_frame *ignores, int plan)
+{
+	const struct index_map *index = state->walker->index;
+	size_t len = state->path.len;
+	struct stat st;
+	int nested;
+
+	if (at > begin) {
+		size_t key_len;
+		int is_dir;
+		const char *key = index_key(index, at - 1, dir_len, &key_len, &is_dir);
+
+		if (!is_dir && key_len == entry->len && !memcmp(key, entry->name, key_len)) {
+			git_index_entry gie;
+
+			index_map_entry(index, at - 1, &gie);
+			if ((gie.mode & S_IFMT) == S_IFGITLINK)
+				return;
+		}
+	}
+
+	strbuf_addstr(&state->path, ".git");
+	nested = !lstat(state->path.buf, &st);
+	strbuf_setlen(&state->path, len);
+
+	if (nested)
+		add_found(state, state->path.buf + state->root_len, len - state->root_len);
+	else
+		descend(state, at, at, ignores, plan);
+}
+
+/*
+ * Read the directory in state->path (with a trailing '/'), whose index
+ * entries are [begin, end), then its subdirectories
+ */
+static void walk_directory(struct walk_state *state, unsigned int begin, unsigned int end,
+	const struct ignore_frame *ignores, int plan)
+{
+	struct walker *walker = state->walker;
+	const struct index_map *index = walker->index;
+	size_t len = state->path.len, dir_len = len - state->root_len;
+	const char *path = state->path.buf + state->root_len;
+	struct strbuf names = STRBUF_INIT;
+	struct ignore_frame *frame = NULL;
+	struct dir_entry *entries;
+	unsigned int nr, at = begin;
+
+	if (walker->options->exclude_standard && (frame = read_ignore_frame(state, ignores)))
+		ignores = frame;
+
+	if (directory_entries(state, &names, &entries, &nr) < 0) {
+		free(frame);
+		strbuf_release(&names);
+		return;
+	}
+
+	for (unsigned int i = 0; i < nr; i++) {
+		const struct dir_entry *entry = &entries[i];
+		int cmp = 1;
+
+		/* the index entries before this name are not in the work tree */
+		while (at < end) {
+			size_t key_len;
+			int is_dir;
+			const char *key = index_key(index, at, dir_len, &key_len, &is_dir);
+
+			cmp = key_cmp(key, key_len, is_dir, entry->name, entry->len, entry->is_dir);
+			if (cmp >= 0)
+				break;
+			at++;
+		}
+
+		strbuf_add(&state->path, entry->name, entry->len);
+		/* the buffer may have moved */
+		path = state->path.buf + state->root_len;
+		if (!entry->is_dir) {
+			/* tracked files are never ignored */
+			if (cmp && !is_ignored(walker, ignores, path, dir_len + entry->len, 0))
+				add_found(state, path, dir_len + entry->len);
+		} else if (!is_ignored(walker, ignores, path, dir_len + entry->len, 1)) {
+			unsigned int sub_end = at;
+
+			while (!cmp && sub_end < end) {
+				size_t key_len;
+				int is_dir;
+				const char *key = index_key(index, sub_end, dir_len, &key_len, &is_dir);
+
+				if (key_cmp(key, key_len, is_dir, entry->name, entry->len, 1))
+					break;
+				sub_end++;
+			}
+			strbuf_addch(&state->path, '/');
+			if (sub_end > at)
+				descend(state, at, sub_end, ignores, plan);
+			else
+				untracked_directory(state, at, begin, entry, dir_len, ignores, plan);
+			at = sub_end;
+		}
+		strbuf_setlen(&state->path, len);
+	}
+
+	free(entries);
+	strbuf_release(&names);
+
+	/* the directories queued need the ignore rules of this one */
+	if (plan && frame) {
+		ALLOC_GROW(walker->frames, walker->nr_frames + 1, walker->frames_alloc);
+		walker->frames[walker->nr_frames++] = frame;
+	} else {
+		free(frame);
+	}
+}
+
+static void init_walk_state(struct walk_state *state, struct walker *walker, unsigned int worker)
+{
+	state->walker = walker;
+	state->found = &walker->found[worker];
+	state->arena = &walker->arenas[worker];
+	state->records = &walker->records[worker];
+	strbuf_init(&state->path, 0);
+	strbuf_addstr(&state->path, walker->options->work_tree);
+	if (state->path.len && state->path.buf[state->path.len - 1] != '/')
+		strbuf_addch(&state->path, '/');
+	state->root_len = state->path.len;
+}
+
+struct walk_job {
+	struct walker *walker;
+	struct walk_state *states; /* one per worker */
+};
+
+static void walk_worker_init(void *context, unsigned int worker)
+{
+	struct walk_job *job = context;
+
+	init_walk_state(&job->states[worker], job->walker, worker);
+}
+
+static void walk_worker_process(void *context, unsigned int worker, unsigned int item)
+{
+	struct walk_job *job = context;
+	struct walk_state *state = &job->states[worker];
+	const struct pending_dir *pending = &job->walker->pending[item];
+
+	strbuf_setlen(&state->path, state->root_len);
+	strbuf_addstr(&state->path, pending->path);
+	walk_directory(state, pending->begin, pending->end, pending->ignores, 0);
+}
+
+static void walk_worker_release(void *context, unsigned int worker)
+{
+	struct walk_job *job = context;
+
+	strbuf_release(&job->states[worker].path);
+}
+
+/*
+ * The .gitignore of the directories above the prefix, which are read
+ * first. Returns -1 if one of these directories is ignored
+ */
+static int prefix_ignores(struct walker *walker, const struct ignore_frame **ignores)
+{
+	const char *prefix = walker->options->prefix;
+	struct walk_state state;
+	int ignored = 0;
+
+	*ignores = NULL;
+	if (!walker->options->exclude_standard)
+		return 0;
+
+	init_walk_state(&state, walker, 0);
+	for (const char *slash = prefix; !ignored && (slash = strchr(slash, '/')); slash++) {
+		struct ignore_frame *frame = read_ignore_frame(&state, *ignores);
+
+		if (frame) {
+			ALLOC_GROW(walker->frames, walker->nr_frames + 1, walker->frames_alloc);
+			walker->frames[walker->nr_frames++] = frame;
+			*ignores = frame;
+		}
+		strbuf_add(&state.path, prefix + (state.path.len - state.root_len), slash - prefix - (state.path.len - state.root_len));
+		ignored = is_ignored(walker, *ignores, state.path.buf + state.root_len, state.path.len - state.root_len, 1);
+		strbuf_addch(&state.path, '/');
+	}
+
+	strbuf_release(&state.path);
+	return ignored ? -1 : 0;
+}
+
+/*
+ * Write the directories walked to the cache, unless it already has them
+ * all : with the fsmonitor, its old token still reports what changed
+ */
+static void save_cache(struct walker *walker, unsigned int workers)
+{
+	struct untracked_cache *cache = walker->cache;
+	const char *prefix = walker->options->prefix;
+	size_t prefix_len = strlen(prefix);
+	unsigned int nr = 0, read = 0, cached = 0;
+
+	for (unsigned int i = 0; i < workers; i++) {
+		nr += walker->records[i].nr;
+		read += walker->records[i].read;
+	}
+	for (unsigned int i = 0; i < cache->nr; i++)
+		if (!strncmp(cache->dirs[i].path, prefix, prefix_len))
+			cached++;
+
+	if (read || nr != cached || (cache->new_token && !cache->fsmonitor)) {
+		for (unsigned int i = 1; i < workers; i++)
+			strbuf_addbuf(&walker->records[0].buf, &walker->records[i].buf);
+		untracked_cache_write(cache, walker->options->cache_file, prefix, &walker->records[0].buf, nr);
+	}
+	trace_perf_add("untracked_cache_dirs_read", read);
+	trace_perf_add("untracked_cache_dirs_cached", nr - read);
+
+	for (unsigned int i = 0; i < workers; i++)
+		strbuf_release(&walker->records[i].buf);
+	untracked_cache_release(cache);
+	free(cache);
+}
+
+static int path_cmp(const void *a, const void *b)
+{
+	return strcmp(*(const char **)a, *(const char **)b);
+}
+
+void list_untracked(struct untracked *untracked, const struct index_map *index, const struct untracked_options *options)
+{
+	unsigned int workers = options->workers ? options->workers : 1;
+	const struct ignore_frame *ignores;
+	struct walker walker;
+	struct walk_state state;
+	size_t prefix_len = strlen(options->prefix);
+	unsigned int begin, end;
+
+	memset(&walker, 0, sizeof(walker));
+	walker.options = options;
+	walker.index = index;
+	walker.found = xcalloc(workers, sizeof(*walker.found));
+	walker.arenas = xcalloc(workers, sizeof(*walker.arenas));
+	walker.records = xcalloc(workers, sizeof(*walker.records));
+	for (unsigned int i = 0; i < workers; i++)
+		strbuf_init(&walker.records[i].buf, 0);
+	if (options->cache_file) {
+		walker.cache = xmalloc(sizeof(*walker.cache));
+		untracked_cache_load(walker.cache, options->cache_file);
+		/* asked before reading anything : what changes during the walk is reported next time */
+		if (options->fsmonitor_hook)
+			untracked_cache_query_fsmonitor(walker.cache, options->fsmonitor_hook, options->work_tree);
+	}
+	if (options->exclude_standard) {
+		if (options->info_exclude)
+			walker.global[0] = ignore_list_load(options->info_exclude, "", 0);
+		if (options->excludes_file)
+			walker.global[1] = ignore_list_load(options->excludes_file, "", 0);
+	}
+
+	uint64_t start = trace_perf_start();
+	if (prefix_ignores(&walker, &ignores) == 0) {
+		begin = index_map_lower_bound(index, options->prefix, prefix_len);
+		end = index_map_prefix_end(index, begin, options->prefix, prefix_len);
+		queue_directory(&walker, options->prefix, prefix_len, begin, end, ignores);
+	}
+
+	/* the top levels are read here, until there are directories enough for the workers */
+	init_walk_state(&state, &walker, 0);
+	for (unsigned int depth = 0; workers > 1 && depth < MAX_PLAN_DEPTH &&
+	     walker.nr_pending && walker.nr_pending < DIRECTORIES_PER_WORKER * workers; depth++) {
+		struct pending_dir *level = walker.pending;
+		unsigned int nr = walker.nr_pending;
+
+		walker.pending = NULL;
+		walker.nr_pending = walker.pending_alloc = 0;
+		for (unsigned int i = 0; i < nr; i++) {
+			strbuf_setlen(&state.path, state.root_len);
+			strbuf_addstr(&state.path, level[i].path);
+			walk_directory(&state, level[i].begin, level[i].end, level[i].ignores, 1);
+		}
+		free(level);
+	}
+	strbuf_release(&state.path);
+
+	/* one directory at a time : workers which are done take the next one */
+	struct walk_job job = {&walker, xcalloc(workers, sizeof(struct walk_state))};
+	struct parallel_job parallel = {
+		walker.nr_pending, 1,
+		walk_worker_init, walk_worker_process, walk_worker_release,
+		&job
+	};
+	run_parallel(&parallel, workers);
+	free(job.states);
+
+	untracked->nr = 0;
+	for (unsigned int i = 0; i < workers; i++)
+		untracked->nr += walker.found[i].nr;
+	untracked->paths = xmalloc((untracked->nr ? untracked->nr : 1) * sizeof(*untracked->paths));
+	untracked->nr = 0;
+	for (unsigned int i = 0; i < workers; i++) {
+		if (walker.found[i].nr)
+			memcpy(untracked->paths + untracked->nr, walker.found[i].paths,
+			       walker.found[i].nr * sizeof(*untracked->paths));
+		untracked->nr += walker.found[i].nr;
+		free(walker.found[i].paths);
+	}
+	qsort(untracked->paths, untracked->nr, sizeof(*untracked->paths), path_cmp);
+	untracked->arenas = walker.arenas;
+	untracked->nr_arenas = workers;
+	if (walker.cache)
+		save_cache(&walker, workers);
+	else
+		for (unsigned int i = 0; i < workers; i++)
+			strbuf_release(&walker.records[i].buf);
+	trace_perf_stop("list_untracked", start);
+
+	for (unsigned int i = 0; i < walker.nr_frames; i++)
+		free(walker.frames[i]);
+	free(walker.frames);
+	free(walker.pending);
+	arena_release(&walker.pending_paths);
+	free(walker.found);
+	free(walker.records);
+}
+
+void untracked_release(struct untracked *untracked)
+{
+	for (unsigned int i = 0; i < untracked->nr_arenas; i++)
+		arena_release(&untracked->arenas[i]);
+	free(untracked->arenas);
+	free(untracked->paths);
+	untracked->arenas = NULL;
+	untracked->paths = NULL;
+	untracked->nr = untracked->nr_arenas = 0;
+}
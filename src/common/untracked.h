@@ -0,0 +1,41 @@
+#ifndef UNTRACKED_H
+#define UNTRACKED_H
+
+#include "index-map.h"
+#include "arena.h"
+
+/*
+ * The untracked files of a work tree, as "git ls-files --others" finds
+ * them : the directories are read on several threads, one directory per
+ * work item, and the names of each are merge-joined with the slice of
+ * the sorted index below it, so no path is looked up in the index.
+ *
+ * ".git" is never listed, untracked repositories are listed as "dir/"
+ * without their contents, and with exclude_standard the ignored files
+ * and directories (.gitignore, info/exclude, core.excludesFile) are
+ * left out : ignored directories are not read at all.
+ */
+
+struct untracked_options {
+	const char *work_tree; /* absolute */
+	const char *prefix; /* only below it : "" or "dir/" */
+	int exclude_standard;
+	const char *info_exclude; /* the files of exclude_standard, NULL if none */
+	const char *excludes_file;
+	unsigned int workers;
+	const char *cache_file; /* see untracked-cache.h, NULL for none */
+	const char *fsmonitor_hook; /* with the cache, NULL for none */
+};
+
+struct untracked {
+	const char **paths; /* from the top of the work tree, sorted */
+	unsigned int nr;
+	struct arena *arenas; /* of the paths, one per worker */
+	unsigned int nr_arenas;
+};
+
+void list_untracked(struct untracked *untracked, const struct index_map *index, const struct untracked_options *options);
+
+void untracked_release(struct untracked *untracked);
+
+#endif
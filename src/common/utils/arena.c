@@ -0,0 +1,88 @@
+#include <string.h>
+#include <stdint.h>
+#include "arena.h"
+#include "utils.h"
+
+#define ARENA_ALIGNMENT 16
+
+struct arena_block {
+	struct arena_block *next;
+	size_t size, used;
+	/* malloc() aligns the block, a new block starts aligned enough */
+	char data[] __attribute__((aligned(ARENA_ALIGNMENT)));
+};
+
+static struct arena_block *new_block(size_t size)
+{
+	struct arena_block *block = xmalloc(sizeof(*block) + size);
+
+	block->size = size;
+	block->used = 0;
+	return block;
+}
+
+static void *arena_alloc_aligned(struct arena *arena, size_t size, size_t alignment)
+{
+	struct arena_block *block = arena->blocks;
+	size_t offset;
+
+	if (block) {
+		uintptr_t start = (uintptr_t)(block->data + block->used);
+
+		offset = block->used + (((start + alignment - 1) & ~(uintptr_t)(alignment - 1)) - start);
+		if (offset <= block->size && size <= block->size - offset) {
+			block->used = offset + size;
+			return block->data + offset;
+		}
+	}
+
+	/* big allocations get a block of their own, behind the current one */
+	if (size > ARENA_BLOCK_SIZE / 4) {
+		struct arena_block *big = new_block(size);
+
+		big->used = size;
+		if (block) {
+			big->next = block->next;
+			block->next = big;
+		} else {
+			big->next = NULL;
+			arena->blocks = big;
+		}
+		return big->data;
+	}
+
+	block = new_block(ARENA_BLOCK_SIZE);
+	block->next = arena->blocks;
+	arena->blocks = block;
+	block->used = size;
+	return block->data;
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+	return arena_alloc_aligned(arena, size, ARENA_ALIGNMENT);
+}
+
+char *arena_memdupz(struct arena *arena, const void *data, size_t len)
+{
+	char *copy = arena_alloc_aligned(arena, len + 1, 1);
+
+	memcpy(copy, data, len);
+	copy[len] = '\0';
+	return copy;
+}
+
+char *arena_strdup(struct arena *arena, const char *str)
+{
+	return arena_memdupz(arena, str, strlen(str));
+}
+
+void arena_release(struct arena *arena)
+{
+	while (arena->blocks) {
+		struct arena_block *next = arena->blocks->next;
+
+		free(arena->blocks);
+		arena->blocks = next;
+	}
+}
@@ -0,0 +1,33 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+ * A bump allocator for the many small, short-lived allocations of a
+ * command (paths, names) : they are carved out of big blocks, sized
+ * exactly, and all freed at once by arena_release(). Individual
+ * allocations cannot be freed.
+ */
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+struct arena_block;
+
+struct arena {
+	struct arena_block *blocks; /* the one allocations come from first */
+};
+
+#define ARENA_INIT { NULL }
+
+void *arena_alloc(struct arena *arena, size_t size);
+//size bytes aligned for any type. Dies when out of memory, as xmalloc()
+
+char *arena_strdup(struct arena *arena, const char *str);
+char *arena_memdupz(struct arena *arena, const void *data, size_t len);
+//copies of strings, NUL terminated, with no alignment padding
+
+void arena_release(struct arena *arena);
+//free everything allocated from arena
+
+#endif
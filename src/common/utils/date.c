@@ -11,6 +11,7 @@
 #include "errors.h"
 #include "date.h"
 #include "ctype.h"
+#include "utils.h"
 
 /*
  * This is like mktime, but without normalization of tm_wday and tm_yday.
@@ -67,27 +68,57 @@ static struct tm *time_to_tm(unsigned long time, int tz)
 }
 
 /*
- * What value of "tz" was in effect back then at "time" in the
- * local timezone?
+ * The local timezone changes its offset at the start of a minute : the
+ * offset found for a time holds for the whole minute, as long as TZ does
+ * not change.
  */
-static int local_tzoffset(unsigned long time)
+#define TZ_SLOT 60
+
+static struct {
+	int valid;
+	unsigned long slot;
+	char *tz; /* NULL when TZ is not set */
+	int minutes;
+} local_offset;
+
+/* How many minutes east of UTC the local timezone was at "time" */
+static int local_offset_minutes(unsigned long time)
 {
+	const char *tz = getenv("TZ");
+	int same_tz = tz ? local_offset.tz && !strcmp(tz, local_offset.tz) : !local_offset.tz;
 	time_t t, t_local;
 	struct tm tm;
-	int offset, eastwest;
 
+	if (local_offset.valid && same_tz && local_offset.slot == time / TZ_SLOT)
+		return local_offset.minutes;
+
+	/* localtime_r() may not read TZ again by itself */
+	if (!same_tz)
+		tzset();
 	t = time;
 	localtime_r(&t, &tm);
 	t_local = tm_to_time_t(&tm);
 
-	if (t_local < t) {
+	free(local_offset.tz);
+	local_offset.tz = tz ? xstrdup(tz) : NULL;
+	local_offset.slot = time / TZ_SLOT;
+	local_offset.minutes = (t_local - t) / 60;
+	local_offset.valid = 1;
+	return local_offset.minutes;
+}
+
+/*
+ * What value of "tz" was in effect back then at "time" in the
+ * local timezone?
+ */
+static int local_tzoffset(unsigned long time)
+{
+	int offset = local_offset_minutes(time), eastwest = 1;
+
+	if (offset < 0) {
 		eastwest = -1;
-		offset = t - t_local;
-	} else {
-		eastwest = 1;
-		offset = t_local - t;
+		offset = -offset;
 	}
-	offset /= 60; /* in minutes */
 	offset = (offset % 60) + ((offset / 60) * 100);
 	return offset * eastwest;
 }
@@ -561,23 +592,35 @@ static int match_digit(const char *date, struct tm *tm, int *offset, int *tm_gmt
 static int match_tz(const char *date, int *offp)
 {
 	char *end;
-	int offset = strtoul(date+1, &end, 10);
-	int min, hour;
-	int n = end - date - 1;
+	int hour = strtoul(date + 1, &end, 10);
+	int n = end - (date + 1);
+	int min = 0;
 
-	min = offset % 100;
-	hour = offset / 100;
+	if (n == 4) {
+		/* hhmm */
+		min = hour % 100;
+		hour = hour / 100;
+	} else if (n != 2) {
+		min = 99; /* random crap */
+	} else if (*end == ':') {
+		/* hh:mm? */
+		min = strtoul(end + 1, &end, 10);
+		if (end - (date + 1) != 5)
+			min = 99; /* random crap */
+	} /* otherwise we parsed "hh" */
 
 	/*
-	 * Don't accept any random crap.. At least 3 digits, and
-	 * a valid minute. We might want to check that the minutes
-	 * are divisible by 30 or something too.
+	 * Don't accept any random crap. Even though some places have
+	 * offset larger than 12 hours (e.g. Pacific/Kiritimati is at
+	 * UTC+14), there is something wrong if hour part is much
+	 * larger than that. We might also want to check that the
+	 * minutes are divisible by 15 or something too. (Offset of
+	 * Kathmandu, Nepal is UTC+5:45)
 	 */
-	if (min < 60 && n > 2) {
-		offset = hour*60+min;
+	if (min < 60 && hour < 24) {
+		int offset = hour * 60 + min;
 		if (*date == '-')
 			offset = -offset;
-
 		*offp = offset;
 	}
 	return end - date;
@@ -594,6 +637,99 @@ static int date_string(unsigned long date, int offset, char *buf, int len)
 	return snprintf(buf, len, "%lu %c%02d%02d", date, sign, offset / 60, offset % 60);
 }
 
+/* Read exactly n digits at *date into *value */
+static int read_digits(const char **date, int n, int *value)
+{
+	int v = 0;
+
+	while (n--) {
+		if (!isdigit(**date))
+			return -1;
+		v = v * 10 + *(*date)++ - '0';
+	}
+	*value = v;
+	return 0;
+}
+
+/* A "+hhmm" (or "-hhmm") offset at *date, in minutes : git takes no more than 23:59 */
+static int read_tz(const char **date, int *offset)
+{
+	int sign = **date == '-' ? -1 : 1, hhmm;
+
+	if ((**date != '+' && **date != '-') || ((*date)++, read_digits(date, 4, &hhmm)) ||
+	    hhmm / 100 >= 24 || hhmm % 100 >= 60)
+		return -1;
+	*offset = sign * ((hhmm / 100) * 60 + hhmm % 100);
+	/* which parse_date_basic() takes for no offset at all */
+	return *offset == -1 ? -1 : 0;
+}
+
+/*
+ * The formats git itself writes, and which scripts set in GIT_AUTHOR_DATE
+ * and GIT_COMMITTER_DATE : "[@]<seconds> +hhmm" and ISO 8601's
+ * "yyyy-mm-ddThh:mm:ss" (or with a space instead of the 'T') followed by
+ * "Z" or "[ ]+hhmm". They are read strictly, with the results the
+ * heuristics below would give. Returns -1 for anything else, to be left
+ * to them.
+ */
+static int parse_date_strict(const char *date, unsigned long *timestamp, int *offset)
+{
+	struct tm tm;
+	time_t t;
+
+	/* anything but "yyyy-" is read as seconds */
+	if (strnlen(date, 5) < 5 || date[4] != '-') {
+		unsigned long seconds;
+		char *end;
+
+		date += *date == '@';
+		if (!isdigit(*date))
+			return -1;
+		errno = 0;
+		seconds = strtoul(date, &end, 10);
+		/* fewer digits could be a YYYYMMDD date, and tm_to_time_t() stops at 2099 */
+		if (errno || seconds < 100000000 || seconds >= 4102444800UL || *end != ' ')
+			return -1;
+		date = end + 1;
+		if (read_tz(&date, offset) < 0 || (*date && *date != '\n'))
+			return -1;
+		*timestamp = seconds;
+		return 0;
+	}
+
+	memset(&tm, 0, sizeof(tm));
+	if (read_digits(&date, 4, &tm.tm_year) < 0 || *date++ != '-' ||
+	    read_digits(&date, 2, &tm.tm_mon) < 0 || *date++ != '-' ||
+	    read_digits(&date, 2, &tm.tm_mday) < 0 || (*date != 'T' && *date != ' ') ||
+	    (date++, read_digits(&date, 2, &tm.tm_hour)) < 0 || *date++ != ':' ||
+	    read_digits(&date, 2, &tm.tm_min) < 0 || *date++ != ':' ||
+	    read_digits(&date, 2, &tm.tm_sec) < 0)
+		return -1;
+	if (tm.tm_year < 1970 || tm.tm_year > 2099 || tm.tm_mon < 1 || tm.tm_mon > 12 ||
+	    tm.tm_mday < 1 || tm.tm_mday > 31 || tm.tm_hour > 23 || tm.tm_min > 59 || tm.tm_sec > 59)
+		return -1;
+
+	if (*date == 'Z') {
+		date++;
+		*offset = 0;
+	} else {
+		if (*date == ' ')
+			date++;
+		if (read_tz(&date, offset) < 0)
+			return -1;
+	}
+	if (*date && *date != '\n')
+		return -1;
+
+	tm.tm_year -= 1900;
+	tm.tm_mon--;
+	t = tm_to_time_t(&tm);
+	if (t == -1)
+		return -1;
+	*timestamp = t - *offset * 60;
+	return 0;
+}
+
 /* Gr. strptime is crap for this; it doesn't have a way to require RFC2822
    (i.e. English) day/month names, and it doesn't work correctly with %z. */
 int parse_date_basic(const char *date, unsigned long *timestamp, int *offset)
@@ -608,6 +744,9 @@ int parse_date_basic(const char *date, unsigned long *timestamp, int *offset)
 	if (!offset)
 		offset = &dummy_offset;
 
+	if (!parse_date_strict(date, timestamp, offset))
+		return 0;
+
 	memset(&tm, 0, sizeof(tm));
 	tm.tm_year = -1;
 	tm.tm_mon = -1;
@@ -693,8 +832,7 @@ void datestamp(char *buf, int bufsize)
 
 	time(&now);
 
-	offset = tm_to_time_t(localtime(&now)) - now;
-	offset /= 60;
+	offset = local_offset_minutes(now);
 
 	date_string(now, offset, buf, bufsize);
 }
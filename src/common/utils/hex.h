@@ -0,0 +1,24 @@
+#ifndef HEX_H
+#define HEX_H
+
+#include <stddef.h>
+#include <git2.h>
+
+/*
+ * Hexadecimal encoding through a table of the 256 byte pairs : one load
+ * and one 2 bytes store per input byte, instead of the two nibble
+ * lookups of git_oid_fmt().
+ */
+
+char *hex_encode(char *out, const unsigned char *data, size_t len);
+//write the 2 * len lowercase hex digits of data in out (not NUL
+//terminated). Returns the end of what was written
+
+char *oid_to_hex(char *out, const git_oid *oid);
+//write the GIT_OID_HEXSZ hex digits of oid in out (not NUL terminated),
+//as git_oid_fmt() does. Returns out + GIT_OID_HEXSZ
+
+int hex_value(int c);
+//the value of the hex digit c, -1 if it is not one
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef OID_HASH_H
+#define OID_HASH_H
+
+#include <stddef.h>
+#include <string.h>
+#include <git2.h>
+
+/*
+ * The hash of an oid in the tables keyed by oids (the oid sets and maps,
+ * the buckets of the pack writer, the tree cache, the shared object
+ * cache) : its first bytes, sha1s being already well spread.
+ */
+
+static inline size_t oid_hash(const git_oid *oid)
+{
+	unsigned int hash;
+
+	memcpy(&hash, oid->id, sizeof(hash));
+	return hash;
+}
+
+#endif
@@ -0,0 +1,195 @@
+#include <stdint.h>
+#include <string.h>
+#include "oid-set.h"
+#include "oid-hash.h"
+#include "utils.h"
+
+#define OID_SET_INITIAL_SIZE 1024
+
+/* Word by word : memcmp() is a call for each probe */
+static inline int oid_equal(const git_oid *a, const git_oid *b)
+{
+	uint64_t a0, a1, b0, b1;
+	uint32_t a2, b2;
+
+	memcpy(&a0, a->id, 8);
+	memcpy(&b0, b->id, 8);
+	memcpy(&a1, a->id + 8, 8);
+	memcpy(&b1, b->id + 8, 8);
+	memcpy(&a2, a->id + 16, 4);
+	memcpy(&b2, b->id + 16, 4);
+	return !((a0 ^ b0) | (a1 ^ b1) | (a2 ^ b2));
+}
+
+static inline int is_null(const git_oid *oid)
+{
+	static const git_oid null_oid;
+
+	return oid_equal(oid, &null_oid);
+}
+
+/* The smallest table at most half full with nr oids */
+static size_t table_size(size_t size, size_t nr)
+{
+	if (!size)
+		size = OID_SET_INITIAL_SIZE;
+	while (2 * nr > size)
+		size *= 2;
+	return size;
+}
+
+/* Slot holding oid, or the free slot where it should go */
+static size_t find_slot(const struct oid_set *set, const git_oid *oid)
+{
+	size_t mask = set->size - 1;
+	size_t i;
+
+	for (i = oid_hash(oid) & mask; !is_null(&set->entries[i]); i = (i + 1) & mask) {
+		if (oid_equal(&set->entries[i], oid))
+			break;
+	}
+
+	return i;
+}
+
+static void rehash(struct oid_set *set, size_t new_size)
+{
+	git_oid *old_entries = set->entries;
+	size_t old_size = set->size;
+
+	set->entries = xcalloc(new_size, sizeof(*set->entries));
+	set->size = new_size;
+
+	for (size_t i = 0; i < old_size; i++) {
+		if (!is_null(&old_entries[i]))
+			set->entries[find_slot(set, &old_entries[i])] = old_entries[i];
+	}
+
+	free(old_entries);
+}
+
+int oid_set_contains(const struct oid_set *set, const git_oid *oid)
+{
+	if (is_null(oid))
+		return set->has_null;
+	if (!set->size)
+		return 0;
+
+	return !is_null(&set->entries[find_slot(set, oid)]);
+}
+
+int oid_set_add(struct oid_set *set, const git_oid *oid)
+{
+	size_t slot;
+
+	if (is_null(oid)) {
+		if (set->has_null)
+			return 0;
+		return set->has_null = 1;
+	}
+
+	if (2 * (set->nr + 1) > set->size)
+		rehash(set, table_size(set->size, set->nr + 1));
+
+	slot = find_slot(set, oid);
+	if (!is_null(&set->entries[slot]))
+		return 0;
+
+	set->entries[slot] = *oid;
+	set->nr++;
+	return 1;
+}
+
+void oid_set_reserve(struct oid_set *set, size_t nr)
+{
+	if (2 * nr > set->size)
+		rehash(set, table_size(set->size, nr));
+}
+
+void oid_set_clear(struct oid_set *set)
+{
+	free(set->entries);
+	set->entries = NULL;
+	set->size = set->nr = 0;
+	set->has_null = 0;
+}
+
+/* Never empty, so that a value is not NULL */
+static void *new_value(struct oid_map *map)
+{
+	size_t size = map->value_size ? map->value_size : 1;
+	void *value = arena_alloc(&map->values, size);
+
+	memset(value, 0, size);
+	return value;
+}
+
+static size_t find_map_slot(const struct oid_map *map, const git_oid *oid)
+{
+	size_t mask = map->size - 1;
+	size_t i;
+
+	for (i = oid_hash(oid) & mask; map->entries[i].value; i = (i + 1) & mask) {
+		if (oid_equal(&map->entries[i].oid, oid))
+			break;
+	}
+
+	return i;
+}
+
+static void rehash_map(struct oid_map *map, size_t new_size)
+{
+	struct oid_map_entry *old_entries = map->entries;
+	size_t old_size = map->size;
+
+	map->entries = xcalloc(new_size, sizeof(*map->entries));
+	map->size = new_size;
+
+	for (size_t i = 0; i < old_size; i++) {
+		if (old_entries[i].value)
+			map->entries[find_map_slot(map, &old_entries[i].oid)] = old_entries[i];
+	}
+
+	free(old_entries);
+}
+
+void *oid_map_get(const struct oid_map *map, const git_oid *oid)
+{
+	if (!map->size)
+		return NULL;
+
+	return map->entries[find_map_slot(map, oid)].value;
+}
+
+void *oid_map_put(struct oid_map *map, const git_oid *oid, int *added)
+{
+	struct oid_map_entry *entry;
+
+	if (2 * (map->nr + 1) > map->size)
+		rehash_map(map, table_size(map->size, map->nr + 1));
+
+	entry = &map->entries[find_map_slot(map, oid)];
+	if (added)
+		*added = !entry->value;
+	if (!entry->value) {
+		entry->oid = *oid;
+		entry->value = new_value(map);
+		map->nr++;
+	}
+
+	return entry->value;
+}
+
+void oid_map_reserve(struct oid_map *map, size_t nr)
+{
+	if (2 * nr > map->size)
+		rehash_map(map, table_size(map->size, nr));
+}
+
+void oid_map_clear(struct oid_map *map)
+{
+	arena_release(&map->values);
+	free(map->entries);
+	map->entries = NULL;
+	map->size = map->nr = 0;
+}
@@ -0,0 +1,62 @@
+#ifndef OID_SET_H
+#define OID_SET_H
+
+#include <stddef.h>
+#include <git2.h>
+#include "arena.h"
+
+/*
+ * Sets and maps keyed by oids (open addressing, linear probing), held in
+ * one flat array : looking an oid up reads one or two cache lines, and
+ * adding one allocates nothing but when the table grows. Oids are
+ * hashed by oid_hash().
+ */
+
+struct oid_set {
+	git_oid *entries;
+	size_t size; /* always a power of 2, or 0 */
+	size_t nr;
+	int has_null; /* the null oid marks a free slot, so it is kept aside */
+};
+
+#define OID_SET_INIT { NULL, 0, 0, 0 }
+
+int oid_set_contains(const struct oid_set *set, const git_oid *oid);
+int oid_set_add(struct oid_set *set, const git_oid *oid);
+//returns 1 if oid was added, 0 if it was already there
+void oid_set_reserve(struct oid_set *set, size_t nr);
+//make room for nr oids in all, so that adding them does not rehash
+void oid_set_clear(struct oid_set *set);
+
+/*
+ * The values of a map all have the size given to OID_MAP_INIT, and live
+ * in an arena : a value stays where it is until oid_map_clear(), however
+ * much the map grows.
+ */
+
+struct oid_map_entry {
+	git_oid oid;
+	void *value; /* NULL for a free slot */
+};
+
+struct oid_map {
+	struct oid_map_entry *entries;
+	size_t size; /* always a power of 2, or 0 */
+	size_t nr;
+	size_t value_size;
+	struct arena values;
+};
+
+#define OID_MAP_INIT(value_size) { NULL, 0, 0, (value_size), ARENA_INIT }
+
+void *oid_map_get(const struct oid_map *map, const git_oid *oid);
+//the value of oid, NULL if it is not in map
+void *oid_map_put(struct oid_map *map, const git_oid *oid, int *added);
+//the value of oid, zeroed if it is new. *added (unless added is NULL)
+//tells whether it was
+void oid_map_reserve(struct oid_map *map, size_t nr);
+//make room for nr oids in all
+void oid_map_clear(struct oid_map *map);
+//free the map and all its values
+
+#endif
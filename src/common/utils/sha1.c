@@ -0,0 +1,98 @@
+#include <string.h>
+#include "sha1.h"
+#include "byte-order.h"
+
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static void sha1_block(struct sha1_ctx *ctx, const unsigned char *data)
+{
+	uint32_t w[80];
+	uint32_t a = ctx->h[0], b = ctx->h[1], c = ctx->h[2], d = ctx->h[3], e = ctx->h[4];
+
+	for (int i = 0; i < 16; i++)
+		w[i] = get_be32_at(data + 4 * i);
+	for (int i = 16; i < 80; i++)
+		w[i] = ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+	for (int i = 0; i < 80; i++) {
+		uint32_t f, k, t;
+
+		if (i < 20) {
+			f = (b & c) | (~b & d);
+			k = 0x5a827999;
+		} else if (i < 40) {
+			f = b ^ c ^ d;
+			k = 0x6ed9eba1;
+		} else if (i < 60) {
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8f1bbcdc;
+		} else {
+			f = b ^ c ^ d;
+			k = 0xca62c1d6;
+		}
+
+		t = ROL(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = ROL(b, 30);
+		b = a;
+		a = t;
+	}
+
+	ctx->h[0] += a;
+	ctx->h[1] += b;
+	ctx->h[2] += c;
+	ctx->h[3] += d;
+	ctx->h[4] += e;
+}
+
+void sha1_init(struct sha1_ctx *ctx)
+{
+	ctx->h[0] = 0x67452301;
+	ctx->h[1] = 0xefcdab89;
+	ctx->h[2] = 0x98badcfe;
+	ctx->h[3] = 0x10325476;
+	ctx->h[4] = 0xc3d2e1f0;
+	ctx->size = 0;
+}
+
+void sha1_update(struct sha1_ctx *ctx, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	size_t used = ctx->size % 64;
+
+	ctx->size += len;
+
+	if (used) {
+		size_t fill = 64 - used < len ? 64 - used : len;
+
+		memcpy(ctx->block + used, p, fill);
+		p += fill;
+		len -= fill;
+		if (used + fill < 64)
+			return;
+		sha1_block(ctx, ctx->block);
+	}
+
+	for (; len >= 64; p += 64, len -= 64)
+		sha1_block(ctx, p);
+
+	memcpy(ctx->block, p, len);
+}
+
+void sha1_final(unsigned char hash[SHA1_RAWSZ], struct sha1_ctx *ctx)
+{
+	static const unsigned char padding[64] = {0x80};
+	unsigned char length[8];
+	uint64_t bits = ctx->size * 8;
+	size_t used = ctx->size % 64;
+
+	put_be32_at(length, bits >> 32);
+	put_be32_at(length + 4, bits);
+
+	sha1_update(ctx, padding, used < 56 ? 56 - used : 120 - used);
+	sha1_update(ctx, length, 8);
+
+	for (int i = 0; i < 5; i++)
+		put_be32_at(hash + 4 * i, ctx->h[i]);
+}
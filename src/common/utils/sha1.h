@@ -0,0 +1,24 @@
+#ifndef SHA1_H
+#define SHA1_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Plain SHA-1, for the checksums of the files git2 writes itself (the
+ * index). Objects are hashed by libgit2 (git_odb_hash).
+ */
+
+#define SHA1_RAWSZ 20
+
+struct sha1_ctx {
+	uint32_t h[5];
+	uint64_t size;
+	unsigned char block[64];
+};
+
+void sha1_init(struct sha1_ctx *ctx);
+void sha1_update(struct sha1_ctx *ctx, const void *data, size_t len);
+void sha1_final(unsigned char hash[SHA1_RAWSZ], struct sha1_ctx *ctx);
+
+#endif
@@ -295,11 +295,36 @@ size_t strbuf_fread(struct strbuf *sb, size_t size, FILE *f)
 	return res;
 }
 
+/*
+ * What is left to read from fd, if it tells : the rest of a regular
+ * file (plus one byte to see its end without growing), or the bytes
+ * waiting in a pipe or a socket. 0 when it does not know
+ */
+static size_t read_size_hint(int fd)
+{
+	struct stat st;
+	int avail;
+
+	if (!fstat(fd, &st) && S_ISREG(st.st_mode)) {
+		off_t pos = lseek(fd, 0, SEEK_CUR);
+		if (pos >= 0 && st.st_size > pos)
+			return st.st_size - pos + 1;
+		return 0;
+	}
+#ifdef FIONREAD
+	if (!ioctl(fd, FIONREAD, &avail) && avail > 0)
+		return avail;
+#endif
+	return 0;
+}
+
 ssize_t strbuf_read(struct strbuf *sb, int fd, size_t hint)
 {
 	size_t oldlen = sb->len;
 	size_t oldalloc = sb->alloc;
 
+	if (!hint)
+		hint = read_size_hint(fd);
 	strbuf_grow(sb, hint ? hint : 8192);
 	for (;;) {
 		ssize_t cnt;
@@ -315,7 +340,11 @@ ssize_t strbuf_read(struct strbuf *sb, int fd, size_t hint)
 		if (!cnt)
 			break;
 		sb->len += cnt;
-		strbuf_grow(sb, 8192);
+		/* only when full : strbuf_grow() then grows it geometrically, by alloc_nr() */
+		if (sb->len + 1 == sb->alloc) {
+			hint = read_size_hint(fd);
+			strbuf_grow(sb, hint > 8192 ? hint : 8192);
+		}
 	}
 
 	sb->buf[sb->len] = '\0';
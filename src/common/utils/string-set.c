@@ -0,0 +1,166 @@
+#include <string.h>
+#include "string-set.h"
+#include "utils.h"
+
+#define STRING_SET_INITIAL_SIZE 64
+
+/* marks a slot whose string was removed, so that probing goes on */
+static char deleted_entry[1];
+
+/* FNV-1a */
+static unsigned int hash_string(const char *str)
+{
+	unsigned int hash = 2166136261u;
+
+	while (*str) {
+		hash ^= (unsigned char)*str++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+/* Slot holding str, or the empty slot where it should go */
+static size_t find_slot(const struct string_set *set, const char *str, unsigned int hash)
+{
+	size_t mask = set->size - 1;
+	size_t i = hash & mask;
+	size_t first_deleted = set->size;
+
+	for (;;) {
+		char *entry = set->entries[i];
+
+		if (!entry)
+			return first_deleted < set->size ? first_deleted : i;
+
+		if (entry == deleted_entry) {
+			if (first_deleted == set->size)
+				first_deleted = i;
+		} else if (set->hashes[i] == hash && !strcmp(entry, str)) {
+			return i;
+		}
+
+		i = (i + 1) & mask;
+	}
+}
+
+static void rehash(struct string_set *set, size_t new_size)
+{
+	char **old_entries = set->entries;
+	unsigned int *old_hashes = set->hashes;
+	size_t old_size = set->size;
+	size_t i;
+
+	set->entries = xcalloc(new_size, sizeof(*set->entries));
+	set->hashes = xcalloc(new_size, sizeof(*set->hashes));
+	set->size = new_size;
+	set->deleted = 0;
+
+	for (i = 0; i < old_size; i++) {
+		size_t slot;
+
+		if (!old_entries[i] || old_entries[i] == deleted_entry)
+			continue;
+
+		slot = old_hashes[i] & (new_size - 1);
+		while (set->entries[slot])
+			slot = (slot + 1) & (new_size - 1);
+
+		set->entries[slot] = old_entries[i];
+		set->hashes[slot] = old_hashes[i];
+	}
+
+	free(old_entries);
+	free(old_hashes);
+}
+
+int string_set_contains(const struct string_set *set, const char *str)
+{
+	size_t slot;
+	char *entry;
+
+	if (!set->nr)
+		return 0;
+
+	slot = find_slot(set, str, hash_string(str));
+	entry = set->entries[slot];
+
+	return entry && entry != deleted_entry;
+}
+
+int string_set_add(struct string_set *set, const char *str)
+{
+	unsigned int hash = hash_string(str);
+	size_t slot;
+
+	/* keep at most 3/4 of the slots in use, tombstones included */
+	if (!set->size)
+		rehash(set, STRING_SET_INITIAL_SIZE);
+	else if ((set->nr + set->deleted + 1) * 4 > set->size * 3)
+		rehash(set, set->nr * 2 >= set->size ? set->size * 2 : set->size);
+
+	slot = find_slot(set, str, hash);
+	if (set->entries[slot] && set->entries[slot] != deleted_entry)
+		return 0;
+
+	if (set->entries[slot] == deleted_entry)
+		set->deleted--;
+
+	set->entries[slot] = xstrdup(str);
+	set->hashes[slot] = hash;
+	set->nr++;
+
+	return 1;
+}
+
+int string_set_remove(struct string_set *set, const char *str)
+{
+	size_t slot;
+
+	if (!set->nr)
+		return 0;
+
+	slot = find_slot(set, str, hash_string(str));
+	if (!set->entries[slot] || set->entries[slot] == deleted_entry)
+		return 0;
+
+	free(set->entries[slot]);
+	set->entries[slot] = deleted_entry;
+	set->nr--;
+	set->deleted++;
+
+	return 1;
+}
+
+void string_set_remove_prefix(struct string_set *set, const char *prefix)
+{
+	size_t len = strlen(prefix);
+	size_t i;
+
+	for (i = 0; i < set->size; i++) {
+		char *entry = set->entries[i];
+
+		if (!entry || entry == deleted_entry || strncmp(entry, prefix, len))
+			continue;
+
+		free(entry);
+		set->entries[i] = deleted_entry;
+		set->nr--;
+		set->deleted++;
+	}
+}
+
+void string_set_clear(struct string_set *set)
+{
+	size_t i;
+
+	for (i = 0; i < set->size; i++)
+		if (set->entries[i] && set->entries[i] != deleted_entry)
+			free(set->entries[i]);
+
+	free(set->entries);
+	free(set->hashes);
+	set->entries = NULL;
+	set->hashes = NULL;
+	set->size = set->nr = set->deleted = 0;
+}
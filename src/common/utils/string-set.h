@@ -0,0 +1,29 @@
+#ifndef STRING_SET_H
+#define STRING_SET_H
+
+#include <stddef.h>
+
+/*
+ * A set of strings (open addressing, linear probing). The set owns
+ * copies of the strings it holds.
+ */
+struct string_set {
+	char **entries;
+	unsigned int *hashes;
+	size_t size; /* always a power of 2, or 0 */
+	size_t nr;
+	size_t deleted;
+};
+
+#define STRING_SET_INIT { NULL, NULL, 0, 0, 0 }
+
+int string_set_contains(const struct string_set *set, const char *str);
+int string_set_add(struct string_set *set, const char *str);
+//returns 1 if str was added, 0 if it was already there
+int string_set_remove(struct string_set *set, const char *str);
+//returns 1 if str was removed, 0 if it was not there
+void string_set_remove_prefix(struct string_set *set, const char *prefix);
+//remove every string starting with prefix
+void string_set_clear(struct string_set *set);
+
+#endif
@@ -0,0 +1,134 @@
+#include "git-compat-util.h"
+#include "thread-pool.h"
+#include "utils.h"
+#include "errors.h"
+
+#ifndef NO_PTHREADS
+#include <pthread.h>
+#endif
+
+/* chunks handed out per worker when the caller does not choose */
+#define CHUNKS_PER_WORKER 16
+
+int online_cpus(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (ncpus > 0)
+		return (int)ncpus;
+#endif
+	return 1;
+}
+
+struct parallel_state {
+	struct parallel_job *job;
+	unsigned int next_item;
+#ifndef NO_PTHREADS
+	pthread_mutex_t lock;
+#endif
+};
+
+struct parallel_worker {
+	struct parallel_state *state;
+	unsigned int id;
+#ifndef NO_PTHREADS
+	pthread_t thread;
+#endif
+};
+
+/* Reserve the next chunk of items, returns 0 when everything is done */
+static int next_chunk(struct parallel_state *state, unsigned int *begin, unsigned int *end)
+{
+	struct parallel_job *job = state->job;
+	int found = 0;
+
+#ifndef NO_PTHREADS
+	pthread_mutex_lock(&state->lock);
+#endif
+	if (state->next_item < job->nr_items) {
+		*begin = state->next_item;
+		*end = *begin + job->chunk_size;
+		if (*end > job->nr_items || *end < *begin)
+			*end = job->nr_items;
+		state->next_item = *end;
+		found = 1;
+	}
+#ifndef NO_PTHREADS
+	pthread_mutex_unlock(&state->lock);
+#endif
+
+	return found;
+}
+
+static void *run_worker(void *data)
+{
+	struct parallel_worker *worker = data;
+	struct parallel_job *job = worker->state->job;
+	unsigned int begin, end, i;
+
+	if (job->init)
+		job->init(job->context, worker->id);
+
+	while (next_chunk(worker->state, &begin, &end))
+		for (i = begin; i < end; i++)
+			job->process(job->context, worker->id, i);
+
+	if (job->release)
+		job->release(job->context, worker->id);
+
+	return NULL;
+}
+
+void run_parallel(struct parallel_job *job, unsigned int nr_workers)
+{
+	struct parallel_state state;
+	struct parallel_worker *workers;
+	unsigned int i;
+
+#ifdef NO_PTHREADS
+	nr_workers = 1;
+#endif
+	if (nr_workers < 1)
+		nr_workers = 1;
+	if (nr_workers > job->nr_items)
+		nr_workers = job->nr_items ? job->nr_items : 1;
+
+	if (!job->chunk_size) {
+		job->chunk_size = job->nr_items / (nr_workers * CHUNKS_PER_WORKER);
+		if (!job->chunk_size)
+			job->chunk_size = 1;
+	}
+
+	state.job = job;
+	state.next_item = 0;
+	workers = xcalloc(nr_workers, sizeof(*workers));
+
+#ifndef NO_PTHREADS
+	pthread_mutex_init(&state.lock, NULL);
+
+	for (i = 1; i < nr_workers; i++) {
+		int err;
+
+		workers[i].state = &state;
+		workers[i].id = i;
+		err = pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]);
+		if (err)
+			die("cannot create thread: %s", strerror(err));
+	}
+#endif
+
+	/* the calling thread does its share of the work too */
+	workers[0].state = &state;
+	workers[0].id = 0;
+	run_worker(&workers[0]);
+
+#ifndef NO_PTHREADS
+	for (i = 1; i < nr_workers; i++)
+		pthread_join(workers[i].thread, NULL);
+
+	pthread_mutex_destroy(&state.lock);
+#endif
+
+	free(workers);
+}
@@ -0,0 +1,29 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+/*
+ * Run the same function over a range of items on several threads.
+ *
+ * Items are handed out to the workers by chunks of consecutive items,
+ * so callers that process sorted data (index entries, tree entries)
+ * keep some locality in each worker. The calling thread is worker 0;
+ * with one worker (or without pthreads) everything runs inline.
+ */
+struct parallel_job {
+	unsigned int nr_items;
+	unsigned int chunk_size; /* 0 to let run_parallel() choose */
+
+	void (*init)(void *context, unsigned int worker); /* optional */
+	void (*process)(void *context, unsigned int worker, unsigned int item);
+	void (*release)(void *context, unsigned int worker); /* optional */
+
+	void *context;
+};
+
+int online_cpus(void);
+//number of processors we can run on (at least 1)
+
+void run_parallel(struct parallel_job *job, unsigned int nr_workers);
+//process all the items of job with nr_workers threads and wait for them
+
+#endif
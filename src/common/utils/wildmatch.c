@@ -0,0 +1,193 @@
+#include <string.h>
+#include "wildmatch.h"
+
+/*
+ * The matcher of rsync, as git uses it : an ABORT result tells the '*'
+ * above that no shift of the text can match, so that a failing pattern
+ * with many stars does not retry every split of the text.
+ */
+enum {
+	WM_NOMATCH,
+	WM_MATCH,
+	WM_ABORT_ALL,
+	WM_ABORT_TO_STARSTAR
+};
+
+static int in_class(const unsigned char *name, size_t len, unsigned char c)
+{
+#define CLASS(s) (len == sizeof(s) - 1 && !memcmp(name, s, len))
+	int lower = c >= 'a' && c <= 'z', upper = c >= 'A' && c <= 'Z', digit = c >= '0' && c <= '9';
+	int graph = c > ' ' && c < 0x7f;
+
+	if (CLASS("alnum"))
+		return lower || upper || digit;
+	if (CLASS("alpha"))
+		return lower || upper;
+	if (CLASS("blank"))
+		return c == ' ' || c == '\t';
+	if (CLASS("cntrl"))
+		return c < ' ' || c == 0x7f;
+	if (CLASS("digit"))
+		return digit;
+	if (CLASS("graph"))
+		return graph;
+	if (CLASS("lower"))
+		return lower;
+	if (CLASS("print"))
+		return graph || c == ' ';
+	if (CLASS("punct"))
+		return graph && !lower && !upper && !digit;
+	if (CLASS("space"))
+		return c == ' ' || (c >= '\t' && c <= '\r');
+	if (CLASS("upper"))
+		return upper;
+	if (CLASS("xdigit"))
+		return digit || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+	return -1;
+#undef CLASS
+}
+
+/* Whether the char t_ch is in the set of brackets at *pp, which is moved past the set */
+static int match_bracket(const unsigned char **pp, unsigned char t_ch, unsigned int flags)
+{
+	const unsigned char *p = *pp;
+	unsigned char p_ch = *++p, prev_ch = 0;
+	int negated, matched = 0;
+
+	if (p_ch == '^')
+		p_ch = '!';
+	negated = p_ch == '!';
+	if (negated)
+		p_ch = *++p;
+
+	do {
+		if (!p_ch)
+			return WM_ABORT_ALL;
+		if (p_ch == '\\') {
+			p_ch = *++p;
+			if (!p_ch)
+				return WM_ABORT_ALL;
+			if (t_ch == p_ch)
+				matched = 1;
+		} else if (p_ch == '-' && prev_ch && p[1] && p[1] != ']') {
+			p_ch = *++p;
+			if (p_ch == '\\') {
+				p_ch = *++p;
+				if (!p_ch)
+					return WM_ABORT_ALL;
+			}
+			if (t_ch <= p_ch && t_ch >= prev_ch)
+				matched = 1;
+			p_ch = 0; /* no range from the end of a range */
+		} else if (p_ch == '[' && p[1] == ':') {
+			const unsigned char *s = p += 2;
+			int in;
+
+			while ((p_ch = *p) && p_ch != ']')
+				p++;
+			if (!p_ch)
+				return WM_ABORT_ALL;
+			if (p - s < 1 || p[-1] != ':') {
+				/* no ":]" : a plain '[' */
+				p = s - 2;
+				p_ch = '[';
+				if (t_ch == p_ch)
+					matched = 1;
+				continue;
+			}
+			in = in_class(s, p - s - 1, t_ch);
+			if (in < 0)
+				return WM_ABORT_ALL;
+			if (in)
+				matched = 1;
+			p_ch = 0;
+		} else if (t_ch == p_ch) {
+			matched = 1;
+		}
+	} while (prev_ch = p_ch, (p_ch = *++p) != ']');
+
+	*pp = p;
+	return matched != negated && (t_ch != '/' || !(flags & WM_PATHNAME)) ? WM_MATCH : WM_NOMATCH;
+}
+
+static int do_wild(const unsigned char *p, const unsigned char *text, unsigned int flags)
+{
+	const unsigned char *pattern = p;
+
+	for (; *p; text++, p++) {
+		unsigned char p_ch = *p, t_ch = *text;
+		int match_slash, matched;
+
+		if (!t_ch && p_ch != '*')
+			return WM_ABORT_ALL;
+
+		switch (p_ch) {
+		case '\\':
+			/* a trailing '\' matches nothing : t_ch is not NUL */
+			p_ch = *++p;
+			/* fall through */
+		default:
+			if (t_ch != p_ch)
+				return WM_NOMATCH;
+			continue;
+		case '?':
+			if (t_ch == '/' && (flags & WM_PATHNAME))
+				return WM_NOMATCH;
+			continue;
+		case '[':
+			matched = match_bracket(&p, t_ch, flags);
+			if (matched != WM_MATCH)
+				return matched;
+			continue;
+		case '*':
+			/* without WM_PATHNAME, '*' is "**" */
+			match_slash = !(flags & WM_PATHNAME);
+			if (*++p == '*') {
+				const unsigned char *prev_p = p - 2;
+
+				while (*++p == '*')
+					;
+				/* "**" only spans directories as a whole path component */
+				if (!match_slash && (prev_p < pattern || *prev_p == '/') &&
+				    (!*p || *p == '/' || (p[0] == '\\' && p[1] == '/'))) {
+					if (*p == '/' && do_wild(p + 1, text, flags) == WM_MATCH)
+						return WM_MATCH;
+					match_slash = 1;
+				}
+			}
+			if (!*p) {
+				/* a trailing "*" stops at the end of the component */
+				if (!match_slash && strchr((const char *)text, '/'))
+					return WM_NOMATCH;
+				return WM_MATCH;
+			}
+			if (!match_slash && *p == '/') {
+				/* "*" then '/' : the rest of this component */
+				const char *slash = strchr((const char *)text, '/');
+
+				if (!slash)
+					return WM_NOMATCH;
+				text = (const unsigned char *)slash;
+				/* the slashes are matched by the loop */
+				break;
+			}
+			for (; t_ch; t_ch = *++text) {
+				matched = do_wild(p, text, flags);
+				if (matched != WM_NOMATCH) {
+					if (!match_slash || matched != WM_ABORT_TO_STARSTAR)
+						return matched;
+				} else if (!match_slash && t_ch == '/') {
+					return WM_ABORT_TO_STARSTAR;
+				}
+			}
+			return WM_ABORT_ALL;
+		}
+	}
+
+	return *text ? WM_NOMATCH : WM_MATCH;
+}
+
+int wildmatch(const char *pattern, const char *text, unsigned int flags)
+{
+	return do_wild((const unsigned char *)pattern, (const unsigned char *)text, flags) == WM_MATCH;
+}
@@ -0,0 +1,20 @@
+#ifndef WILDMATCH_H
+#define WILDMATCH_H
+
+/*
+ * Shell globs as git matches the patterns of .gitignore and pathspecs :
+ * '\' escapes the next char, and brackets take ranges, '!' or '^'
+ * negations and the POSIX classes ("[[:digit:]]"). Case is significant.
+ *
+ * With WM_PATHNAME (.gitignore), '*', '?' and brackets do not match a
+ * '/', and "**" between slashes (or at an end of the pattern) matches
+ * any number of directories. Without it (pathspecs), '*' matches any
+ * string, slashes included.
+ */
+
+#define WM_PATHNAME 1
+
+int wildmatch(const char *pattern, const char *text, unsigned int flags);
+//returns 1 if the whole of text matches pattern, 0 otherwise
+
+#endif
@@ -9,6 +9,22 @@
 #include "repository.h"
 #include "strbuf.h"
 #include "environment.h"
+#include "fallback-helper.h"
+#include "daemon.h"
+#include "ipc.h"
+#include "trace.h"
+#include "output.h"
+#include "utils.h"
+#include "odb-batch.h"
+#include "pack-reader.h"
+#include "shared-cache.h"
+#include "ident.h"
+#include "ignore.h"
+
+/* the standard input of a batch is read by blocks of this size */
+#define BATCH_CHUNK_SIZE (64 * 1024)
+
+static int batch_mode = 0;
 
 static const char git_usage_string[] =
 	"git [--version] [--exec-path[=<path>]] [--html-path] [--man-path] [--info-path]\n"
@@ -19,9 +35,17 @@ static const char git_usage_string[] =
 
 // original source : https://github.com/vfr-nl/git2
 void free_global_resources() {
+	free_stdout_output();
+	trace_perf_flush();
 	git_support_free_arguments();
 	git_exec_cmd_free_resources();
 	free_repository();
+	free_prefix_table();
+	free_pack_indexes();
+	free_pack_reader();
+	free_shared_cache();
+	free_ident_cache();
+	free_ignore_cache();
 }
 
 static int handle_options(const char ***argv, int *argc) {
@@ -38,25 +62,25 @@ static int handle_options(const char ***argv, int *argc) {
 		 * to make them look like flags.
 		 */
 		if (!strcmp(cmd, "--help") || !strcmp(cmd, "--version"))
-			please_git_do_it_for_me();
+			please_git_do_it_for_option(cmd);
 
 		/*
 		 * Check remaining flags.
 		 */
 		if (!prefixcmp(cmd, "--exec-path")) {
-			please_git_do_it_for_me();
+			please_git_do_it_for_option(cmd);
 		} else if (!strcmp(cmd, "--html-path")) {
-			please_git_do_it_for_me();
+			please_git_do_it_for_option(cmd);
 		} else if (!strcmp(cmd, "--man-path")) {
-			please_git_do_it_for_me();
+			please_git_do_it_for_option(cmd);
 		} else if (!strcmp(cmd, "--info-path")) {
-			please_git_do_it_for_me();
+			please_git_do_it_for_option(cmd);
 		} else if (!strcmp(cmd, "-p") || !strcmp(cmd, "--paginate")) {
-			please_git_do_it_for_me();
+			please_git_do_it_for_option(cmd);
 		} else if (!strcmp(cmd, "--no-pager")) {
-			please_git_do_it_for_me();
+			please_git_do_it_for_option(cmd);
 		} else if (!strcmp(cmd, "--no-replace-objects")) {
-			please_git_do_it_for_me();
+			please_git_do_it_for_option(cmd);
 		} else if (!strcmp(cmd, "--git-dir")) {
 			if (*argc < 2) {
 				fprintf(stderr, "No directory given for --git-dir.\n" );
@@ -79,9 +103,15 @@ static int handle_options(const char ***argv, int *argc) {
 		} else if (!prefixcmp(cmd, "--work-tree=")) {
 			setenv(GIT_WORK_TREE_ENVIRONMENT, cmd + 12, 1);
 		} else if (!strcmp(cmd, "--bare")) {
-			please_git_do_it_for_me();
+			please_git_do_it_for_option(cmd);
 		} else if (!strcmp(cmd, "-c")) {
-			please_git_do_it_for_me();
+			please_git_do_it_for_option(cmd);
+		} else if (!strcmp(cmd, "--batch")) {
+			batch_mode = 1;
+		} else if (!prefixcmp(cmd, "--daemon=")) {
+			run_daemon(cmd + 9, run_builtin);
+		} else if (!prefixcmp(cmd, "--fallback-helper=")) {
+			run_fallback_helper(cmd + 18);
 		} else {
 			fprintf(stderr, "Unknown option: %s\n", cmd);
 			usage(git_usage_string);
@@ -94,6 +124,133 @@ static int handle_options(const char ***argv, int *argc) {
 	return handled;
 }
 
+/* Returns the exit code of the command, -1 if the daemon is not there */
+static int forward_to_daemon(const char *socket_path, int argc, const char **argv)
+{
+	const char **daemon_argv = xmalloc((argc + 2) * sizeof(*daemon_argv));
+
+	daemon_argv[0] = "git";
+	memcpy(daemon_argv + 1, argv, argc * sizeof(*argv));
+	daemon_argv[argc + 1] = NULL;
+
+	uint64_t start = trace_perf_start();
+	int code = ipc_forward(socket_path, daemon_argv);
+	trace_perf_stop("daemon_forward", start);
+
+	free(daemon_argv);
+	return code;
+}
+
+/*
+ * Get the next command of the batch read from fd into argv, the line
+ * "git" included : its arguments, each one ended by a NUL, end with an
+ * empty argument. input holds what was read past the previous command.
+ * Returns the number of arguments, 0 at the end of the batch.
+ */
+static int read_batch_command(int fd, struct strbuf *input, struct strbuf *command,
+	const char ***argv, int *alloc)
+{
+	size_t end = 0;
+	int argc = 0;
+
+	for (;;) {
+		/* the arguments of the command, if they are all there */
+		const char *nul;
+		while ((nul = memchr(input->buf + end, '\0', input->len - end))) {
+			size_t len = nul - (input->buf + end);
+			end += len + 1;
+			if (!len)
+				goto complete;
+			argc++;
+		}
+
+		strbuf_grow(input, BATCH_CHUNK_SIZE);
+		ssize_t loaded = xread(fd, input->buf + input->len, BATCH_CHUNK_SIZE);
+		if (loaded < 0)
+			die_errno("could not read the batch");
+		if (!loaded) {
+			if (input->len)
+				die("incomplete command at the end of the batch");
+			return 0;
+		}
+		strbuf_setlen(input, input->len + loaded);
+	}
+
+complete:
+	if (!argc)
+		die("empty command in the batch");
+
+	strbuf_reset(command);
+	strbuf_add(command, input->buf, end);
+	strbuf_remove(input, 0, end);
+
+	ALLOC_GROW(*argv, argc + 2, *alloc);
+	(*argv)[0] = "git";
+	const char *arg = command->buf;
+	for (int i = 1; i <= argc; i++) {
+		(*argv)[i] = arg;
+		arg += strlen(arg) + 1;
+	}
+	(*argv)[argc + 1] = NULL;
+
+	return argc + 1;
+}
+
+static jmp_buf batch_fallback;
+static int batch_fallback_status;
+
+/*
+ * Run the commands of the standard input one after the other, keeping the
+ * repository and the index open between them. Each one has /dev/null as
+ * its standard input, and is run by a child git if we cannot. The batch
+ * stops at the first command which fails, with its exit status.
+ */
+static int run_batch(void)
+{
+	struct strbuf input = STRBUF_INIT, command = STRBUF_INIT;
+	const char **argv = NULL;
+	int argc, alloc = 0, code = EXIT_SUCCESS;
+
+	int fd = dup(0);
+	int null_fd = open("/dev/null", O_RDONLY);
+	if (fd < 0 || null_fd < 0 || fcntl(fd, F_SETFD, FD_CLOEXEC) || fcntl(null_fd, F_SETFD, FD_CLOEXEC))
+		die_errno("could not set up the batch");
+
+	git_support_catch_fallbacks(&batch_fallback, &batch_fallback_status);
+
+	while ((argc = read_batch_command(fd, &input, &command, &argv, &alloc))) {
+		int fell_back;
+
+		if (dup2(null_fd, 0) < 0)
+			die_errno("could not set up the batch");
+		git_support_free_arguments();
+		git_support_register_arguments(argc, argv);
+
+		if (setjmp(batch_fallback)) {
+			code = batch_fallback_status;
+			fell_back = 1;
+		} else {
+			code = run_builtin(argc - 1, argv + 1);
+			fell_back = 0;
+		}
+
+		output_flush(get_stdout_output());
+		release_stale_repository(fell_back);
+		if (code)
+			break;
+	}
+
+	git_support_catch_fallbacks(NULL, NULL);
+
+	close(null_fd);
+	close(fd);
+	free(argv);
+	strbuf_release(&command);
+	strbuf_release(&input);
+
+	return code;
+}
+
 int main(int argc, const char **argv){
 	git_extract_argv0_path(argv[0]);
 	git_support_register_arguments(argc, argv);
@@ -104,16 +261,29 @@ int main(int argc, const char **argv){
 	argv++;
 	handle_options(&argv, &argc);
 
+	if (batch_mode) {
+		if (argc)
+			usage(git_usage_string);
+		int code = run_batch();
+		free_global_resources();
+		return code;
+	}
+
 	if (argc == 0) {
 		usage(git_usage_string);
 	}
 
-	cmd_handler handler = lookup_handler(argv[0]);
-	if (handler == NULL) {
-		please_git_do_it_for_me();
+	const char *daemon_socket = getenv(GIT2_DAEMON_SOCKET_ENVIRONMENT);
+	if (daemon_socket && *daemon_socket) {
+		int code = forward_to_daemon(daemon_socket, argc, argv);
+		if (code >= 0) {
+			free_global_resources();
+			return code;
+		}
+		//the daemon is not there: run the command ourselves
 	}
 
-	int code = handler(argc, argv);
+	int code = run_builtin(argc, argv);
 
 	free_global_resources();
 
@@ -0,0 +1,144 @@
+#!/bin/sh
+#
+# Compare what git2 and git print for "cat-file -t, -s, -e, -p" and
+# "cat-file <type>", on the objects of every type and on missing ones.
+#
+# usage: cat-file.sh [<git2 binary>]
+#
+# Settings (environment):
+#   GIT          the git to compare with (default git)
+#   COMPARE_DIR  where the repository is made (default a directory of
+#                mktemp, removed at the end)
+#
+# Each call runs under both binaries, in a repository with a binary
+# blob, a symlink, an executable, a big blob (streamed by git2), two
+# commits and tags of a commit, a tree and a tag. Their standard
+# output, standard error and exit code must be the same. The calls git2
+# is expected to answer itself must not appear in its GIT2_FALLBACK_LOG.
+# One TAP line is printed per call, and the script exits with the number
+# of the calls which failed.
+
+COMPARE_DIRECTORY="$(cd "$(dirname "$0")" && pwd)"
+ROOT_DIRECTORY="$(dirname "$(dirname "$COMPARE_DIRECTORY")")"
+
+GIT2="${1:-$ROOT_DIRECTORY/bin/git2}"
+GIT="${GIT:-git}"
+
+case "$GIT2" in
+/*) ;;
+*) GIT2="$(pwd)/$GIT2" ;;
+esac
+
+if test -n "$COMPARE_DIR"
+then
+	rm -rf "$COMPARE_DIR" && mkdir -p "$COMPARE_DIR" || exit 1
+else
+	COMPARE_DIR="$(mktemp -d "${TMPDIR:-/tmp}/git2-compare.XXXXXX")" || exit 1
+	trap 'rm -rf "$COMPARE_DIR"' EXIT
+fi
+
+REPOSITORY="$COMPARE_DIR/repository"
+OUT="$COMPARE_DIR/out"
+FALLBACK_LOG="$COMPARE_DIR/fallback.log"
+
+export GIT_AUTHOR_NAME="A U Thor" GIT_AUTHOR_EMAIL="author@example.com"
+export GIT_COMMITTER_NAME="C O Mitter" GIT_COMMITTER_EMAIL="committer@example.com"
+export GIT_AUTHOR_DATE="1112911993 -0700" GIT_COMMITTER_DATE="1112911993 -0700"
+export GIT_CONFIG_NOSYSTEM=1 HOME="$COMPARE_DIR"
+unset GIT_DIR GIT_WORK_TREE
+
+(
+	mkdir -p "$REPOSITORY/dir" && cd "$REPOSITORY" &&
+	"$GIT" init -q &&
+	echo "hello" >hello &&
+	printf 'a\000b\377\n' >binary &&
+	printf '#!/bin/sh\necho\n' >dir/script && chmod +x dir/script &&
+	ln -s hello link &&
+	: >empty &&
+	awk 'BEGIN { for (i = 0; i < 65536; i++) print "line " i }' >big &&
+	"$GIT" add . &&
+	"$GIT" commit -q -m "first" &&
+	echo "world" >>hello &&
+	"$GIT" commit -q -a -m "second
+
+with a body" &&
+	"$GIT" tag -a -m "a tag" v1 &&
+	"$GIT" tag -a -m "a tag of a tree" tree-tag HEAD^{tree} &&
+	"$GIT" tag light HEAD^ &&
+	"$GIT" repack -q -a -d &&
+	echo "loose" | "$GIT" hash-object -w --stdin >/dev/null
+) >/dev/null || {
+	echo "could not make the repository in $REPOSITORY" >&2
+	exit 1
+}
+
+# The object names the calls are about
+names="HEAD HEAD^ HEAD^{tree} HEAD:dir HEAD:hello HEAD:binary HEAD:link HEAD:empty HEAD:big
+HEAD:dir/script v1 tree-tag light"
+oids=
+for name in $names
+do
+	oids="$oids $(cd "$REPOSITORY" && "$GIT" rev-parse "$name")"
+done
+loose="$(echo "loose" | "$GIT" hash-object --stdin)"
+abbreviated="$(cd "$REPOSITORY" && "$GIT" rev-parse --short HEAD)"
+missing=0123456789abcdef0123456789abcdef01234567
+
+test_count=0
+failed=0
+
+# compare <native|any> <arguments of cat-file> : run both, tell whether they agree
+compare () {
+	expect="$1"
+	shift
+	test_count=$((test_count + 1))
+	rm -f "$FALLBACK_LOG"
+	(cd "$REPOSITORY" && "$GIT" cat-file "$@" >"$OUT.git.1" 2>"$OUT.git.2"; echo $? >"$OUT.git.code")
+	(cd "$REPOSITORY" && GIT2_FALLBACK_LOG="$FALLBACK_LOG" "$GIT2" cat-file "$@" >"$OUT.git2.1" 2>"$OUT.git2.2"; echo $? >"$OUT.git2.code")
+
+	problem=
+	cmp -s "$OUT.git.1" "$OUT.git2.1" || problem="$problem stdout"
+	cmp -s "$OUT.git.2" "$OUT.git2.2" || problem="$problem stderr"
+	cmp -s "$OUT.git.code" "$OUT.git2.code" ||
+	problem="$problem exit code ($(cat "$OUT.git.code") for git, $(cat "$OUT.git2.code") for git2)"
+	if test "$expect" = native && test -s "$FALLBACK_LOG"
+	then
+		problem="$problem fell back ($(cut -f3 "$FALLBACK_LOG" | head -n 1))"
+	fi
+
+	if test -z "$problem"
+	then
+		echo "ok $test_count - cat-file $*"
+	else
+		echo "not ok $test_count - cat-file $*:$problem"
+		failed=$((failed + 1))
+	fi
+}
+
+for name in $names $oids $loose $abbreviated
+do
+	for option in -t -s -e -p
+	do
+		compare native "$option" "$name"
+	done
+done
+
+# <type> : the type of the object, or one it peels to
+for oid in $oids $loose
+do
+	type="$(cd "$REPOSITORY" && "$GIT" cat-file -t "$oid")"
+	compare native "$type" "$oid"
+done
+compare any tree HEAD
+compare any commit v1
+compare any blob HEAD
+
+# names which do not resolve, objects which are not there
+for option in -t -s -e -p blob
+do
+	compare native "$option" "$missing"
+	compare any "$option" no-such-name
+done
+
+echo "1..$test_count"
+exit $failed
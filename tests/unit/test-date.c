@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "date.h"
+#include "test-lib.h"
+
+/*
+ * What parse_date() makes of the dates of GIT_AUTHOR_DATE and
+ * GIT_COMMITTER_DATE, as "<seconds> +hhmm" (NULL if it is rejected) :
+ * the formats parse_date_strict() reads, on and around the bounds it
+ * enforces, and what it leaves to the heuristics. The expected results
+ * are those of git 2.39 ("git var GIT_COMMITTER_IDENT") in the two
+ * timezones below, which only differ for the dates parse_date() has to
+ * read in the local time.
+ */
+static const struct {
+	const char *date, *utc, *india;
+} cases[] = {
+	/* "[@]<seconds> +hhmm" */
+	{ "1234567890 +0000", "1234567890 +0000", "1234567890 +0000" },
+	{ "@1234567890 +0100", "1234567890 +0100", "1234567890 +0100" },
+	{ "1234567890 -0130", "1234567890 -0130", "1234567890 -0130" },
+	{ "1234567890 +0000\n", "1234567890 +0000", "1234567890 +0000" },
+	{ "100000000 +0000", "100000000 +0000", "100000000 +0000" },
+	{ "99999999 +0000", NULL, NULL },
+	{ "4102444799 +0000", "4102444799 +0000", "4102444799 +0000" },
+	{ "4102444800 +0000", NULL, NULL },
+	{ "1234567890 +0060", "1234567890 +0000", "1234567890 +0530" },
+	{ "1234567890 +01", "1234567890 +0100", "1234567890 +0100" },
+	{ "1234567890 -0000", "1234567890 +0000", "1234567890 +0000" },
+	{ "1234567890 +1400", "1234567890 +1400", "1234567890 +1400" },
+	{ "1234567890 -1200", "1234567890 -1200", "1234567890 -1200" },
+	{ "1234567890  +0000", "1234567890 +0000", "1234567890 +0000" },
+	{ "1234567890 +0000 x", "1234567890 +0000", "1234567890 +0000" },
+	{ "1234567890", "1234567890 +0000", "1234567890 +0530" },
+	{ "@1234567890", "1234567890 +0000", "1234567890 +0530" },
+	{ "12345678901234567890 +0000", NULL, NULL },
+	{ "1234567890 +2359", "1234567890 +2359", "1234567890 +2359" },
+	{ "1234567890 +2400", "1234567890 +0000", "1234567890 +0530" },
+	{ "1234567890 +9959", "1234567890 +0000", "1234567890 +0530" },
+	{ "1234567890 +0000garbage", "1234567890 +0000", "1234567890 +0000" },
+	{ "1234567890 0000", "1234567890 +0000", "1234567890 +0000" },
+	{ "1234567890 +00000", "1234567890 +0000", "1234567890 +0530" },
+	{ "@ 1234567890 +0000", "1234567890 +0000", "1234567890 +0000" },
+	{ "-1234567890 +0000", NULL, NULL },
+	/* ISO 8601, "Z" or an offset */
+	{ "2005-04-07T22:13:13Z", "1112911993 +0000", "1112911993 +0000" },
+	{ "2005-04-07T22:13:13 +0200", "1112904793 +0200", "1112904793 +0200" },
+	{ "2005-04-07T22:13:13+0200", "1112904793 +0200", "1112904793 +0200" },
+	{ "2005-04-07 22:13:13 -0700", "1112937193 -0700", "1112937193 -0700" },
+	{ "2005-04-07 22:13:13 +0530", "1112892193 +0530", "1112892193 +0530" },
+	{ "2005-04-07 22:13:13 +0545", "1112891293 +0545", "1112891293 +0545" },
+	{ "2005-04-07T22:13:13Z\n", "1112911993 +0000", "1112911993 +0000" },
+	{ "1970-01-01T00:00:00Z", "0 +0000", "0 +0000" },
+	{ "1970-01-01T00:00:01 +0100", "18446744073709548017 +0100", "18446744073709548017 +0100" },
+	{ "2099-12-31T23:59:59Z", "4102444799 +0000", "4102444799 +0000" },
+	{ "2100-01-01T00:00:00Z", NULL, NULL },
+	{ "1969-12-31T23:59:59Z", NULL, NULL },
+	{ "2000-02-29T12:00:00Z", "951825600 +0000", "951825600 +0000" },
+	{ "2004-02-29T12:00:00 -0800", "1078084800 -0800", "1078084800 -0800" },
+	{ "2038-01-19T03:14:08Z", "2147483648 +0000", "2147483648 +0000" },
+	{ "2005-13-01T00:00:00Z", "1105574400 +0000", "1105574400 +0000" },
+	{ "2005-00-10T00:00:00Z", NULL, NULL },
+	{ "2005-04-00T00:00:00Z", NULL, NULL },
+	{ "2005-04-32T00:00:00Z", NULL, NULL },
+	{ "2005-04-07T24:00:00Z", "1112918400 +0000", "1112918400 +0000" },
+	{ "2005-04-07T23:60:00Z", NULL, NULL },
+	{ "2005-04-07T23:59:60Z", "1112918400 +0000", "1112918400 +0000" },
+	{ "2005-04-07T22:13Z", "1112911980 +0000", "1112911980 +0000" },
+	{ "2005-4-7T22:13:13Z", "1112911993 +0000", "1112911993 +0000" },
+	{ "2005-04-07T22:13:13+02:00", "1112904793 +0200", "1112904793 +0200" },
+	{ "2005-04-07T22:13:13.123Z", "1112911993 +0000", "1112911993 +0000" },
+	{ "2005-04-07T22:13:13", "1112911993 +0000", "1112892193 +0530" },
+	{ "2005-04-07T22:13:13 +060", "1112911993 +0000", "1112892193 +0530" },
+	{ "2005-04-07T22:13:13 +0070", "1112911993 +0000", "1112892193 +0530" },
+	{ "2005-04-07T22:13:13 Z", "1112911993 +0000", "1112911993 +0000" },
+	{ "2005-04-07T22:13:13Zx", "1112911993 +0000", "1112892193 +0530" },
+	{ "2005-04-07X22:13:13Z", "1112911993 +0000", "1112911993 +0000" },
+	{ "2005-04-07T22:13:13 +2400", "1112911993 +0000", "1112892193 +0530" },
+	{ "2005-04-07T22:13:13 -2359", "1112998333 -2359", "1112998333 -2359" },
+	{ "2005-04-07T22:13:13 +0000 +0100", "1112908393 +0100", "1112908393 +0100" },
+	{ "2005-02-30T00:00:00Z", "1109721600 +0000", "1109721600 +0000" },
+	{ " 2005-04-07T22:13:13Z", "1112911993 +0000", "1112911993 +0000" },
+	/* left to the heuristics */
+	{ "Thu, 07 Apr 2005 22:13:13 +0200", "1112904793 +0200", "1112904793 +0200" },
+	{ "garbage", NULL, NULL },
+};
+
+static void check_dates(const char *tz, int india)
+{
+	setenv("TZ", tz, 1);
+	tzset();
+	for (size_t i = 0; i < sizeof(cases) / sizeof(*cases); i++) {
+		const char *date = cases[i].date, *expected = india ? cases[i].india : cases[i].utc;
+		int len = strcspn(date, "\n");
+		char result[64];
+		int parsed = parse_date(date, result, sizeof(result)) >= 0;
+
+		/* the name of the case stays on its line */
+		if (!test_check(parsed ? expected && !strcmp(result, expected) : !expected,
+				"TZ=%s '%.*s%s' is %s", tz, len, date, date[len] ? "\\n" : "",
+				expected ? expected : "invalid"))
+			printf("# got %s\n", parsed ? result : "invalid");
+	}
+}
+
+int main(void)
+{
+	check_dates("UTC", 0);
+	check_dates("IST-5:30", 1);
+	return test_done();
+}
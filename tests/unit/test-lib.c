@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "test-lib.h"
+
+static int count, failed;
+
+int test_check(int ok, const char *fmt, ...)
+{
+	va_list params;
+
+	count++;
+	if (!ok)
+		failed++;
+	printf("%sok %d - ", ok ? "" : "not ", count);
+	va_start(params, fmt);
+	vprintf(fmt, params);
+	va_end(params);
+	putchar('\n');
+	return ok;
+}
+
+int test_done(void)
+{
+	printf("1..%d\n", count);
+	if (failed)
+		fprintf(stderr, "# failed %d among %d test(s)\n", failed, count);
+	return failed < 255 ? failed : 255;
+}
+
+/* What the tested modules call of git2, which the tests do not link */
+
+void die(const char *err, ...)
+{
+	va_list params;
+
+	fputs("fatal: ", stderr);
+	va_start(params, err);
+	vfprintf(stderr, err, params);
+	va_end(params);
+	fputc('\n', stderr);
+	exit(128);
+}
+
+char *xstrdup(const char *str)
+{
+	char *ret = strdup(str);
+
+	if (!ret)
+		die("Out of memory, strdup failed");
+	return ret;
+}
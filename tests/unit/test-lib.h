@@ -0,0 +1,18 @@
+#ifndef TEST_LIB_H
+#define TEST_LIB_H
+
+/*
+ * The unit tests of the modules of src/common/utils which do not need a
+ * repository. Each test-*.c is a program running a table of cases and
+ * printing one TAP line per case, as git's test suite does ("ok 3 - ...",
+ * "not ok 4 - ..."), then the plan. Its exit status is the number of the
+ * cases which failed, 0 if they all passed.
+ */
+
+int test_check(int ok, const char *fmt, ...) __attribute__((format (printf, 2, 3)));
+//print the result of the next case, named by fmt. Returns ok
+
+int test_done(void);
+//print the plan : returns the exit status of the program
+
+#endif
@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sha1.h"
+#include "test-lib.h"
+
+/*
+ * The known answers of FIPS 180 (its one and two block messages, and
+ * the million 'a'), messages ending on each side of the padding bounds
+ * (55, 56 and 64 bytes), and the same data hashed in pieces of every
+ * size and from an address which is not aligned.
+ */
+static const struct {
+	const char *data;
+	size_t repeat; /* data is hashed that many times, once if 0 */
+	const char *hash;
+} cases[] = {
+	{ "", 0, "da39a3ee5e6b4b0d3255bfef95601890afd80709" },
+	{ "abc", 0, "a9993e364706816aba3e25717850c26c9cd0d89d" },
+	{ "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 0,
+		"84983e441c3bd26ebaae4aa1f95129e5e54670f1" },
+	{ "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu", 0,
+		"a49b2446a02c645bf419f995b67091253a04a259" },
+	{ "a", 55, "c1c8bbdc22796e28c0e15163d20899b65621d65a" },
+	{ "a", 56, "c2db330f6083854c99d4b5bfb6e8f29f201be699" },
+	{ "a", 63, "03f09f5b158a7a8cdad920bddc29b81c18a551f5" },
+	{ "a", 64, "0098ba824b5c16427bd7a1122a5a442a25ec644d" },
+	{ "a", 65, "11655326c708d70319be2610e8a57d9a5b959d3b" },
+	{ "a", 128, "ad5b3fdbcb526778c2839d2f151ea753995e26a0" },
+	{ "a", 1000000, "34aa973cd4c4daa4f61eeb2bdbad27316534016f" },
+};
+
+static void to_hex(char *out, const unsigned char *hash)
+{
+	for (int i = 0; i < SHA1_RAWSZ; i++)
+		sprintf(out + 2 * i, "%02x", hash[i]);
+}
+
+/* The hash of the len bytes at data, given to sha1_update() step bytes at a time */
+static void hash_by_steps(char *hex, const unsigned char *data, size_t len, size_t step)
+{
+	unsigned char hash[SHA1_RAWSZ];
+	struct sha1_ctx ctx;
+
+	sha1_init(&ctx);
+	for (size_t done = 0; done < len; done += step)
+		sha1_update(&ctx, data + done, len - done < step ? len - done : step);
+	sha1_final(hash, &ctx);
+	to_hex(hex, hash);
+}
+
+static size_t expand(unsigned char **buf, size_t offset, const char *data, size_t repeat)
+{
+	size_t len = strlen(data) * (repeat ? repeat : 1);
+
+	*buf = malloc(offset + len + 1);
+	if (!*buf)
+		exit(1);
+	for (size_t i = 0; i < len; i += strlen(data))
+		memcpy(*buf + offset + i, data, strlen(data));
+	return len;
+}
+
+int main(void)
+{
+	static const size_t steps[] = { 1, 3, 63, 64, 65, 4096 };
+
+	for (size_t i = 0; i < sizeof(cases) / sizeof(*cases); i++) {
+		unsigned char *buf;
+		size_t len = expand(&buf, 1, cases[i].data, cases[i].repeat);
+		char hex[2 * SHA1_RAWSZ + 1];
+
+		hash_by_steps(hex, buf + 1, len, len ? len : 1);
+		test_check(!strcmp(hex, cases[i].hash), "sha1 of %zu bytes, from an odd address, is %s",
+			len, cases[i].hash);
+		memmove(buf, buf + 1, len);
+		for (size_t j = 0; j < sizeof(steps) / sizeof(*steps); j++) {
+			if (steps[j] >= len && j)
+				break;
+			hash_by_steps(hex, buf, len, steps[j]);
+			test_check(!strcmp(hex, cases[i].hash), "sha1 of %zu bytes, by %zu, is %s",
+				len, steps[j], cases[i].hash);
+		}
+		free(buf);
+	}
+	return test_done();
+}
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include "wildmatch.h"
+#include "test-lib.h"
+
+/*
+ * The cases of git's t/t3070-wildmatch.sh : whether text matches pattern
+ * with WM_PATHNAME (as in .gitignore, git's "glob" column) and without
+ * it (as in pathspecs, its "pathmatch" column). The case insensitive
+ * columns are left out, git2 has no WM_CASEFOLD.
+ */
+static const struct {
+	int glob, pathmatch;
+	const char *text, *pattern;
+} cases[] = {
+	{ 1, 1, "foo", "foo" },
+	{ 0, 0, "foo", "bar" },
+	{ 1, 1, "", "" },
+	{ 1, 1, "foo", "???" },
+	{ 0, 0, "foo", "??" },
+	{ 1, 1, "foo", "*" },
+	{ 1, 1, "foo", "f*" },
+	{ 0, 0, "foo", "*f" },
+	{ 1, 1, "foo", "*foo*" },
+	{ 1, 1, "foobar", "*ob*a*r*" },
+	{ 1, 1, "aaaaaaabababab", "*ab" },
+	{ 1, 1, "foo*", "foo\\*" },
+	{ 0, 0, "foobar", "foo\\*bar" },
+	{ 1, 1, "f\\oo", "f\\\\oo" },
+	{ 1, 1, "ball", "*[al]?" },
+	{ 0, 0, "ten", "[ten]" },
+	{ 1, 1, "ten", "**[!te]" },
+	{ 0, 0, "ten", "**[!ten]" },
+	{ 1, 1, "ten", "t[a-g]n" },
+	{ 0, 0, "ten", "t[!a-g]n" },
+	{ 1, 1, "ton", "t[!a-g]n" },
+	{ 1, 1, "ton", "t[^a-g]n" },
+	{ 1, 1, "a]b", "a[]]b" },
+	{ 1, 1, "a-b", "a[]-]b" },
+	{ 1, 1, "a]b", "a[]-]b" },
+	{ 0, 0, "aab", "a[]-]b" },
+	{ 1, 1, "aab", "a[]a-]b" },
+	{ 1, 1, "]", "]" },
+	{ 0, 1, "foo/baz/bar", "foo*bar" },
+	{ 0, 1, "foo/baz/bar", "foo**bar" },
+	{ 1, 1, "foobazbar", "foo**bar" },
+	{ 1, 1, "foo/baz/bar", "foo/**/bar" },
+	{ 1, 0, "foo/baz/bar", "foo/**/**/bar" },
+	{ 1, 1, "foo/b/a/z/bar", "foo/**/bar" },
+	{ 1, 1, "foo/b/a/z/bar", "foo/**/**/bar" },
+	{ 1, 0, "foo/bar", "foo/**/bar" },
+	{ 1, 0, "foo/bar", "foo/**/**/bar" },
+	{ 0, 1, "foo/bar", "foo?bar" },
+	{ 0, 1, "foo/bar", "foo[/]bar" },
+	{ 0, 1, "foo/bar", "f[^eiu][^eiu][^eiu][^eiu][^eiu]r" },
+	{ 1, 1, "foo-bar", "f[^eiu][^eiu][^eiu][^eiu][^eiu]r" },
+	{ 1, 0, "foo", "**/foo" },
+	{ 1, 1, "XXX/foo", "**/foo" },
+	{ 1, 1, "bar/baz/foo", "**/foo" },
+	{ 0, 1, "bar/baz/foo", "*/foo" },
+	{ 0, 1, "foo/bar/baz", "**/bar*" },
+	{ 1, 1, "deep/foo/bar/baz", "**/bar/*" },
+	{ 0, 1, "deep/foo/bar/baz/", "**/bar/*" },
+	{ 1, 1, "deep/foo/bar/baz/", "**/bar/**" },
+	{ 0, 0, "deep/foo/bar", "**/bar/*" },
+	{ 1, 1, "deep/foo/bar/", "**/bar/**" },
+	{ 0, 1, "foo/bar/baz", "**/bar**" },
+	{ 1, 1, "foo/bar/baz/x", "*/bar/**" },
+	{ 0, 1, "deep/foo/bar/baz/x", "*/bar/**" },
+	{ 1, 1, "deep/foo/bar/baz/x", "**/bar/*/*" },
+	{ 0, 0, "acrt", "a[c-c]st" },
+	{ 1, 1, "acrt", "a[c-c]rt" },
+	{ 0, 0, "]", "[!]-]" },
+	{ 1, 1, "a", "[!]-]" },
+	{ 0, 0, "", "\\" },
+	{ 0, 0, "\\", "\\" },
+	{ 0, 0, "XXX/\\", "*/\\" },
+	{ 1, 1, "XXX/\\", "*/\\\\" },
+	{ 1, 1, "foo", "foo" },
+	{ 1, 1, "@foo", "@foo" },
+	{ 0, 0, "foo", "@foo" },
+	{ 1, 1, "[ab]", "\\[ab]" },
+	{ 1, 1, "[ab]", "[[]ab]" },
+	{ 1, 1, "[ab]", "[[:]ab]" },
+	{ 0, 0, "[ab]", "[[::]ab]" },
+	{ 1, 1, "[ab]", "[[:digit]ab]" },
+	{ 1, 1, "[ab]", "[\\[:]ab]" },
+	{ 1, 1, "?a?b", "\\??\\?b" },
+	{ 1, 1, "abc", "\\a\\b\\c" },
+	{ 0, 0, "foo", "" },
+	{ 1, 1, "foo/bar/baz/to", "**/t[o]" },
+	{ 1, 1, "a1B", "[[:alpha:]][[:digit:]][[:upper:]]" },
+	{ 0, 0, "a", "[[:digit:][:upper:][:space:]]" },
+	{ 1, 1, "A", "[[:digit:][:upper:][:space:]]" },
+	{ 1, 1, "1", "[[:digit:][:upper:][:space:]]" },
+	{ 0, 0, "1", "[[:digit:][:upper:][:spaci:]]" },
+	{ 1, 1, " ", "[[:digit:][:upper:][:space:]]" },
+	{ 0, 0, ".", "[[:digit:][:upper:][:space:]]" },
+	{ 1, 1, ".", "[[:digit:][:punct:][:space:]]" },
+	{ 1, 1, "5", "[[:xdigit:]]" },
+	{ 1, 1, "f", "[[:xdigit:]]" },
+	{ 1, 1, "D", "[[:xdigit:]]" },
+	{ 1, 1, "_", "[[:alnum:][:alpha:][:blank:][:cntrl:][:digit:][:graph:][:lower:][:print:][:punct:][:space:][:upper:][:xdigit:]]" },
+	{ 1, 1, ".", "[^[:alnum:][:alpha:][:blank:][:cntrl:][:digit:][:lower:][:space:][:upper:][:xdigit:]]" },
+	{ 1, 1, "5", "[a-c[:digit:]x-z]" },
+	{ 1, 1, "b", "[a-c[:digit:]x-z]" },
+	{ 1, 1, "y", "[a-c[:digit:]x-z]" },
+	{ 0, 0, "q", "[a-c[:digit:]x-z]" },
+	{ 1, 1, "]", "[\\\\-^]" },
+	{ 0, 0, "[", "[\\\\-^]" },
+	{ 1, 1, "-", "[\\-_]" },
+	{ 1, 1, "]", "[\\]]" },
+	{ 0, 0, "\\]", "[\\]]" },
+	{ 0, 0, "\\", "[\\]]" },
+	{ 0, 0, "ab", "a[]b" },
+	{ 0, 0, "a[]b", "a[]b" },
+	{ 0, 0, "ab[", "ab[" },
+	{ 0, 0, "ab", "[!" },
+	{ 0, 0, "ab", "[-" },
+	{ 1, 1, "-", "[-]" },
+	{ 0, 0, "-", "[a-" },
+	{ 0, 0, "-", "[!a-" },
+	{ 1, 1, "-", "[--A]" },
+	{ 1, 1, "5", "[--A]" },
+	{ 1, 1, " ", "[ --]" },
+	{ 1, 1, "$", "[ --]" },
+	{ 1, 1, "-", "[ --]" },
+	{ 0, 0, "0", "[ --]" },
+	{ 1, 1, "-", "[---]" },
+	{ 1, 1, "-", "[------]" },
+	{ 0, 0, "j", "[a-e-n]" },
+	{ 1, 1, "-", "[a-e-n]" },
+	{ 1, 1, "a", "[!------]" },
+	{ 0, 0, "[", "[]-a]" },
+	{ 1, 1, "^", "[]-a]" },
+	{ 0, 0, "^", "[!]-a]" },
+	{ 1, 1, "[", "[!]-a]" },
+	{ 1, 1, "^", "[a^bc]" },
+	{ 1, 1, "-b]", "[a-]b]" },
+	{ 0, 0, "\\", "[\\]" },
+	{ 1, 1, "\\", "[\\\\]" },
+	{ 0, 0, "\\", "[!\\\\]" },
+	{ 1, 1, "G", "[A-\\\\]" },
+	{ 0, 0, "aaabbb", "b*a" },
+	{ 0, 0, "aabcaa", "*ba*" },
+	{ 1, 1, ",", "[,]" },
+	{ 1, 1, ",", "[\\\\,]" },
+	{ 1, 1, "\\", "[\\\\,]" },
+	{ 1, 1, "-", "[,-.]" },
+	{ 0, 0, "+", "[,-.]" },
+	{ 0, 0, "-.]", "[,-.]" },
+	{ 1, 1, "2", "[\\1-\\3]" },
+	{ 1, 1, "3", "[\\1-\\3]" },
+	{ 0, 0, "4", "[\\1-\\3]" },
+	{ 1, 1, "\\", "[[-\\]]" },
+	{ 1, 1, "[", "[[-\\]]" },
+	{ 1, 1, "]", "[[-\\]]" },
+	{ 0, 0, "-", "[[-\\]]" },
+	{ 1, 1, "-adobe-courier-bold-o-normal--12-120-75-75-m-70-iso8859-1", "-*-*-*-*-*-*-12-*-*-*-m-*-*-*" },
+	{ 0, 0, "-adobe-courier-bold-o-normal--12-120-75-75-X-70-iso8859-1", "-*-*-*-*-*-*-12-*-*-*-m-*-*-*" },
+	{ 0, 0, "-adobe-courier-bold-o-normal--12-120-75-75-/-70-iso8859-1", "-*-*-*-*-*-*-12-*-*-*-m-*-*-*" },
+	{ 1, 1, "XXX/adobe/courier/bold/o/normal//12/120/75/75/m/70/iso8859/1", "XXX/*/*/*/*/*/*/12/*/*/*/m/*/*/*" },
+	{ 0, 0, "XXX/adobe/courier/bold/o/normal//12/120/75/75/X/70/iso8859/1", "XXX/*/*/*/*/*/*/12/*/*/*/m/*/*/*" },
+	{ 1, 1, "abcd/abcdefg/abcdefghijk/abcdefghijklmnop.txt", "**/*a*b*g*n*t" },
+	{ 0, 0, "abcd/abcdefg/abcdefghijk/abcdefghijklmnop.txtz", "**/*a*b*g*n*t" },
+	{ 0, 0, "foo", "*/*/*" },
+	{ 0, 0, "foo/bar", "*/*/*" },
+	{ 1, 1, "foo/bba/arr", "*/*/*" },
+	{ 0, 1, "foo/bb/aa/rr", "*/*/*" },
+	{ 1, 1, "foo/bb/aa/rr", "**/**/**" },
+	{ 1, 1, "abcXdefXghi", "*X*i" },
+	{ 0, 1, "ab/cXd/efXg/hi", "*X*i" },
+	{ 1, 1, "ab/cXd/efXg/hi", "*/*X*/*/*i" },
+	{ 1, 1, "ab/cXd/efXg/hi", "**/*X*/**/*i" },
+};
+
+int main(void)
+{
+	for (size_t i = 0; i < sizeof(cases) / sizeof(*cases); i++) {
+		const char *text = cases[i].text, *pattern = cases[i].pattern;
+
+		test_check(wildmatch(pattern, text, WM_PATHNAME) == cases[i].glob,
+			"%smatch '%s' '%s' with WM_PATHNAME", cases[i].glob ? "" : "no ", text, pattern);
+		test_check(wildmatch(pattern, text, 0) == cases[i].pathmatch,
+			"%smatch '%s' '%s'", cases[i].pathmatch ? "" : "no ", text, pattern);
+	}
+	return test_done();
+}